@@ -146,6 +146,7 @@
 #define RDP_LOGON_AUTO                 0x0008
 #define RDP_LOGON_NORMAL               0x0033
 #define RDP_COMPRESSION                0x0080
+#define RDP_COMPRESSION_TYPE_MASK      0x1E00 /* CompressionTypeMask */
 #define RDP_LOGON_BLOB                 0x0100
 #define RDP_LOGON_LEAVE_AUDIO          0x2000
 #define RDP_LOGON_RAIL                 0x8000
@@ -223,6 +224,7 @@
 
 #define CAPSTYPE_BITMAPCACHE_HOSTSUPPORT        0x0012
 #define CAPSTYPE_BITMAPCACHE_HOSTSUPPORT_LEN    0x08
+#define TS_BITMAPCACHE_REV2                     0x01
 
 #define CAPSTYPE_BITMAPCACHE_REV2               0x0013
 #define CAPSTYPE_BITMAPCACHE_REV2_LEN           0x28
@@ -459,9 +461,24 @@
 #define PDUTYPE2_SHUTDOWN_DENIED       37
 #define RDP_DATA_PDU_LOGON             38
 #define RDP_DATA_PDU_FONT2             39
+#define PDUTYPE2_BITMAPCACHE_PERSISTENT_LIST 43
 #define RDP_DATA_PDU_DISCONNECT        47
 #define PDUTYPE2_MONITOR_LAYOUT_PDU    55
 
+/* Persistent Key List PDU: bBitMask (2.2.1.17.1) */
+#define PERSIST_FIRST_PDU              0x01
+#define PERSIST_LAST_PDU               0x02
+
+/* Share Data Header: compressedType (2.2.8.1.1.1.2) */
+#define PACKET_COMPR_TYPE_8K           0x00
+#define PACKET_COMPR_TYPE_64K          0x01
+#define PACKET_COMPR_TYPE_RDP6         0x02
+#define PACKET_COMPR_TYPE_RDP61        0x03
+#define CompressionTypeMask            0x0F
+#define PACKET_COMPRESSED              0x20
+#define PACKET_AT_FRONT                0x40
+#define PACKET_FLUSHED                 0x80
+
 /* TS_SECURITY_HEADER: flags (2.2.8.1.1.2.1) */
 #define SEC_EXCHANGE_PKT               0x0001
 #define SEC_ENCRYPT                    0x0008
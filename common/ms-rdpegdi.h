@@ -56,4 +56,23 @@
 #define TS_CACHE_BRUSH                      0x07
 #define TS_CACHE_BITMAP_COMPRESSED_REV3     0x08
 
+/* Cache Bitmap - Revision 2: extraFlags (2.2.2.2.1.2.3), shifted left 7 */
+#define CBR2_HEIGHT_SAME_AS_WIDTH           0x01
+#define CBR2_PERSISTENT_KEY_PRESENT         0x02
+#define CBR2_NO_BITMAP_COMPRESSION_HDR      0x08
+#define CBR2_DO_NOT_CACHE                   0x10
+
+/* GlyphIndex: flAccel (2.2.2.2.1.1.2.13) */
+#define SO_CHAR_INC_EQUAL_BM_BASE           0x20
+
+/* GlyphIndex: rgbData fragment operations (2.2.2.2.1.1.2.13) */
+#define GLYPH_FRAGMENT_USE                  0xFE
+#define GLYPH_FRAGMENT_ADD                  0xFF
+
+/* RDP 6.1 Bulk Compression: Level1ComprFlags (2.2.2.4.1) */
+#define L1_COMPRESSED                       0x01
+#define L1_NO_COMPRESSION                   0x02
+#define L1_PACKET_AT_FRONT                  0x04
+#define L1_INNER_COMPRESSION                0x10
+
 #endif /* MS_RDPEGDI_H */
@@ -95,6 +95,7 @@ struct sockaddr_hvs
 #endif
 
 #include "os_calls.h"
+#include "defines.h"
 #include "limits.h"
 #include "string_calls.h"
 #include "log.h"
@@ -109,6 +110,8 @@ extern char **environ;
 
 #if defined(__linux__)
 #include <linux/unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #endif
 
 /* sys/ucred.h needs to be included to use struct xucred
@@ -449,6 +452,28 @@ g_tcp_set_keepalive(int sck)
     return ret;
 }
 
+/*****************************************************************************/
+int
+g_sck_set_reuseport(int sck)
+{
+#if defined(SO_REUSEPORT)
+    int option_value;
+
+    option_value = 1;
+    if (setsockopt(sck, SOL_SOCKET, SO_REUSEPORT, (char *)&option_value,
+                   sizeof(option_value)) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Error setting SO_REUSEPORT [%s]",
+            g_get_strerror());
+        return 1;
+    }
+    return 0;
+#else
+    LOG(LOG_LEVEL_ERROR, "SO_REUSEPORT is not available");
+    return 1;
+#endif
+}
+
 /*****************************************************************************/
 /* returns a newly created socket or -1 on error */
 /* in win32 a socket is an unsigned int, in linux, it's an int */
@@ -1495,6 +1520,37 @@ g_sck_send(int sck, const void *ptr, unsigned int len, int flags)
 #endif
 }
 
+/*****************************************************************************/
+int
+g_sck_sendv(int sck, const void *ptrs[], const unsigned int lens[],
+            unsigned int count)
+{
+#if defined(_WIN32)
+    if (count < 1)
+    {
+        return 0;
+    }
+    return send(sck, (const char *)ptrs[0], lens[0], 0);
+#else
+    struct msghdr msg = {0};
+    struct iovec iov[G_SCK_SENDV_MAX];
+    unsigned int index;
+
+    if (count > G_SCK_SENDV_MAX)
+    {
+        count = G_SCK_SENDV_MAX;
+    }
+    for (index = 0; index < count; index++)
+    {
+        iov[index].iov_base = (void *)ptrs[index];
+        iov[index].iov_len = lens[index];
+    }
+    msg.msg_iov = &iov[0];
+    msg.msg_iovlen = count;
+    return sendmsg(sck, &msg, 0);
+#endif
+}
+
 /*****************************************************************************/
 int
 g_sck_recv_fd_set(int sck, void *ptr, unsigned int len,
@@ -1835,6 +1891,11 @@ g_set_nonblock(int fd)
     return 0;
 }
 
+/*****************************************************************************/
+/* A wait object is (write fd << 16) | read fd. On Linux both are the same
+   eventfd, elsewhere they are the ends of a pipe */
+#define WAIT_OBJ_IS_EVENTFD(obj) (((obj) >> 16) == ((obj) & 0xffff))
+
 /*****************************************************************************/
 /* returns 0 on error */
 tintptr
@@ -1849,6 +1910,19 @@ g_create_wait_obj(const char *name)
     int fds[2];
     int error;
 
+#if defined(__linux__)
+    /* one fd for both ends, the halves of the object match */
+    fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[0] >= 0)
+    {
+        if (fds[0] > 0xffff)
+        {
+            close(fds[0]);
+            return 0;
+        }
+        return (fds[0] << 16) | fds[0];
+    }
+#endif
     error = pipe(fds);
     if (error != 0)
     {
@@ -1935,6 +2009,13 @@ g_set_wait_obj(tintptr obj)
     {
         return 0;
     }
+#if defined(__linux__)
+    if (WAIT_OBJ_IS_EVENTFD(obj))
+    {
+        /* adding to the counter can't block until it is near overflow */
+        return eventfd_write(obj & 0xffff, 1) != 0;
+    }
+#endif
     fd = obj & USHRT_MAX;
     if (g_fd_can_read(fd))
     {
@@ -1995,6 +2076,19 @@ g_reset_wait_obj(tintptr obj)
         return 0;
     }
     fd = obj & 0xffff;
+#if defined(__linux__)
+    if (WAIT_OBJ_IS_EVENTFD(obj))
+    {
+        eventfd_t value;
+
+        /* one read zeroes the counter */
+        if (eventfd_read(fd, &value) != 0 && errno != EAGAIN)
+        {
+            return 1;
+        }
+        return 0;
+    }
+#endif
     while (g_fd_can_read(fd))
     {
         error = read(fd, buf, 4);
@@ -2063,7 +2157,10 @@ g_delete_wait_obj(tintptr obj)
         return 0;
     }
     close(obj & 0xffff);
-    close(obj >> 16);
+    if (!WAIT_OBJ_IS_EVENTFD(obj))
+    {
+        close(obj >> 16);
+    }
     return 0;
 #endif
 }
@@ -2178,6 +2275,461 @@ g_obj_wait(tintptr *read_objs, int rcount, tintptr *write_objs, int wcount,
 #undef MAX_HANDLES
 }
 
+/*****************************************************************************/
+#if !defined(_WIN32)
+/* most events taken from the kernel per wait */
+#define REACTOR_EVENTS 64
+
+#if defined(__linux__)
+#define REACTOR_CTL_ADD EPOLL_CTL_ADD
+#define REACTOR_CTL_MOD EPOLL_CTL_MOD
+#define REACTOR_CTL_DEL EPOLL_CTL_DEL
+#else
+#define REACTOR_CTL_ADD 1
+#define REACTOR_CTL_MOD 2
+#define REACTOR_CTL_DEL 3
+#endif
+
+struct g_reactor_entry
+{
+    tintptr obj;
+    int events; /* G_REACTOR_*, 0 if paused */
+    int in_use;
+    g_reactor_proc proc;
+    void *arg;
+};
+
+struct g_reactor
+{
+    int epfd; /* -1 if poll() is used */
+    int pid; /* process the kernel registrations belong to */
+    struct g_reactor_entry *entries; /* indexed by fd */
+    int entry_count;
+    int max_fd; /* highest fd in use */
+    struct pollfd *pollfds; /* reused between waits */
+    int pollfd_count;
+};
+
+/*****************************************************************************/
+/* fd the reactor waits on for an object, as g_obj_wait() */
+static int
+reactor_obj_fd(tintptr obj, int events)
+{
+    if (events & G_REACTOR_READ)
+    {
+        return obj & 0xffff;
+    }
+    return (int) obj;
+}
+
+/*****************************************************************************/
+/* update the kernel's copy of a registration, returns error */
+static int
+reactor_ctl(struct g_reactor *self, int op, int fd, int events)
+{
+#if defined(__linux__)
+    struct epoll_event ev = {0};
+
+    if (self->epfd < 0)
+    {
+        return 0;
+    }
+    /* a paused entry is taken out of the kernel's set, as hang ups are
+       always reported */
+    if (events == 0)
+    {
+        if (op == REACTOR_CTL_ADD)
+        {
+            return 0;
+        }
+        op = REACTOR_CTL_DEL;
+    }
+    if (self->pid != g_getpid())
+    {
+        /* a forked child shares the epoll instance, leave it alone */
+        return 0;
+    }
+    ev.data.fd = fd;
+    ev.events = ((events & G_REACTOR_READ) ? EPOLLIN : 0) |
+                ((events & G_REACTOR_WRITE) ? EPOLLOUT : 0);
+    return epoll_ctl(self->epfd, op, fd, &ev) != 0;
+#else
+    return 0;
+#endif
+}
+
+/*****************************************************************************/
+/* fd of a registered object, or -1 */
+static int
+reactor_find(struct g_reactor *self, tintptr obj)
+{
+    int fd;
+
+    fd = obj & 0xffff;
+    if (fd < self->entry_count && self->entries[fd].in_use &&
+            self->entries[fd].obj == obj)
+    {
+        return fd;
+    }
+    fd = (int) obj;
+    if (fd >= 0 && fd < self->entry_count && self->entries[fd].in_use &&
+            self->entries[fd].obj == obj)
+    {
+        return fd;
+    }
+    return -1;
+}
+
+/*****************************************************************************/
+/* make room for count pollfds, returns error */
+static int
+reactor_pollfds(struct g_reactor *self, int count)
+{
+    struct pollfd *pollfds;
+
+    if (count <= self->pollfd_count)
+    {
+        return 0;
+    }
+    count = MAX(count, self->pollfd_count * 2);
+    pollfds = (struct pollfd *) realloc(self->pollfds,
+                                        count * sizeof(struct pollfd));
+    if (pollfds == NULL)
+    {
+        return 1;
+    }
+    self->pollfds = pollfds;
+    self->pollfd_count = count;
+    return 0;
+}
+
+/*****************************************************************************/
+/* run the callback for a ready fd, returns the callback's value */
+static int
+reactor_dispatch(struct g_reactor *self, int fd, int ready)
+{
+    struct g_reactor_entry *entry;
+    int events;
+
+    if (fd < 0 || fd > self->max_fd)
+    {
+        return 0;
+    }
+    entry = self->entries + fd;
+    events = entry->in_use ? (entry->events & ready) : 0;
+    if (events == 0)
+    {
+        return 0;
+    }
+    return entry->proc(entry->arg, entry->obj, events);
+}
+#endif
+
+/*****************************************************************************/
+struct g_reactor *
+g_reactor_create(void)
+{
+#if defined(_WIN32)
+    return NULL;
+#else
+    struct g_reactor *self;
+
+    self = g_new0(struct g_reactor, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->epfd = -1;
+    self->max_fd = -1;
+    self->pid = g_getpid();
+#if defined(__linux__)
+    self->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->epfd < 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "g_reactor_create: epoll_create1 failed [%s], "
+            "using poll", g_get_strerror());
+    }
+#endif
+    return self;
+#endif
+}
+
+/*****************************************************************************/
+void
+g_reactor_delete(struct g_reactor *self)
+{
+#if !defined(_WIN32)
+    if (self == NULL)
+    {
+        return;
+    }
+    if (self->epfd >= 0)
+    {
+        close(self->epfd);
+    }
+    free(self->entries);
+    free(self->pollfds);
+    free(self);
+#endif
+}
+
+/*****************************************************************************/
+int
+g_reactor_add(struct g_reactor *self, tintptr obj, int events,
+              g_reactor_proc proc, void *arg)
+{
+#if defined(_WIN32)
+    return 1;
+#else
+    struct g_reactor_entry *entries;
+    int fd;
+    int count;
+
+    fd = reactor_obj_fd(obj, events);
+    if (fd <= 0 || proc == NULL)
+    {
+        return 1;
+    }
+    if (fd >= self->entry_count)
+    {
+        count = MAX(fd + 1, self->entry_count * 2);
+        entries = (struct g_reactor_entry *)
+                  realloc(self->entries,
+                          count * sizeof(struct g_reactor_entry));
+        if (entries == NULL)
+        {
+            return 1;
+        }
+        memset(entries + self->entry_count, 0,
+               (count - self->entry_count) * sizeof(struct g_reactor_entry));
+        self->entries = entries;
+        self->entry_count = count;
+    }
+    if (self->entries[fd].in_use)
+    {
+        LOG(LOG_LEVEL_ERROR, "g_reactor_add: fd %d already registered", fd);
+        return 1;
+    }
+    if (reactor_ctl(self, REACTOR_CTL_ADD, fd, events) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "g_reactor_add: fd %d [%s]", fd,
+            g_get_strerror());
+        return 1;
+    }
+    self->entries[fd].obj = obj;
+    self->entries[fd].events = events;
+    self->entries[fd].in_use = 1;
+    self->entries[fd].proc = proc;
+    self->entries[fd].arg = arg;
+    self->max_fd = MAX(self->max_fd, fd);
+    return 0;
+#endif
+}
+
+/*****************************************************************************/
+int
+g_reactor_modify(struct g_reactor *self, tintptr obj, int events)
+{
+#if defined(_WIN32)
+    return 1;
+#else
+    struct g_reactor_entry *entry;
+    int fd;
+    int op;
+
+    fd = reactor_find(self, obj);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    entry = self->entries + fd;
+    if (entry->events == events)
+    {
+        return 0;
+    }
+    op = (entry->events == 0) ? REACTOR_CTL_ADD : REACTOR_CTL_MOD;
+    if (reactor_ctl(self, op, fd, events) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "g_reactor_modify: fd %d [%s]", fd,
+            g_get_strerror());
+        return 1;
+    }
+    entry->events = events;
+    return 0;
+#endif
+}
+
+/*****************************************************************************/
+int
+g_reactor_remove(struct g_reactor *self, tintptr obj)
+{
+#if defined(_WIN32)
+    return 1;
+#else
+    struct g_reactor_entry *entry;
+    int fd;
+
+    fd = reactor_find(self, obj);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    entry = self->entries + fd;
+    if (entry->events != 0)
+    {
+        reactor_ctl(self, REACTOR_CTL_DEL, fd, entry->events);
+    }
+    g_memset(entry, 0, sizeof(struct g_reactor_entry));
+    while (self->max_fd >= 0 && !self->entries[self->max_fd].in_use)
+    {
+        self->max_fd--;
+    }
+    return 0;
+#endif
+}
+
+/*****************************************************************************/
+int
+g_reactor_wait(struct g_reactor *self,
+               tintptr *read_objs, int rcount,
+               tintptr *write_objs, int wcount, int mstimeout)
+{
+#if defined(_WIN32)
+    return -1;
+#else
+    struct pollfd *pollfd;
+    int count;
+    int index;
+    int fd;
+    int ready;
+    int rv;
+    int first; /* pollfds before the transient objects */
+#if defined(__linux__)
+    struct epoll_event events[REACTOR_EVENTS];
+#endif
+
+    if (mstimeout < 0)
+    {
+        mstimeout = -1;
+    }
+#if defined(__linux__)
+    if (self->epfd >= 0 && rcount < 1 && wcount < 1)
+    {
+        /* nothing but registered objects, no pollfds to build */
+        count = epoll_wait(self->epfd, events, REACTOR_EVENTS, mstimeout);
+        if (count < 0)
+        {
+            return (errno == EINTR) ? 0 : -1;
+        }
+        for (index = 0; index < count; index++)
+        {
+            ready = 0;
+            if (events[index].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                ready |= G_REACTOR_READ;
+            }
+            if (events[index].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            {
+                ready |= G_REACTOR_WRITE;
+            }
+            rv = reactor_dispatch(self, events[index].data.fd, ready);
+            if (rv != 0)
+            {
+                return rv;
+            }
+        }
+        return 0;
+    }
+#endif
+    /* transient objects, or no epoll, poll() with the epoll fd or the
+       registered objects at the front */
+    first = (self->epfd >= 0) ? 1 : self->max_fd + 1;
+    if (reactor_pollfds(self, first + rcount + wcount) != 0)
+    {
+        return -1;
+    }
+    count = 0;
+    if (self->epfd >= 0)
+    {
+        self->pollfds[count].fd = self->epfd;
+        self->pollfds[count].events = POLLIN;
+        count++;
+    }
+    else
+    {
+        for (fd = 0; fd <= self->max_fd; fd++)
+        {
+            if (self->entries[fd].in_use && self->entries[fd].events != 0)
+            {
+                pollfd = self->pollfds + count++;
+                pollfd->fd = fd;
+                pollfd->events =
+                    ((self->entries[fd].events & G_REACTOR_READ) ?
+                     POLLIN : 0) |
+                    ((self->entries[fd].events & G_REACTOR_WRITE) ?
+                     POLLOUT : 0);
+            }
+        }
+    }
+    first = count;
+    for (index = 0; index < rcount; index++)
+    {
+        fd = read_objs[index] & 0xffff;
+        if (fd > 0)
+        {
+            self->pollfds[count].fd = fd;
+            self->pollfds[count].events = POLLIN;
+            count++;
+        }
+    }
+    for (index = 0; index < wcount; index++)
+    {
+        fd = write_objs[index];
+        if (fd > 0)
+        {
+            self->pollfds[count].fd = fd;
+            self->pollfds[count].events = POLLOUT;
+            count++;
+        }
+    }
+    if (poll(self->pollfds, count, mstimeout) < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    if (self->epfd >= 0)
+    {
+        if (self->pollfds[0].revents != 0)
+        {
+            /* registered objects are ready, collect them */
+            return g_reactor_wait(self, NULL, 0, NULL, 0, 0);
+        }
+        return 0;
+    }
+    for (index = 0; index < first; index++)
+    {
+        pollfd = self->pollfds + index;
+        ready = 0;
+        if (pollfd->revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ready |= G_REACTOR_READ;
+        }
+        if (pollfd->revents & (POLLOUT | POLLHUP | POLLERR))
+        {
+            ready |= G_REACTOR_WRITE;
+        }
+        if (ready != 0)
+        {
+            rv = reactor_dispatch(self, pollfd->fd, ready);
+            if (rv != 0)
+            {
+                return rv;
+            }
+        }
+    }
+    return 0;
+#endif
+}
+
 /*****************************************************************************/
 void
 g_random(char *data, int len)
@@ -3967,6 +4519,23 @@ g_time3(void)
 #endif
 }
 
+/*****************************************************************************/
+/* returns a monotonic time in microseconds, for measuring how long
+   something takes
+   does not work in win32 */
+tui64
+g_time4(void)
+{
+#if defined(_WIN32)
+    return 0;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (tui64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
 /******************************************************************************/
 /******************************************************************************/
 struct bmp_magic
@@ -52,6 +52,9 @@ struct list;
 #define g_tcp_select g_sck_select
 #define g_close_wait_obj g_delete_wait_obj
 
+/* most buffers g_sck_sendv() passes to the kernel in one call */
+#define G_SCK_SENDV_MAX 16
+
 int      g_rm_temp_dir(void);
 int      g_mk_socket_path(const char *app_name);
 void     g_init(const char *app_name);
@@ -67,6 +70,16 @@ void     g_hexdump(const char *p, int len);
 int      g_getchar(void);
 int      g_tcp_set_no_delay(int sck);
 int      g_tcp_set_keepalive(int sck);
+/**
+ * Lets other sockets bind the same address and port (SO_REUSEPORT)
+ *
+ * The kernel spreads incoming connections across all the listening
+ * sockets that have this set. Must be called before the socket is bound.
+ *
+ * @param sck - Socket
+ * @return 0 for success, non-zero if it can't be set or isn't available
+ */
+int      g_sck_set_reuseport(int sck);
 int      g_tcp_socket(void);
 int      g_sck_set_send_buffer_bytes(int sck, int bytes);
 int      g_sck_get_send_buffer_bytes(int sck, int *bytes);
@@ -89,6 +102,18 @@ int      g_sck_listen(int sck);
 int      g_sck_accept(int sck);
 int      g_sck_recv(int sck, void *ptr, unsigned int len, int flags);
 int      g_sck_send(int sck, const void *ptr, unsigned int len, int flags);
+/**
+ * Sends several buffers with one call (scatter-gather)
+ *
+ * @param sck - Socket to send data on
+ * @param ptrs - Array of buffers, in the order they are to be sent
+ * @param lens - Length of each buffer
+ * @param count - Number of buffers. Only the first G_SCK_SENDV_MAX are used
+ * @return Bytes sent, or < 0 for error. As with g_sck_send(), this may be
+ *         less than the total length, and may end part way into a buffer.
+ */
+int      g_sck_sendv(int sck, const void *ptrs[], const unsigned int lens[],
+                     unsigned int count);
 /**
  * Receives data and file descriptors on a unix domain socket
  *
@@ -215,6 +240,67 @@ int      g_delete_wait_obj(tintptr obj);
  */
 int      g_obj_wait(tintptr *read_objs, int rcount, tintptr *write_objs,
                     int wcount, int mstimeout);
+
+/* events for the g_reactor_* calls */
+#define G_REACTOR_READ  (1 << 0)
+#define G_REACTOR_WRITE (1 << 1)
+
+struct g_reactor;
+/**
+ * Called by g_reactor_wait() when a registered object is ready
+ *
+ * @param arg Value passed to g_reactor_add()
+ * @param obj Ready object
+ * @param events G_REACTOR_READ and/or G_REACTOR_WRITE
+ * @return 0 to carry on, anything else stops the dispatch and is
+ *         returned by g_reactor_wait()
+ */
+typedef int (*g_reactor_proc)(void *arg, tintptr obj, int events);
+/**
+ * Create an event loop with persistent registrations
+ *
+ * Objects registered with g_reactor_add() stay registered, so a wait costs
+ * nothing per registered object. This uses epoll(7) on Linux, and poll(2)
+ * elsewhere. There is no limit on the number of objects.
+ *
+ * A registered object must be removed before it is closed.
+ *
+ * @return New reactor, or NULL on error
+ */
+struct g_reactor *g_reactor_create(void);
+void     g_reactor_delete(struct g_reactor *self);
+/**
+ * Register an object
+ *
+ * @param obj Wait object or socket. Read objects are handled the same way
+ *        as by g_obj_wait()
+ * @param events G_REACTOR_READ and/or G_REACTOR_WRITE
+ * @param proc Called when the object is ready
+ * @param arg Passed to proc
+ * @return 0 for success
+ */
+int      g_reactor_add(struct g_reactor *self, tintptr obj, int events,
+                       g_reactor_proc proc, void *arg);
+/**
+ * Change the events an object is waited for. 0 pauses the object
+ * without removing it.
+ */
+int      g_reactor_modify(struct g_reactor *self, tintptr obj, int events);
+int      g_reactor_remove(struct g_reactor *self, tintptr obj);
+/**
+ * Wait for registered objects and run their callbacks
+ *
+ * Objects in read_objs and write_objs are waited on for this call only,
+ * as with g_obj_wait(). They are for objects whose set changes from one
+ * wait to the next; the caller polls them afterwards.
+ *
+ * @param mstimeout Timeout in milliseconds. < 0 means an infinite timeout.
+ * @return 0 for success, < 0 if the wait failed, or the first non-zero
+ *         value returned by a callback
+ */
+int      g_reactor_wait(struct g_reactor *self,
+                        tintptr *read_objs, int rcount,
+                        tintptr *write_objs, int wcount, int mstimeout);
 void     g_random(char *data, int len);
 int      g_abs(int i);
 int      g_memcmp(const void *s1, const void *s2, int len);
@@ -398,6 +484,7 @@ int      g_check_user_in_group(const char *username, int gid, int *ok);
 int      g_time1(void);
 int      g_time2(void);
 int      g_time3(void);
+tui64    g_time4(void);
 int      g_save_to_bmp(const char *filename, char *data, int stride_bytes,
                        int width, int height, int depth, int bits_per_pixel);
 void    *g_shmat(int shmid);
@@ -34,6 +34,10 @@
 #include <openssl/rsa.h>
 #include <openssl/dh.h>
 #include <openssl/crypto.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
 
 #include "os_calls.h"
 #include "string_calls.h"
@@ -44,6 +48,30 @@
 
 #define SSL_WANT_READ_WRITE_TIMEOUT 100
 
+/* seconds a session ticket key is used to issue tickets. Tickets are
+   accepted for one more period after that */
+#define SSL_TICKET_KEY_LIFETIME (60 * 60)
+
+/* a session ticket key, see RFC 5077 section 4 */
+struct ssl_ticket_key
+{
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+};
+
+/* ticket keys shared by the listener and its children. Only the listener
+   writes here, into the slot after the current one, which no one is
+   reading, before making it current */
+struct ssl_ticket_keys
+{
+    volatile unsigned int gen; /* current key is key[gen % 3] */
+    struct ssl_ticket_key key[3];
+};
+
+static struct ssl_ticket_keys *g_ticket_keys = NULL;
+static int g_ticket_keys_rotate_time = 0; /* g_time1() of next rotation */
+
 /*
  * Globals used by openssl 3 and later */
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
@@ -63,6 +91,8 @@ struct ssl_tls
     struct trans *trans;
     tintptr rwo; /* wait obj */
     int error_logged; /* Error has already been logged */
+    int ktls; /* kernel TLS was asked for */
+    int ktls_send; /* kernel is encrypting what is sent */
 };
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
@@ -1023,12 +1053,171 @@ log_encrypted_file_unsupported(char *buf, int size, int rwflag, void *u)
 }
 
 /*****************************************************************************/
+static int
+ssl_ticket_key_generate(struct ssl_ticket_key *key)
+{
+    if (RAND_bytes(key->name, sizeof(key->name)) != 1 ||
+            RAND_bytes(key->aes_key, sizeof(key->aes_key)) != 1 ||
+            RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) != 1)
+    {
+        return 1;
+    }
+    return 0;
+}
 
+/*****************************************************************************/
 int
-ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
-               const char *tls_ciphers)
+ssl_tls_ticket_keys_init(void)
+{
+    void *addr;
+    int fd;
+
+    if (g_ticket_keys != NULL)
+    {
+        return 0;
+    }
+    if (g_alloc_shm_map_fd(&addr, &fd, sizeof(struct ssl_ticket_keys)) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "Can't share TLS session ticket keys, "
+            "reconnecting clients will need a full handshake");
+        return 1;
+    }
+    /* the mapping stays, and is inherited by children */
+    g_file_close(fd);
+    g_ticket_keys = (struct ssl_ticket_keys *) addr;
+    g_memset(g_ticket_keys, 0, sizeof(struct ssl_ticket_keys));
+    if (ssl_ticket_key_generate(&g_ticket_keys->key[0]) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "Can't generate a TLS session ticket key");
+        ssl_tls_ticket_keys_deinit();
+        return 1;
+    }
+    /* nothing was issued with the previous key, make it unmatchable */
+    g_ticket_keys->key[2] = g_ticket_keys->key[0];
+    g_ticket_keys->key[2].name[0] ^= 0xff;
+    g_ticket_keys_rotate_time = g_time1() + SSL_TICKET_KEY_LIFETIME;
+    return 0;
+}
+
+/*****************************************************************************/
+void
+ssl_tls_ticket_keys_deinit(void)
+{
+    if (g_ticket_keys != NULL)
+    {
+        g_munmap(g_ticket_keys, sizeof(struct ssl_ticket_keys));
+        g_ticket_keys = NULL;
+    }
+}
+
+/*****************************************************************************/
+int
+ssl_tls_ticket_keys_check(void)
+{
+    struct ssl_ticket_key *key;
+    int now;
+
+    if (g_ticket_keys == NULL)
+    {
+        return -1;
+    }
+    now = g_time1();
+    if (now >= g_ticket_keys_rotate_time)
+    {
+        key = &g_ticket_keys->key[(g_ticket_keys->gen + 1) % 3];
+        if (ssl_ticket_key_generate(key) == 0)
+        {
+            /* the key must be complete before anyone can pick it */
+            __sync_synchronize();
+            g_ticket_keys->gen++;
+            LOG(LOG_LEVEL_DEBUG, "TLS session ticket key rotated");
+        }
+        g_ticket_keys_rotate_time = now + SSL_TICKET_KEY_LIFETIME;
+    }
+    return (g_ticket_keys_rotate_time - now) * 1000;
+}
+
+/*****************************************************************************/
+/* issue or check a session ticket with the shared keys
+   returns -1 error, 0 unknown key, 1 ok, 2 ok but issue a new ticket */
+static int
+ssl_ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                  EVP_CIPHER_CTX *cctx,
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+                  EVP_MAC_CTX *hctx,
+#else
+                  HMAC_CTX *hctx,
+#endif
+                  int enc)
+{
+    struct ssl_ticket_key key;
+    unsigned int gen;
+    int rv;
+
+    gen = g_ticket_keys->gen;
+    __sync_synchronize();
+    if (enc)
+    {
+        key = g_ticket_keys->key[gen % 3];
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+        {
+            return -1;
+        }
+        g_memcpy(key_name, key.name, sizeof(key.name));
+        rv = 1;
+    }
+    else
+    {
+        key = g_ticket_keys->key[gen % 3];
+        rv = 1;
+        if (g_memcmp(key_name, key.name, sizeof(key.name)) != 0)
+        {
+            key = g_ticket_keys->key[(gen + 2) % 3];
+            rv = 2;
+            if (g_memcmp(key_name, key.name, sizeof(key.name)) != 0)
+            {
+                /* too old, full handshake */
+                return 0;
+            }
+        }
+    }
+    if ((enc ? EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL,
+                                  key.aes_key, iv) :
+            EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL,
+                               key.aes_key, iv)) != 1)
+    {
+        return -1;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    {
+        char digest[] = "sha256";
+        OSSL_PARAM params[3];
+
+        params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+                    key.hmac_key, sizeof(key.hmac_key));
+        params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                    digest, 0);
+        params[2] = OSSL_PARAM_construct_end();
+        if (EVP_MAC_CTX_set_params(hctx, params) != 1)
+        {
+            return -1;
+        }
+    }
+#else
+    if (HMAC_Init_ex(hctx, key.hmac_key, sizeof(key.hmac_key),
+                     EVP_sha256(), NULL) != 1)
+    {
+        return -1;
+    }
+#endif
+    return rv;
+}
+
+/*****************************************************************************/
+int
+ssl_tls_accept_start(struct ssl_tls *self, long ssl_protocols,
+                     const char *tls_ciphers, int ktls, int tickets)
 {
-    int connection_status;
     long options = 0;
 
     ERR_clear_error();
@@ -1074,6 +1263,23 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
      */
     options |= SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS;
 
+    /**
+     * SSL_OP_ENABLE_KTLS:
+     *
+     * Hand the record layer to the kernel once the handshake is done, if
+     * the kernel supports the negotiated cipher. If not, OpenSSL carries
+     * on in userspace.
+     */
+    if (ktls)
+    {
+#if defined(SSL_OP_ENABLE_KTLS)
+        options |= SSL_OP_ENABLE_KTLS;
+#else
+        LOG(LOG_LEVEL_WARNING, "Kernel TLS requested, but this OpenSSL "
+            "does not support it");
+#endif
+    }
+
     self->ctx = SSL_CTX_new(SSLv23_server_method());
     if (self->ctx == NULL)
     {
@@ -1132,6 +1338,25 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
 
     SSL_CTX_set_read_ahead(self->ctx, 0);
 
+    /*
+     * Each connection has its own context, often in its own process, so a
+     * session cache here would never be hit again. Session tickets with
+     * the keys shared by the listener let a client resume on any of them */
+    SSL_CTX_set_session_cache_mode(self->ctx, SSL_SESS_CACHE_OFF);
+    if (!tickets)
+    {
+        SSL_CTX_set_options(self->ctx, SSL_OP_NO_TICKET);
+    }
+    else if (g_ticket_keys != NULL)
+    {
+        SSL_CTX_set_timeout(self->ctx, SSL_TICKET_KEY_LIFETIME);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(self->ctx, ssl_ticket_key_cb);
+#else
+        SSL_CTX_set_tlsext_ticket_key_cb(self->ctx, ssl_ticket_key_cb);
+#endif
+    }
+
     /*
      * We don't currently handle encrypted private keys - set a callback
      * to tell the user if one is provided */
@@ -1186,46 +1411,52 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
         return 1;
     }
 
-    while (1)
-    {
-        /*
-         * Make sure the error queue is clear before (re-) attempting the
-         * accept. If the accept is successful, the error queue will
-         * remain clear for normal SSL operation */
-        ERR_clear_error();
+    self->ktls = ktls;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+ssl_tls_accept_continue(struct ssl_tls *self)
+{
+    int connection_status;
 
-        connection_status = SSL_accept(self->ssl);
+    /*
+     * Make sure the error queue is clear before (re-) attempting the
+     * accept. If the accept is successful, the error queue will
+     * remain clear for normal SSL operation */
+    ERR_clear_error();
 
-        if (connection_status <= 0)
+    connection_status = SSL_accept(self->ssl);
+
+    if (connection_status <= 0)
+    {
+        if (ssl_tls_log_error(self, "SSL_accept", connection_status))
         {
-            if (ssl_tls_log_error(self, "SSL_accept", connection_status))
-            {
-                return 1;
-            }
-            /**
-             * retry when SSL_get_error returns:
-             *     SSL_ERROR_WANT_READ
-             *     SSL_ERROR_WANT_WRITE
-             */
-            switch (SSL_get_error(self->ssl, connection_status))
-            {
-                case SSL_ERROR_WANT_READ:
-                    g_sck_can_recv(self->trans->sck, SSL_WANT_READ_WRITE_TIMEOUT);
-                    break;
-                case SSL_ERROR_WANT_WRITE:
-                    g_sck_can_send(self->trans->sck, SSL_WANT_READ_WRITE_TIMEOUT);
-                    break;
-            }
+            return SSL_TLS_ACCEPT_ERROR;
         }
-        else
+        if (SSL_get_error(self->ssl, connection_status) ==
+                SSL_ERROR_WANT_WRITE)
         {
-            break;
+            return SSL_TLS_ACCEPT_WANT_WRITE;
         }
+        return SSL_TLS_ACCEPT_WANT_READ;
     }
 
-    LOG(LOG_LEVEL_TRACE, "TLS connection accepted");
+    LOG(LOG_LEVEL_TRACE, "TLS connection accepted%s",
+        SSL_session_reused(self->ssl) ? ", session resumed" : "");
 
-    return 0;
+    if (self->ktls)
+    {
+#if defined(SSL_OP_ENABLE_KTLS)
+        self->ktls_send = BIO_get_ktls_send(SSL_get_wbio(self->ssl)) > 0;
+#endif
+        LOG(LOG_LEVEL_INFO, "Kernel TLS %s for cipher %s",
+            self->ktls_send ? "in use" : "not available, using OpenSSL",
+            SSL_get_cipher_name(self->ssl));
+    }
+
+    return SSL_TLS_ACCEPT_DONE;
 }
 
 /*****************************************************************************/
@@ -1415,6 +1646,13 @@ ssl_get_cipher_name(const struct ssl_tls *ssl)
     return SSL_get_cipher_name(ssl->ssl);
 }
 
+/*****************************************************************************/
+int
+ssl_tls_is_ktls_send(const struct ssl_tls *ssl)
+{
+    return ssl->ktls_send;
+}
+
 /*****************************************************************************/
 tintptr
 ssl_get_rwo(const struct ssl_tls *ssl)
@@ -26,6 +26,15 @@
 struct ssl_tls;
 struct trans;
 
+/* progress of a handshake, from ssl_tls_accept_continue() */
+enum ssl_tls_accept_status
+{
+    SSL_TLS_ACCEPT_DONE = 0,
+    SSL_TLS_ACCEPT_ERROR,
+    SSL_TLS_ACCEPT_WANT_READ,
+    SSL_TLS_ACCEPT_WANT_WRITE
+};
+
 int
 ssl_init(void);
 int
@@ -85,12 +94,57 @@ int
 ssl_gen_key_xrdp1(int key_size_in_bits, const char *exp, int exp_len,
                   char *mod, int mod_len, char *pri, int pri_len);
 
+/**
+ * Sets up TLS session ticket keys shared with processes forked later
+ *
+ * Call in the listening process before it accepts connections. The keys
+ * live in shared memory, so a client can resume a session with any child,
+ * and children see the rotations done by ssl_tls_ticket_keys_check().
+ * @return 0 for success
+ */
+int
+ssl_tls_ticket_keys_init(void);
+void
+ssl_tls_ticket_keys_deinit(void);
+/**
+ * Replaces the ticket key when it is old enough
+ *
+ * Call from the process that called ssl_tls_ticket_keys_init()
+ * @return milliseconds until the next call is needed, -1 if never
+ */
+int
+ssl_tls_ticket_keys_check(void);
+
 /* xrdp_tls.c */
 struct ssl_tls *
 ssl_tls_create(struct trans *trans, const char *key, const char *cert);
+/**
+ * Set up the server side of a TLS handshake
+ *
+ * Nothing is sent or received. Call ssl_tls_accept_continue() until it
+ * returns SSL_TLS_ACCEPT_DONE or SSL_TLS_ACCEPT_ERROR.
+ *
+ * @param ssl_protocols SSL_OP_NO_* flags for protocols to turn off
+ * @param tls_ciphers OpenSSL cipher list, or empty for the default
+ * @param ktls Non-zero to try kernel TLS offload, see
+ *        ssl_tls_is_ktls_send()
+ * @param tickets Non-zero to issue and accept session tickets, with the
+ *        keys from ssl_tls_ticket_keys_init() if there are any
+ * @return 0 for success
+ */
 int
-ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
-               const char *tls_ciphers);
+ssl_tls_accept_start(struct ssl_tls *self, long ssl_protocols,
+                     const char *tls_ciphers, int ktls, int tickets);
+/**
+ * Take the handshake as far as it can go without blocking
+ *
+ * @return SSL_TLS_ACCEPT_DONE when the connection is ready for use,
+ *         SSL_TLS_ACCEPT_WANT_READ or SSL_TLS_ACCEPT_WANT_WRITE when the
+ *         socket must become readable or writeable before the next call,
+ *         or SSL_TLS_ACCEPT_ERROR if the handshake failed
+ */
+int
+ssl_tls_accept_continue(struct ssl_tls *self);
 int
 ssl_tls_disconnect(struct ssl_tls *self);
 void
@@ -105,6 +159,14 @@ const char *
 ssl_get_version(const struct ssl_tls *ssl);
 const char *
 ssl_get_cipher_name(const struct ssl_tls *ssl);
+/**
+ * Is the kernel doing the record layer for sending?
+ *
+ * If so, application data can be written straight to the socket, so it
+ * can be sent with send()/sendmsg() without a pass through OpenSSL.
+ */
+int
+ssl_tls_is_ktls_send(const struct ssl_tls *ssl);
 int
 ssl_get_protocols_from_string(const char *str, long *ssl_protocols);
 const char *
@@ -26,12 +26,17 @@
 #include "string_calls.h"
 #include "trans.h"
 #include "arch.h"
+#include "defines.h"
 #include "parse.h"
 #include "ssl_calls.h"
 #include "log.h"
 
 #define MAX_SBYTES 0
 
+/* when less than this fraction of trans->out_s is left to queue, copy it
+   rather than give the queue the whole buffer */
+#define STEAL_OUT_S_DIVISOR 4
+
 /** Time between polls of is_term when connecting */
 #define CONNECT_TERM_POLL_MS 3000
 /** Time we wait before another connect() attempt if one fails immediately */
@@ -59,6 +64,34 @@ trans_tls_send(struct trans *self, const char *data, int len)
     return ssl_tls_write(self->tls, data, len);
 }
 
+/*****************************************************************************/
+/* TLS records are built one buffer at a time, so there is no gain in
+   handing them over together */
+static int
+trans_tls_sendv(struct trans *self, const void *ptrs[],
+                const unsigned int lens[], int count)
+{
+    int index;
+    int sent;
+    int total;
+
+    total = 0;
+    for (index = 0; index < count; index++)
+    {
+        sent = trans_tls_send(self, (const char *) ptrs[index], lens[index]);
+        if (sent <= 0)
+        {
+            return (total > 0) ? total : sent;
+        }
+        total += sent;
+        if (sent < (int) lens[index])
+        {
+            break;
+        }
+    }
+    return total;
+}
+
 /*****************************************************************************/
 static int
 trans_tls_can_recv(struct trans *self, int sck, int millis)
@@ -84,6 +117,14 @@ trans_tcp_send(struct trans *self, const char *data, int len)
     return g_tcp_send(self->sck, data, len, 0);
 }
 
+/*****************************************************************************/
+static int
+trans_tcp_sendv(struct trans *self, const void *ptrs[],
+                const unsigned int lens[], int count)
+{
+    return g_sck_sendv(self->sck, ptrs, lens, count);
+}
+
 /*****************************************************************************/
 static int
 trans_tcp_can_recv(struct trans *self, int sck, int millis)
@@ -91,6 +132,119 @@ trans_tcp_can_recv(struct trans *self, int sck, int millis)
     return g_sck_can_recv(sck, millis);
 }
 
+/*****************************************************************************/
+/* the handshake is over, send and receive through TLS from now on */
+static void
+trans_tls_accepted(struct trans *self)
+{
+    /* assign tls functions */
+    self->trans_recv = trans_tls_recv;
+    self->trans_send = trans_tls_send;
+    self->trans_sendv = trans_tls_sendv;
+    if (ssl_tls_is_ktls_send(self->tls))
+    {
+        /* the kernel frames and encrypts, queued output can go straight
+           to the socket */
+        self->trans_sendv = trans_tcp_sendv;
+    }
+    self->trans_can_recv = trans_tls_can_recv;
+
+    self->ssl_protocol = ssl_get_version(self->tls);
+    self->cipher_name = ssl_get_cipher_name(self->tls);
+}
+
+/*****************************************************************************/
+/* ms left before the handshake deadline, or -1 if there is none */
+static int
+trans_tls_accept_time_left(struct trans *self)
+{
+    int left;
+
+    if (self->tls_accept_timeout <= 0)
+    {
+        return -1;
+    }
+    left = self->tls_accept_timeout - (g_time3() - self->tls_accept_start);
+    return MAX(left, 0);
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+trans_tls_accept_step(struct trans *self)
+{
+    self->tls_accept = ssl_tls_accept_continue(self->tls);
+    switch (self->tls_accept)
+    {
+        case SSL_TLS_ACCEPT_DONE:
+            trans_tls_accepted(self);
+            return 0;
+
+        case SSL_TLS_ACCEPT_ERROR:
+            self->status = TRANS_STATUS_DOWN;
+            return 1;
+    }
+    if (trans_tls_accept_time_left(self) == 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "TLS handshake not finished after %d ms, "
+            "dropping the connection", self->tls_accept_timeout);
+        self->status = TRANS_STATUS_DOWN;
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* top up the pacer's tokens for the time gone by */
+static void
+trans_pace_refill(struct trans *self)
+{
+    int now;
+    int elapsed;
+    int tokens;
+
+    now = self->pace_clock();
+    elapsed = now - self->pace_time;
+    if (elapsed < 0)
+    {
+        /* clock wrapped */
+        self->pace_time = now;
+        return;
+    }
+    /* a long gap only ever fills the bucket */
+    elapsed = MIN(elapsed, 1000);
+    tokens = (int) (((long long) elapsed * self->pace_rate) / 1000);
+    if (tokens > 0)
+    {
+        self->pace_tokens = MIN(self->pace_tokens + tokens,
+                                self->pace_burst);
+        self->pace_time = now;
+    }
+}
+
+/*****************************************************************************/
+/* bytes the pacer lets out now, or -1 if there is no limit */
+static int
+trans_pace_allowance(struct trans *self)
+{
+    if (self->pace_rate <= 0)
+    {
+        return -1;
+    }
+    trans_pace_refill(self);
+    return MAX(self->pace_tokens, 0);
+}
+
+/*****************************************************************************/
+static void
+trans_pace_consume(struct trans *self, int sent)
+{
+    if (self->pace_rate > 0)
+    {
+        self->pace_tokens -= sent;
+    }
+}
+
 /*****************************************************************************/
 struct trans *
 trans_create(int mode, int in_size, int out_size)
@@ -111,12 +265,111 @@ trans_create(int mode, int in_size, int out_size)
         /* assign tcp calls by default */
         self->trans_recv = trans_tcp_recv;
         self->trans_send = trans_tcp_send;
+        self->trans_sendv = trans_tcp_sendv;
         self->trans_can_recv = trans_tcp_can_recv;
+        self->pace_clock = g_time3;
     }
 
     return self;
 }
 
+/*****************************************************************************/
+struct trans_buf *
+trans_buf_create(char *data, int size)
+{
+    struct trans_buf *buf;
+
+    buf = g_new(struct trans_buf, 1);
+    if (buf == NULL)
+    {
+        g_free(data);
+        return NULL;
+    }
+    buf->refcount = 1;
+    buf->size = size;
+    buf->data = data;
+    return buf;
+}
+
+/*****************************************************************************/
+void
+trans_buf_ref(struct trans_buf *buf)
+{
+    buf->refcount++;
+}
+
+/*****************************************************************************/
+void
+trans_buf_unref(struct trans_buf *buf)
+{
+    if (buf == NULL)
+    {
+        return;
+    }
+    buf->refcount--;
+    if (buf->refcount < 1)
+    {
+        g_free(buf->data);
+        g_free(buf);
+    }
+}
+
+/*****************************************************************************/
+/* remove the first entry from the output queue */
+static void
+trans_wait_pop(struct trans *self)
+{
+    struct trans_wait *wait;
+
+    wait = self->wait_head;
+    self->wait_head = wait->next;
+    if (self->wait_head == NULL)
+    {
+        self->wait_tail = NULL;
+    }
+    trans_buf_unref(wait->buf);
+    g_free(wait);
+}
+
+/*****************************************************************************/
+/* queue part of a buffer to be sent when the socket allows, takes a
+   reference on the buffer, returns error */
+static int
+trans_wait_push(struct trans *self, struct trans_buf *buf,
+                const char *p, int size)
+{
+    struct trans_wait *wait;
+
+    wait = g_new0(struct trans_wait, 1);
+    if (wait == NULL)
+    {
+        return 1;
+    }
+    trans_buf_ref(buf);
+    wait->buf = buf;
+    wait->p = p;
+    wait->end = p + size;
+    if (self->si != 0)
+    {
+        if ((self->si->cur_source != XRDP_SOURCE_NONE) &&
+                (self->si->cur_source != self->my_source))
+        {
+            self->si->source[self->si->cur_source] += size;
+            wait->source = self->si->source + self->si->cur_source;
+        }
+    }
+    if (self->wait_tail == NULL)
+    {
+        self->wait_head = wait;
+    }
+    else
+    {
+        self->wait_tail->next = wait;
+    }
+    self->wait_tail = wait;
+    return 0;
+}
+
 /*****************************************************************************/
 void
 trans_delete(struct trans *self)
@@ -134,6 +387,12 @@ trans_delete(struct trans *self)
 
     free_stream(self->in_s);
     free_stream(self->out_s);
+    free_stream(self->cork_s);
+
+    while (self->wait_head != NULL)
+    {
+        trans_wait_pop(self);
+    }
 
     if (self->sck >= 0)
     {
@@ -204,6 +463,9 @@ int
 trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
                        tbus *wobjs, int *wcount, int *timeout)
 {
+    int left;
+    int delay;
+
     if (self == 0)
     {
         return 1;
@@ -214,6 +476,33 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
         return 1;
     }
 
+    if (trans_tls_accept_pending(self))
+    {
+        /* the handshake is all there is to wait for until it is over */
+        if (self->tls_accept == SSL_TLS_ACCEPT_WANT_WRITE)
+        {
+            wobjs[*wcount] = self->sck;
+            (*wcount)++;
+        }
+        else
+        {
+            robjs[*rcount] = self->sck;
+            (*rcount)++;
+        }
+        left = trans_tls_accept_time_left(self);
+        if (left >= 0 && (*timeout < 0 || *timeout > left))
+        {
+            *timeout = left;
+        }
+        return 0;
+    }
+
+    /* don't sleep on output that is still corked */
+    if (trans_flush(self) != 0)
+    {
+        return 1;
+    }
+
     if ((self->si != 0) && (self->si->source[self->my_source] > MAX_SBYTES))
     {
     }
@@ -225,48 +514,97 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
         }
     }
 
-    if (self->wait_s != 0)
+    if (self->wait_head != NULL)
     {
-        wobjs[*wcount] = self->sck;
-        (*wcount)++;
+        delay = trans_pace_delay(self);
+        if (delay > 0)
+        {
+            /* the socket may be writeable, but the pacer says wait */
+            if (*timeout < 0 || *timeout > delay)
+            {
+                *timeout = delay;
+            }
+        }
+        else
+        {
+            wobjs[*wcount] = self->sck;
+            (*wcount)++;
+        }
     }
 
     return 0;
 }
 
+/*****************************************************************************/
+/* account for 'sent' bytes from the front of the output queue */
+static void
+trans_wait_consume(struct trans *self, int sent)
+{
+    struct trans_wait *wait;
+    int bytes;
+
+    while (sent > 0 && self->wait_head != NULL)
+    {
+        wait = self->wait_head;
+        bytes = MIN(sent, (int) (wait->end - wait->p));
+        wait->p += bytes;
+        if (wait->source != 0)
+        {
+            wait->source[0] -= bytes;
+        }
+        sent -= bytes;
+        if (wait->p >= wait->end)
+        {
+            trans_wait_pop(self);
+        }
+    }
+}
+
 /*****************************************************************************/
 static int
 trans_send_waiting(struct trans *self, int block)
 {
-    struct stream *temp_s;
-    int bytes;
+    struct trans_wait *wait;
+    const void *ptrs[G_SCK_SENDV_MAX];
+    unsigned int lens[G_SCK_SENDV_MAX];
+    int count;
     int sent;
     int timeout;
     int cont;
+    int allowance;
 
     timeout = block ? 100 : 0;
     cont = 1;
     while (cont)
     {
-        if (self->wait_s != 0)
+        if (self->wait_head != NULL)
         {
-            temp_s = self->wait_s;
-            if (g_tcp_can_send(self->sck, timeout))
+            allowance = trans_pace_allowance(self);
+            if (allowance != 0 && g_tcp_can_send(self->sck, timeout))
             {
-                bytes = (int) (temp_s->end - temp_s->p);
-                sent = self->trans_send(self, temp_s->p, bytes);
-                if (sent > 0)
+                /* hand as much of the queue as we can to one send */
+                count = 0;
+                wait = self->wait_head;
+                while (wait != NULL && count < G_SCK_SENDV_MAX &&
+                        allowance != 0)
                 {
-                    temp_s->p += sent;
-                    if (temp_s->source != 0)
-                    {
-                        temp_s->source[0] -= sent;
-                    }
-                    if (temp_s->p >= temp_s->end)
+                    ptrs[count] = wait->p;
+                    lens[count] = (unsigned int) (wait->end - wait->p);
+                    if (allowance > 0)
                     {
-                        self->wait_s = temp_s->next;
-                        free_stream(temp_s);
+                        /* no more than the pacer lets out */
+                        lens[count] = MIN(lens[count],
+                                          (unsigned int) allowance);
+                        allowance -= (int) lens[count];
                     }
+                    count++;
+                    wait = wait->next;
+                }
+                sent = self->trans_sendv(self, ptrs, lens, count);
+                if (sent > 0)
+                {
+                    trans_wait_consume(self, sent);
+                    trans_pace_consume(self, sent);
                 }
                 else if (sent == 0)
                 {
@@ -282,6 +620,10 @@ trans_send_waiting(struct trans *self, int block)
             }
             else if (block)
             {
+                if (allowance == 0)
+                {
+                    g_sleep(MIN(trans_pace_delay(self), 100));
+                }
                 /* check for term here */
                 if (self->is_term != 0)
                 {
@@ -324,6 +666,11 @@ trans_check_wait_objs(struct trans *self)
         return 1;
     }
 
+    if (trans_tls_accept_pending(self))
+    {
+        return trans_tls_accept_step(self);
+    }
+
     rv = 0;
 
     if (self->type1 == TRANS_TYPE_LISTENER) /* listening */
@@ -538,6 +885,10 @@ trans_force_write_s(struct trans *self, struct stream *out_s)
     }
     size = (int) (out_s->end - out_s->data);
     total = 0;
+    if (trans_flush(self) != 0)
+    {
+        return 1;
+    }
     if (trans_send_waiting(self, 1) != 0)
     {
         self->status = TRANS_STATUS_DOWN;
@@ -580,6 +931,7 @@ trans_force_write_s(struct trans *self, struct stream *out_s)
         else
         {
             total = total + sent;
+            trans_pace_consume(self, sent);
         }
     }
     return 0;
@@ -593,93 +945,369 @@ trans_force_write(struct trans *self)
 }
 
 /*****************************************************************************/
-int
-trans_write_copy_s(struct trans *self, struct stream *out_s)
+/* flush what is queued and try to send 'size' bytes of new data
+   returns bytes sent, or -1 on error */
+static int
+trans_write_start(struct trans *self, const char *data, int size)
 {
-    int size;
     int sent;
-    struct stream *wait_s;
-    struct stream *temp_s;
-    char *out_data;
+    int allowance;
 
     if (self->status != TRANS_STATUS_UP)
     {
-        return 1;
+        return -1;
     }
     /* try to send any left over */
     if (trans_send_waiting(self, 0) != 0)
     {
         /* error */
         self->status = TRANS_STATUS_DOWN;
+        return -1;
+    }
+    if (self->wait_head != NULL || size < 1)
+    {
+        /* must go behind what is already queued */
+        return 0;
+    }
+    allowance = trans_pace_allowance(self);
+    if (allowance == 0)
+    {
+        return 0;
+    }
+    if (allowance > 0)
+    {
+        /* the rest is queued until the pacer lets it out */
+        size = MIN(size, allowance);
+    }
+    /* if no left over, try to send this new data */
+    if (!g_tcp_can_send(self->sck, 0))
+    {
+        return 0;
+    }
+    sent = self->trans_send(self, data, size);
+    if (sent > 0)
+    {
+        trans_pace_consume(self, sent);
+        return sent;
+    }
+    if (sent < 0 && g_tcp_last_error_would_block(self->sck))
+    {
+        return 0;
+    }
+    return -1;
+}
+
+/*****************************************************************************/
+/* queue a copy of data, returns error */
+static int
+trans_wait_push_copy(struct trans *self, const char *data, int size)
+{
+    struct trans_buf *buf;
+    char *copy;
+    int rv;
+
+    copy = g_new(char, size);
+    if (copy == NULL)
+    {
         return 1;
     }
-    out_data = out_s->data;
-    sent = 0;
+    g_memcpy(copy, data, size);
+    buf = trans_buf_create(copy, size);
+    if (buf == NULL)
+    {
+        return 1;
+    }
+    rv = trans_wait_push(self, buf, copy, size);
+    trans_buf_unref(buf);
+    return rv;
+}
+
+/*****************************************************************************/
+/* queue the unsent part of a stream by taking its buffer, the stream is
+   left with no buffer, returns error */
+static int
+trans_wait_push_stream(struct trans *self, struct stream *out_s, int sent)
+{
+    struct trans_buf *buf;
+    int size;
+    int rv;
+
     size = (int) (out_s->end - out_s->data);
-    if (self->wait_s == 0)
+    buf = trans_buf_create(out_s->data, out_s->size);
+    out_s->data = NULL;
+    out_s->size = 0;
+    out_s->p = NULL;
+    out_s->end = NULL;
+    if (buf == NULL)
     {
-        /* if no left over, try to send this new data */
-        if (g_tcp_can_send(self->sck, 0))
+        return 1;
+    }
+    rv = trans_wait_push(self, buf, buf->data + sent, size - sent);
+    trans_buf_unref(buf);
+    return rv;
+}
+
+/*****************************************************************************/
+int
+trans_set_cork(struct trans *self, int cork)
+{
+    if (!cork)
+    {
+        self->cork = 0;
+        return trans_flush(self);
+    }
+    if (self->cork_s == NULL)
+    {
+        make_stream(self->cork_s);
+        if (self->cork_s == NULL)
         {
-            sent = self->trans_send(self, out_s->data, size);
-            if (sent > 0)
-            {
-                out_data += sent;
-                size -= sent;
-            }
-            else if (sent == 0)
-            {
-                return 1;
-            }
-            else
-            {
-                if (!g_tcp_last_error_would_block(self->sck))
-                {
-                    return 1;
-                }
-            }
+            return 1;
         }
+        init_stream(self->cork_s, TRANS_CORK_BYTES);
     }
-    if (size < 1)
+    self->cork = 1;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+trans_flush(struct trans *self)
+{
+    struct stream *s;
+    int size;
+    int sent;
+
+    s = self->cork_s;
+    if (s == NULL || s->end == s->data)
     {
         return 0;
     }
-    /* did not send right away, have to copy */
-    make_stream(wait_s);
-    init_stream(wait_s, size);
-    if (self->si != 0)
+    size = (int) (s->end - s->data);
+    sent = trans_write_start(self, s->data, size);
+    if (sent < 0)
     {
-        if ((self->si->cur_source != XRDP_SOURCE_NONE) &&
-                (self->si->cur_source != self->my_source))
+        init_stream(s, TRANS_CORK_BYTES);
+        return 1;
+    }
+    if (sent < size)
+    {
+        /* the queue takes the buffer, no copy */
+        if (trans_wait_push_stream(self, s, sent) != 0)
         {
-            self->si->source[self->si->cur_source] += size;
-            wait_s->source = self->si->source + self->si->cur_source;
+            return 1;
         }
     }
-    out_uint8a(wait_s, out_data, size);
-    s_mark_end(wait_s);
-    wait_s->p = wait_s->data;
-    if (self->wait_s == 0)
+    init_stream(s, TRANS_CORK_BYTES);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+trans_set_pacing(struct trans *self, int kbps)
+{
+    if (kbps <= 0)
     {
-        self->wait_s = wait_s;
+        self->pace_rate = 0;
+        return 0;
     }
-    else
+    /* keep the byte counts well inside an int */
+    kbps = MIN(kbps, 10 * 1000 * 1000);
+    self->pace_rate = kbps * (1000 / 8);
+    /* 50 ms worth, but never less than a couple of full TLS records */
+    self->pace_burst = MAX(self->pace_rate / 20, 2 * TRANS_CORK_BYTES);
+    self->pace_tokens = self->pace_burst;
+    self->pace_time = self->pace_clock();
+    return 0;
+}
+
+/*****************************************************************************/
+int
+trans_pace_delay(struct trans *self)
+{
+    long long needed;
+
+    if (self->pace_rate <= 0)
     {
-        temp_s = self->wait_s;
-        while (temp_s->next != 0)
+        return 0;
+    }
+    trans_pace_refill(self);
+    needed = MIN(TRANS_PACE_QUANTUM, self->pace_burst);
+    if (self->pace_tokens >= needed)
+    {
+        return 0;
+    }
+    /* until there are enough tokens to be worth sending, rounded up */
+    needed -= self->pace_tokens;
+    return (int) ((needed * 1000 + self->pace_rate - 1) / self->pace_rate);
+}
+
+/*****************************************************************************/
+int
+trans_pace_backlog(struct trans *self)
+{
+    if (self->pace_rate <= 0)
+    {
+        return 0;
+    }
+    return self->wait_head != NULL || trans_pace_delay(self) > 0;
+}
+
+/*****************************************************************************/
+/* while corked, collect a small write to go out with others
+   returns 1 if the data was taken, 0 if it is to be sent now, or -1 on
+   error */
+static int
+trans_cork_write(struct trans *self, const char *data, int size)
+{
+    struct stream *s;
+
+    if (!self->cork || self->status != TRANS_STATUS_UP)
+    {
+        return 0;
+    }
+    s = self->cork_s;
+    if ((int) (s->end - s->data) + size > TRANS_CORK_BYTES)
+    {
+        if (trans_flush(self) != 0)
         {
-            temp_s = temp_s->next;
+            return -1;
         }
-        temp_s->next = wait_s;
     }
-    return 0;
+    if (size >= TRANS_CORK_BYTES)
+    {
+        /* big enough to go by itself */
+        return 0;
+    }
+    g_memcpy(s->end, data, size);
+    s->end += size;
+    if (s->end - s->data == TRANS_CORK_BYTES)
+    {
+        if (trans_flush(self) != 0)
+        {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+int
+trans_write_copy_s(struct trans *self, struct stream *out_s)
+{
+    int size;
+    int sent;
+    int corked;
+
+    size = (int) (out_s->end - out_s->data);
+    corked = trans_cork_write(self, out_s->data, size);
+    if (corked != 0)
+    {
+        return corked < 0;
+    }
+    sent = trans_write_start(self, out_s->data, size);
+    if (sent < 0)
+    {
+        return 1;
+    }
+    if (sent >= size)
+    {
+        return 0;
+    }
+    /* did not send right away, have to copy */
+    return trans_wait_push_copy(self, out_s->data + sent, size - sent);
+}
+
+/*****************************************************************************/
+int
+trans_write_s(struct trans *self, struct stream *out_s)
+{
+    int size;
+    int sent;
+    int rv;
+
+    size = (int) (out_s->end - out_s->data);
+    rv = trans_cork_write(self, out_s->data, size);
+    if (rv != 0)
+    {
+        free_stream(out_s);
+        return rv < 0;
+    }
+    sent = trans_write_start(self, out_s->data, size);
+    if (sent < 0)
+    {
+        rv = 1;
+    }
+    else if (sent < size)
+    {
+        rv = trans_wait_push_stream(self, out_s, sent);
+    }
+    free_stream(out_s);
+    return rv;
+}
+
+/*****************************************************************************/
+int
+trans_write_buf(struct trans *self, struct trans_buf *buf)
+{
+    int sent;
+    int corked;
+
+    corked = trans_cork_write(self, buf->data, buf->size);
+    if (corked != 0)
+    {
+        return corked < 0;
+    }
+    sent = trans_write_start(self, buf->data, buf->size);
+    if (sent < 0)
+    {
+        return 1;
+    }
+    if (sent >= buf->size)
+    {
+        return 0;
+    }
+    return trans_wait_push(self, buf, buf->data + sent, buf->size - sent);
 }
 
 /*****************************************************************************/
 int
 trans_write_copy(struct trans *self)
 {
-    return trans_write_copy_s(self, self->out_s);
+    struct stream *out_s;
+    int size;
+    int sent;
+    int alloc_size;
+    int corked;
+
+    out_s = self->out_s;
+    size = (int) (out_s->end - out_s->data);
+    corked = trans_cork_write(self, out_s->data, size);
+    if (corked != 0)
+    {
+        return corked < 0;
+    }
+    sent = trans_write_start(self, out_s->data, size);
+    if (sent < 0)
+    {
+        return 1;
+    }
+    if (sent >= size)
+    {
+        return 0;
+    }
+    if ((size - sent) * STEAL_OUT_S_DIVISOR < out_s->size)
+    {
+        /* only a little left, cheaper to copy it */
+        return trans_wait_push_copy(self, out_s->data + sent, size - sent);
+    }
+    /* give the buffer to the queue and get out_s a new one */
+    alloc_size = out_s->size;
+    if (trans_wait_push_stream(self, out_s, sent) != 0)
+    {
+        return 1;
+    }
+    init_stream(out_s, alloc_size);
+    return 0;
 }
 
 /*****************************************************************************/
@@ -886,6 +1514,11 @@ trans_listen_address(struct trans *self, const char *port, const char *address)
         g_file_set_cloexec(self->sck, 1);
         g_tcp_set_non_blocking(self->sck);
 
+        if (self->listen_reuseport && g_sck_set_reuseport(self->sck) != 0)
+        {
+            return 1;
+        }
+
         if (g_tcp_bind_address(self->sck, port, address) == 0)
         {
             if (g_tcp_listen(self->sck) == 0)
@@ -954,6 +1587,10 @@ trans_listen_address(struct trans *self, const char *port, const char *address)
         }
         g_file_set_cloexec(self->sck, 1);
         g_tcp_set_non_blocking(self->sck);
+        if (self->listen_reuseport && g_sck_set_reuseport(self->sck) != 0)
+        {
+            return 1;
+        }
         if (g_tcp4_bind_address(self->sck, port, address) == 0)
         {
             if (g_tcp_listen(self->sck) == 0)
@@ -973,6 +1610,10 @@ trans_listen_address(struct trans *self, const char *port, const char *address)
         }
         g_file_set_cloexec(self->sck, 1);
         g_tcp_set_non_blocking(self->sck);
+        if (self->listen_reuseport && g_sck_set_reuseport(self->sck) != 0)
+        {
+            return 1;
+        }
         if (g_tcp6_bind_address(self->sck, port, address) == 0)
         {
             if (g_tcp_listen(self->sck) == 0)
@@ -1033,33 +1674,39 @@ trans_get_out_s(struct trans *self, int size)
 /*****************************************************************************/
 /* returns error */
 int
-trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
-                   long ssl_protocols, const char *tls_ciphers)
+trans_tls_accept_start(struct trans *self, const char *key, const char *cert,
+                       long ssl_protocols, const char *tls_ciphers, int ktls,
+                       int tickets, int timeout)
 {
     self->tls = ssl_tls_create(self, key, cert);
     if (self->tls == NULL)
     {
-        LOG(LOG_LEVEL_ERROR, "trans_set_tls_mode: ssl_tls_create malloc error");
+        LOG(LOG_LEVEL_ERROR, "trans_tls_accept_start: ssl_tls_create malloc "
+            "error");
         return 1;
     }
 
-    if (ssl_tls_accept(self->tls, ssl_protocols, tls_ciphers) != 0)
+    if (ssl_tls_accept_start(self->tls, ssl_protocols, tls_ciphers, ktls,
+                             tickets) != 0)
     {
-        LOG(LOG_LEVEL_ERROR, "trans_set_tls_mode: ssl_tls_accept failed");
+        LOG(LOG_LEVEL_ERROR, "trans_tls_accept_start: ssl_tls_accept_start "
+            "failed");
         return 1;
     }
 
-    /* assign tls functions */
-    self->trans_recv = trans_tls_recv;
-    self->trans_send = trans_tls_send;
-    self->trans_can_recv = trans_tls_can_recv;
-
-    self->ssl_protocol = ssl_get_version(self->tls);
-    self->cipher_name = ssl_get_cipher_name(self->tls);
-
+    self->tls_accept = SSL_TLS_ACCEPT_WANT_READ;
+    self->tls_accept_start = g_time3();
+    self->tls_accept_timeout = timeout;
     return 0;
 }
 
+/*****************************************************************************/
+int
+trans_tls_accept_pending(const struct trans *self)
+{
+    return self->tls != NULL && self->tls_accept != SSL_TLS_ACCEPT_DONE;
+}
+
 /*****************************************************************************/
 /* returns error */
 int
@@ -1073,6 +1720,7 @@ trans_shutdown_tls_mode(struct trans *self)
     /* assign callback back to tcp cal */
     self->trans_recv = trans_tcp_recv;
     self->trans_send = trans_tcp_send;
+    self->trans_sendv = trans_tcp_sendv;
     self->trans_can_recv = trans_tcp_can_recv;
 
     return 0;
@@ -37,6 +37,13 @@
 #define TRANS_STATUS_DOWN 0
 #define TRANS_STATUS_UP 1
 
+/* bytes a corked transport collects before sending, one full TLS record */
+#define TRANS_CORK_BYTES 16384
+
+/* bytes a paced transport waits for before it sends again, so a busy
+   link is not fed a few bytes at a time */
+#define TRANS_PACE_QUANTUM 4096
+
 struct trans; /* forward declaration */
 struct xrdp_tls;
 
@@ -46,7 +53,10 @@ typedef int (*ttrans_conn_in)(struct trans *self,
 typedef int (*tis_term)(void);
 typedef int (*trans_recv_proc) (struct trans *self, char *ptr, int len);
 typedef int (*trans_send_proc) (struct trans *self, const char *data, int len);
+typedef int (*trans_sendv_proc) (struct trans *self, const void *ptrs[],
+                                 const unsigned int lens[], int count);
 typedef int (*trans_can_recv_proc) (struct trans *self, int sck, int millis);
+typedef int (*trans_clock_proc) (void);
 
 /* optional source info */
 
@@ -91,6 +101,29 @@ struct source_info
     int source[XRDP_SOURCE_MAX_COUNT];
 };
 
+/**
+ * @brief Reference counted block of output data
+ *
+ * Lets output be queued on a transport without copying it. The data is
+ * freed with g_free() when the last reference is dropped.
+ */
+struct trans_buf
+{
+    int refcount;
+    int size;
+    char *data;
+};
+
+/* one entry in the queue of output waiting for the socket */
+struct trans_wait
+{
+    struct trans_wait *next;
+    struct trans_buf *buf;
+    const char *p; /* next byte to send */
+    const char *end;
+    int *source; /* source_info counter to take sent bytes off, or NULL */
+};
+
 struct trans
 {
     tbus sck; /* socket handle */
@@ -105,7 +138,16 @@ struct trans
     struct stream *out_s;
     char *listen_filename;
     tis_term is_term; /* used to test for exit */
-    struct stream *wait_s;
+    struct trans_wait *wait_head; /* output waiting to be sent */
+    struct trans_wait *wait_tail;
+    int cork; /* collect small writes, see trans_set_cork() */
+    struct stream *cork_s;
+    int listen_reuseport; /* share the port with other listeners */
+    int pace_rate; /* bytes a second let out, see trans_set_pacing() */
+    int pace_burst; /* most bytes let out at once */
+    int pace_tokens; /* bytes that can go now, negative after a forced write */
+    int pace_time; /* pace_clock() when pace_tokens was last topped up */
+    trans_clock_proc pace_clock; /* ms clock for the pacer, g_time3() */
     int no_stream_init_on_data_in;
     int extra_flags; /* user defined */
     void *extra_data; /* user defined */
@@ -114,8 +156,12 @@ struct trans
     struct ssl_tls *tls;
     const char *ssl_protocol; /* e.g. TLSv1, TLSv1.1, TLSv1.2, unknown */
     const char *cipher_name;  /* e.g. AES256-GCM-SHA384 */
+    int tls_accept; /* handshake progress, see trans_tls_accept_start() */
+    int tls_accept_start; /* g_time3() when the handshake started */
+    int tls_accept_timeout; /* ms the handshake may take, 0 for no limit */
     trans_recv_proc trans_recv;
     trans_send_proc trans_send;
+    trans_sendv_proc trans_sendv;
     trans_can_recv_proc trans_can_recv;
     struct source_info *si;
     enum xrdp_source my_source;
@@ -143,10 +189,99 @@ int
 trans_force_read(struct trans *self, int size);
 int
 trans_force_write(struct trans *self);
+/**
+ * Send the contents of self->out_s, queueing anything that cannot be
+ * sent straight away
+ *
+ * If a large part has to be queued, the stream's buffer is handed to the
+ * queue and out_s gets a new one, so out_s must be set up again with
+ * trans_get_out_s() or init_stream() before it is reused.
+ */
 int
 trans_write_copy(struct trans *self);
+/**
+ * Send the contents of a stream, copying anything that cannot be sent
+ * straight away. The caller keeps the stream.
+ */
 int
 trans_write_copy_s(struct trans *self, struct stream *out_s);
+/**
+ * Send the contents of a stream the caller has finished with
+ *
+ * Anything that cannot be sent straight away is queued without a copy.
+ * The stream is freed by the transport whether or not the call succeeds.
+ */
+int
+trans_write_s(struct trans *self, struct stream *out_s);
+/**
+ * Send a reference counted buffer
+ *
+ * The transport takes its own reference if the data has to be queued, so
+ * the same buffer can be written to several transports without a copy.
+ */
+int
+trans_write_buf(struct trans *self, struct trans_buf *buf);
+/**
+ * Wrap a g_malloc()ed block in a trans_buf with a single reference
+ *
+ * @param data Block, owned by the trans_buf from now on
+ * @param size Bytes of data
+ * @return New buffer, or NULL on error (data is freed)
+ */
+struct trans_buf *
+trans_buf_create(char *data, int size);
+/**
+ * Turn output batching on or off
+ *
+ * While corked, writes smaller than TRANS_CORK_BYTES are collected and
+ * sent together, as one TLS record and one system call, when the buffer
+ * fills, on trans_flush(), on a forced write, or when the transport is
+ * next polled. Turning the cork off flushes.
+ *
+ * @return 0 for success
+ */
+int
+trans_set_cork(struct trans *self, int cork);
+/**
+ * Send anything collected while corked
+ *
+ * @return 0 for success
+ */
+int
+trans_flush(struct trans *self);
+/**
+ * Limit the rate output is sent at
+ *
+ * A token bucket lets out 'kbps' on average, in bursts of up to 50 ms
+ * worth. Output over the limit is queued, and sent when the bucket has
+ * filled up again. Forced writes are sent straight away, and the bytes
+ * are taken off what can be sent after them.
+ *
+ * @param kbps kbit/s to send at, 0 for no limit
+ * @return 0 for success
+ */
+int
+trans_set_pacing(struct trans *self, int kbps);
+/**
+ * How long until the pacer lets more output go
+ *
+ * @return ms to wait, 0 if output can go now or there is no limit
+ */
+int
+trans_pace_delay(struct trans *self);
+/**
+ * Is output waiting for the pacer?
+ *
+ * True if there is a limit, and anything written now would be queued
+ * behind what is already waiting or until the bucket fills up again.
+ * Producers can use this to drop output rather than queue it.
+ */
+int
+trans_pace_backlog(struct trans *self);
+void
+trans_buf_ref(struct trans_buf *buf);
+void
+trans_buf_unref(struct trans_buf *buf);
 /**
  * Connect the transport to the specified destination
  *
@@ -172,9 +307,31 @@ struct stream *
 trans_get_in_s(struct trans *self);
 struct stream *
 trans_get_out_s(struct trans *self, int size);
+/**
+ * Start the server side of a TLS handshake without waiting for the peer
+ *
+ * Until trans_tls_accept_pending() returns false,
+ * trans_get_wait_objs_rw() waits only for what the handshake needs, and
+ * trans_check_wait_objs() takes it on a step. The latter fails if the
+ * handshake fails or is not over in 'timeout' ms. This lets one thread
+ * run many handshakes, with slow peers dropped at the deadline.
+ *
+ * @param ssl_protocols SSL_OP_NO_* flags for protocols to turn off
+ * @param tls_ciphers OpenSSL cipher list, or empty for the default
+ * @param ktls Non-zero to try kernel TLS offload
+ * @param tickets Non-zero to issue and accept session tickets
+ * @param timeout ms allowed for the handshake, 0 for no limit
+ * @return 0 for success
+ */
+int
+trans_tls_accept_start(struct trans *self, const char *key, const char *cert,
+                       long ssl_protocols, const char *tls_ciphers, int ktls,
+                       int tickets, int timeout);
+/**
+ * Is a handshake from trans_tls_accept_start() still going on?
+ */
 int
-trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
-                   long ssl_protocols, const char *tls_ciphers);
+trans_tls_accept_pending(const struct trans *self);
 int
 trans_shutdown_tls_mode(struct trans *self);
 int
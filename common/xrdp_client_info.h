@@ -115,6 +115,7 @@ struct xrdp_client_info
     int cache3_size;
     int bitmap_cache_persist_enable; /* 0 or 2 */
     int bitmap_cache_version; /* ored 1 = original version, 2 = v2, 4 = v3 */
+    int bitmap_cache_persist_mask; /* bit n set if v2 cache n is on disk */
     /* pointer info */
     int pointer_cache_entries;
     /* other */
@@ -170,6 +171,7 @@ struct xrdp_client_info
     char orders[32];
     int order_flags_ex;
     int use_bulk_comp;
+    int use_bulk_comp_rdp61; /* XCRUSH when the client can do it */
     int pointer_flags; /* 0 color, 1 new, 2 no new */
     int use_fast_path;
     int require_credentials; /* when true, credentials *must* be passed on cmd line */
@@ -217,9 +219,16 @@ struct xrdp_client_info
 
     int use_frame_acks;
     int max_unacknowledged_frame_count;
+    int session_max_mbps; /* cap on what is sent to the client, 0 for none */
+    int bitmap_comp_threads; /* compress bitmap updates in this many bands */
+    int jpeg_comp_threads; /* compress JPEG tiles in this many stripes */
+    int use_glyph_frag_cache; /* send repeated text as glyph fragments */
 
     long ssl_protocols;
     char *tls_ciphers;
+    int tls_ktls; /* try kernel TLS offload */
+    int tls_session_tickets; /* let clients resume TLS sessions */
+    int tls_handshake_timeout; /* seconds, 0 for no limit */
 
     char client_ip[MAX_PEER_ADDRSTRLEN];
     char client_description[MAX_PEER_DESCSTRLEN];
@@ -229,6 +238,8 @@ struct xrdp_client_info
 
     int no_orders_supported;
     int use_cache_glyph_v2;
+    int glyph_frag_entries; /* client's glyph fragment cache, 0 for none */
+    int glyph_frag_size; /* most bytes in a fragment */
     int rail_enable;
     // Mask of reasons why output may be suppressed
     // (see enum suppress_output_reason)
@@ -278,6 +289,6 @@ enum xrdp_encoder_flags
 
 /* yyyymmdd of last incompatible change to xrdp_client_info */
 /* also used for changes to all the xrdp installed headers */
-#define CLIENT_INFO_CURRENT_VERSION 20240805
+#define CLIENT_INFO_CURRENT_VERSION 20261018
 
 #endif
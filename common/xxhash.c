@@ -0,0 +1,157 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/xxhash.c
+ * @brief   64 bit non-cryptographic content hash
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <string.h>
+
+#include "xxhash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(_x, _r) (((_x) << (_r)) | ((_x) >> (64 - (_r))))
+
+/*****************************************************************************/
+/* little endian loads from anywhere */
+static tui64
+read64(const tui8 *p)
+{
+#if defined(L_ENDIAN)
+    tui64 rv;
+
+    memcpy(&rv, p, 8);
+    return rv;
+#else
+    return (tui64) p[0] | ((tui64) p[1] << 8) | ((tui64) p[2] << 16) |
+           ((tui64) p[3] << 24) | ((tui64) p[4] << 32) |
+           ((tui64) p[5] << 40) | ((tui64) p[6] << 48) |
+           ((tui64) p[7] << 56);
+#endif
+}
+
+/*****************************************************************************/
+static tui32
+read32(const tui8 *p)
+{
+#if defined(L_ENDIAN)
+    tui32 rv;
+
+    memcpy(&rv, p, 4);
+    return rv;
+#else
+    return (tui32) p[0] | ((tui32) p[1] << 8) | ((tui32) p[2] << 16) |
+           ((tui32) p[3] << 24);
+#endif
+}
+
+/*****************************************************************************/
+static tui64
+round64(tui64 acc, tui64 input)
+{
+    acc += input * PRIME64_2;
+    acc = ROTL64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+/*****************************************************************************/
+static tui64
+merge_round64(tui64 acc, tui64 val)
+{
+    acc ^= round64(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/*****************************************************************************/
+tui64
+xxh64(const void *data, size_t len, tui64 seed)
+{
+    const tui8 *p = (const tui8 *) data;
+    const tui8 *end = p + len;
+    const tui8 *limit;
+    tui64 v1;
+    tui64 v2;
+    tui64 v3;
+    tui64 v4;
+    tui64 h;
+
+    if (len >= 32)
+    {
+        /* the four lanes don't depend on each other */
+        v1 = seed + PRIME64_1 + PRIME64_2;
+        v2 = seed + PRIME64_2;
+        v3 = seed;
+        v4 = seed - PRIME64_1;
+        limit = end - 32;
+        do
+        {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+            p += 32;
+        }
+        while (p <= limit);
+        h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+        h = merge_round64(h, v1);
+        h = merge_round64(h, v2);
+        h = merge_round64(h, v3);
+        h = merge_round64(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME64_5;
+    }
+    h += (tui64) len;
+
+    /* whatever is left over */
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= round64(0, read64(p));
+        h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= (tui64) read32(p) * PRIME64_1;
+        h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        h ^= (*p) * PRIME64_5;
+        h = ROTL64(h, 11) * PRIME64_1;
+    }
+
+    /* avalanche */
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,48 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/xxhash.h
+ * @brief   64 bit non-cryptographic content hash
+ *
+ * This is XXH64 by Yann Collet, giving the same values as the reference
+ * implementation. Input is taken in 32 byte stripes across four
+ * independent 64 bit lanes, which compilers keep in registers or
+ * vectorise, so it runs at close to memory speed.
+ *
+ * It is for telling apart blocks of data, such as cached bitmaps, and
+ * gives no protection against data chosen to collide.
+ */
+
+#if !defined(XXHASH_H)
+#define XXHASH_H
+
+#include "arch.h"
+
+/**
+ * Hashes a block of data
+ *
+ * @param data Pointer to the data, which need not be aligned
+ * @param len Length of the data in bytes
+ * @param seed Starting value, different seeds give unrelated hashes
+ * @return 64 bit hash
+ */
+tui64
+xxh64(const void *data, size_t len, tui64 seed);
+
+#endif /* XXHASH_H */
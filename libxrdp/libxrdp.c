@@ -29,6 +29,8 @@
 #include "ms-rdpbcgr.h"
 
 #define MAX_BITMAP_BUF_SIZE (16 * 1024) /* 16K */
+#define MAX_BITMAP_COMP_THREADS 16
+#define MIN_BITMAP_BAND_LINES 16
 #define TS_MONITOR_ATTRIBUTES_SIZE 20 /* [MS-RDPBCGR] 2.2.1.3.9 */
 
 /******************************************************************************/
@@ -55,6 +57,19 @@ libxrdp_init(tbus id, struct trans *trans, const char *xrdp_ini)
     return session;
 }
 
+/******************************************************************************/
+int EXPORT_CC
+libxrdp_load_client_address(struct xrdp_session *session)
+{
+    if (session->trans == NULL || session->trans->sck < 0)
+    {
+        return 1;
+    }
+    xrdp_rdp_load_client_address((struct xrdp_rdp *)session->rdp,
+                                 session->trans);
+    return 0;
+}
+
 /******************************************************************************/
 int EXPORT_CC
 libxrdp_exit(struct xrdp_session *session)
@@ -406,6 +421,271 @@ libxrdp_send_bell(struct xrdp_session *session)
     return 0;
 }
 
+/*****************************************************************************/
+/* TS_BITMAP_DATA up to the bitmap itself, returns the bytes written */
+static int
+libxrdp_out_bitmap_data_hdr(struct xrdp_session *session, struct stream *s,
+                            int x, int top, int cx, int width, int e,
+                            int lines, int bpp, int bufsize)
+{
+    int line_size;
+
+    line_size = (width + e) * ((bpp + 7) / 8);
+    out_uint16_le(s, x); /* left */
+    out_uint16_le(s, top); /* top */
+    out_uint16_le(s, (x + cx) - 1); /* right */
+    out_uint16_le(s, (top + lines) - 1); /* bottom */
+    out_uint16_le(s, width + e); /* width */
+    out_uint16_le(s, lines); /* height */
+    out_uint16_le(s, bpp); /* bpp */
+
+    if (session->client_info->op1)
+    {
+        out_uint16_le(s, 0x401); /* compress */
+        out_uint16_le(s, bufsize); /* compressed size */
+        return 18;
+    }
+    out_uint16_le(s, 0x1); /* compress */
+    out_uint16_le(s, bufsize + 8);
+    out_uint8s(s, 2); /* pad */
+    out_uint16_le(s, bufsize); /* compressed size */
+    out_uint16_le(s, line_size); /* line size */
+    out_uint16_le(s, line_size * lines); /* final size */
+    return 26;
+}
+
+/* a run of lines of a bitmap update, compressed by one thread into
+   chunks that are each sent as a rectangle */
+struct bitmap_band
+{
+    int top; /* first line in the band */
+    int lines;
+    int chunk_count;
+    int *chunk_lines;
+    struct stream **chunks;
+    struct stream *temp_s;
+};
+
+struct bitmap_bands
+{
+    char *data;
+    int width;
+    int bpp;
+    int e;
+    int server_line_bytes;
+    struct bitmap_band *band;
+};
+
+/*****************************************************************************/
+/* compress a band bottom line first, as libxrdp_send_bitmap() does the
+   whole bitmap */
+static void
+libxrdp_compress_bitmap_band(void *arg, int index)
+{
+    struct bitmap_bands *bands;
+    struct bitmap_band *band;
+    struct stream *s;
+    char *in_data;
+    int lines_left;
+    int lines_sending;
+
+    bands = (struct bitmap_bands *) arg;
+    band = bands->band + index;
+    in_data = bands->data + band->top * bands->server_line_bytes;
+    lines_left = band->lines;
+    while (lines_left > 0)
+    {
+        s = band->chunks[band->chunk_count];
+        init_stream(s, MAX_BITMAP_BUF_SIZE);
+        if (bands->bpp > 24)
+        {
+            lines_sending = xrdp_bitmap32_compress(in_data, bands->width,
+                                                   band->lines, s, 32,
+                                                   MAX_BITMAP_BUF_SIZE - 100,
+                                                   lines_left - 1,
+                                                   band->temp_s, bands->e,
+                                                   0x10);
+        }
+        else
+        {
+            lines_sending = xrdp_bitmap_compress(in_data, bands->width,
+                                                 band->lines, s, bands->bpp,
+                                                 MAX_BITMAP_BUF_SIZE - 100,
+                                                 lines_left - 1,
+                                                 band->temp_s, bands->e);
+        }
+        if (lines_sending == 0)
+        {
+            break;
+        }
+        s_mark_end(s);
+        band->chunk_lines[band->chunk_count] = lines_sending;
+        band->chunk_count++;
+        lines_left -= lines_sending;
+    }
+}
+
+/*****************************************************************************/
+static void
+libxrdp_send_bitmap_update(struct xrdp_session *session, struct stream *s,
+                           char *p_num_updates, int num_updates)
+{
+    s_mark_end(s);
+    p_num_updates[0] = num_updates;
+    p_num_updates[1] = num_updates >> 8;
+    LOG_DEVEL(LOG_LEVEL_TRACE, "Sending [MS-RDPBCGR] TS_UPDATE_BITMAP_DATA "
+              "updateType %d (UPDATETYPE_BITMAP), numberRectangles %d, "
+              "rectangles <omitted from log>",
+              RDP_UPDATE_BITMAP, num_updates);
+    xrdp_rdp_send_data((struct xrdp_rdp *)session->rdp, s,
+                       RDP_DATA_PDU_UPDATE);
+}
+
+/*****************************************************************************/
+/* libxrdp_send_bitmap() with the lines split into bands that are
+   compressed at the same time, the rectangles go out in the same order
+   and packed into PDUs the same way, only the rectangles don't cross
+   a band */
+static int
+libxrdp_send_bitmap_bands(struct xrdp_session *session, int width, int bpp,
+                          char *data, int x, int y, int cx, int cy, int e,
+                          int server_line_bytes, int num_bands)
+{
+    struct xrdp_rdp *rdp;
+    struct bitmap_bands bands;
+    struct bitmap_band *band;
+    struct stream *s;
+    struct stream *chunk;
+    char *p_num_updates;
+    int num_updates;
+    int total_bufsize;
+    int bufsize;
+    int lines_left;
+    int max_bands;
+    int index;
+    int jndex;
+    int rv;
+
+    rdp = (struct xrdp_rdp *)session->rdp;
+    if (rdp->bitmap_workers == NULL)
+    {
+        /* sized for the most bands any update can have rather than this
+           one, this thread takes jobs too */
+        max_bands = MIN(session->client_info->bitmap_comp_threads,
+                        MAX_BITMAP_COMP_THREADS);
+        rdp->bitmap_workers = xrdp_workers_create(max_bands - 1);
+        if (rdp->bitmap_workers == NULL)
+        {
+            return 1;
+        }
+    }
+
+    bands.data = data;
+    bands.width = width;
+    bands.bpp = bpp;
+    bands.e = e;
+    bands.server_line_bytes = server_line_bytes;
+    bands.band = g_new0(struct bitmap_band, num_bands);
+    if (bands.band == NULL)
+    {
+        return 1;
+    }
+    rv = 0;
+    for (index = 0; index < num_bands; index++)
+    {
+        band = bands.band + index;
+        band->top = cy * index / num_bands;
+        band->lines = cy * (index + 1) / num_bands - band->top;
+        /* every chunk has at least one line */
+        band->chunk_lines = g_new(int, band->lines);
+        band->chunks = g_new0(struct stream *, band->lines);
+        make_stream(band->temp_s);
+        init_stream(band->temp_s, 65536);
+        if (band->chunk_lines == NULL || band->chunks == NULL)
+        {
+            rv = 1;
+            continue;
+        }
+        for (jndex = 0; jndex < band->lines; jndex++)
+        {
+            make_stream(band->chunks[jndex]);
+        }
+    }
+
+    if (rv == 0)
+    {
+        xrdp_workers_run(rdp->bitmap_workers, num_bands,
+                         libxrdp_compress_bitmap_band, &bands);
+
+        make_stream(s);
+        init_stream(s, MAX_BITMAP_BUF_SIZE);
+        p_num_updates = NULL;
+        num_updates = 0;
+        total_bufsize = 0;
+        for (index = num_bands - 1; index >= 0; index--)
+        {
+            band = bands.band + index;
+            lines_left = band->lines;
+            for (jndex = 0; jndex < band->chunk_count; jndex++)
+            {
+                chunk = band->chunks[jndex];
+                bufsize = (int) (chunk->end - chunk->data);
+                if (num_updates > 0 &&
+                        total_bufsize + bufsize > MAX_BITMAP_BUF_SIZE - 100)
+                {
+                    libxrdp_send_bitmap_update(session, s, p_num_updates,
+                                               num_updates);
+                    num_updates = 0;
+                }
+                if (num_updates == 0)
+                {
+                    total_bufsize = 0;
+                    xrdp_rdp_init_data(rdp, s);
+                    out_uint16_le(s, RDP_UPDATE_BITMAP); /* updateType */
+                    p_num_updates = s->p;
+                    out_uint8s(s, 2); /* num_updates set later */
+                }
+                lines_left -= band->chunk_lines[jndex];
+                total_bufsize += libxrdp_out_bitmap_data_hdr(
+                                     session, s, x, y + band->top + lines_left,
+                                     cx, width, e, band->chunk_lines[jndex],
+                                     bpp, bufsize);
+                out_uint8a(s, chunk->data, bufsize);
+                total_bufsize += bufsize;
+                num_updates++;
+            }
+            if (lines_left > 0)
+            {
+                LOG(LOG_LEVEL_WARNING, "libxrdp_send_bitmap_bands: %d lines "
+                    "could not be compressed", lines_left);
+            }
+        }
+        if (num_updates > 0)
+        {
+            libxrdp_send_bitmap_update(session, s, p_num_updates,
+                                       num_updates);
+        }
+        free_stream(s);
+    }
+
+    for (index = 0; index < num_bands; index++)
+    {
+        band = bands.band + index;
+        if (band->chunks != NULL)
+        {
+            for (jndex = 0; jndex < band->lines; jndex++)
+            {
+                free_stream(band->chunks[jndex]);
+            }
+        }
+        g_free(band->chunks);
+        g_free(band->chunk_lines);
+        free_stream(band->temp_s);
+    }
+    g_free(bands.band);
+    return rv;
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
@@ -424,6 +704,7 @@ libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
     int num_updates = 0;
     int line_pad_bytes;
     int server_line_bytes;
+    int num_bands;
     char *p_num_updates = (char *)NULL;
     char *p = (char *)NULL;
     char *q = (char *)NULL;
@@ -456,7 +737,19 @@ libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
     make_stream(s);
     init_stream(s, MAX_BITMAP_BUF_SIZE);
 
-    if (session->client_info->use_bitmap_comp)
+    /* enough lines for each thread to be worth it */
+    num_bands = MIN(session->client_info->bitmap_comp_threads,
+                    MAX_BITMAP_COMP_THREADS);
+    num_bands = MIN(num_bands, cy / MIN_BITMAP_BAND_LINES);
+    if (session->client_info->use_bitmap_comp && num_bands > 1 &&
+            cy <= height &&
+            libxrdp_send_bitmap_bands(session, width, bpp, data, x, y, cx, cy,
+                                      e, server_line_bytes, num_bands) == 0)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "libxrdp_send_bitmap: compressed in %d "
+                  "bands", num_bands);
+    }
+    else if (session->client_info->use_bitmap_comp)
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "libxrdp_send_bitmap: compression");
         make_stream(temp_s);
@@ -523,34 +816,11 @@ libxrdp_send_bitmap(struct xrdp_session *session, int width, int height,
                 i = i - lines_sending;
                 s_mark_end(s);
                 s_pop_layer(s, channel_hdr);
-                out_uint16_le(s, x); /* left */
-                out_uint16_le(s, y + i); /* top */
-                out_uint16_le(s, (x + cx) - 1); /* right */
-                out_uint16_le(s, (y + i + lines_sending) - 1); /* bottom */
-                out_uint16_le(s, width + e); /* width */
-                out_uint16_le(s, lines_sending); /* height */
-                out_uint16_le(s, bpp); /* bpp */
-
-                if (session->client_info->op1)
-                {
-                    out_uint16_le(s, 0x401); /* compress */
-                    out_uint16_le(s, bufsize); /* compressed size */
-                    j = (width + e) * Bpp;
-                    j = j * lines_sending;
-                    total_bufsize += 18; /* bytes since pop layer */
-                }
-                else
-                {
-                    out_uint16_le(s, 0x1); /* compress */
-                    out_uint16_le(s, bufsize + 8);
-                    out_uint8s(s, 2); /* pad */
-                    out_uint16_le(s, bufsize); /* compressed size */
-                    j = (width + e) * Bpp;
-                    out_uint16_le(s, j); /* line size */
-                    j = j * lines_sending;
-                    out_uint16_le(s, j); /* final size */
-                    total_bufsize += 26; /* bytes since pop layer */
-                }
+                /* bytes since pop layer */
+                total_bufsize += libxrdp_out_bitmap_data_hdr(session, s, x,
+                                 y + i, cx, width, e, lines_sending, bpp,
+                                 bufsize);
+                j = (width + e) * Bpp * lines_sending;
 
                 LOG_DEVEL(LOG_LEVEL_DEBUG, "libxrdp_send_bitmap: decompressed pixels %d "
                           "decompressed bytes %d compressed bytes %d",
@@ -1223,22 +1493,23 @@ libxrdp_reset(struct xrdp_session *session,
 int EXPORT_CC
 libxrdp_orders_send_raw_bitmap2(struct xrdp_session *session,
                                 int width, int height, int bpp, char *data,
-                                int cache_id, int cache_idx)
+                                int cache_id, int cache_idx, tui64 key)
 {
     return xrdp_orders_send_raw_bitmap2((struct xrdp_orders *)session->orders,
                                         width, height, bpp, data,
-                                        cache_id, cache_idx);
+                                        cache_id, cache_idx, key);
 }
 
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_orders_send_bitmap2(struct xrdp_session *session,
                             int width, int height, int bpp, char *data,
-                            int cache_id, int cache_idx, int hints)
+                            int cache_id, int cache_idx, int hints,
+                            tui64 key)
 {
     return xrdp_orders_send_bitmap2((struct xrdp_orders *)session->orders,
                                     width, height, bpp, data,
-                                    cache_id, cache_idx, hints);
+                                    cache_id, cache_idx, hints, key);
 }
 
 /*****************************************************************************/
@@ -1252,6 +1523,22 @@ libxrdp_orders_send_bitmap3(struct xrdp_session *session,
                                     cache_id, cache_idx, hints);
 }
 
+/*****************************************************************************/
+const tui64 *EXPORT_CC
+libxrdp_get_persistent_keys(struct xrdp_session *session, int cache_id,
+                            int *count)
+{
+    struct xrdp_rdp *rdp = (struct xrdp_rdp *)session->rdp;
+
+    if (cache_id < 0 || cache_id >= XRDP_MAX_BITMAP_CACHE_ID)
+    {
+        *count = 0;
+        return NULL;
+    }
+    *count = rdp->persist_key_count[cache_id];
+    return rdp->persist_keys[cache_id];
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_get_channel_count(const struct xrdp_session *session)
@@ -158,6 +158,34 @@ struct xrdp_channel
     struct xrdp_drdynvc drdynvcs[256];
 };
 
+/* threads that xrdp_workers_run() hands jobs to */
+struct xrdp_workers
+{
+    int num_threads;
+    tbus lock;
+    tbus start_sem;
+    tbus done_sem;
+    int quit;
+    void (*job)(void *arg, int index);
+    void *job_arg;
+    int job_count;
+    int next_job; /* under lock */
+};
+
+/* bulk compression of one kind of PDU, see xrdp_rdp_compress() */
+struct xrdp_bulk_stats
+{
+    int packets;        /* compressed, or tried to be */
+    int skipped;        /* not tried as they looked incompressible */
+    tui64 bytes_in;     /* of all of them */
+    tui64 bytes_out;    /* as sent */
+    tui64 usecs;        /* in compress_rdp() */
+};
+
+/* slow path pduType2 values, then fast path updateCode values */
+#define XRDP_BULK_STATS_FASTPATH 64
+#define XRDP_BULK_STATS_COUNT (XRDP_BULK_STATS_FASTPATH + 16)
+
 /* rdp */
 struct xrdp_rdp
 {
@@ -168,6 +196,23 @@ struct xrdp_rdp
     struct xrdp_client_info client_info;
     struct xrdp_mppc_enc *mppc_enc;
     void *rfx_enc;
+    struct xrdp_bulk_stats bulk_stats[XRDP_BULK_STATS_COUNT];
+    /* keys of the bitmaps the client loaded into its persistent bitmap
+       caches, key n is at cache index n */
+    tui64 *persist_keys[XRDP_MAX_BITMAP_CACHE_ID];
+    int persist_key_count[XRDP_MAX_BITMAP_CACHE_ID];
+    int persist_key_total[XRDP_MAX_BITMAP_CACHE_ID];
+    /* compress bands of a bitmap update at once, created when first used */
+    struct xrdp_workers *bitmap_workers;
+};
+
+/* solid fills held back in a batch of orders */
+#define XRDP_ORDERS_MAX_FILLS 64
+
+struct xrdp_orders_fill
+{
+    struct xrdp_rect rect; /* already clipped */
+    int color;
 };
 
 /* state */
@@ -288,10 +333,14 @@ struct xrdp_orders
     /* shared */
     struct stream *s;
     struct stream *temp_s;
+    /* solid fills not yet in out_s, see xrdp_orders_rect() */
+    struct xrdp_orders_fill fills[XRDP_ORDERS_MAX_FILLS];
+    int fill_count;
 };
 
 #define PROTO_RDP_40 1
 #define PROTO_RDP_50 2
+#define PROTO_RDP_61 3
 
 struct xrdp_mppc_enc
 {
@@ -305,7 +354,9 @@ struct xrdp_mppc_enc
     int    flags;            /* PACKET_COMPRESSED, PACKET_AT_FRONT, PACKET_FLUSHED etc */
     int    flagsHold;
     int    first_pkt;        /* this is the first pkt passing through enc */
-    tui16 *hash_table;
+    tui16 *hash_table;       /* latest position in historyBuffer for a hash */
+    tui16 *hash_chain;       /* previous position with the same hash */
+    struct xrdp_xcrush_enc *xcrush; /* level 1 state for PROTO_RDP_61 */
 };
 
 int
@@ -314,6 +365,16 @@ struct xrdp_mppc_enc *
 mppc_enc_new(int protocol_type);
 void
 mppc_enc_free(struct xrdp_mppc_enc *enc);
+int
+mppc_enc_worth_trying(struct xrdp_mppc_enc *enc, const tui8 *data, int len);
+
+/* xrdp_xcrush_enc.c */
+int
+compress_rdp_61(struct xrdp_mppc_enc *enc, tui8 *srcData, int len);
+struct xrdp_xcrush_enc *
+xcrush_enc_new(int max_len);
+void
+xcrush_enc_free(struct xrdp_xcrush_enc *self);
 
 /* xrdp_tcp.c */
 struct xrdp_tcp *
@@ -420,6 +481,8 @@ enum suppress_output_reason
 struct xrdp_rdp *
 xrdp_rdp_create(struct xrdp_session *session, struct trans *trans);
 void
+xrdp_rdp_load_client_address(struct xrdp_rdp *self, struct trans *trans);
+void
 xrdp_rdp_delete(struct xrdp_rdp *self);
 int
 xrdp_rdp_init(struct xrdp_rdp *self, struct stream *s);
@@ -450,6 +513,8 @@ xrdp_rdp_incoming(struct xrdp_rdp *self);
 int
 xrdp_rdp_process_data(struct xrdp_rdp *self, struct stream *s);
 int
+xrdp_rdp_process_persistent_list(struct xrdp_rdp *self, struct stream *s);
+int
 xrdp_rdp_disconnect(struct xrdp_rdp *self);
 int
 xrdp_rdp_send_deactivate(struct xrdp_rdp *self);
@@ -552,11 +617,11 @@ xrdp_orders_send_font(struct xrdp_orders *self,
 int
 xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
                              int width, int height, int bpp, char *data,
-                             int cache_id, int cache_idx);
+                             int cache_id, int cache_idx, tui64 key);
 int
 xrdp_orders_send_bitmap2(struct xrdp_orders *self,
                          int width, int height, int bpp, char *data,
-                         int cache_id, int cache_idx, int hints);
+                         int cache_id, int cache_idx, int hints, tui64 key);
 int
 xrdp_orders_send_bitmap3(struct xrdp_orders *self,
                          int width, int height, int bpp, char *data,
@@ -606,7 +671,7 @@ xrdp_codec_jpeg_compress(void *handle,
                         );
 
 void *
-xrdp_jpeg_init(void);
+xrdp_jpeg_init(int num_threads);
 int
 xrdp_jpeg_deinit(void *handle);
 
@@ -658,4 +723,13 @@ int
 xrdp_caps_send_demand_active(struct xrdp_rdp *self);
 int
 xrdp_caps_process_confirm_active(struct xrdp_rdp *self, struct stream *s);
+
+/* xrdp_workers.c */
+struct xrdp_workers *
+xrdp_workers_create(int num_threads);
+void
+xrdp_workers_delete(struct xrdp_workers *self);
+void
+xrdp_workers_run(struct xrdp_workers *self, int job_count,
+                 void (*job)(void *arg, int index), void *arg);
 #endif
@@ -102,10 +102,33 @@ struct display_size_description;
  */
 struct xrdp_session *
 libxrdp_init(tbus id, struct trans *trans, const char *xrdp_ini);
+/***
+ * Fill in the client address from the session's trans
+ *
+ * libxrdp_init() does this itself if the trans is connected. A session
+ * set up before the connection arrives calls this once trans->sck is set.
+ *
+ * @param session Session from libxrdp_init()
+ * @return 0 for success
+ */
+int
+libxrdp_load_client_address(struct xrdp_session *session);
 int
 libxrdp_exit(struct xrdp_session *session);
 int
 libxrdp_disconnect(struct xrdp_session *session);
+/***
+ * Run the connection sequence up to the end of MCS
+ *
+ * If the client asks for TLS, this returns as soon as the handshake has
+ * started, with trans_tls_accept_pending() true for the session's trans.
+ * The caller takes the handshake on from its wait loop with
+ * trans_get_wait_objs_rw() and trans_check_wait_objs(), then calls this
+ * again to carry on.
+ *
+ * @param session Session from libxrdp_init()
+ * @return 0 for success
+ */
 int
 libxrdp_process_incoming(struct xrdp_session *session);
 int EXPORT_CC
@@ -198,18 +221,33 @@ libxrdp_orders_send_font(struct xrdp_session *session,
 int
 libxrdp_reset(struct xrdp_session *session, unsigned int width,
               unsigned int height, int bpp);
+/* key is the persistent cache key for the client to store the bitmap
+   under, or 0 for none */
 int
 libxrdp_orders_send_raw_bitmap2(struct xrdp_session *session,
                                 int width, int height, int bpp, char *data,
-                                int cache_id, int cache_idx);
+                                int cache_id, int cache_idx, tui64 key);
 int
 libxrdp_orders_send_bitmap2(struct xrdp_session *session,
                             int width, int height, int bpp, char *data,
-                            int cache_id, int cache_idx, int hints);
+                            int cache_id, int cache_idx, int hints,
+                            tui64 key);
 int
 libxrdp_orders_send_bitmap3(struct xrdp_session *session,
                             int width, int height, int bpp, char *data,
                             int cache_id, int cache_idx, int hints);
+/**
+ * Gets the keys of the bitmaps the client loaded from disk into a
+ * persistent bitmap cache at the start of the connection
+ *
+ * @param session RDP session
+ * @param cache_id Bitmap cache
+ * @param[out] count Number of keys
+ * @return Keys, the one at index n is held at cache index n, or NULL
+ */
+const tui64 *
+libxrdp_get_persistent_keys(struct xrdp_session *session, int cache_id,
+                            int *count);
 /**
  * Returns the number of channels in the session
  *
@@ -28,11 +28,130 @@ http://msdn.microsoft.com/en-us/library/cc241877.aspx
 #include <config_ac.h>
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "libxrdp.h"
 
 #define FLAGS_RLE     0x10
 #define FLAGS_NOALPHA 0x20
 
+#if defined(__SSE2__)
+/*****************************************************************************/
+/* index of lowest set bit, bits must not be zero */
+static int
+fctz(unsigned int bits)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(bits);
+#else
+    int rv;
+
+    rv = 0;
+    while ((bits & 1) == 0)
+    {
+        bits >>= 1;
+        rv++;
+    }
+    return rv;
+#endif
+}
+#endif
+
+#if defined(__AVX2__)
+#define FSPLIT_BLOCK 32
+
+/*****************************************************************************/
+/* one byte of each of 32 pixels */
+static __m256i
+fplane32(__m256i p0, __m256i p1, __m256i p2, __m256i p3, int shift)
+{
+    __m256i mask;
+    __m256i lo;
+    __m256i hi;
+
+    mask = _mm256_set1_epi32(0xff);
+    lo = _mm256_packs_epi32(
+             _mm256_and_si256(_mm256_srli_epi32(p0, shift), mask),
+             _mm256_and_si256(_mm256_srli_epi32(p1, shift), mask));
+    hi = _mm256_packs_epi32(
+             _mm256_and_si256(_mm256_srli_epi32(p2, shift), mask),
+             _mm256_and_si256(_mm256_srli_epi32(p3, shift), mask));
+    /* the packs work within each 128 bit half, put the pixels back
+       in order */
+    return _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi),
+                                       _mm256_setr_epi32(0, 4, 1, 5,
+                                               2, 6, 3, 7));
+}
+
+/*****************************************************************************/
+/* split FSPLIT_BLOCK pixels, a_data can be NULL */
+static void
+fsplit_block(const char *in_data, char *a_data, char *r_data,
+             char *g_data, char *b_data)
+{
+    __m256i p0;
+    __m256i p1;
+    __m256i p2;
+    __m256i p3;
+
+    p0 = _mm256_loadu_si256((const __m256i *) (in_data + 0));
+    p1 = _mm256_loadu_si256((const __m256i *) (in_data + 32));
+    p2 = _mm256_loadu_si256((const __m256i *) (in_data + 64));
+    p3 = _mm256_loadu_si256((const __m256i *) (in_data + 96));
+    if (a_data != NULL)
+    {
+        _mm256_storeu_si256((__m256i *) a_data, fplane32(p0, p1, p2, p3, 24));
+    }
+    _mm256_storeu_si256((__m256i *) r_data, fplane32(p0, p1, p2, p3, 16));
+    _mm256_storeu_si256((__m256i *) g_data, fplane32(p0, p1, p2, p3, 8));
+    _mm256_storeu_si256((__m256i *) b_data, fplane32(p0, p1, p2, p3, 0));
+}
+#elif defined(__SSE2__)
+#define FSPLIT_BLOCK 16
+
+/*****************************************************************************/
+/* one byte of each of 16 pixels */
+static __m128i
+fplane16(__m128i p0, __m128i p1, __m128i p2, __m128i p3, int shift)
+{
+    __m128i mask;
+
+    mask = _mm_set1_epi32(0xff);
+    return _mm_packus_epi16(
+               _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, shift), mask),
+                               _mm_and_si128(_mm_srli_epi32(p1, shift), mask)),
+               _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, shift), mask),
+                               _mm_and_si128(_mm_srli_epi32(p3, shift), mask)));
+}
+
+/*****************************************************************************/
+/* split FSPLIT_BLOCK pixels, a_data can be NULL */
+static void
+fsplit_block(const char *in_data, char *a_data, char *r_data,
+             char *g_data, char *b_data)
+{
+    __m128i p0;
+    __m128i p1;
+    __m128i p2;
+    __m128i p3;
+
+    p0 = _mm_loadu_si128((const __m128i *) (in_data + 0));
+    p1 = _mm_loadu_si128((const __m128i *) (in_data + 16));
+    p2 = _mm_loadu_si128((const __m128i *) (in_data + 32));
+    p3 = _mm_loadu_si128((const __m128i *) (in_data + 48));
+    if (a_data != NULL)
+    {
+        _mm_storeu_si128((__m128i *) a_data, fplane16(p0, p1, p2, p3, 24));
+    }
+    _mm_storeu_si128((__m128i *) r_data, fplane16(p0, p1, p2, p3, 16));
+    _mm_storeu_si128((__m128i *) g_data, fplane16(p0, p1, p2, p3, 8));
+    _mm_storeu_si128((__m128i *) b_data, fplane16(p0, p1, p2, p3, 0));
+}
+#endif
 
 
 /*****************************************************************************/
@@ -58,6 +177,16 @@ fsplit3(char *in_data, int start_line, int width, int e,
     {
         ptr32 = (int *) (in_data + start_line * width * 4);
         index = 0;
+#if defined(FSPLIT_BLOCK)
+        while (index + FSPLIT_BLOCK <= width)
+        {
+            fsplit_block((char *) ptr32, NULL, r_data + out_index,
+                                g_data + out_index, b_data + out_index);
+            ptr32 += FSPLIT_BLOCK;
+            out_index += FSPLIT_BLOCK;
+            index += FSPLIT_BLOCK;
+        }
+#endif
 #if defined(L_ENDIAN)
         while (index + 4 <= width)
         {
@@ -139,6 +268,17 @@ fsplit4(char *in_data, int start_line, int width, int e,
     {
         ptr32 = (int *) (in_data + start_line * width * 4);
         index = 0;
+#if defined(FSPLIT_BLOCK)
+        while (index + FSPLIT_BLOCK <= width)
+        {
+            fsplit_block((char *) ptr32, a_data + out_index,
+                                r_data + out_index, g_data + out_index,
+                                b_data + out_index);
+            ptr32 += FSPLIT_BLOCK;
+            out_index += FSPLIT_BLOCK;
+            index += FSPLIT_BLOCK;
+        }
+#endif
 #if defined(L_ENDIAN)
         while (index + 4 <= width)
         {
@@ -227,6 +367,47 @@ fdelta(char *in_plane, char *out_plane, int cx, int cy)
     src8 = in_plane;
     dst8 = out_plane;
     src8_end = src8 + (cx * cy - cx);
+#if defined(__AVX2__)
+    {
+        __m256i zero;
+        __m256i d;
+        __m256i neg;
+
+        zero = _mm256_setzero_si256();
+        while (src8 + 32 <= src8_end)
+        {
+            d = _mm256_sub_epi8(
+                    _mm256_loadu_si256((const __m256i *) (src8 + cx)),
+                    _mm256_loadu_si256((const __m256i *) src8));
+            neg = _mm256_cmpgt_epi8(zero, d);
+            d = _mm256_sub_epi8(_mm256_xor_si256(d, neg), neg);
+            d = _mm256_add_epi8(_mm256_add_epi8(d, d), neg);
+            _mm256_storeu_si256((__m256i *) (dst8 + cx), d);
+            src8 += 32;
+            dst8 += 32;
+        }
+    }
+#elif defined(__SSE2__)
+    {
+        __m128i zero;
+        __m128i d;
+        __m128i neg;
+
+        /* as DELTA_ONE, sign and magnitude with the sign at the bottom */
+        zero = _mm_setzero_si128();
+        while (src8 + 16 <= src8_end)
+        {
+            d = _mm_sub_epi8(_mm_loadu_si128((const __m128i *) (src8 + cx)),
+                             _mm_loadu_si128((const __m128i *) src8));
+            neg = _mm_cmpgt_epi8(zero, d);
+            d = _mm_sub_epi8(_mm_xor_si128(d, neg), neg);
+            d = _mm_add_epi8(_mm_add_epi8(d, d), neg);
+            _mm_storeu_si128((__m128i *) (dst8 + cx), d);
+            src8 += 16;
+            dst8 += 16;
+        }
+    }
+#endif
     while (src8 + 8 <= src8_end)
     {
         DELTA_ONE;
@@ -311,8 +492,47 @@ fout(int collen, int replen, char *colptr, struct stream *s)
 }
 
 /*****************************************************************************/
+/* how many bytes from ptr8 on, stopping at lend, match the next byte
+   if same is set, or don't if it isn't */
+static int
+frun(const char *ptr8, const char *lend, int same)
+{
+    const char *start;
+#if defined(__SSE2__)
+    unsigned int bits;
+#endif
+
+    start = ptr8;
+#if defined(__SSE2__)
+    while (ptr8 + 16 <= lend)
+    {
+        bits = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                                     _mm_loadu_si128((const __m128i *) ptr8),
+                                     _mm_loadu_si128((const __m128i *) (ptr8 + 1))));
+        if (same)
+        {
+            bits = ~bits;
+        }
+        bits &= 0xFFFF;
+        if (bits != 0)
+        {
+            return (int) (ptr8 - start) + fctz(bits);
+        }
+        ptr8 += 16;
+    }
+#endif
+    while (ptr8 < lend && (ptr8[0] == ptr8[1]) == (same != 0))
+    {
+        ptr8++;
+    }
+    return (int) (ptr8 - start);
+}
+
+/*****************************************************************************/
+/* the lines are packed on their own, line_end gets the bytes out after
+   each so the first lines can be taken without packing again */
 static int
-fpack(char *plane, int cx, int cy, struct stream *s)
+fpack(char *plane, int cx, int cy, struct stream *s, int *line_end)
 {
     char *ptr8;
     char *colptr;
@@ -321,6 +541,7 @@ fpack(char *plane, int cx, int cy, struct stream *s)
     int jndex;
     int collen;
     int replen;
+    int count;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "fpack:");
     holdp = s->p;
@@ -343,67 +564,136 @@ fpack(char *plane, int cx, int cy, struct stream *s)
         }
         while (ptr8 < lend)
         {
-            if (ptr8[0] == ptr8[1])
+            /* bytes the same as the next add to the run */
+            count = frun(ptr8, lend, 1);
+            replen += count;
+            ptr8 += count;
+            if (ptr8 >= lend)
             {
-                replen++;
+                break;
             }
-            else
+            /* the first byte that isn't ends it */
+            if (replen > 0)
             {
-                if (replen > 0)
+                if (replen < 3)
                 {
-                    if (replen < 3)
-                    {
-                        collen += replen + 1;
-                        replen = 0;
-                    }
-                    else
-                    {
-                        fout(collen, replen, colptr, s);
-                        colptr = ptr8 + 1;
-                        replen = 0;
-                        collen = 1;
-                    }
+                    collen += replen + 1;
+                    replen = 0;
                 }
                 else
                 {
-                    collen++;
+                    fout(collen, replen, colptr, s);
+                    colptr = ptr8 + 1;
+                    replen = 0;
+                    collen = 1;
                 }
             }
-            ptr8++;
+            else
+            {
+                collen++;
+            }
+            /* and the ones after it are colours */
+            count = frun(ptr8 + 1, lend, 0);
+            collen += count;
+            ptr8 += count + 1;
         }
         /* end of line */
         fout(collen, replen, colptr, s);
+        line_end[jndex] = (int) (s->p - holdp);
     }
     return (int) (s->p - holdp);
 }
 
 /*****************************************************************************/
 static int
-foutraw3(struct stream *s, int bytes, int header,
-         char *r_data, char *g_data, char *b_data)
+foutraw(struct stream *s, int bytes, int header, char **planes,
+        int num_planes)
 {
+    int index;
+
     out_uint8(s, header);
-    out_uint8a(s, r_data, bytes);
-    out_uint8a(s, g_data, bytes);
-    out_uint8a(s, b_data, bytes);
+    for (index = 0; index < num_planes; index++)
+    {
+        out_uint8a(s, planes[index], bytes);
+    }
     /* pad if no RLE */
     out_uint8(s, 0x00);
     return 0;
 }
 
 /*****************************************************************************/
+/* RLE of as many lines as fit in byte_limit, or the raw planes if they
+   are smaller, returns the number of lines */
 static int
-foutraw4(struct stream *s, int bytes, int header,
-         char *a_data, char *r_data, char *g_data, char *b_data)
+fpack_planes(struct stream *s, int header, char **planes,
+             char **delta_planes, int num_planes, int cx, int cy,
+             int byte_limit)
 {
+    char *hold_p;
+    char *plane_p[4];
+    char *dst;
+    int *line_end;
+    int max_bytes;
+    int total_bytes;
+    int bytes;
+    int index;
+    int full_cy;
+
+    line_end = g_new(int, num_planes * cy);
+    if (line_end == NULL)
+    {
+        return 0;
+    }
+    hold_p = s->p;
+    full_cy = cy;
     out_uint8(s, header);
-    out_uint8a(s, a_data, bytes);
-    out_uint8a(s, r_data, bytes);
-    out_uint8a(s, g_data, bytes);
-    out_uint8a(s, b_data, bytes);
-    /* pad if no RLE */
-    out_uint8(s, 0x00);
-    return 0;
+    for (index = 0; index < num_planes; index++)
+    {
+        plane_p[index] = s->p;
+        fpack(delta_planes[index], cx, cy, s, line_end + index * full_cy);
+    }
+    while (cy > 0)
+    {
+        max_bytes = cx * cy * num_planes;
+        total_bytes = 0;
+        for (index = 0; index < num_planes; index++)
+        {
+            total_bytes += line_end[index * full_cy + cy - 1];
+        }
+        if (total_bytes > max_bytes)
+        {
+            if (2 + max_bytes <= byte_limit)
+            {
+                s->p = hold_p;
+                foutraw(s, cx * cy, header & FLAGS_NOALPHA, planes,
+                        num_planes);
+                break;
+            }
+        }
+        if (1 + total_bytes <= byte_limit)
+        {
+            /* close up the planes if lines were dropped */
+            dst = hold_p + 1;
+            for (index = 0; index < num_planes; index++)
+            {
+                bytes = line_end[index * full_cy + cy - 1];
+                if (dst != plane_p[index])
+                {
+                    g_memmove(dst, plane_p[index], bytes);
+                }
+                dst += bytes;
+            }
+            s->p = dst;
+            break;
+        }
+        cy--;
+    }
+    if (cy == 0)
+    {
+        s->p = hold_p;
+    }
+    g_free(line_end);
+    return cy;
 }
 
 /*****************************************************************************/
@@ -414,23 +704,13 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
                        int start_line, struct stream *temp_s,
                        int e, int flags)
 {
-    char *a_data;
-    char *r_data;
-    char *g_data;
-    char *b_data;
-    char *sa_data;
-    char *sr_data;
-    char *sg_data;
-    char *sb_data;
-    char *hold_p;
-    int a_bytes;
-    int r_bytes;
-    int g_bytes;
-    int b_bytes;
+    char *planes[4];
+    char *delta_planes[4];
+    int num_planes;
+    int index;
     int cx;
     int cy;
     int max_bytes;
-    int total_bytes;
     int header;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_bitmap32_compress:");
@@ -442,115 +722,45 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     }
     header = flags & 0xFF;
     cx = width + e;
-    sa_data = temp_s->data;
-    sr_data = sa_data + max_bytes;
-    sg_data = sr_data + max_bytes;
-    sb_data = sg_data + max_bytes;
-    a_data = sb_data + max_bytes;
-    r_data = a_data + max_bytes;
-    g_data = r_data + max_bytes;
-    b_data = g_data + max_bytes;
-    hold_p = s->p;
+    for (index = 0; index < 4; index++)
+    {
+        planes[index] = temp_s->data + index * max_bytes;
+        delta_planes[index] = temp_s->data + (index + 4) * max_bytes;
+    }
 
     if (header & FLAGS_NOALPHA)
     {
+        /* no alpha plane */
+        num_planes = 3;
         cy = fsplit3(in_data, start_line, width, e,
-                     sr_data, sg_data, sb_data);
-        if (header & FLAGS_RLE)
-        {
-            fdelta(sr_data, r_data, cx, cy);
-            fdelta(sg_data, g_data, cx, cy);
-            fdelta(sb_data, b_data, cx, cy);
-            while (cy > 0)
-            {
-                s->p = hold_p;
-                out_uint8(s, header);
-                r_bytes = fpack(r_data, cx, cy, s);
-                g_bytes = fpack(g_data, cx, cy, s);
-                b_bytes = fpack(b_data, cx, cy, s);
-                max_bytes = cx * cy * 3;
-                total_bytes = r_bytes + g_bytes + b_bytes;
-                if (total_bytes > max_bytes)
-                {
-                    if (2 + max_bytes <= byte_limit)
-                    {
-                        s->p = hold_p;
-                        foutraw3(s, cx * cy, FLAGS_NOALPHA, sr_data, sg_data, sb_data);
-                        break;
-                    }
-                }
-                if (1 + total_bytes <= byte_limit)
-                {
-                    break;
-                }
-                cy--;
-            }
-        }
-        else
-        {
-            while (cy > 0)
-            {
-                max_bytes = cx * cy * 3;
-                if (2 + max_bytes <= byte_limit)
-                {
-                    s->p = hold_p;
-                    foutraw3(s, cx * cy, FLAGS_NOALPHA, sr_data, sg_data, sb_data);
-                    break;
-                }
-                cy--;
-            }
-        }
+                     planes[0], planes[1], planes[2]);
     }
     else
     {
+        num_planes = 4;
         cy = fsplit4(in_data, start_line, width, e,
-                     sa_data, sr_data, sg_data, sb_data);
-        if (header & FLAGS_RLE)
+                     planes[0], planes[1], planes[2], planes[3]);
+    }
+
+    if (header & FLAGS_RLE)
+    {
+        for (index = 0; index < num_planes; index++)
         {
-            fdelta(sa_data, a_data, cx, cy);
-            fdelta(sr_data, r_data, cx, cy);
-            fdelta(sg_data, g_data, cx, cy);
-            fdelta(sb_data, b_data, cx, cy);
-            while (cy > 0)
-            {
-                s->p = hold_p;
-                out_uint8(s, header);
-                a_bytes = fpack(a_data, cx, cy, s);
-                r_bytes = fpack(r_data, cx, cy, s);
-                g_bytes = fpack(g_data, cx, cy, s);
-                b_bytes = fpack(b_data, cx, cy, s);
-                max_bytes = cx * cy * 4;
-                total_bytes = a_bytes + r_bytes + g_bytes + b_bytes;
-                if (total_bytes > max_bytes)
-                {
-                    if (2 + max_bytes <= byte_limit)
-                    {
-                        s->p = hold_p;
-                        foutraw4(s, cx * cy, 0, sa_data, sr_data, sg_data, sb_data);
-                        break;
-                    }
-                }
-                if (1 + total_bytes <= byte_limit)
-                {
-                    break;
-                }
-                cy--;
-            }
+            fdelta(planes[index], delta_planes[index], cx, cy);
         }
-        else
+        return fpack_planes(s, header, planes, delta_planes, num_planes,
+                            cx, cy, byte_limit);
+    }
+
+    while (cy > 0)
+    {
+        max_bytes = cx * cy * num_planes;
+        if (2 + max_bytes <= byte_limit)
         {
-            while (cy > 0)
-            {
-                max_bytes = cx * cy * 4;
-                if (2 + max_bytes <= byte_limit)
-                {
-                    s->p = hold_p;
-                    foutraw4(s, cx * cy, 0, sa_data, sr_data, sg_data, sb_data);
-                    break;
-                }
-                cy--;
-            }
+            foutraw(s, cx * cy, header & FLAGS_NOALPHA, planes, num_planes);
+            break;
         }
+        cy--;
     }
     return cy;
 }
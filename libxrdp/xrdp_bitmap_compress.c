@@ -24,6 +24,10 @@
 #include <config_ac.h>
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "libxrdp.h"
 
 #define BC_MAX_BYTES (16 * 1024)
@@ -647,6 +651,232 @@
         bicolor_spin = 0; \
     } while (0)
 
+/*****************************************************************************/
+static tui32
+run_pixel(const char *line, int x, int Bpp)
+{
+    switch (Bpp)
+    {
+        case 1:
+            return GETPIXEL8(line, x, 0, 0);
+        case 2:
+            return GETPIXEL16(line, x, 0, 0);
+        default:
+            return GETPIXEL32(line, x, 0, 0);
+    }
+}
+
+#if defined(__SSE2__)
+/*****************************************************************************/
+static __m128i
+run_splat(tui32 pixel, int Bpp)
+{
+    switch (Bpp)
+    {
+        case 1:
+            return _mm_set1_epi8((char) pixel);
+        case 2:
+            return _mm_set1_epi16((short) pixel);
+        default:
+            return _mm_set1_epi32((int) pixel);
+    }
+}
+
+/*****************************************************************************/
+static __m128i
+run_cmpeq(__m128i a, __m128i b, int Bpp)
+{
+    switch (Bpp)
+    {
+        case 1:
+            return _mm_cmpeq_epi8(a, b);
+        case 2:
+            return _mm_cmpeq_epi16(a, b);
+        default:
+            return _mm_cmpeq_epi32(a, b);
+    }
+}
+#endif
+
+/*****************************************************************************/
+/* number of pixels from x on where the pixel is v and, if there is a line
+   above, the pixel above is v too */
+static int
+run_fill(const char *line, const char *above, int x, int width, int Bpp,
+         tui32 v)
+{
+    int index;
+
+    index = x;
+#if defined(__SSE2__)
+    {
+        __m128i vv;
+        __m128i eq;
+        int step;
+
+        vv = run_splat(v, Bpp);
+        step = 16 / Bpp;
+        for (; index + step <= width; index += step)
+        {
+            eq = run_cmpeq(_mm_loadu_si128((const __m128i *)
+                                           (line + index * Bpp)), vv, Bpp);
+            if (above != NULL)
+            {
+                eq = _mm_and_si128(eq, run_cmpeq(_mm_loadu_si128(
+                                                     (const __m128i *) (above + index * Bpp)), vv, Bpp));
+            }
+            if (_mm_movemask_epi8(eq) != 0xFFFF)
+            {
+                break;
+            }
+        }
+    }
+#endif
+    for (; index < width; index++)
+    {
+        if (run_pixel(line, index, Bpp) != v ||
+                (above != NULL && run_pixel(above, index, Bpp) != v))
+        {
+            break;
+        }
+    }
+    return index - x;
+}
+
+/*****************************************************************************/
+/* number of pixels from x on where the pixel is v and the pixel above,
+   if any, is neither v nor v ^ mix */
+static int
+run_color(const char *line, const char *above, int x, int width, int Bpp,
+          tui32 v, tui32 mix)
+{
+    int index;
+
+    index = x;
+#if defined(__SSE2__)
+    {
+        __m128i vv;
+        __m128i vm;
+        __m128i eq;
+        __m128i a;
+        int step;
+
+        vv = run_splat(v, Bpp);
+        vm = run_splat(v ^ mix, Bpp);
+        step = 16 / Bpp;
+        for (; index + step <= width; index += step)
+        {
+            eq = run_cmpeq(_mm_loadu_si128((const __m128i *)
+                                           (line + index * Bpp)), vv, Bpp);
+            if (above != NULL)
+            {
+                a = _mm_loadu_si128((const __m128i *) (above + index * Bpp));
+                eq = _mm_andnot_si128(_mm_or_si128(run_cmpeq(a, vv, Bpp),
+                                                   run_cmpeq(a, vm, Bpp)),
+                                      eq);
+            }
+            if (_mm_movemask_epi8(eq) != 0xFFFF)
+            {
+                break;
+            }
+        }
+    }
+#endif
+    for (; index < width; index++)
+    {
+        if (run_pixel(line, index, Bpp) != v)
+        {
+            break;
+        }
+        if (above != NULL && (run_pixel(above, index, Bpp) == v ||
+                              run_pixel(above, index, Bpp) == (v ^ mix)))
+        {
+            break;
+        }
+    }
+    return index - x;
+}
+
+/*****************************************************************************/
+/* count copies of a pixel as the copy orders take them */
+static void
+run_out(struct stream *temp_s, tui32 pixel, int count, int Bpp)
+{
+    int index;
+
+    for (index = 0; index < count; index++)
+    {
+        switch (Bpp)
+        {
+            case 1:
+                out_uint8(temp_s, pixel);
+                break;
+            case 2:
+                out_uint16_le(temp_s, pixel);
+                break;
+            default:
+                out_uint8(temp_s, pixel & 0xff);
+                out_uint8(temp_s, (pixel >> 8) & 0xff);
+                out_uint8(temp_s, (pixel >> 16) & 0xff);
+                break;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* the pixel at i repeats the last one, and once a run of those is under
+   way each further pixel only adds to the counts, so rather than go
+   through the tests pixel by pixel take the whole run at once */
+#define IN_RUN(_Bpp) \
+    do { \
+        run_count = 0; \
+        if (i < width && mix_count <= 3 && bicolor_count <= 3 && \
+                run_pixel(line, i, _Bpp) == (tui32) last_pixel) \
+        { \
+            ypixel = (last_line == 0) ? 0 : \
+                     (int) run_pixel(last_line, i, _Bpp); \
+            if (ypixel == last_pixel) \
+            { \
+                /* fill and color, and fill or mix with all bits clear */ \
+                run_count = run_fill(line, last_line, i, width, _Bpp, \
+                                     last_pixel); \
+                fill_count += run_count; \
+                color_count += run_count; \
+                if (fom_count + run_count > fom_mask_len * 8) \
+                { \
+                    g_memset(fom_mask + fom_mask_len, 0, \
+                             (fom_count + run_count + 7) / 8 - fom_mask_len); \
+                    fom_mask_len = (fom_count + run_count + 7) / 8; \
+                } \
+                fom_count += run_count; \
+                last_ypixel = last_pixel; \
+            } \
+            else if (ypixel != (last_pixel ^ mix) && \
+                     fill_count <= 3 && fom_count <= 3) \
+            { \
+                /* color only */ \
+                run_count = run_color(line, last_line, i, width, _Bpp, \
+                                      last_pixel, mix); \
+                color_count += run_count; \
+                fill_count = 0; \
+                fom_count = 0; \
+                fom_mask_len = 0; \
+                last_ypixel = (last_line == 0) ? 0 : (int) \
+                              run_pixel(last_line, i + run_count - 1, _Bpp); \
+            } \
+            if (run_count > 0) \
+            { \
+                run_out(temp_s, last_pixel, run_count, _Bpp); \
+                mix_count = 0; \
+                bicolor_count = 0; \
+                bicolor1 = last_pixel; \
+                bicolor2 = last_pixel; \
+                bicolor_spin = 0; \
+                count += run_count; \
+            } \
+        } \
+    } while (0)
+
 /*****************************************************************************/
 int
 xrdp_bitmap_compress(char *in_data, int width, int height,
@@ -676,6 +906,7 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
     int mix;
     int fom_count;
     int fom_mask_len;
+    int run_count;
     int temp; /* used in macros */
 
     init_stream(temp_s, 0);
@@ -718,6 +949,13 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
 
             for (i = 0; i < end; i++)
             {
+                IN_RUN(1);
+                if (run_count > 0)
+                {
+                    i += run_count - 1;
+                    continue;
+                }
+
                 /* read next pixel */
                 IN_PIXEL8(line, i, 0, width, last_pixel, pixel);
                 IN_PIXEL8(last_line, i, 0, width, last_ypixel, ypixel);
@@ -1010,6 +1248,13 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
 
             for (i = 0; i < end; i++)
             {
+                IN_RUN(2);
+                if (run_count > 0)
+                {
+                    i += run_count - 1;
+                    continue;
+                }
+
                 /* read next pixel */
                 IN_PIXEL16(line, i, 0, width, last_pixel, pixel);
                 IN_PIXEL16(last_line, i, 0, width, last_ypixel, ypixel);
@@ -1302,6 +1547,13 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
 
             for (i = 0; i < end; i++)
             {
+                IN_RUN(4);
+                if (run_count > 0)
+                {
+                    i += run_count - 1;
+                    continue;
+                }
+
                 /* read next pixel */
                 IN_PIXEL32(line, i, 0, width, last_pixel, pixel);
                 IN_PIXEL32(last_line, i, 0, width, last_ypixel, ypixel);
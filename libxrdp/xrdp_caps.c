@@ -319,17 +319,33 @@ xrdp_caps_process_bmpcache2(struct xrdp_rdp *self, struct stream *s,
     in_uint16_le(s, i); /* cache flags */
     self->client_info.bitmap_cache_persist_enable = i;
     in_uint8s(s, 2); /* number of caches in set, 3 */
+    /* the top bit of each entry count is set for a persistent cache */
+    self->client_info.bitmap_cache_persist_mask = 0;
     in_uint32_le(s, i);
+    if (i & BMPCACHE2_FLAG_PERSIST)
+    {
+        self->client_info.bitmap_cache_persist_mask |= 1;
+    }
+    i = i & 0x7fffffff;
     i = MIN(i, XRDP_MAX_BITMAP_CACHE_IDX);
     i = MAX(i, 0);
     self->client_info.cache1_entries = i;
     self->client_info.cache1_size = 256 * Bpp;
     in_uint32_le(s, i);
+    if (i & BMPCACHE2_FLAG_PERSIST)
+    {
+        self->client_info.bitmap_cache_persist_mask |= 2;
+    }
+    i = i & 0x7fffffff;
     i = MIN(i, XRDP_MAX_BITMAP_CACHE_IDX);
     i = MAX(i, 0);
     self->client_info.cache2_entries = i;
     self->client_info.cache2_size = 1024 * Bpp;
     in_uint32_le(s, i);
+    if (i & BMPCACHE2_FLAG_PERSIST)
+    {
+        self->client_info.bitmap_cache_persist_mask |= 4;
+    }
     i = i & 0x7fffffff;
     i = MIN(i, XRDP_MAX_BITMAP_CACHE_IDX);
     i = MAX(i, 0);
@@ -470,6 +486,8 @@ xrdp_caps_process_glyphcache(struct xrdp_rdp *self, struct stream *s,
                              int len)
 {
     int glyph_support_level;
+    int frag_entries;
+    int frag_size;
 
     if (len < 40 + 4 + 2 + 2) /* MS-RDPBCGR 2.2.7.1.8 */
     {
@@ -478,7 +496,8 @@ xrdp_caps_process_glyphcache(struct xrdp_rdp *self, struct stream *s,
     }
 
     in_uint8s(s, 40);  /* glyph cache */
-    in_uint8s(s, 4);   /* frag cache */
+    in_uint16_le(s, frag_entries); /* frag cache */
+    in_uint16_le(s, frag_size);
     in_uint16_le(s, glyph_support_level);
     in_uint8s(s, 2);   /* pad */
 
@@ -486,6 +505,13 @@ xrdp_caps_process_glyphcache(struct xrdp_rdp *self, struct stream *s,
     {
         self->client_info.use_cache_glyph_v2 = 1;
     }
+    if (glyph_support_level != GLYPH_SUPPORT_NONE)
+    {
+        self->client_info.glyph_frag_entries = frag_entries;
+        self->client_info.glyph_frag_size = frag_size;
+    }
+    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_caps_process_glyphcache: fragment cache "
+              "entries %d, size %d", frag_entries, frag_size);
     LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_caps_process_glyphcache: support level %d ",
               glyph_support_level);
     return 0;
@@ -1269,6 +1295,21 @@ xrdp_caps_send_demand_active(struct xrdp_rdp *self)
               "CAPSTYPE_COLORCACHE: "
               "colorTableCacheSize = 6");
 
+    /* Output bitmap cache host support capability set, without it
+       clients don't send their persistent bitmap cache keys */
+    if (self->client_info.use_bitmap_cache)
+    {
+        caps_count++;
+        out_uint16_le(s, CAPSTYPE_BITMAPCACHE_HOSTSUPPORT);
+        out_uint16_le(s, CAPSTYPE_BITMAPCACHE_HOSTSUPPORT_LEN);
+        out_uint8(s, TS_BITMAPCACHE_REV2); /* cacheVersion */
+        out_uint8(s, 0); /* pad1 */
+        out_uint16_le(s, 0); /* pad2 */
+        LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_caps_send_demand_active: Server Capability "
+                  "CAPSTYPE_BITMAPCACHE_HOSTSUPPORT: "
+                  "cacheVersion = TS_BITMAPCACHE_REV2");
+    }
+
     /* Output pointer capability set */
     caps_count++;
     out_uint16_le(s, CAPSTYPE_POINTER);
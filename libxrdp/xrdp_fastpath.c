@@ -136,7 +136,9 @@ xrdp_fastpath_session_callback(struct xrdp_fastpath *self, int msg,
 }
 
 /*****************************************************************************/
-/* no fragmentation */
+/* no fragmentation
+ * s may be a fragment or compressor view of a buffer owned elsewhere, so
+ * it can't be handed to the transport; only an unsent tail is copied */
 int
 xrdp_fastpath_send(struct xrdp_fastpath *self, struct stream *s)
 {
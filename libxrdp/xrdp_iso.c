@@ -447,14 +447,13 @@ xrdp_iso_send_cc(struct xrdp_iso *self)
               "length indicator %d, DST-REF 0, SRC-REF 0, CLASS OPTION 0",
               len_indicator);
 
-    if (trans_write_copy_s(self->trans, s) != 0)
+    /* the stream is ours, so any unsent part can be queued without a copy */
+    if (trans_write_s(self->trans, s) != 0)
     {
         LOG(LOG_LEVEL_ERROR, "Sending [ITU-T X.224] CC-TPDU (Connection Confirm) failed");
-        free_stream(s);
         return 1;
     }
 
-    free_stream(s);
     return 0;
 }
 /*****************************************************************************
@@ -634,6 +633,7 @@ xrdp_iso_send(struct xrdp_iso *self, struct stream *s)
               "length indicator 2, TPDU code 0x%2.2x, EOT 1, TPDU-NR 0x00",
               ISO_PDU_DT);
 
+    /* callers keep using s after this, so only an unsent tail is copied */
     if (trans_write_copy_s(self->trans, s) != 0)
     {
         LOG(LOG_LEVEL_ERROR, "xrdp_iso_send: trans_write_copy_s failed");
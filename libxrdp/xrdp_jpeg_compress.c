@@ -199,7 +199,7 @@ xrdp_codec_jpeg_compress(void *handle,
 
 /*****************************************************************************/
 void *
-xrdp_jpeg_init(void)
+xrdp_jpeg_init(int num_threads)
 {
     tjhandle tj_han;
 
@@ -230,15 +230,56 @@ xrdp_jpeg_deinit(void *handle)
 #include <stdlib.h>
 #include <string.h>
 #include <jpeglib.h>
+#include "log.h"
 
 #define JP_QUALITY 75
 
+/* lines in a row of MCUs with 4:2:0 sampling, stripes are whole rows */
+#define JP_MCU_SIZE 16
+/* restart markers count round RST0 to RST7 */
+#define JP_RST_COUNT 8
+#define JP_MAX_STRIPES 16
+
 struct mydata_comp
 {
     JOCTET *cb;
     int cb_bytes;
     int total_done;
     int overwrite;
+    int grow; /* make cb bigger rather than go round again */
+};
+
+/* a libjpeg compressor kept from one image to the next */
+struct jp_context
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_destination_mgr dst_mgr;
+    struct mydata_comp md;
+    JOCTET *out; /* a stripe as a JPEG of its own */
+    int out_size;
+    int out_bytes;
+#if !defined(JCS_EXTENSIONS)
+    JOCTET *row;
+    int row_size;
+#endif
+};
+
+struct xrdp_jpeg
+{
+    struct jp_context bitmap_ctx; /* xrdp_jpeg_compress() */
+    /* xrdp_codec_jpeg_compress(), one per stripe */
+    struct jp_context *stripe_ctx;
+    int max_stripes;
+    struct xrdp_workers *workers;
+    /* the image being compressed */
+    const char *src;
+    int stride;
+    int cx;
+    int cy;
+    int quality;
+    int stripe_lines;
+    int restart_interval;
 };
 
 /*****************************************************************************/
@@ -261,10 +302,25 @@ static int
 my_empty_output_buffer(j_compress_ptr cinfo)
 {
     struct mydata_comp *md;
+    JOCTET *cb;
     int chunk_bytes;
 
     md = (struct mydata_comp *)(cinfo->client_data);
     chunk_bytes = md->cb_bytes;
+    if (md->grow)
+    {
+        cb = (JOCTET *) g_malloc(md->cb_bytes * 2, 0);
+        if (cb != NULL)
+        {
+            g_memcpy(cb, md->cb, md->cb_bytes);
+            g_free(md->cb);
+            md->cb = cb;
+            md->cb_bytes *= 2;
+            cinfo->dest->next_output_byte = md->cb + chunk_bytes;
+            cinfo->dest->free_in_buffer = md->cb_bytes - chunk_bytes;
+            return 1;
+        }
+    }
     md->total_done += chunk_bytes;
     cinfo->dest->next_output_byte = md->cb;
     cinfo->dest->free_in_buffer = md->cb_bytes;
@@ -285,42 +341,62 @@ my_term_destination(j_compress_ptr cinfo)
     md->total_done += chunk_bytes;
 }
 
+/*****************************************************************************/
+static void
+jp_context_init(struct jp_context *ctx)
+{
+    ctx->cinfo.err = jpeg_std_error(&ctx->jerr);
+    jpeg_create_compress(&ctx->cinfo);
+    ctx->cinfo.client_data = &ctx->md;
+    ctx->dst_mgr.init_destination = my_init_destination;
+    ctx->dst_mgr.empty_output_buffer = my_empty_output_buffer;
+    ctx->dst_mgr.term_destination = my_term_destination;
+    ctx->cinfo.dest = &ctx->dst_mgr;
+}
+
+/*****************************************************************************/
+static void
+jp_context_deinit(struct jp_context *ctx)
+{
+    jpeg_destroy_compress(&ctx->cinfo);
+    g_free(ctx->out);
+#if !defined(JCS_EXTENSIONS)
+    g_free(ctx->row);
+#endif
+}
+
+/*****************************************************************************/
+static void
+jp_set_params(struct jp_context *ctx, int width, int height, int quality)
+{
+    ctx->cinfo.image_width = width;
+    ctx->cinfo.image_height = height;
+    jpeg_set_defaults(&ctx->cinfo);
+    ctx->cinfo.num_components = 3;
+    ctx->cinfo.dct_method = JDCT_FLOAT;
+    jpeg_set_quality(&ctx->cinfo, quality, 1);
+}
+
 /*****************************************************************************/
 static int
-jp_do_compress(JOCTET *data, int width, int height, int bpp, int quality,
-               JOCTET *comp_data, int *comp_data_bytes)
+jp_do_compress(struct jp_context *ctx, JOCTET *data, int width, int height,
+               int bpp, int quality, JOCTET *comp_data, int *comp_data_bytes)
 {
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    struct jpeg_destination_mgr dst_mgr;
-    struct mydata_comp md;
+    struct jpeg_compress_struct *cinfo;
     JSAMPROW row_pointer[4];
     int Bpp;
 
     Bpp = (bpp + 7) / 8;
-    memset(&cinfo, 0, sizeof(cinfo));
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    memset(&md, 0, sizeof(md));
-    md.cb = comp_data,
-    md.cb_bytes = *comp_data_bytes;
-    cinfo.client_data = &md;
-    memset(&dst_mgr, 0, sizeof(dst_mgr));
-    dst_mgr.init_destination = my_init_destination;
-    dst_mgr.empty_output_buffer = my_empty_output_buffer;
-    dst_mgr.term_destination = my_term_destination;
-    cinfo.dest = &dst_mgr;
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = Bpp;
-    cinfo.in_color_space = JCS_RGB;
-    jpeg_set_defaults(&cinfo);
-    cinfo.num_components = 3;
-    cinfo.dct_method = JDCT_FLOAT;
-    jpeg_set_quality(&cinfo, quality, 1);
-    jpeg_start_compress(&cinfo, 1);
-
-    while (cinfo.next_scanline + 3 < cinfo.image_height)
+    cinfo = &ctx->cinfo;
+    g_memset(&ctx->md, 0, sizeof(ctx->md));
+    ctx->md.cb = comp_data,
+    ctx->md.cb_bytes = *comp_data_bytes;
+    cinfo->input_components = Bpp;
+    cinfo->in_color_space = JCS_RGB;
+    jp_set_params(ctx, width, height, quality);
+    jpeg_start_compress(cinfo, 1);
+
+    while (cinfo->next_scanline + 3 < cinfo->image_height)
     {
         row_pointer[0] = data;
         data += width * Bpp;
@@ -330,21 +406,20 @@ jp_do_compress(JOCTET *data, int width, int height, int bpp, int quality,
         data += width * Bpp;
         row_pointer[3] = data;
         data += width * Bpp;
-        jpeg_write_scanlines(&cinfo, row_pointer, 4);
+        jpeg_write_scanlines(cinfo, row_pointer, 4);
     }
 
-    while (cinfo.next_scanline < cinfo.image_height)
+    while (cinfo->next_scanline < cinfo->image_height)
     {
         row_pointer[0] = data;
         data += width * Bpp;
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        jpeg_write_scanlines(cinfo, row_pointer, 1);
     }
 
-    jpeg_finish_compress(&cinfo);
-    *comp_data_bytes = md.total_done;
-    jpeg_destroy_compress(&cinfo);
+    jpeg_finish_compress(cinfo);
+    *comp_data_bytes = ctx->md.total_done;
 
-    if (md.overwrite)
+    if (ctx->md.overwrite)
     {
         return 1;
     }
@@ -354,7 +429,7 @@ jp_do_compress(JOCTET *data, int width, int height, int bpp, int quality,
 
 /*****************************************************************************/
 static int
-jpeg_compress(char *in_data, int width, int height,
+jpeg_compress(struct jp_context *ctx, char *in_data, int width, int height,
               struct stream *s, struct stream *temp_s, int bpp,
               int byte_limit, int e, int quality)
 {
@@ -404,8 +479,8 @@ jpeg_compress(char *in_data, int width, int height,
     }
 
     cdata_bytes = byte_limit;
-    jp_do_compress(data, width + e, height, 24, quality, (JOCTET *) s->p,
-                   &cdata_bytes);
+    jp_do_compress(ctx, data, width + e, height, 24, quality,
+                   (JOCTET *) s->p, &cdata_bytes);
     s->p += cdata_bytes;
     return cdata_bytes;
 }
@@ -417,31 +492,322 @@ xrdp_jpeg_compress(void *handle, char *in_data, int width, int height,
                    int start_line, struct stream *temp_s,
                    int e, int quality)
 {
-    jpeg_compress(in_data, width, height, s, temp_s, bpp, byte_limit,
-                  e, quality);
+    struct xrdp_jpeg *self;
+
+    self = (struct xrdp_jpeg *) handle;
+    if (self == NULL)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_jpeg_compress: handle is nil");
+        return height;
+    }
+    jpeg_compress(&self->bitmap_ctx, in_data, width, height, s, temp_s, bpp,
+                  byte_limit, e, quality);
     return height;
 }
 
 /*****************************************************************************/
+/* lines of XBGR pixels, as TJPF_XBGR takes them, to a JPEG in ctx->out */
+static int
+jp_compress_xbgr(struct jp_context *ctx, const char *src, int stride,
+                 int width, int height, int quality, int restart_interval)
+{
+    struct jpeg_compress_struct *cinfo;
+    JSAMPROW row_pointer[1];
+#if !defined(JCS_EXTENSIONS)
+    const tui8 *src8;
+    int index;
+#endif
+
+    cinfo = &ctx->cinfo;
+    if (ctx->out == NULL)
+    {
+        ctx->out_size = 64 * 1024;
+        ctx->out = (JOCTET *) g_malloc(ctx->out_size, 0);
+        if (ctx->out == NULL)
+        {
+            return 1;
+        }
+    }
+    g_memset(&ctx->md, 0, sizeof(ctx->md));
+    ctx->md.cb = ctx->out;
+    ctx->md.cb_bytes = ctx->out_size;
+    ctx->md.grow = 1;
+#if defined(JCS_EXTENSIONS)
+    cinfo->input_components = 4;
+    cinfo->in_color_space = JCS_EXT_XBGR;
+#else
+    if (ctx->row_size < width * 3)
+    {
+        g_free(ctx->row);
+        ctx->row_size = width * 3;
+        ctx->row = (JOCTET *) g_malloc(ctx->row_size, 0);
+        if (ctx->row == NULL)
+        {
+            ctx->row_size = 0;
+            return 1;
+        }
+    }
+    cinfo->input_components = 3;
+    cinfo->in_color_space = JCS_RGB;
+#endif
+    jp_set_params(ctx, width, height, quality);
+    cinfo->restart_interval = restart_interval;
+    jpeg_start_compress(cinfo, 1);
+    while (cinfo->next_scanline < cinfo->image_height)
+    {
+#if defined(JCS_EXTENSIONS)
+        row_pointer[0] = (JSAMPROW) src;
+#else
+        src8 = (const tui8 *) src;
+        for (index = 0; index < width; index++)
+        {
+            ctx->row[index * 3 + 0] = src8[index * 4 + 3];
+            ctx->row[index * 3 + 1] = src8[index * 4 + 2];
+            ctx->row[index * 3 + 2] = src8[index * 4 + 1];
+        }
+        row_pointer[0] = ctx->row;
+#endif
+        src += stride;
+        jpeg_write_scanlines(cinfo, row_pointer, 1);
+    }
+    jpeg_finish_compress(cinfo);
+    /* the buffer may have grown */
+    ctx->out = ctx->md.cb;
+    ctx->out_size = ctx->md.cb_bytes;
+    ctx->out_bytes = ctx->md.total_done;
+    return ctx->md.overwrite;
+}
+
+/*****************************************************************************/
+static void
+jp_stripe_job(void *arg, int index)
+{
+    struct xrdp_jpeg *self;
+    int top;
+
+    self = (struct xrdp_jpeg *) arg;
+    top = index * self->stripe_lines;
+    if (jp_compress_xbgr(self->stripe_ctx + index,
+                         self->src + top * self->stride, self->stride,
+                         self->cx, MIN(self->stripe_lines, self->cy - top),
+                         self->quality, self->restart_interval) != 0)
+    {
+        self->stripe_ctx[index].out_bytes = 0;
+    }
+}
+
+/*****************************************************************************/
+/* offset of the entropy coded data, just past the SOS segment, and of
+   the height in the SOF segment */
+static int
+jp_find_scan(const JOCTET *data, int bytes, int *sof_height)
+{
+    int offset;
+    int marker;
+    int len;
+
+    if (bytes < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    {
+        return -1;
+    }
+    offset = 2;
+    while (offset + 4 <= bytes)
+    {
+        if (data[offset] != 0xFF)
+        {
+            return -1;
+        }
+        marker = data[offset + 1];
+        len = (data[offset + 2] << 8) | data[offset + 3];
+        if (marker >= 0xC0 && marker <= 0xC2)
+        {
+            *sof_height = offset + 5;
+        }
+        offset += 2 + len;
+        if (marker == 0xDA)
+        {
+            return (offset <= bytes) ? offset : -1;
+        }
+    }
+    return -1;
+}
+
+/*****************************************************************************/
+/* stripes of whole MCU rows are compressed at the same time as JPEGs of
+   their own, with the restart interval set to a stripe. Put back to back
+   with restart markers between them, the scans make up the JPEG that one
+   compressor would have given */
 int
 xrdp_codec_jpeg_compress(void *handle, int format, char *inp_data, int width,
                          int height, int stride, int x, int y, int cx, int cy,
                          int quality, char *out_data, int *io_len)
 {
-    return 0;
+    struct xrdp_jpeg *self;
+    struct jp_context *ctx;
+    int mcu_rows;
+    int mcu_cols;
+    int num_stripes;
+    int stripe_mcu_rows;
+    int index;
+    int scan;
+    int hdr_bytes;
+    int sof_height;
+    int bytes;
+    int total;
+
+    /*
+     * note: for now we assume that format is always XBGR and ignore format
+     */
+
+    self = (struct xrdp_jpeg *) handle;
+    if (self == NULL)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_codec_jpeg_compress: handle is nil");
+        return -1;
+    }
+
+    mcu_rows = (cy + JP_MCU_SIZE - 1) / JP_MCU_SIZE;
+    mcu_cols = (cx + JP_MCU_SIZE - 1) / JP_MCU_SIZE;
+    num_stripes = MIN(self->max_stripes, mcu_rows);
+    stripe_mcu_rows = (mcu_rows + num_stripes - 1) / num_stripes;
+    if (num_stripes < 2 || mcu_cols * stripe_mcu_rows > 0xFFFF)
+    {
+        /* one stripe, no restart markers */
+        num_stripes = 1;
+        stripe_mcu_rows = mcu_rows;
+        self->restart_interval = 0;
+    }
+    else
+    {
+        num_stripes = (mcu_rows + stripe_mcu_rows - 1) / stripe_mcu_rows;
+        self->restart_interval = mcu_cols * stripe_mcu_rows;
+    }
+    self->src = inp_data + y * stride + x * 4;
+    self->stride = stride;
+    self->cx = cx;
+    self->cy = cy;
+    self->quality = quality;
+    self->stripe_lines = stripe_mcu_rows * JP_MCU_SIZE;
+
+    if (num_stripes == 1)
+    {
+        jp_stripe_job(self, 0);
+    }
+    else
+    {
+        xrdp_workers_run(self->workers, num_stripes, jp_stripe_job, self);
+    }
+
+    /* the first stripe gives the headers */
+    ctx = self->stripe_ctx;
+    sof_height = -1;
+    hdr_bytes = jp_find_scan(ctx->out, ctx->out_bytes, &sof_height);
+    if (hdr_bytes < 0 || sof_height < 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_codec_jpeg_compress: bad JPEG headers");
+        return -1;
+    }
+    total = hdr_bytes;
+    for (index = 0; index < num_stripes; index++)
+    {
+        ctx = self->stripe_ctx + index;
+        scan = jp_find_scan(ctx->out, ctx->out_bytes, &bytes);
+        if (scan < 0 || ctx->out_bytes < scan + 2)
+        {
+            LOG(LOG_LEVEL_ERROR, "xrdp_codec_jpeg_compress: stripe %d "
+                "failed", index);
+            return -1;
+        }
+        /* RSTn before, EOI after */
+        total += ctx->out_bytes - scan;
+    }
+    if (total > *io_len)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_codec_jpeg_compress: %d bytes is more "
+            "than the %d bytes room", total, *io_len);
+        return -1;
+    }
+
+    g_memcpy(out_data, self->stripe_ctx->out, hdr_bytes);
+    out_data[sof_height] = cy >> 8;
+    out_data[sof_height + 1] = cy;
+    total = hdr_bytes;
+    for (index = 0; index < num_stripes; index++)
+    {
+        ctx = self->stripe_ctx + index;
+        if (index > 0)
+        {
+            out_data[total++] = 0xFF;
+            out_data[total++] = 0xD0 + (index - 1) % JP_RST_COUNT;
+        }
+        scan = jp_find_scan(ctx->out, ctx->out_bytes, &bytes);
+        /* all but the EOI */
+        bytes = ctx->out_bytes - scan - 2;
+        g_memcpy(out_data + total, ctx->out + scan, bytes);
+        total += bytes;
+    }
+    out_data[total++] = 0xFF;
+    out_data[total++] = 0xD9; /* EOI */
+    *io_len = total;
+    return height;
 }
 
 /*****************************************************************************/
 void *
-xrdp_jpeg_init(void)
+xrdp_jpeg_init(int num_threads)
 {
-    return 0;
+    struct xrdp_jpeg *self;
+    int index;
+
+    self = g_new0(struct xrdp_jpeg, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->max_stripes = MAX(1, MIN(num_threads, JP_MAX_STRIPES));
+    self->stripe_ctx = g_new0(struct jp_context, self->max_stripes);
+    if (self->stripe_ctx == NULL)
+    {
+        g_free(self);
+        return NULL;
+    }
+    if (self->max_stripes > 1)
+    {
+        /* the calling thread does a stripe too */
+        self->workers = xrdp_workers_create(self->max_stripes - 1);
+        if (self->workers == NULL)
+        {
+            self->max_stripes = 1;
+        }
+    }
+    jp_context_init(&self->bitmap_ctx);
+    for (index = 0; index < self->max_stripes; index++)
+    {
+        jp_context_init(self->stripe_ctx + index);
+    }
+    return self;
 }
 
 /*****************************************************************************/
 int
 xrdp_jpeg_deinit(void *handle)
 {
+    struct xrdp_jpeg *self;
+    int index;
+
+    self = (struct xrdp_jpeg *) handle;
+    if (self == NULL)
+    {
+        return 0;
+    }
+    xrdp_workers_delete(self->workers);
+    jp_context_deinit(&self->bitmap_ctx);
+    for (index = 0; index < self->max_stripes; index++)
+    {
+        jp_context_deinit(self->stripe_ctx + index);
+    }
+    g_free(self->stripe_ctx);
+    g_free(self);
     return 0;
 }
 
@@ -468,7 +834,7 @@ xrdp_codec_jpeg_compress(void *handle, int format, char *inp_data, int width,
 
 /*****************************************************************************/
 void *
-xrdp_jpeg_init(void)
+xrdp_jpeg_init(int num_threads)
 {
     return 0;
 }
@@ -35,6 +35,11 @@
 #define MAX_ORDERS_SIZE(_client_info) \
     (MAX((_client_info)->max_fastpath_frag_bytes, 16 * 1024) - 256);
 
+static int
+xrdp_orders_flush_fills(struct xrdp_orders *self,
+                        const struct xrdp_rect *cover,
+                        const struct xrdp_rect *src);
+
 /*****************************************************************************/
 struct xrdp_orders *
 xrdp_orders_create(struct xrdp_session *session, struct xrdp_rdp *rdp_layer)
@@ -48,7 +53,7 @@ xrdp_orders_create(struct xrdp_session *session, struct xrdp_rdp *rdp_layer)
     init_stream(self->out_s, 32 * 1024);
     self->orders_state.clip_right = 1; /* silly rdp right clip */
     self->orders_state.clip_bottom = 1; /* silly rdp bottom clip */
-    self->jpeg_han = xrdp_jpeg_init();
+    self->jpeg_han = xrdp_jpeg_init(rdp_layer->client_info.jpeg_comp_threads);
     self->rfx_min_pixel = rdp_layer->client_info.rfx_min_pixel;
     if (self->rfx_min_pixel == 0)
     {
@@ -88,6 +93,7 @@ xrdp_orders_reset(struct xrdp_orders *self)
     }
     g_free(self->orders_state.text_data);
     g_memset(&(self->orders_state), 0, sizeof(self->orders_state));
+    self->fill_count = 0;
     self->order_count_ptr = 0;
     self->order_count = 0;
     self->order_level = 0;
@@ -148,6 +154,11 @@ xrdp_orders_send(struct xrdp_orders *self)
     rv = 0;
     if (self->order_level > 0)
     {
+        if (self->order_level == 1 &&
+                xrdp_orders_flush_fills(self, NULL, NULL) != 0)
+        {
+            rv = 1;
+        }
         self->order_level--;
         if ((self->order_level == 0) && (self->order_count > 0))
         {
@@ -190,6 +201,11 @@ xrdp_orders_force_send(struct xrdp_orders *self)
     {
         return 1;
     }
+    if ((self->order_level > 0) &&
+            (xrdp_orders_flush_fills(self, NULL, NULL) != 0))
+    {
+        return 1;
+    }
     if ((self->order_level > 0) && (self->order_count > 0))
     {
         s_mark_end(self->out_s);
@@ -499,9 +515,9 @@ xrdp_order_pack_small_or_tiny(struct xrdp_orders *self,
 /* returns error */
 /* send a solid rect to client */
 /* max size 23 */
-int
-xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
-                 int color, struct xrdp_rect *rect)
+static int
+xrdp_orders_out_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
+                     int color, struct xrdp_rect *rect)
 {
     int order_flags;
     int vals[8];
@@ -665,6 +681,280 @@ xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
     return 0;
 }
 
+/*****************************************************************************/
+/* the part of an order inside its clip */
+/* returns boolean, false if nothing is left */
+static int
+xrdp_orders_clip_area(int x, int y, int cx, int cy,
+                      const struct xrdp_rect *clip, struct xrdp_rect *area)
+{
+    area->left = x;
+    area->top = y;
+    area->right = x + cx;
+    area->bottom = y + cy;
+    if (clip != 0)
+    {
+        area->left = MAX(area->left, clip->left);
+        area->top = MAX(area->top, clip->top);
+        area->right = MIN(area->right, clip->right);
+        area->bottom = MIN(area->bottom, clip->bottom);
+    }
+    return (area->left < area->right) && (area->top < area->bottom);
+}
+
+/*****************************************************************************/
+/* returns boolean */
+static int
+xrdp_orders_rect_overlaps(const struct xrdp_rect *a, const struct xrdp_rect *b)
+{
+    return (a->left < b->right) && (b->left < a->right) &&
+           (a->top < b->bottom) && (b->top < a->bottom);
+}
+
+/*****************************************************************************/
+/* returns boolean */
+static int
+xrdp_orders_rect_contains(const struct xrdp_rect *outer,
+                          const struct xrdp_rect *inner)
+{
+    return (inner->left >= outer->left) && (inner->right <= outer->right) &&
+           (inner->top >= outer->top) && (inner->bottom <= outer->bottom);
+}
+
+/*****************************************************************************/
+/* grow a to take in b if together they make a rectangle */
+/* returns boolean */
+static int
+xrdp_orders_rect_merge(struct xrdp_rect *a, const struct xrdp_rect *b)
+{
+    if (xrdp_orders_rect_contains(a, b))
+    {
+        return 1;
+    }
+    if ((a->left == b->left) && (a->right == b->right) &&
+            (a->top <= b->bottom) && (b->top <= a->bottom))
+    {
+        a->top = MIN(a->top, b->top);
+        a->bottom = MAX(a->bottom, b->bottom);
+        return 1;
+    }
+    if ((a->top == b->top) && (a->bottom == b->bottom) &&
+            (a->left <= b->right) && (b->left <= a->right))
+    {
+        a->left = MIN(a->left, b->left);
+        a->right = MAX(a->right, b->right);
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* bytes of fields a fill would take if it was the next order */
+static int
+xrdp_orders_fill_bytes(struct xrdp_orders *self,
+                       const struct xrdp_orders_fill *fill)
+{
+    struct xrdp_orders_state *state;
+    int vals[8];
+    int coord_bytes;
+    int bytes;
+    int index;
+
+    state = &(self->orders_state);
+    vals[0] = fill->rect.left;
+    vals[1] = state->rect_x;
+    vals[2] = fill->rect.top;
+    vals[3] = state->rect_y;
+    vals[4] = fill->rect.right - fill->rect.left;
+    vals[5] = state->rect_cx;
+    vals[6] = fill->rect.bottom - fill->rect.top;
+    vals[7] = state->rect_cy;
+    coord_bytes = xrdp_orders_send_delta(self, vals, 8) ? 1 : 2;
+    bytes = (state->last_order != RDP_ORDER_RECT) ? 1 : 0;
+    for (index = 0; index < 8; index += 2)
+    {
+        if (vals[index] != vals[index + 1])
+        {
+            bytes += coord_bytes;
+        }
+    }
+    for (index = 0; index < 24; index += 8)
+    {
+        if (((fill->color ^ state->rect_color) >> index) & 0xff)
+        {
+            bytes++;
+        }
+    }
+    return bytes;
+}
+
+/*****************************************************************************/
+/* send the solid fills held back, called before any other order that
+   draws. Fills inside cover are dropped, the order coming paints over
+   them, unless it copies from src first. Fills that don't overlap, or are
+   the same colour, can go in any order, so each time the one that takes
+   the fewest bytes after the last is sent */
+/* returns error */
+static int
+xrdp_orders_flush_fills(struct xrdp_orders *self,
+                        const struct xrdp_rect *cover,
+                        const struct xrdp_rect *src)
+{
+    struct xrdp_orders_fill *fills;
+    char done[XRDP_ORDERS_MAX_FILLS];
+    int count;
+    int index;
+    int other;
+    int best;
+    int best_bytes;
+    int bytes;
+
+    count = self->fill_count;
+    if (count == 0)
+    {
+        return 0;
+    }
+    /* xrdp_orders_out_rect() can get back here from xrdp_orders_check() */
+    self->fill_count = 0;
+    fills = self->fills;
+    for (index = 0; index < count; index++)
+    {
+        done[index] = (cover != 0) &&
+                      xrdp_orders_rect_contains(cover, &(fills[index].rect)) &&
+                      ((src == 0) ||
+                       !xrdp_orders_rect_overlaps(src, &(fills[index].rect)));
+    }
+    best_bytes = 0;
+    for (;;)
+    {
+        best = -1;
+        for (index = 0; index < count; index++)
+        {
+            if (done[index])
+            {
+                continue;
+            }
+            /* fills before it that it would paint over go first */
+            for (other = 0; other < index; other++)
+            {
+                if (!done[other] &&
+                        (fills[other].color != fills[index].color) &&
+                        xrdp_orders_rect_overlaps(&(fills[other].rect),
+                                                  &(fills[index].rect)))
+                {
+                    break;
+                }
+            }
+            if (other < index)
+            {
+                continue;
+            }
+            bytes = xrdp_orders_fill_bytes(self, fills + index);
+            if ((best < 0) || (bytes < best_bytes))
+            {
+                best = index;
+                best_bytes = bytes;
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        done[best] = 1;
+        if (xrdp_orders_out_rect(self, fills[best].rect.left,
+                                 fills[best].rect.top,
+                                 fills[best].rect.right - fills[best].rect.left,
+                                 fills[best].rect.bottom - fills[best].rect.top,
+                                 fills[best].color, 0) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* before an order that paints all of x, y, cx, cy inside rect, reading
+   nothing from the screen */
+static int
+xrdp_orders_flush_fills_opaque(struct xrdp_orders *self, int x, int y,
+                               int cx, int cy, struct xrdp_rect *rect)
+{
+    struct xrdp_rect cover;
+
+    if (!xrdp_orders_clip_area(x, y, cx, cy, rect, &cover))
+    {
+        return xrdp_orders_flush_fills(self, 0, 0);
+    }
+    return xrdp_orders_flush_fills(self, &cover, 0);
+}
+
+/*****************************************************************************/
+/* returns error */
+/* a solid rect is held back until the next order that isn't one, or the
+   orders are sent. Meanwhile a fill painted over by a later one is dropped
+   and a fill next to an earlier one of the same colour makes it bigger */
+int
+xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
+                 int color, struct xrdp_rect *rect)
+{
+    struct xrdp_orders_fill *fill;
+    struct xrdp_rect area;
+    int index;
+    int count;
+
+    if (!xrdp_orders_clip_area(x, y, cx, cy, rect, &area))
+    {
+        return 0;
+    }
+    if (self->order_level < 1)
+    {
+        /* no xrdp_orders_send() to come */
+        return xrdp_orders_out_rect(self, x, y, cx, cy, color, rect);
+    }
+
+    count = 0;
+    for (index = 0; index < self->fill_count; index++)
+    {
+        if (!xrdp_orders_rect_contains(&area, &(self->fills[index].rect)))
+        {
+            self->fills[count++] = self->fills[index];
+        }
+    }
+    self->fill_count = count;
+
+    /* fills after the one it joins must not be painted over out of turn */
+    for (index = self->fill_count - 1; index >= 0; index--)
+    {
+        fill = self->fills + index;
+        if (fill->color == color)
+        {
+            if (xrdp_orders_rect_merge(&(fill->rect), &area))
+            {
+                return 0;
+            }
+        }
+        else if (xrdp_orders_rect_overlaps(&(fill->rect), &area))
+        {
+            break;
+        }
+    }
+
+    if (self->fill_count >= XRDP_ORDERS_MAX_FILLS)
+    {
+        if (xrdp_orders_flush_fills(self, 0, 0) != 0)
+        {
+            return 1;
+        }
+    }
+    fill = self->fills + self->fill_count;
+    fill->rect = area;
+    fill->color = color;
+    self->fill_count++;
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns error */
 /* send a screen blt order */
@@ -679,7 +969,33 @@ xrdp_orders_screen_blt(struct xrdp_orders *self, int x, int y,
     int present = 0;
     char *present_ptr = (char *)NULL;
     char *order_flags_ptr = (char *)NULL;
+    struct xrdp_rect cover;
+    struct xrdp_rect src;
+    int rv;
 
+    if (rop == 0xcc)
+    {
+        src.left = srcx;
+        src.top = srcy;
+        src.right = srcx + cx;
+        src.bottom = srcy + cy;
+        if (xrdp_orders_clip_area(x, y, cx, cy, rect, &cover))
+        {
+            rv = xrdp_orders_flush_fills(self, &cover, &src);
+        }
+        else
+        {
+            rv = xrdp_orders_flush_fills(self, 0, 0);
+        }
+    }
+    else
+    {
+        rv = xrdp_orders_flush_fills(self, 0, 0);
+    }
+    if (rv != 0)
+    {
+        return 1;
+    }
     if (xrdp_orders_check(self, 25) != 0)
     {
         return 1;
@@ -871,7 +1187,20 @@ xrdp_orders_pat_blt(struct xrdp_orders *self, int x, int y,
     char *present_ptr;
     char *order_flags_ptr;
     struct xrdp_brush blank_brush;
+    int rv;
 
+    if ((rop == 0xf0) && ((brush == 0) || (brush->style == 0)))
+    {
+        rv = xrdp_orders_flush_fills_opaque(self, x, y, cx, cy, rect);
+    }
+    else
+    {
+        rv = xrdp_orders_flush_fills(self, 0, 0);
+    }
+    if (rv != 0)
+    {
+        return 1;
+    }
     if (xrdp_orders_check(self, 39) != 0)
     {
         return 1;
@@ -1088,7 +1417,20 @@ xrdp_orders_dest_blt(struct xrdp_orders *self, int x, int y,
     int present;
     char *present_ptr;
     char *order_flags_ptr;
+    int rv;
 
+    if ((rop == 0x00) || (rop == 0xff))
+    {
+        rv = xrdp_orders_flush_fills_opaque(self, x, y, cx, cy, rect);
+    }
+    else
+    {
+        rv = xrdp_orders_flush_fills(self, 0, 0);
+    }
+    if (rv != 0)
+    {
+        return 1;
+    }
     if (xrdp_orders_check(self, 21) != 0)
     {
         return 1;
@@ -1260,6 +1602,10 @@ xrdp_orders_line(struct xrdp_orders *self, int mix_mode,
         rop = 0x0d; /* R2_COPYPEN */
     }
 
+    if (xrdp_orders_flush_fills(self, 0, 0) != 0)
+    {
+        return 1;
+    }
     if (xrdp_orders_check(self, 32) != 0)
     {
         return 1;
@@ -1461,7 +1807,21 @@ xrdp_orders_mem_blt(struct xrdp_orders *self, int cache_id,
     int present = 0;
     char *present_ptr = (char *)NULL;
     char *order_flags_ptr = (char *)NULL;
+    int rv;
 
+    /* 255 is an off screen surface, which may be the one drawn to */
+    if ((rop == 0xcc) && (cache_id != 255))
+    {
+        rv = xrdp_orders_flush_fills_opaque(self, x, y, cx, cy, rect);
+    }
+    else
+    {
+        rv = xrdp_orders_flush_fills(self, 0, 0);
+    }
+    if (rv != 0)
+    {
+        return 1;
+    }
     if (xrdp_orders_check(self, 30) != 0)
     {
         return 1;
@@ -1672,6 +2032,10 @@ xrdp_orders_composite_blt(struct xrdp_orders *self, int srcidx, int srcformat,
     char *present_ptr;
     char *order_flags_ptr;
 
+    if (xrdp_orders_flush_fills(self, 0, 0) != 0)
+    {
+        return 1;
+    }
     if (xrdp_orders_check(self, 80) != 0)
     {
         return 1;
@@ -2001,6 +2365,10 @@ xrdp_orders_text(struct xrdp_orders *self,
     char *present_ptr = (char *)NULL;
     char *order_flags_ptr = (char *)NULL;
 
+    if (xrdp_orders_flush_fills(self, 0, 0) != 0)
+    {
+        return 1;
+    }
     if (xrdp_orders_check(self, 44 + data_len) != 0)
     {
         return 1;
@@ -2190,6 +2558,10 @@ xrdp_orders_send_palette(struct xrdp_orders *self, int *palette,
     int len;
     int i;
 
+    if (xrdp_orders_flush_fills(self, 0, 0) != 0)
+    {
+        return 1;
+    }
     if (xrdp_orders_check(self, 2000) != 0)
     {
         LOG(LOG_LEVEL_ERROR, "xrdp_orders_send_palette: xrdp_orders_check failed");
@@ -2657,7 +3029,7 @@ xrdp_orders_send_font(struct xrdp_orders *self,
 int
 xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
                              int width, int height, int bpp, char *data,
-                             int cache_id, int cache_idx)
+                             int cache_id, int cache_idx, tui64 key)
 {
     int order_flags = 0;
     int len = 0;
@@ -2667,6 +3039,7 @@ xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
     int j = 0;
     int pixel = 0;
     int e = 0;
+    int key_size;
     int max_order_size;
     struct xrdp_client_info *ci;
 
@@ -2694,23 +3067,36 @@ xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
 
     Bpp = (bpp + 7) / 8;
     bufsize = (width + e) * height * Bpp;
-    while (bufsize + 14 > max_order_size)
+    key_size = (key != 0) ? 8 : 0;
+    while (bufsize + key_size + 14 > max_order_size)
     {
         height--;
         bufsize = (width + e) * height * Bpp;
+        /* the client would keep only part of the bitmap under the key */
+        key = 0;
+        key_size = 0;
     }
-    if (xrdp_orders_check(self, bufsize + 14) != 0)
+    if (xrdp_orders_check(self, bufsize + key_size + 14) != 0)
     {
         return 1;
     }
     self->order_count++;
     order_flags = TS_STANDARD | TS_SECONDARY;
     out_uint8(self->out_s, order_flags);
-    len = (bufsize + 6) - 7; /* length after type minus 7 */
+    len = (bufsize + key_size + 6) - 7; /* length after type minus 7 */
     out_uint16_le(self->out_s, len);
     i = (((Bpp + 2) << 3) & 0x38) | (cache_id & 7);
+    if (key != 0)
+    {
+        i = i | (CBR2_PERSISTENT_KEY_PRESENT << 7);
+    }
     out_uint16_le(self->out_s, i); /* flags */
     out_uint8(self->out_s, TS_CACHE_BITMAP_UNCOMPRESSED_REV2); /* type */
+    if (key != 0)
+    {
+        out_uint32_le(self->out_s, (tui32) key); /* key1 */
+        out_uint32_le(self->out_s, (tui32) (key >> 32)); /* key2 */
+    }
     out_uint8(self->out_s, width + e);
     out_uint8(self->out_s, height);
     out_uint16_be(self->out_s, bufsize | 0x4000);
@@ -2783,7 +3169,7 @@ xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
 int
 xrdp_orders_send_bitmap2(struct xrdp_orders *self,
                          int width, int height, int bpp, char *data,
-                         int cache_id, int cache_idx, int hints)
+                         int cache_id, int cache_idx, int hints, tui64 key)
 {
     int order_flags = 0;
     int len = 0;
@@ -2792,6 +3178,7 @@ xrdp_orders_send_bitmap2(struct xrdp_orders *self,
     int i = 0;
     int lines_sending = 0;
     int e = 0;
+    int key_size;
     struct stream *s = NULL;
     struct stream *temp_s = NULL;
     char *p = NULL;
@@ -2842,23 +3229,35 @@ xrdp_orders_send_bitmap2(struct xrdp_orders *self,
     if (lines_sending != height)
     {
         height = lines_sending;
+        /* the client would keep only part of the bitmap under the key */
+        key = 0;
     }
 
     bufsize = (int)(s->p - p);
     Bpp = (bpp + 7) / 8;
-    if (xrdp_orders_check(self, bufsize + 14) != 0)
+    key_size = (key != 0) ? 8 : 0;
+    if (xrdp_orders_check(self, bufsize + key_size + 14) != 0)
     {
         return 1;
     }
     self->order_count++;
     order_flags = TS_STANDARD | TS_SECONDARY;
     out_uint8(self->out_s, order_flags);
-    len = (bufsize + 6) - 7; /* length after type minus 7 */
+    len = (bufsize + key_size + 6) - 7; /* length after type minus 7 */
     out_uint16_le(self->out_s, len);
     i = (((Bpp + 2) << 3) & 0x38) | (cache_id & 7);
-    i = i | (0x08 << 7); /* CBR2_NO_BITMAP_COMPRESSION_HDR */
+    i = i | (CBR2_NO_BITMAP_COMPRESSION_HDR << 7);
+    if (key != 0)
+    {
+        i = i | (CBR2_PERSISTENT_KEY_PRESENT << 7);
+    }
     out_uint16_le(self->out_s, i); /* flags */
     out_uint8(self->out_s, TS_CACHE_BITMAP_COMPRESSED_REV2); /* type */
+    if (key != 0)
+    {
+        out_uint32_le(self->out_s, (tui32) key); /* key1 */
+        out_uint32_le(self->out_s, (tui32) (key >> 32)); /* key2 */
+    }
     out_uint8(self->out_s, width + e);
     out_uint8(self->out_s, height);
     out_uint16_be(self->out_s, bufsize | 0x4000);
@@ -3129,6 +3528,10 @@ xrdp_orders_send_create_os_surface(struct xrdp_orders *self, int id,
         bytes += num_del_list * 2;
     }
 
+    if (xrdp_orders_flush_fills(self, 0, 0) != 0)
+    {
+        return 1;
+    }
     if (xrdp_orders_check(self, bytes) != 0)
     {
         return 1;
@@ -3173,6 +3576,10 @@ xrdp_orders_send_switch_os_surface(struct xrdp_orders *self, int id)
     int order_flags;
     int cache_id;
 
+    if (xrdp_orders_flush_fills(self, 0, 0) != 0)
+    {
+        return 1;
+    }
     if (xrdp_orders_check(self, 3) != 0)
     {
         return 1;
@@ -53,6 +53,8 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
     client_info->xrdp_keyboard_overrides.type = -1;
     client_info->xrdp_keyboard_overrides.subtype = -1;
     client_info->xrdp_keyboard_overrides.layout = -1;
+    client_info->tls_session_tickets = 1;
+    client_info->use_bulk_comp_rdp61 = 1;
 
     /* initialize (zero out) local variables: */
     items = list_create();
@@ -76,10 +78,26 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
         {
             client_info->use_bitmap_comp = g_text2bool(value);
         }
+        else if (g_strcasecmp(item, "bitmap_compression_threads") == 0)
+        {
+            client_info->bitmap_comp_threads = g_atoi(value);
+        }
         else if (g_strcasecmp(item, "bulk_compression") == 0)
         {
             client_info->use_bulk_comp = g_text2bool(value);
         }
+        else if (g_strcasecmp(item, "bulk_compression_rdp61") == 0)
+        {
+            client_info->use_bulk_comp_rdp61 = g_text2bool(value);
+        }
+        else if (g_strcasecmp(item, "jpeg_compression_threads") == 0)
+        {
+            client_info->jpeg_comp_threads = g_atoi(value);
+        }
+        else if (g_strcasecmp(item, "glyph_fragment_cache") == 0)
+        {
+            client_info->use_glyph_frag_cache = g_text2bool(value);
+        }
         else if (g_strcasecmp(item, "crypt_level") == 0)
         {
             if (g_strcasecmp(value, "none") == 0)
@@ -189,6 +207,22 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
         {
             client_info->tls_ciphers = g_strdup(value);
         }
+        else if (g_strcasecmp(item, "tls_ktls") == 0)
+        {
+            client_info->tls_ktls = g_text2bool(value);
+        }
+        else if (g_strcasecmp(item, "tls_session_tickets") == 0)
+        {
+            client_info->tls_session_tickets = g_text2bool(value);
+        }
+        else if (g_strcasecmp(item, "tls_handshake_timeout") == 0)
+        {
+            client_info->tls_handshake_timeout = g_atoi(value);
+        }
+        else if (g_strcasecmp(item, "session_max_mbps") == 0)
+        {
+            client_info->session_max_mbps = g_atoi(value);
+        }
         else if (g_strcasecmp(item, "security_layer") == 0)
         {
             if (g_strcasecmp(value, "rdp") == 0)
@@ -355,6 +389,19 @@ xrdp_rdp_detect_cpu(void)
 }
 #endif
 
+/*****************************************************************************/
+void
+xrdp_rdp_load_client_address(struct xrdp_rdp *self, struct trans *trans)
+{
+    g_sck_get_peer_ip_address(trans->sck,
+                              self->client_info.client_ip,
+                              sizeof(self->client_info.client_ip),
+                              NULL);
+    g_sck_get_peer_description(trans->sck,
+                               self->client_info.client_description,
+                               sizeof(self->client_info.client_description));
+}
+
 /*****************************************************************************/
 struct xrdp_rdp *
 xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
@@ -376,14 +423,11 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
     self->client_info.cache2_size = 1024;
     self->client_info.cache3_entries = 262;
     self->client_info.cache3_size = 4096;
-    /* load client ip info */
-    g_sck_get_peer_ip_address(trans->sck,
-                              self->client_info.client_ip,
-                              sizeof(self->client_info.client_ip),
-                              NULL);
-    g_sck_get_peer_description(trans->sck,
-                               self->client_info.client_description,
-                               sizeof(self->client_info.client_description));
+    /* load client ip info, later if the connection isn't here yet */
+    if (trans->sck >= 0)
+    {
+        xrdp_rdp_load_client_address(self, trans);
+    }
     self->mppc_enc = mppc_enc_new(PROTO_RDP_50);
 #if defined(XRDP_NEUTRINORDP)
     self->rfx_enc = rfx_context_new();
@@ -395,15 +439,50 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
     return self;
 }
 
+/*****************************************************************************/
+/* what bulk compression did for each kind of PDU over the connection */
+static void
+xrdp_rdp_log_bulk_stats(struct xrdp_rdp *self)
+{
+    struct xrdp_bulk_stats *stats;
+    int index;
+
+    for (index = 0; index < XRDP_BULK_STATS_COUNT; index++)
+    {
+        stats = self->bulk_stats + index;
+        if (stats->packets + stats->skipped == 0)
+        {
+            continue;
+        }
+        LOG(LOG_LEVEL_DEBUG, "Bulk compression of %s 0x%2.2x: %d PDUs, "
+            "%d skipped as incompressible, %llu bytes in, %llu bytes out, "
+            "%llu us",
+            index < XRDP_BULK_STATS_FASTPATH ? "pduType2" : "updateCode",
+            index % XRDP_BULK_STATS_FASTPATH,
+            stats->packets + stats->skipped, stats->skipped,
+            (unsigned long long) stats->bytes_in,
+            (unsigned long long) stats->bytes_out,
+            (unsigned long long) stats->usecs);
+    }
+}
+
 /*****************************************************************************/
 void
 xrdp_rdp_delete(struct xrdp_rdp *self)
 {
+    int index;
+
     if (self == 0)
     {
         return;
     }
 
+    xrdp_rdp_log_bulk_stats(self);
+    for (index = 0; index < XRDP_MAX_BITMAP_CACHE_ID; index++)
+    {
+        g_free(self->persist_keys[index]);
+    }
+    xrdp_workers_delete(self->bitmap_workers);
     xrdp_sec_delete(self->sec_layer);
     mppc_enc_free(self->mppc_enc);
 #if defined(XRDP_NEUTRINORDP)
@@ -584,6 +663,33 @@ xrdp_rdp_send(struct xrdp_rdp *self, struct stream *s, int pdu_type)
     return 0;
 }
 
+/*****************************************************************************/
+/* compress_rdp(), unless the data looks like it won't shrink, keeping
+   count of what it saves and what it costs in stats */
+static int
+xrdp_rdp_compress(struct xrdp_rdp *self, tui8 *data, int len,
+                  struct xrdp_bulk_stats *stats)
+{
+    struct xrdp_mppc_enc *mppc_enc;
+    tui64 start;
+    int rv;
+
+    mppc_enc = self->mppc_enc;
+    stats->bytes_in += len;
+    if (!mppc_enc_worth_trying(mppc_enc, data, len))
+    {
+        stats->skipped++;
+        stats->bytes_out += len;
+        return 0;
+    }
+    start = g_time4();
+    rv = compress_rdp(mppc_enc, data, len);
+    stats->usecs += g_time4() - start;
+    stats->packets++;
+    stats->bytes_out += rv ? mppc_enc->bytes_in_opb : len;
+    return rv;
+}
+
 /*****************************************************************************/
 /* Send a [MS-RDPBCGR] Data PDU for the given pduType2 from
  * the specified source with the headers
@@ -620,7 +726,9 @@ xrdp_rdp_send_data_from_channel(struct xrdp_rdp *self, struct stream *s,
             self->session->up_and_running)
     {
         mppc_enc = self->mppc_enc;
-        if (compress_rdp(mppc_enc, (tui8 *)(s->p + 18), tocomplen))
+        if (xrdp_rdp_compress(self, (tui8 *)(s->p + 18), tocomplen,
+                              self->bulk_stats +
+                              (data_pdu_type % XRDP_BULK_STATS_FASTPATH)))
         {
             clen = mppc_enc->bytes_in_opb + 18;
             pdulen = clen;
@@ -647,7 +755,7 @@ xrdp_rdp_send_data_from_channel(struct xrdp_rdp *self, struct stream *s,
         {
             LOG_DEVEL(LOG_LEVEL_TRACE,
                       "xrdp_rdp_send_data_from_channel: "
-                      "compress_rdp failed, sending "
+                      "data not compressed, sending "
                       "uncompressed data. type %d, flags %d",
                       mppc_enc->protocol_type, mppc_enc->flags);
         }
@@ -807,8 +915,10 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
         {
             to_comp_len = no_comp_len - header_bytes;
             mppc_enc = self->mppc_enc;
-            if (compress_rdp(mppc_enc, (tui8 *)(frag_s.p + header_bytes),
-                             to_comp_len))
+            if (xrdp_rdp_compress(self, (tui8 *)(frag_s.p + header_bytes),
+                                  to_comp_len,
+                                  self->bulk_stats + XRDP_BULK_STATS_FASTPATH +
+                                  (updateCode & 15)))
             {
                 comp_len = mppc_enc->bytes_in_opb + header_bytes;
                 send_len = comp_len;
@@ -827,7 +937,7 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
             else
             {
                 LOG(LOG_LEVEL_DEBUG,
-                    "compress_rdp failed, sending uncompressed data. "
+                    "data not compressed, sending uncompressed data. "
                     "type %d, flags %d", mppc_enc->protocol_type,
                     mppc_enc->flags);
             }
@@ -941,6 +1051,11 @@ xrdp_rdp_incoming(struct xrdp_rdp *self)
         LOG(LOG_LEVEL_ERROR, "xrdp_rdp_incoming: xrdp_sec_incoming failed");
         return 1;
     }
+    if (trans_tls_accept_pending(iso->trans))
+    {
+        /* called again once the TLS handshake is over */
+        return 0;
+    }
     self->mcs_channel = self->sec_layer->mcs_layer->userid +
                         MCS_USERCHANNEL_BASE;
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_rdp->mcs_channel %d", self->mcs_channel);
@@ -1510,6 +1625,106 @@ xrdp_rdp_process_suppress(struct xrdp_rdp *self, struct stream *s)
     return rv;
 }
 
+/*****************************************************************************/
+/* Process a [MS-RDPBCGR] TS_BITMAPCACHE_PERSISTENT_LIST_PDU message. The
+   keys come in cache order, and the client puts the bitmaps for each
+   cache at index 0 upwards, so the key's position is its cache index */
+int
+xrdp_rdp_process_persistent_list(struct xrdp_rdp *self, struct stream *s)
+{
+    int num_entries[5];
+    int total_entries[5];
+    int cache_entries[XRDP_MAX_BITMAP_CACHE_ID];
+    int bit_mask;
+    int cache_id;
+    int index;
+    int count;
+    int total;
+    tui32 key1;
+    tui32 key2;
+
+    if (!s_check_rem_and_log(s, 24, "Parsing [MS-RDPBCGR] "
+                             "TS_BITMAPCACHE_PERSISTENT_LIST_PDU"))
+    {
+        return 1;
+    }
+    count = 0;
+    for (cache_id = 0; cache_id < 5; cache_id++)
+    {
+        in_uint16_le(s, num_entries[cache_id]);
+        count += num_entries[cache_id];
+    }
+    for (cache_id = 0; cache_id < 5; cache_id++)
+    {
+        in_uint16_le(s, total_entries[cache_id]);
+    }
+    in_uint8(s, bit_mask);
+    in_uint8s(s, 3); /* pad2, pad3 */
+    LOG_DEVEL(LOG_LEVEL_TRACE, "Received [MS-RDPBCGR] "
+              "TS_BITMAPCACHE_PERSISTENT_LIST_PDU numEntriesCache0-4 "
+              "%d %d %d %d %d, totalEntriesCache0-4 %d %d %d %d %d, "
+              "bBitMask 0x%2.2x", num_entries[0], num_entries[1],
+              num_entries[2], num_entries[3], num_entries[4],
+              total_entries[0], total_entries[1], total_entries[2],
+              total_entries[3], total_entries[4], bit_mask);
+    if (!s_check_rem_and_log(s, count * 8, "Parsing [MS-RDPBCGR] "
+                             "TS_BITMAPCACHE_PERSISTENT_LIST_ENTRY"))
+    {
+        return 1;
+    }
+
+    if (bit_mask & PERSIST_FIRST_PDU)
+    {
+        cache_entries[0] = self->client_info.cache1_entries;
+        cache_entries[1] = self->client_info.cache2_entries;
+        cache_entries[2] = self->client_info.cache3_entries;
+        for (cache_id = 0; cache_id < XRDP_MAX_BITMAP_CACHE_ID; cache_id++)
+        {
+            g_free(self->persist_keys[cache_id]);
+            self->persist_keys[cache_id] = NULL;
+            self->persist_key_count[cache_id] = 0;
+            self->persist_key_total[cache_id] = 0;
+            total = MIN(total_entries[cache_id], cache_entries[cache_id]);
+            if ((self->client_info.bitmap_cache_persist_mask &
+                    (1 << cache_id)) && (total > 0))
+            {
+                self->persist_keys[cache_id] = g_new(tui64, total);
+                if (self->persist_keys[cache_id] != NULL)
+                {
+                    self->persist_key_total[cache_id] = total;
+                }
+            }
+        }
+    }
+
+    /* anything for caches we don't have, or past the totals given in the
+       first PDU, is skipped */
+    for (cache_id = 0; cache_id < 5; cache_id++)
+    {
+        for (index = 0; index < num_entries[cache_id]; index++)
+        {
+            in_uint32_le(s, key1);
+            in_uint32_le(s, key2);
+            if ((cache_id < XRDP_MAX_BITMAP_CACHE_ID) &&
+                    (self->persist_key_count[cache_id] <
+                     self->persist_key_total[cache_id]))
+            {
+                count = self->persist_key_count[cache_id]++;
+                self->persist_keys[cache_id][count] =
+                    ((tui64) key2 << 32) | key1;
+            }
+        }
+    }
+
+    if (bit_mask & PERSIST_LAST_PDU)
+    {
+        LOG(LOG_LEVEL_INFO, "Client has %d, %d and %d bitmaps in its "
+            "persistent bitmap caches", self->persist_key_count[0],
+            self->persist_key_count[1], self->persist_key_count[2]);
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /* Process a [MS-RDPBCGR] TS_SHAREDATAHEADER message based on it's pduType2 */
 int
@@ -1580,6 +1795,9 @@ xrdp_rdp_process_data(struct xrdp_rdp *self, struct stream *s)
         case RDP_DATA_PDU_FONT2: /* 39(0x27) */
             xrdp_rdp_process_data_font(self, s);
             break;
+        case PDUTYPE2_BITMAPCACHE_PERSISTENT_LIST: /* 43(0x2b) */
+            xrdp_rdp_process_persistent_list(self, s);
+            break;
         case 56: /* PDUTYPE2_FRAME_ACKNOWLEDGE 0x38 */
             xrdp_rdp_process_frame_ack(self, s);
             break;
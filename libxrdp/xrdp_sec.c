@@ -894,13 +894,24 @@ xrdp_sec_process_logon_info(struct xrdp_sec *self, struct stream *s)
 
     if (flags & RDP_COMPRESSION)
     {
+        int compression_type = (flags & RDP_COMPRESSION_TYPE_MASK) >> 9;
         LOG_DEVEL(LOG_LEVEL_DEBUG, "[MS-RDPBCGR] TS_INFO_PACKET flag INFO_COMPRESSION found, "
-                  "CompressionType 0x%1.1x", (flags & 0x00001E00) >> 9);
-        /* TODO: check the client's supported compression type vs the server
-           compression used */
+                  "CompressionType 0x%1.1x", compression_type);
         if (self->rdp_layer->client_info.use_bulk_comp)
         {
-
+            /* the client can do every type up to the one it names, nothing
+               has been compressed yet so the encoder can still change */
+            if (compression_type >= PACKET_COMPR_TYPE_RDP61 &&
+                    self->rdp_layer->client_info.use_bulk_comp_rdp61)
+            {
+                struct xrdp_mppc_enc *enc = mppc_enc_new(PROTO_RDP_61);
+                if (enc != NULL)
+                {
+                    mppc_enc_free(self->rdp_layer->mppc_enc);
+                    self->rdp_layer->mppc_enc = enc;
+                    LOG(LOG_LEVEL_DEBUG, "Using RDP 6.1 bulk compression");
+                }
+            }
             self->rdp_layer->client_info.rdp_compression = 1;
             LOG(LOG_LEVEL_DEBUG, "Client requested compression enabled.");
         }
@@ -2882,8 +2893,10 @@ xrdp_sec_init_rdp_security(struct xrdp_sec *self)
 }
 
 /*****************************************************************************/
-int
-xrdp_sec_incoming(struct xrdp_sec *self)
+/* negotiate and set up the security layer, a TLS handshake is only
+   started here */
+static int
+xrdp_sec_incoming_security(struct xrdp_sec *self)
 {
     struct list *items = NULL;
     struct list *values = NULL;
@@ -2892,6 +2905,7 @@ xrdp_sec_incoming(struct xrdp_sec *self)
     char *item = NULL;
     char *value = NULL;
     char key_file[256];
+    int handshake_ms;
 
     iso = self->mcs_layer->iso_layer;
 
@@ -2906,14 +2920,20 @@ xrdp_sec_incoming(struct xrdp_sec *self)
     if (iso->selectedProtocol > PROTOCOL_RDP)
     {
         /* init tls security */
-
-        if (trans_set_tls_mode(self->mcs_layer->iso_layer->trans,
-                               self->rdp_layer->client_info.key_file,
-                               self->rdp_layer->client_info.certificate,
-                               self->rdp_layer->client_info.ssl_protocols,
-                               self->rdp_layer->client_info.tls_ciphers) != 0)
+        handshake_ms =
+            self->rdp_layer->client_info.tls_handshake_timeout * 1000;
+
+        if (trans_tls_accept_start(iso->trans,
+                                   self->rdp_layer->client_info.key_file,
+                                   self->rdp_layer->client_info.certificate,
+                                   self->rdp_layer->client_info.ssl_protocols,
+                                   self->rdp_layer->client_info.tls_ciphers,
+                                   self->rdp_layer->client_info.tls_ktls,
+                                   self->rdp_layer->client_info.tls_session_tickets,
+                                   handshake_ms) != 0)
         {
-            LOG(LOG_LEVEL_ERROR, "xrdp_sec_incoming: trans_set_tls_mode failed");
+            LOG(LOG_LEVEL_ERROR, "xrdp_sec_incoming: trans_tls_accept_start "
+                "failed");
             return 1;
         }
 
@@ -2995,6 +3015,29 @@ xrdp_sec_incoming(struct xrdp_sec *self)
         }
     }
 
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_sec_incoming(struct xrdp_sec *self)
+{
+    struct trans *trans;
+
+    trans = self->mcs_layer->iso_layer->trans;
+    if (trans->tls == NULL)
+    {
+        if (xrdp_sec_incoming_security(self) != 0)
+        {
+            return 1;
+        }
+        if (trans_tls_accept_pending(trans))
+        {
+            /* the caller waits for the handshake, then calls again */
+            return 0;
+        }
+    }
+
     /* negotiate mcs layer */
     if (xrdp_mcs_incoming(self->mcs_layer) != 0)
     {
@@ -0,0 +1,147 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Small pool of threads for splitting up encoding work
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * The calling thread hands out job indexes along with the pool, and
+ * xrdp_workers_run() only returns once every job is done, so the caller
+ * owns all the results in the order it asked for them.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+#include "thread_calls.h"
+
+/*****************************************************************************/
+/* take job indexes until there are none left */
+static void
+xrdp_workers_do_jobs(struct xrdp_workers *self)
+{
+    int index;
+
+    for (;;)
+    {
+        tc_mutex_lock(self->lock);
+        index = self->next_job;
+        self->next_job++;
+        tc_mutex_unlock(self->lock);
+        if (index >= self->job_count)
+        {
+            break;
+        }
+        self->job(self->job_arg, index);
+    }
+}
+
+/*****************************************************************************/
+static THREAD_RV THREAD_CC
+xrdp_workers_thread(void *in_val)
+{
+    struct xrdp_workers *self;
+
+    self = (struct xrdp_workers *) in_val;
+    for (;;)
+    {
+        tc_sem_dec(self->start_sem);
+        if (self->quit)
+        {
+            tc_sem_inc(self->done_sem);
+            break;
+        }
+        xrdp_workers_do_jobs(self);
+        tc_sem_inc(self->done_sem);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+struct xrdp_workers *
+xrdp_workers_create(int num_threads)
+{
+    struct xrdp_workers *self;
+    int index;
+
+    self = g_new0(struct xrdp_workers, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->lock = tc_mutex_create();
+    self->start_sem = tc_sem_create(0);
+    self->done_sem = tc_sem_create(0);
+    for (index = 0; index < num_threads; index++)
+    {
+        if (tc_thread_create(xrdp_workers_thread, self) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "xrdp_workers_create: only started %d "
+                "of %d threads", index, num_threads);
+            break;
+        }
+        self->num_threads++;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_workers_delete(struct xrdp_workers *self)
+{
+    int index;
+
+    if (self == NULL)
+    {
+        return;
+    }
+    self->quit = 1;
+    for (index = 0; index < self->num_threads; index++)
+    {
+        tc_sem_inc(self->start_sem);
+    }
+    for (index = 0; index < self->num_threads; index++)
+    {
+        tc_sem_dec(self->done_sem);
+    }
+    tc_sem_delete(self->start_sem);
+    tc_sem_delete(self->done_sem);
+    tc_mutex_delete(self->lock);
+    g_free(self);
+}
+
+/*****************************************************************************/
+void
+xrdp_workers_run(struct xrdp_workers *self, int job_count,
+                 void (*job)(void *arg, int index), void *arg)
+{
+    int index;
+
+    self->job = job;
+    self->job_arg = arg;
+    self->job_count = job_count;
+    self->next_job = 0;
+    for (index = 0; index < self->num_threads; index++)
+    {
+        tc_sem_inc(self->start_sem);
+    }
+    xrdp_workers_do_jobs(self);
+    for (index = 0; index < self->num_threads; index++)
+    {
+        tc_sem_dec(self->done_sem);
+    }
+}
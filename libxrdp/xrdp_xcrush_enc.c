@@ -0,0 +1,346 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * RDP 6.1 bulk compression (XCRUSH), [MS-RDPEGDI] 3.1.8.2
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Level 1 finds runs of data seen before anywhere in a 2,000,000 byte
+ * history. The data is cut into chunks where a rolling hash of the last
+ * 32 bytes hits a pattern, so the same content gives the same chunks
+ * wherever it lies, and chunks are looked up whole. Level 2 is MPPC-64K
+ * over what level 1 leaves.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+#include "ms-rdpegdi.h"
+
+#define XCRUSH_HISTORY_LEN 2000000 /* [MS-RDPEGDI] 3.1.8.2.1 */
+
+/* chunking, a boundary goes where the rolling hash has these bits clear */
+#define XCRUSH_CHUNK_MASK 0x7f
+#define XCRUSH_CHUNK_MIN 32  /* longer than the rolling hash looks back */
+#define XCRUSH_CHUNK_MAX 1024
+
+#define XCRUSH_TABLE_BITS 16
+#define XCRUSH_TABLE_SIZE (1 << XCRUSH_TABLE_BITS)
+
+/* a match costs 8 bytes of RDP61_MATCH_DETAILS, so anything shorter
+   is better left to level 2 */
+#define XCRUSH_MIN_MATCH 16
+#define XCRUSH_MAX_MATCH 65535
+
+/* level 2 doesn't get going on anything shorter */
+#define XCRUSH_MIN_INNER 50
+
+struct xcrush_chunk
+{
+    tui32 offset; /* in history */
+    tui32 sig;
+    int len;
+};
+
+struct xcrush_match
+{
+    int length;
+    int output_offset; /* in the packet */
+    int history_offset;
+};
+
+struct xrdp_xcrush_enc
+{
+    tui8 *history;
+    int history_offset;     /* next free byte in history */
+    int l1_flags_hold;      /* for the next packet that goes out */
+    tui32 gear[256];        /* rolling hash values for each byte */
+    struct xcrush_chunk *chunks;
+    struct xcrush_match *matches;
+    int max_matches;
+    tui8 *l1_buffer;
+    struct xrdp_mppc_enc *inner; /* level 2 */
+};
+
+/*****************************************************************************/
+struct xrdp_xcrush_enc *
+xcrush_enc_new(int max_len)
+{
+    struct xrdp_xcrush_enc *self;
+    tui32 seed;
+    int index;
+
+    self = g_new0(struct xrdp_xcrush_enc, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->history = g_new(tui8, XCRUSH_HISTORY_LEN);
+    self->chunks = g_new0(struct xcrush_chunk, XCRUSH_TABLE_SIZE);
+    self->max_matches = max_len / XCRUSH_MIN_MATCH + 1;
+    self->matches = g_new(struct xcrush_match, self->max_matches);
+    self->l1_buffer = g_new(tui8, max_len);
+    self->inner = mppc_enc_new(PROTO_RDP_50);
+    if (self->history == NULL || self->chunks == NULL ||
+            self->matches == NULL || self->l1_buffer == NULL ||
+            self->inner == NULL)
+    {
+        xcrush_enc_free(self);
+        return NULL;
+    }
+    /* any well mixed values will do, the client never sees them */
+    seed = 0x9e3779b9;
+    for (index = 0; index < 256; index++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        self->gear[index] = seed ^ (seed >> 15);
+    }
+    self->l1_flags_hold = L1_PACKET_AT_FRONT;
+    return self;
+}
+
+/*****************************************************************************/
+void
+xcrush_enc_free(struct xrdp_xcrush_enc *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    g_free(self->history);
+    g_free(self->chunks);
+    g_free(self->matches);
+    g_free(self->l1_buffer);
+    mppc_enc_free(self->inner);
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* look up the chunk at [start, end) of the packet, which is in history at
+   base, and see how far a match with it goes, then remember the chunk,
+   returns the match length or 0 */
+static int
+xcrush_match_chunk(struct xrdp_xcrush_enc *self, int base, int len,
+                   int lit_start, int start, int end, tui32 sig,
+                   struct xcrush_match *match)
+{
+    struct xcrush_chunk *chunk;
+    tui8 *history;
+    int hist;
+    int out;
+    int length;
+    int rv;
+
+    history = self->history;
+    chunk = self->chunks + ((sig * 2654435761U) >> (32 - XCRUSH_TABLE_BITS));
+    rv = 0;
+    /* only whole chunks from before this one, the table is not cleared
+       when the history wraps, so check the data too */
+    if (start >= lit_start && chunk->sig == sig && chunk->len == end - start &&
+            chunk->offset + chunk->len <= (tui32) (base + start) &&
+            g_memcmp(history + chunk->offset, history + base + start,
+                     chunk->len) == 0)
+    {
+        hist = chunk->offset;
+        out = start;
+        length = chunk->len;
+        /* back into what would be literals, the copy must still end
+           before where it goes */
+        while (out > lit_start && hist > 0 && hist + length < base + out &&
+                history[hist - 1] == history[base + out - 1] &&
+                length < XCRUSH_MAX_MATCH)
+        {
+            hist--;
+            out--;
+            length++;
+        }
+        /* and forward, as long as the copy is from before where it goes */
+        while (out + length < len && hist + length < base + out &&
+                history[hist + length] == history[base + out + length] &&
+                length < XCRUSH_MAX_MATCH)
+        {
+            length++;
+        }
+        if (length >= XCRUSH_MIN_MATCH)
+        {
+            match->length = length;
+            match->output_offset = out;
+            match->history_offset = hist;
+            rv = length;
+        }
+    }
+    chunk->offset = base + start;
+    chunk->sig = sig;
+    chunk->len = end - start;
+    return rv;
+}
+
+/*****************************************************************************/
+/* find the matches for the packet at base in history, returns how many */
+static int
+xcrush_find_matches(struct xrdp_xcrush_enc *self, int base, int len)
+{
+    const tui8 *data;
+    tui32 hash;
+    int count;
+    int lit_start;
+    int start;
+    int index;
+
+    data = self->history + base;
+    count = 0;
+    lit_start = 0;
+    start = 0;
+    hash = 0;
+    for (index = 0; index < len; index++)
+    {
+        hash = (hash << 1) + self->gear[data[index]];
+        if (index + 1 - start < XCRUSH_CHUNK_MIN ||
+                ((hash & XCRUSH_CHUNK_MASK) != 0 &&
+                 index + 1 - start < XCRUSH_CHUNK_MAX && index + 1 < len))
+        {
+            continue;
+        }
+        /* chunk boundary, the length goes in so chunks ended early by
+           the maximum or the end of the packet don't collide */
+        if (count < self->max_matches &&
+                xcrush_match_chunk(self, base, len, lit_start, start,
+                                   index + 1, hash ^ (index + 1 - start),
+                                   self->matches + count) > 0)
+        {
+            lit_start = self->matches[count].output_offset +
+                        self->matches[count].length;
+            count++;
+        }
+        start = index + 1;
+        hash = 0;
+    }
+    return count;
+}
+
+/*****************************************************************************/
+/* write RDP61_COMPRESSED_DATA level 1 output, returns its size */
+static int
+xcrush_write_l1(struct xrdp_xcrush_enc *self, int base, int len, int count)
+{
+    struct stream ls;
+    struct xcrush_match *match;
+    int lit_start;
+    int index;
+
+    g_memset(&ls, 0, sizeof(ls));
+    ls.data = (char *) self->l1_buffer;
+    ls.p = ls.data;
+    ls.size = len;
+    out_uint16_le(&ls, count); /* MatchCount */
+    for (index = 0; index < count; index++)
+    {
+        match = self->matches + index;
+        out_uint16_le(&ls, match->length); /* MatchLength */
+        out_uint16_le(&ls, match->output_offset); /* MatchOutputOffset */
+        out_uint32_le(&ls, match->history_offset); /* MatchHistoryOffset */
+    }
+    /* Literals, everything between the matches */
+    lit_start = 0;
+    for (index = 0; index < count; index++)
+    {
+        match = self->matches + index;
+        out_uint8a(&ls, self->history + base + lit_start,
+                   match->output_offset - lit_start);
+        lit_start = match->output_offset + match->length;
+    }
+    out_uint8a(&ls, self->history + base + lit_start, len - lit_start);
+    return (int) (ls.p - ls.data);
+}
+
+/**
+ * encode (compress) data using RDP 6.1 protocol
+ *
+ * Always succeeds once the data is in the level 1 history, as the client
+ * adds it to its own history whatever happens. Output can be 2 bytes
+ * longer than the input.
+ *
+ * @param   enc           encoder state info
+ * @param   srcData       uncompressed data
+ * @param   len           length of srcData
+ *
+ * @return  TRUE on success, FALSE on failure
+ */
+int
+compress_rdp_61(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
+{
+    struct xrdp_xcrush_enc *self;
+    tui8 *l1_data;
+    int l1_len;
+    int l1_flags;
+    int l2_flags;
+    int base;
+    int count;
+
+    self = enc->xcrush;
+    l1_flags = self->l1_flags_hold;
+    if (self->history_offset + len + 8 > XCRUSH_HISTORY_LEN)
+    {
+        /* history cannot hold srcData - rewind it */
+        self->history_offset = 0;
+        l1_flags |= L1_PACKET_AT_FRONT;
+    }
+    base = self->history_offset;
+    g_memcpy(self->history + base, srcData, len);
+    self->history_offset += len;
+    self->l1_flags_hold = 0;
+
+    count = xcrush_find_matches(self, base, len);
+    l1_len = 0;
+    if (count > 0)
+    {
+        l1_len = xcrush_write_l1(self, base, len, count);
+    }
+    if (count > 0 && l1_len < len)
+    {
+        l1_flags |= L1_COMPRESSED;
+        l1_data = self->l1_buffer;
+    }
+    else
+    {
+        l1_flags |= L1_NO_COMPRESSION;
+        l1_data = srcData;
+        l1_len = len;
+    }
+
+    l2_flags = 0;
+    if (l1_len > XCRUSH_MIN_INNER &&
+            mppc_enc_worth_trying(self->inner, l1_data, l1_len) &&
+            compress_rdp(self->inner, l1_data, l1_len))
+    {
+        l2_flags = self->inner->flags;
+        l1_data = (tui8 *) self->inner->outputBuffer;
+        l1_len = self->inner->bytes_in_opb;
+    }
+    l1_flags |= L1_INNER_COMPRESSION;
+
+    enc->outputBuffer[0] = (char) l1_flags; /* Level1ComprFlags */
+    enc->outputBuffer[1] = (char) l2_flags; /* Level2ComprFlags */
+    g_memcpy(enc->outputBuffer + 2, l1_data, l1_len);
+    enc->bytes_in_opb = l1_len + 2;
+    enc->flags = PACKET_COMPRESSED | PACKET_COMPR_TYPE_RDP61;
+    LOG_DEVEL(LOG_LEVEL_TRACE, "compress_rdp_61: len %d, matches %d, "
+              "level 1 flags 0x%2.2x, level 2 flags 0x%2.2x, out %d",
+              len, count, l1_flags, l2_flags, enc->bytes_in_opb);
+    return 1;
+}
@@ -1475,6 +1475,18 @@ api_con_trans_list_remove_all(void)
     return 0;
 }
 
+/*****************************************************************************/
+static int
+channel_thread_term_in(void *arg, tintptr obj, int events)
+{
+    LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: g_term_event set");
+    clipboard_deinit();
+    sound_deinit();
+    devredir_deinit();
+    rail_deinit();
+    return 1;
+}
+
 /*****************************************************************************/
 static THREAD_RV THREAD_CC
 channel_thread_loop(void *in_val)
@@ -1486,6 +1498,7 @@ channel_thread_loop(void *in_val)
     int timeout;
     int error;
     THREAD_RV rv;
+    struct g_reactor *reactor;
 
     LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: thread start");
     rv = 0;
@@ -1493,29 +1506,31 @@ channel_thread_loop(void *in_val)
     setup_api_listen();
     error = setup_listen();
 
+    /* only the term event is there for the life of the thread, the rest
+       come and go */
+    reactor = g_reactor_create();
+    if (reactor == NULL ||
+            g_reactor_add(reactor, g_term_event, G_REACTOR_READ,
+                          channel_thread_term_in, NULL) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "channel_thread_loop: can't set up the event "
+            "loop");
+        error = 1;
+    }
+
     if (error == 0)
     {
         timeout = -1;
         num_objs = 0;
         num_wobjs = 0;
-        objs[num_objs] = g_term_event;
-        num_objs++;
         trans_get_wait_objs(g_lis_trans, objs, &num_objs);
         trans_get_wait_objs(g_api_lis_trans, objs, &num_objs);
 
         //g_writeln("timeout %d", timeout);
-        while (g_obj_wait(objs, num_objs, wobjs, num_wobjs, timeout) == 0)
+        while (g_reactor_wait(reactor, objs, num_objs,
+                              wobjs, num_wobjs, timeout) == 0)
         {
             check_timeout();
-            if (g_is_wait_obj_set(g_term_event))
-            {
-                LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: g_term_event set");
-                clipboard_deinit();
-                sound_deinit();
-                devredir_deinit();
-                rail_deinit();
-                break;
-            }
 
             if (g_lis_trans != 0)
             {
@@ -1565,8 +1580,6 @@ channel_thread_loop(void *in_val)
             timeout = -1;
             num_objs = 0;
             num_wobjs = 0;
-            objs[num_objs] = g_term_event;
-            num_objs++;
             trans_get_wait_objs_rw(g_lis_trans, objs, &num_objs,
                                    wobjs, &num_wobjs, &timeout);
             trans_get_wait_objs_rw(g_con_trans, objs, &num_objs,
@@ -1582,8 +1595,9 @@ channel_thread_loop(void *in_val)
             devredir_get_wait_objs(objs, &num_objs, &timeout);
             xfuse_get_wait_objs(objs, &num_objs, &timeout);
             get_timeout(&timeout);
-        } /* end while (g_obj_wait(objs, num_objs, 0, 0, timeout) == 0) */
+        } /* end while (g_reactor_wait(...) == 0) */
     }
+    g_reactor_delete(reactor);
 
     trans_delete(g_lis_trans);
     g_lis_trans = 0;
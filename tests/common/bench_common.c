@@ -0,0 +1,169 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Benchmarks for libcommon
+ *
+ * Not run by make check, timing depends on the machine, valgrind and the
+ * optimisation level. Run it by hand on a quiet machine.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdlib.h>
+
+#include "log.h"
+#include "os_calls.h"
+#include "ssl_calls.h"
+#include "xxhash.h"
+
+/* 64x64 32 bpp tiles, as the painter caches them */
+#define TILE_WIDTH 64
+#define TILE_HEIGHT 64
+#define TILE_BYTES (TILE_WIDTH * TILE_HEIGHT * 4)
+#define BENCH_TILES 4096
+
+static tui32 g_crc_table[256];
+
+/******************************************************************************/
+static void
+crc_init(void)
+{
+    tui32 crc;
+    int index;
+    int bit;
+
+    for (index = 0; index < 256; index++)
+    {
+        crc = index;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+        g_crc_table[index] = crc;
+    }
+}
+
+/******************************************************************************/
+static tui32
+crc_pass(tui32 crc, int value)
+{
+    return g_crc_table[(crc ^ value) & 0xff] ^ (crc >> 8);
+}
+
+/******************************************************************************/
+/* what xrdp_bitmap_hash_crc() did before XXH64, an MD5 of the pixels
+   then a CRC-32 of the size and the digest */
+static tui32
+md5_crc(const tui8 *data)
+{
+    void *md5;
+    char digest[16];
+    tui32 crc;
+    int index;
+
+    md5 = ssl_md5_info_create();
+    ssl_md5_clear(md5);
+    ssl_md5_transform(md5, (const char *) data, TILE_BYTES);
+    ssl_md5_complete(md5, digest);
+    ssl_md5_info_delete(md5);
+    crc = 0xFFFFFFFF;
+    crc = crc_pass(crc, TILE_WIDTH);
+    crc = crc_pass(crc, TILE_WIDTH >> 8);
+    crc = crc_pass(crc, TILE_HEIGHT);
+    crc = crc_pass(crc, TILE_HEIGHT >> 8);
+    for (index = 0; index < 16; index++)
+    {
+        crc = crc_pass(crc, digest[index]);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+/******************************************************************************/
+/* XXH64 against the MD5 and CRC-32 the bitmap cache used to take */
+static int
+bench_xxh64(void)
+{
+    tui8 *data;
+    tui64 sum;
+    tui64 start;
+    tui64 xxh_us;
+    tui64 md5_us;
+    int index;
+
+    data = g_new(tui8, TILE_BYTES);
+    if (data == NULL)
+    {
+        g_printf("xxh64: out of memory\n");
+        return 1;
+    }
+    for (index = 0; index < TILE_BYTES; index++)
+    {
+        data[index] = (tui8) ((index * 2654435761U) >> 24);
+    }
+    crc_init();
+
+    sum = 0;
+    start = g_time4();
+    for (index = 0; index < BENCH_TILES; index++)
+    {
+        data[0] = index;
+        sum += xxh64(data, TILE_BYTES, 0);
+    }
+    xxh_us = MAX(g_time4() - start, 1);
+
+    start = g_time4();
+    for (index = 0; index < BENCH_TILES; index++)
+    {
+        data[0] = index;
+        sum += md5_crc(data);
+    }
+    md5_us = MAX(g_time4() - start, 1);
+
+    /* the checksum keeps the loops from being optimised away */
+    g_printf("%d %dx%d tiles: xxh64 %llu us (%llu MB/s), "
+             "md5+crc32 %llu us (%llu MB/s), checksum %llx\n", BENCH_TILES,
+             TILE_WIDTH, TILE_HEIGHT, (unsigned long long) xxh_us,
+             (unsigned long long) BENCH_TILES * TILE_BYTES / xxh_us,
+             (unsigned long long) md5_us,
+             (unsigned long long) BENCH_TILES * TILE_BYTES / md5_us,
+             (unsigned long long) sum);
+    g_free(data);
+    return 0;
+}
+
+/******************************************************************************/
+int
+main(void)
+{
+    struct log_config *lc;
+    int rv;
+
+    g_init("bench_common");
+    lc = log_config_init_for_console(LOG_LEVEL_WARNING, NULL);
+    log_start_from_param(lc);
+    log_config_free(lc);
+    ssl_init();
+
+    rv = bench_xxh64();
+
+    ssl_finish();
+    log_end();
+    g_deinit();
+    return (rv == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
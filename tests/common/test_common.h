@@ -17,8 +17,12 @@ Suite *make_suite_test_ssl_calls(void);
 Suite *make_suite_test_base64(void);
 Suite *make_suite_test_guid(void);
 Suite *make_suite_test_scancode(void);
+Suite *make_suite_test_trans(void);
+Suite *make_suite_test_xxhash(void);
 
 TCase *make_tcase_test_os_calls_signals(void);
+TCase *make_tcase_test_os_calls_reactor(void);
+TCase *make_tcase_test_trans_tls(void);
 
 void os_calls_signals_init(void);
 void os_calls_signals_deinit(void);
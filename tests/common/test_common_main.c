@@ -56,6 +56,8 @@ int main (void)
     srunner_add_suite(sr, make_suite_test_base64());
     srunner_add_suite(sr, make_suite_test_guid());
     srunner_add_suite(sr, make_suite_test_scancode());
+    srunner_add_suite(sr, make_suite_test_trans());
+    srunner_add_suite(sr, make_suite_test_xxhash());
 
     srunner_set_tap(sr, "-");
     /*
@@ -7,6 +7,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <poll.h>
+#include <sys/socket.h>
 
 #include "os_calls.h"
 #include "list.h"
@@ -487,6 +488,110 @@ START_TEST(test_g_sck_fd_overflow)
 }
 END_TEST
 
+/******************************************************************************/
+/* as xrdp hands a connection to a pre-forked worker, the socket and the
+   mode and stream sizes of the listener it came from */
+START_TEST(test_g_sck_fd_passing__connection)
+{
+    int ctrl[2];
+    int conn[2];
+    int info[3] = { 1, 16, 8192 };
+    int rinfo[3] = { 0, 0, 0 };
+    char buff[8];
+    unsigned int fdcount;
+    int fd;
+
+    ck_assert_int_eq(g_sck_local_socketpair(ctrl), 0);
+    ck_assert_int_eq(g_sck_local_socketpair(conn), 0);
+
+    ck_assert_int_eq(g_sck_send_fd_set(ctrl[0], info, sizeof(info),
+                                       &conn[0], 1), sizeof(info));
+    // The sender's copy goes, as xrdp_listen_handoff() deletes its trans
+    g_sck_close(conn[0]);
+
+    fd = -1;
+    fdcount = 0;
+    ck_assert_int_eq(g_sck_recv_fd_set(ctrl[1], rinfo, sizeof(rinfo),
+                                       &fd, 1, &fdcount), sizeof(rinfo));
+    g_sck_close(ctrl[0]);
+    g_sck_close(ctrl[1]);
+    ck_assert_int_eq(fdcount, 1);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(rinfo[0], info[0]);
+    ck_assert_int_eq(rinfo[1], info[1]);
+    ck_assert_int_eq(rinfo[2], info[2]);
+
+    // The received fd is the connection, both ways
+    ck_assert_int_eq(g_sck_send(conn[1], "ping", 4, 0), 4);
+    ck_assert_int_eq(g_sck_recv(fd, buff, sizeof(buff), 0), 4);
+    ck_assert_int_eq(g_memcmp(buff, "ping", 4), 0);
+    ck_assert_int_eq(g_sck_send(fd, "pong", 4, 0), 4);
+    ck_assert_int_eq(g_sck_recv(conn[1], buff, sizeof(buff), 0), 4);
+    ck_assert_int_eq(g_memcmp(buff, "pong", 4), 0);
+
+    // and the client sees it close when the worker closes it
+    g_sck_close(fd);
+    ck_assert_int_eq(g_sck_recv(conn[1], buff, sizeof(buff), 0), 0);
+    g_sck_close(conn[1]);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_g_sck_set_reuseport)
+{
+#if defined(SO_REUSEPORT)
+    const char *port = "38931";
+    int sck[3];
+
+    /* only sockets that all ask for it can share the port */
+    sck[0] = g_tcp4_socket();
+    sck[1] = g_tcp4_socket();
+    sck[2] = g_tcp4_socket();
+    ck_assert_int_ge(sck[0], 0);
+    ck_assert_int_ge(sck[1], 0);
+    ck_assert_int_ge(sck[2], 0);
+    ck_assert_int_eq(g_sck_set_reuseport(sck[0]), 0);
+    ck_assert_int_eq(g_sck_set_reuseport(sck[1]), 0);
+    ck_assert_int_eq(g_tcp4_bind_address(sck[0], port, "127.0.0.1"), 0);
+    ck_assert_int_eq(g_sck_listen(sck[0]), 0);
+    ck_assert_int_eq(g_tcp4_bind_address(sck[1], port, "127.0.0.1"), 0);
+    ck_assert_int_eq(g_sck_listen(sck[1]), 0);
+    ck_assert_int_ne(g_tcp4_bind_address(sck[2], port, "127.0.0.1"), 0);
+    g_sck_close(sck[0]);
+    g_sck_close(sck[1]);
+    g_sck_close(sck[2]);
+#endif
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_g_wait_obj)
+{
+    unsigned int base_fd_count = get_open_fd_count();
+    tintptr obj;
+
+    obj = g_create_wait_obj("test");
+    ck_assert_int_ne(obj, 0);
+#if defined(__linux__)
+    /* an eventfd, not a pipe */
+    ck_assert_int_eq(get_open_fd_count(), base_fd_count + 1);
+#endif
+    ck_assert_int_eq(g_is_wait_obj_set(obj), 0);
+    ck_assert_int_eq(g_set_wait_obj(obj), 0);
+    ck_assert_int_eq(g_set_wait_obj(obj), 0);
+    ck_assert_int_ne(g_is_wait_obj_set(obj), 0);
+    ck_assert_int_eq(g_obj_wait(&obj, 1, NULL, 0, 0), 0);
+    /* one reset clears any number of sets */
+    ck_assert_int_eq(g_reset_wait_obj(obj), 0);
+    ck_assert_int_eq(g_is_wait_obj_set(obj), 0);
+    ck_assert_int_eq(g_reset_wait_obj(obj), 0);
+    ck_assert_int_eq(g_is_wait_obj_set(obj), 0);
+
+    ck_assert_int_eq(g_delete_wait_obj(obj), 0);
+    ck_assert_int_eq(get_open_fd_count(), base_fd_count);
+}
+END_TEST
+
 /******************************************************************************/
 Suite *
 make_suite_test_os_calls(void)
@@ -512,9 +617,13 @@ make_suite_test_os_calls(void)
     tcase_add_test(tc_os_calls, test_g_file_is_open);
     tcase_add_test(tc_os_calls, test_g_sck_fd_passing);
     tcase_add_test(tc_os_calls, test_g_sck_fd_overflow);
+    tcase_add_test(tc_os_calls, test_g_sck_fd_passing__connection);
+    tcase_add_test(tc_os_calls, test_g_sck_set_reuseport);
+    tcase_add_test(tc_os_calls, test_g_wait_obj);
 
     // Add other test cases in other files
     suite_add_tcase(s, make_tcase_test_os_calls_signals());
+    suite_add_tcase(s, make_tcase_test_os_calls_reactor());
 
     return s;
 }
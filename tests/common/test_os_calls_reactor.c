@@ -0,0 +1,153 @@
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+
+#include "test_common.h"
+
+/* more than g_obj_wait() can handle */
+#define MANY_OBJS 300
+
+struct counter
+{
+    int calls;
+    int events;
+    int rv;
+};
+
+/******************************************************************************/
+static int
+count_in(void *arg, tintptr obj, int events)
+{
+    struct counter *c = (struct counter *) arg;
+
+    c->calls++;
+    c->events |= events;
+    g_reset_wait_obj(obj);
+    return c->rv;
+}
+
+/******************************************************************************/
+START_TEST(test_g_reactor__callback)
+{
+    struct g_reactor *r;
+    struct counter c = {0};
+    tintptr obj;
+
+    r = g_reactor_create();
+    ck_assert_ptr_nonnull(r);
+    obj = g_create_wait_obj("");
+    ck_assert_int_eq(g_reactor_add(r, obj, G_REACTOR_READ, count_in, &c), 0);
+    /* can't register twice */
+    ck_assert_int_ne(g_reactor_add(r, obj, G_REACTOR_READ, count_in, &c), 0);
+
+    ck_assert_int_eq(g_reactor_wait(r, NULL, 0, NULL, 0, 0), 0);
+    ck_assert_int_eq(c.calls, 0);
+
+    g_set_wait_obj(obj);
+    ck_assert_int_eq(g_reactor_wait(r, NULL, 0, NULL, 0, 1000), 0);
+    ck_assert_int_eq(c.calls, 1);
+    ck_assert_int_eq(c.events, G_REACTOR_READ);
+
+    /* the callback's return value comes back */
+    c.rv = 42;
+    g_set_wait_obj(obj);
+    ck_assert_int_eq(g_reactor_wait(r, NULL, 0, NULL, 0, 1000), 42);
+    ck_assert_int_eq(c.calls, 2);
+
+    /* paused and removed objects are not reported */
+    g_set_wait_obj(obj);
+    ck_assert_int_eq(g_reactor_modify(r, obj, 0), 0);
+    ck_assert_int_eq(g_reactor_wait(r, NULL, 0, NULL, 0, 0), 0);
+    ck_assert_int_eq(c.calls, 2);
+    ck_assert_int_eq(g_reactor_modify(r, obj, G_REACTOR_READ), 0);
+    ck_assert_int_eq(g_reactor_wait(r, NULL, 0, NULL, 0, 1000), 42);
+    ck_assert_int_eq(c.calls, 3);
+    g_set_wait_obj(obj);
+    ck_assert_int_eq(g_reactor_remove(r, obj), 0);
+    ck_assert_int_eq(g_reactor_wait(r, NULL, 0, NULL, 0, 0), 0);
+    ck_assert_int_eq(c.calls, 3);
+
+    g_delete_wait_obj(obj);
+    g_reactor_delete(r);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_g_reactor__transient_objs)
+{
+    struct g_reactor *r;
+    struct counter c = {0};
+    tintptr reg;
+    tintptr obj;
+    int start;
+
+    r = g_reactor_create();
+    ck_assert_ptr_nonnull(r);
+    reg = g_create_wait_obj("");
+    obj = g_create_wait_obj("");
+    ck_assert_int_eq(g_reactor_add(r, reg, G_REACTOR_READ, count_in, &c), 0);
+
+    /* a ready transient object ends the wait without a callback */
+    g_set_wait_obj(obj);
+    start = g_time3();
+    ck_assert_int_eq(g_reactor_wait(r, &obj, 1, NULL, 0, 5000), 0);
+    ck_assert_int_lt(g_time3() - start, 4000);
+    ck_assert_int_eq(c.calls, 0);
+    g_reset_wait_obj(obj);
+
+    /* registered objects still get their callback */
+    g_set_wait_obj(reg);
+    ck_assert_int_eq(g_reactor_wait(r, &obj, 1, NULL, 0, 1000), 0);
+    ck_assert_int_eq(c.calls, 1);
+
+    g_reactor_remove(r, reg);
+    g_delete_wait_obj(reg);
+    g_delete_wait_obj(obj);
+    g_reactor_delete(r);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_g_reactor__many_objs)
+{
+    struct g_reactor *r;
+    struct counter c = {0};
+    tintptr objs[MANY_OBJS];
+    int index;
+
+    r = g_reactor_create();
+    ck_assert_ptr_nonnull(r);
+    for (index = 0; index < MANY_OBJS; index++)
+    {
+        objs[index] = g_create_wait_obj("");
+        ck_assert_int_ne(objs[index], 0);
+        ck_assert_int_eq(g_reactor_add(r, objs[index], G_REACTOR_READ,
+                                       count_in, &c), 0);
+    }
+    g_set_wait_obj(objs[MANY_OBJS - 1]);
+    ck_assert_int_eq(g_reactor_wait(r, NULL, 0, NULL, 0, 1000), 0);
+    ck_assert_int_eq(c.calls, 1);
+    for (index = 0; index < MANY_OBJS; index++)
+    {
+        g_reactor_remove(r, objs[index]);
+        g_delete_wait_obj(objs[index]);
+    }
+    g_reactor_delete(r);
+}
+END_TEST
+
+/******************************************************************************/
+TCase *
+make_tcase_test_os_calls_reactor(void)
+{
+    TCase *tc = tcase_create("oscalls-reactor");
+
+    tcase_add_test(tc, test_g_reactor__callback);
+    tcase_add_test(tc, test_g_reactor__transient_objs);
+    tcase_add_test(tc, test_g_reactor__many_objs);
+
+    return tc;
+}
@@ -369,6 +369,23 @@ START_TEST(test_gen_key_xrdp1)
 }
 END_TEST
 
+START_TEST(test_tls_ticket_keys)
+{
+    int millis;
+
+    /* nothing to rotate before there are keys */
+    ck_assert_int_eq(ssl_tls_ticket_keys_check(), -1);
+    ck_assert_int_eq(ssl_tls_ticket_keys_init(), 0);
+    /* a second init keeps the keys the children already have */
+    ck_assert_int_eq(ssl_tls_ticket_keys_init(), 0);
+    millis = ssl_tls_ticket_keys_check();
+    ck_assert_int_gt(millis, 0);
+    ck_assert_int_le(millis, 60 * 60 * 1000);
+    ssl_tls_ticket_keys_deinit();
+    ck_assert_int_eq(ssl_tls_ticket_keys_check(), -1);
+}
+END_TEST
+
 /******************************************************************************/
 Suite *
 make_suite_test_ssl_calls(void)
@@ -403,6 +420,10 @@ make_suite_test_ssl_calls(void)
     suite_add_tcase(s, tc);
     tcase_add_test(tc, test_hmac_sha1_dgst_ok);
 
+    tc = tcase_create("ssl_calls_tls_ticket_keys");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_tls_ticket_keys);
+
     tc = tcase_create("ssl_calls_rsa_key");
     suite_add_tcase(s, tc);
     tcase_set_timeout(tc, RSA_BASED_TEST_SUITE_TIMEOUT);
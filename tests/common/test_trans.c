@@ -0,0 +1,405 @@
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "parse.h"
+#include "trans.h"
+
+#include "test_common.h"
+
+/* big enough to fill the socket buffers several times over */
+#define PDU_SIZE 4096
+#define PDU_COUNT 512
+
+static int g_sck[2];
+static struct trans *g_t;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    if (g_sck_local_socketpair(g_sck) != 0)
+    {
+        const char *errstr = g_get_strerror();
+        ck_abort_msg("Can't create socketpair [%s]", errstr);
+    }
+    g_sck_set_non_blocking(g_sck[0]);
+    g_sck_set_non_blocking(g_sck[1]);
+    g_t = trans_create(TRANS_MODE_UNIX, 128, PDU_SIZE);
+    ck_assert_ptr_nonnull(g_t);
+    g_t->sck = g_sck[0];
+    g_t->type1 = TRANS_TYPE_CLIENT;
+    g_t->status = TRANS_STATUS_UP;
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    trans_delete(g_t); /* closes g_sck[0] */
+    g_sck_close(g_sck[1]);
+}
+
+/******************************************************************************/
+/* byte 'pos' of the test output */
+static char
+pattern(int pos)
+{
+    return (char) ((pos * 7) ^ (pos >> 9));
+}
+
+/******************************************************************************/
+/* read everything waiting on the far end, checking it follows the pattern,
+   returns bytes read so far */
+static int
+drain(int pos)
+{
+    char buf[8192];
+    int index;
+    int got;
+
+    while ((got = g_sck_recv(g_sck[1], buf, sizeof(buf), 0)) > 0)
+    {
+        for (index = 0; index < got; index++)
+        {
+            ck_assert_int_eq(buf[index], pattern(pos + index));
+        }
+        pos += got;
+    }
+    return pos;
+}
+
+/******************************************************************************/
+/* keep flushing the queue and reading until 'total' bytes have arrived,
+   'pos' have already been read */
+static void
+drain_all(int pos, int total)
+{
+    struct stream *s;
+    int tries;
+
+    make_stream(s);
+    init_stream(s, 16);
+    for (tries = 0; pos < total && tries < 10000; tries++)
+    {
+        /* an empty write just flushes what is queued */
+        ck_assert_int_eq(trans_write_copy_s(g_t, s), 0);
+        pos = drain(pos);
+    }
+    free_stream(s);
+    ck_assert_int_eq(pos, total);
+    ck_assert_ptr_null(g_t->wait_head);
+    ck_assert_ptr_null(g_t->wait_tail);
+}
+
+/******************************************************************************/
+START_TEST(test_g_sck_sendv)
+{
+    const void *ptrs[3] = { "abc", "", "defgh" };
+    const unsigned int lens[3] = { 3, 0, 5 };
+    char buf[16];
+
+    ck_assert_int_eq(g_sck_sendv(g_sck[0], ptrs, lens, 3), 8);
+    ck_assert_int_eq(g_sck_recv(g_sck[1], buf, sizeof(buf), 0), 8);
+    ck_assert_mem_eq(buf, "abcdefgh", 8);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans_write_copy_s__queues_in_order)
+{
+    struct stream *s;
+    int index;
+    int pos;
+
+    make_stream(s);
+    init_stream(s, PDU_SIZE);
+    pos = 0;
+    for (index = 0; index < PDU_COUNT; index++)
+    {
+        init_stream(s, PDU_SIZE);
+        for (; s->p < s->data + PDU_SIZE; pos++)
+        {
+            out_uint8(s, pattern(pos));
+        }
+        s_mark_end(s);
+        ck_assert_int_eq(trans_write_copy_s(g_t, s), 0);
+    }
+    free_stream(s);
+    /* the socket can't have taken all that */
+    ck_assert_ptr_nonnull(g_t->wait_head);
+    drain_all(0, pos);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans_write_copy__keeps_out_s_usable)
+{
+    struct stream *s;
+    int index;
+    int pos;
+
+    pos = 0;
+    for (index = 0; index < PDU_COUNT; index++)
+    {
+        s = trans_get_out_s(g_t, PDU_SIZE);
+        ck_assert_ptr_nonnull(s);
+        for (; s->p < s->data + PDU_SIZE; pos++)
+        {
+            out_uint8(s, pattern(pos));
+        }
+        s_mark_end(s);
+        ck_assert_int_eq(trans_write_copy(g_t), 0);
+    }
+    ck_assert_ptr_nonnull(g_t->wait_head);
+    drain_all(0, pos);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans_write_s__and_buf)
+{
+    struct stream *s;
+    struct trans_buf *buf;
+    char *data;
+    int index;
+    int pos;
+
+    pos = 0;
+    for (index = 0; index < PDU_COUNT; index++)
+    {
+        if (index & 1)
+        {
+            make_stream(s);
+            init_stream(s, PDU_SIZE);
+            for (; s->p < s->data + PDU_SIZE; pos++)
+            {
+                out_uint8(s, pattern(pos));
+            }
+            s_mark_end(s);
+            ck_assert_int_eq(trans_write_s(g_t, s), 0);
+        }
+        else
+        {
+            data = g_new(char, PDU_SIZE);
+            ck_assert_ptr_nonnull(data);
+            buf = trans_buf_create(data, PDU_SIZE);
+            ck_assert_ptr_nonnull(buf);
+            for (; data < buf->data + PDU_SIZE; pos++)
+            {
+                *data++ = pattern(pos);
+            }
+            ck_assert_int_eq(trans_write_buf(g_t, buf), 0);
+            /* the queue holds its own reference if it kept the data */
+            ck_assert_int_le(buf->refcount, 2);
+            trans_buf_unref(buf);
+        }
+    }
+    ck_assert_ptr_nonnull(g_t->wait_head);
+    drain_all(0, pos);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans_set_cork__batches_writes)
+{
+    struct stream *s;
+    char buf[64];
+    int index;
+    int pos;
+
+    ck_assert_int_eq(trans_set_cork(g_t, 1), 0);
+    make_stream(s);
+    pos = 0;
+    for (index = 0; index < 10; index++)
+    {
+        init_stream(s, 100);
+        for (; s->p < s->data + 100; pos++)
+        {
+            out_uint8(s, pattern(pos));
+        }
+        s_mark_end(s);
+        ck_assert_int_eq(trans_write_copy_s(g_t, s), 0);
+    }
+    /* nothing goes out until the flush */
+    ck_assert_int_lt(g_sck_recv(g_sck[1], buf, sizeof(buf), 0), 0);
+    ck_assert_int_eq(trans_flush(g_t), 0);
+    index = drain(0);
+    ck_assert_int_eq(index, pos);
+
+    /* a write bigger than the batch is sent after what was collected */
+    init_stream(s, 16);
+    for (; s->p < s->data + 16; pos++)
+    {
+        out_uint8(s, pattern(pos));
+    }
+    s_mark_end(s);
+    ck_assert_int_eq(trans_write_copy_s(g_t, s), 0);
+    init_stream(s, TRANS_CORK_BYTES + 100);
+    for (; s->p < s->data + TRANS_CORK_BYTES + 100; pos++)
+    {
+        out_uint8(s, pattern(pos));
+    }
+    s_mark_end(s);
+    ck_assert_int_eq(trans_write_copy_s(g_t, s), 0);
+    free_stream(s);
+    ck_assert_int_eq(trans_set_cork(g_t, 0), 0);
+    drain_all(index, pos);
+}
+END_TEST
+
+/******************************************************************************/
+/* the pacer's clock, moved on by hand */
+static int g_now;
+
+static int
+fake_clock(void)
+{
+    return g_now;
+}
+
+/******************************************************************************/
+/* write 'count' PDUs carrying the pattern from 'pos', reading what gets
+   through as it goes, returns the new 'pos' */
+static int
+write_paced(int pos, int count, int *got)
+{
+    struct stream *s;
+    int index;
+
+    make_stream(s);
+    for (index = 0; index < count; index++)
+    {
+        init_stream(s, PDU_SIZE);
+        for (; s->p < s->data + PDU_SIZE; pos++)
+        {
+            out_uint8(s, pattern(pos));
+        }
+        s_mark_end(s);
+        ck_assert_int_eq(trans_write_copy_s(g_t, s), 0);
+        /* keep the socket empty, so only the pacer holds data back */
+        *got = drain(*got);
+    }
+    free_stream(s);
+    return pos;
+}
+
+/******************************************************************************/
+/* let the pacer send what it can of the queue, returns bytes read so far */
+static int
+flush_paced(int got)
+{
+    struct stream *s;
+
+    make_stream(s);
+    init_stream(s, 16);
+    ck_assert_int_eq(trans_write_copy_s(g_t, s), 0);
+    free_stream(s);
+    return drain(got);
+}
+
+/******************************************************************************/
+START_TEST(test_trans_set_pacing__limits_rate)
+{
+    tbus robjs[4];
+    tbus wobjs[4];
+    int rcount;
+    int wcount;
+    int timeout;
+    int pos;
+    int got;
+
+    g_now = 1000;
+    g_t->pace_clock = fake_clock;
+    /* 1 Mbyte/s, so 1000 bytes a ms and a 50000 byte burst */
+    ck_assert_int_eq(trans_set_pacing(g_t, 8000), 0);
+    ck_assert_int_eq(trans_pace_delay(g_t), 0);
+    ck_assert_int_eq(trans_pace_backlog(g_t), 0);
+
+    /* only the first burst goes while the clock stands still */
+    got = 0;
+    pos = write_paced(0, 50, &got);
+    ck_assert_int_eq(got, 50000);
+    ck_assert(trans_pace_backlog(g_t));
+    /* TRANS_PACE_QUANTUM bytes at 1000 bytes a ms, rounded up */
+    ck_assert_int_eq(trans_pace_delay(g_t), 5);
+
+    /* the socket can take more, but the pacer says wait */
+    rcount = 0;
+    wcount = 0;
+    timeout = -1;
+    ck_assert_int_eq(trans_get_wait_objs_rw(g_t, robjs, &rcount,
+                                            wobjs, &wcount, &timeout), 0);
+    ck_assert_int_eq(wcount, 0);
+    ck_assert_int_eq(timeout, 5);
+
+    /* too few tokens yet to be worth sending */
+    g_now += 4;
+    ck_assert_int_eq(trans_pace_delay(g_t), 1);
+    g_now += 1;
+    ck_assert_int_eq(trans_pace_delay(g_t), 0);
+    rcount = 0;
+    wcount = 0;
+    timeout = -1;
+    ck_assert_int_eq(trans_get_wait_objs_rw(g_t, robjs, &rcount,
+                                            wobjs, &wcount, &timeout), 0);
+    ck_assert_int_eq(wcount, 1);
+    ck_assert_int_eq(timeout, -1);
+    got = flush_paced(got);
+    ck_assert_int_eq(got, 55000);
+
+    /* a long gap only fills the bucket */
+    g_now += 60000;
+    got = flush_paced(got);
+    ck_assert_int_eq(got, 105000);
+
+    /* a clock going backwards gives nothing */
+    g_now -= 10;
+    got = flush_paced(got);
+    ck_assert_int_eq(got, 105000);
+    ck_assert_int_eq(trans_pace_delay(g_t), 5);
+
+    /* 50 ms gives a full burst */
+    g_now += 50;
+    got = flush_paced(got);
+    ck_assert_int_eq(got, 155000);
+    g_now += 50;
+    got = flush_paced(got);
+    ck_assert_int_eq(got, pos);
+    ck_assert_ptr_null(g_t->wait_head);
+    /* 204800 - 155000 bytes taken off the burst */
+    ck_assert_int_eq(g_t->pace_tokens, 50000 - (pos - 155000));
+    ck_assert_int_eq(trans_pace_delay(g_t), 4);
+
+    /* no limit */
+    ck_assert_int_eq(trans_set_pacing(g_t, 0), 0);
+    ck_assert_int_eq(trans_pace_delay(g_t), 0);
+    ck_assert_int_eq(trans_pace_backlog(g_t), 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_trans(void)
+{
+    Suite *s;
+    TCase *tc_trans;
+
+    s = suite_create("Trans");
+
+    tc_trans = tcase_create("trans");
+    tcase_add_checked_fixture(tc_trans, setup, teardown);
+    suite_add_tcase(s, tc_trans);
+    tcase_add_test(tc_trans, test_g_sck_sendv);
+    tcase_add_test(tc_trans, test_trans_write_copy_s__queues_in_order);
+    tcase_add_test(tc_trans, test_trans_write_copy__keeps_out_s_usable);
+    tcase_add_test(tc_trans, test_trans_write_s__and_buf);
+    tcase_add_test(tc_trans, test_trans_set_cork__batches_writes);
+    tcase_add_test(tc_trans, test_trans_set_pacing__limits_rate);
+
+    suite_add_tcase(s, make_tcase_test_trans_tls());
+
+    return s;
+}
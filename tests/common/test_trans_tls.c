@@ -0,0 +1,237 @@
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <openssl/ssl.h>
+
+#include "os_calls.h"
+#include "parse.h"
+#include "string_calls.h"
+#include "trans.h"
+
+#include "test_common.h"
+
+#ifndef TOP_SRCDIR
+#define TOP_SRCDIR "."
+#endif
+
+#define TEST_KEY TOP_SRCDIR "/tests/common/test_tls_key.pem"
+#define TEST_CERT TOP_SRCDIR "/tests/common/test_tls_cert.pem"
+
+/* handshakes run at the same time by one thread */
+#define HANDSHAKES 8
+
+struct tls_pair
+{
+    int sck[2];
+    struct trans *t; /* server end */
+    SSL *ssl; /* client end */
+};
+
+static SSL_CTX *g_client_ctx;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_client_ctx = SSL_CTX_new(TLS_client_method());
+    ck_assert_ptr_nonnull(g_client_ctx);
+    SSL_CTX_set_verify(g_client_ctx, SSL_VERIFY_NONE, NULL);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    SSL_CTX_free(g_client_ctx);
+}
+
+/******************************************************************************/
+/* a server transport with a handshake started, and a client to talk to it */
+static void
+pair_create(struct tls_pair *pair, int timeout)
+{
+    ck_assert_int_eq(g_sck_local_socketpair(pair->sck), 0);
+    g_sck_set_non_blocking(pair->sck[0]);
+    g_sck_set_non_blocking(pair->sck[1]);
+    pair->t = trans_create(TRANS_MODE_UNIX, 8192, 8192);
+    ck_assert_ptr_nonnull(pair->t);
+    pair->t->sck = pair->sck[0];
+    pair->t->type1 = TRANS_TYPE_SERVER;
+    pair->t->status = TRANS_STATUS_UP;
+    ck_assert_int_eq(trans_tls_accept_start(pair->t, TEST_KEY, TEST_CERT,
+                                            0, "", 0, 0, timeout), 0);
+    ck_assert(trans_tls_accept_pending(pair->t));
+    pair->ssl = SSL_new(g_client_ctx);
+    ck_assert_ptr_nonnull(pair->ssl);
+    SSL_set_fd(pair->ssl, pair->sck[1]);
+    SSL_set_connect_state(pair->ssl);
+}
+
+/******************************************************************************/
+static void
+pair_delete(struct tls_pair *pair)
+{
+    SSL_free(pair->ssl);
+    trans_delete(pair->t); /* closes sck[0] */
+    g_sck_close(pair->sck[1]);
+}
+
+/******************************************************************************/
+/* wait for and step the handshakes still going on, returns how many */
+static int
+step_handshakes(struct tls_pair *pairs, int count)
+{
+    tbus robjs[HANDSHAKES];
+    tbus wobjs[HANDSHAKES];
+    int rcount;
+    int wcount;
+    int timeout;
+    int pending;
+    int index;
+
+    rcount = 0;
+    wcount = 0;
+    timeout = -1;
+    for (index = 0; index < count; index++)
+    {
+        if (trans_tls_accept_pending(pairs[index].t))
+        {
+            ck_assert_int_eq(trans_get_wait_objs_rw(pairs[index].t,
+                                                    robjs, &rcount,
+                                                    wobjs, &wcount,
+                                                    &timeout), 0);
+        }
+    }
+    if (timeout < 0 || timeout > 100)
+    {
+        timeout = 100;
+    }
+    g_obj_wait(robjs, rcount, wobjs, wcount, timeout);
+    pending = 0;
+    for (index = 0; index < count; index++)
+    {
+        if (trans_tls_accept_pending(pairs[index].t))
+        {
+            if (trans_check_wait_objs(pairs[index].t) != 0)
+            {
+                return -1;
+            }
+            pending += trans_tls_accept_pending(pairs[index].t);
+        }
+    }
+    return pending;
+}
+
+/******************************************************************************/
+START_TEST(test_trans_tls_accept__many_in_one_thread)
+{
+    struct tls_pair pairs[HANDSHAKES];
+    struct stream *s;
+    char buf[8];
+    int index;
+    int pending;
+    int tries;
+
+    for (index = 0; index < HANDSHAKES; index++)
+    {
+        pair_create(&pairs[index], 10000);
+    }
+    pending = HANDSHAKES;
+    for (tries = 0; pending > 0 && tries < 200; tries++)
+    {
+        for (index = 0; index < HANDSHAKES; index++)
+        {
+            /* the clients only ever want to read from a socketpair */
+            SSL_do_handshake(pairs[index].ssl);
+        }
+        pending = step_handshakes(pairs, HANDSHAKES);
+        ck_assert_int_ge(pending, 0);
+    }
+    ck_assert_int_eq(pending, 0);
+
+    for (index = 0; index < HANDSHAKES; index++)
+    {
+        ck_assert_ptr_nonnull(pairs[index].t->ssl_protocol);
+        /* data goes through TLS both ways now */
+        ck_assert_int_eq(SSL_write(pairs[index].ssl, "ping", 4), 4);
+        ck_assert_int_eq(trans_force_read(pairs[index].t, 4), 0);
+        ck_assert_mem_eq(pairs[index].t->in_s->data, "ping", 4);
+        s = trans_get_out_s(pairs[index].t, 16);
+        out_uint8a(s, "pong", 4);
+        s_mark_end(s);
+        ck_assert_int_eq(trans_force_write(pairs[index].t), 0);
+        for (tries = 0; tries < 100; tries++)
+        {
+            if (SSL_read(pairs[index].ssl, buf, sizeof(buf)) == 4)
+            {
+                break;
+            }
+            g_sck_can_recv(pairs[index].sck[1], 100);
+        }
+        ck_assert_mem_eq(buf, "pong", 4);
+        pair_delete(&pairs[index]);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans_tls_accept__deadline)
+{
+    struct tls_pair pair;
+    int start;
+    int pending;
+    int tries;
+
+    start = g_time3();
+    pair_create(&pair, 300);
+    /* the client never says anything */
+    pending = 1;
+    for (tries = 0; pending > 0 && tries < 100; tries++)
+    {
+        pending = step_handshakes(&pair, 1);
+    }
+    ck_assert_int_eq(pending, -1);
+    ck_assert_int_eq(pair.t->status, TRANS_STATUS_DOWN);
+    ck_assert_int_ge(g_time3() - start, 300);
+    ck_assert_int_lt(g_time3() - start, 3000);
+    pair_delete(&pair);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans_tls_accept__not_tls)
+{
+    struct tls_pair pair;
+    const char *req = "GET / HTTP/1.0\r\n\r\n";
+    int pending;
+    int tries;
+
+    pair_create(&pair, 0);
+    ck_assert_int_eq(g_sck_send(pair.sck[1], req, g_strlen(req), 0),
+                     g_strlen(req));
+    pending = 1;
+    for (tries = 0; pending > 0 && tries < 100; tries++)
+    {
+        pending = step_handshakes(&pair, 1);
+    }
+    ck_assert_int_eq(pending, -1);
+    ck_assert_int_eq(pair.t->status, TRANS_STATUS_DOWN);
+    pair_delete(&pair);
+}
+END_TEST
+
+/******************************************************************************/
+TCase *
+make_tcase_test_trans_tls(void)
+{
+    TCase *tc = tcase_create("trans-tls");
+
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_trans_tls_accept__many_in_one_thread);
+    tcase_add_test(tc, test_trans_tls_accept__deadline);
+    tcase_add_test(tc, test_trans_tls_accept__not_tls);
+
+    return tc;
+}
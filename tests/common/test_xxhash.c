@@ -0,0 +1,97 @@
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "xxhash.h"
+
+#include "test_common.h"
+
+/* a 64x64 32 bpp tile, as the painter caches them */
+#define TILE_BYTES (64 * 64 * 4)
+
+/******************************************************************************/
+static void
+fill(tui8 *data, int len)
+{
+    int index;
+
+    for (index = 0; index < len; index++)
+    {
+        data[index] = (tui8) ((index * 2654435761U) >> 24);
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_xxh64__reference_values)
+{
+    tui8 data[1000];
+
+    /* from the reference implementation */
+    ck_assert(xxh64("", 0, 0) == 0xEF46DB3751D8E999ULL);
+    ck_assert(xxh64("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+    fill(data, sizeof(data));
+    ck_assert(xxh64(data, sizeof(data), 0) == 0x8420ADDB9882CC1BULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xxh64__alignment_and_seed)
+{
+    tui8 data[256 + 8];
+    tui8 copy[256];
+    tui64 hash;
+    int len;
+    int offset;
+
+    fill(data, sizeof(data));
+    for (len = 0; len <= 256; len += 13)
+    {
+        g_memcpy(copy, data + 1, len);
+        hash = xxh64(copy, len, 0);
+        for (offset = 1; offset < 8; offset++)
+        {
+            g_memcpy(data + offset, copy, len);
+            ck_assert(xxh64(data + offset, len, 0) == hash);
+        }
+        ck_assert(xxh64(copy, len, 1) != hash);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xxh64__single_bit_changes)
+{
+    tui8 data[TILE_BYTES];
+    tui64 hash;
+    int bit;
+
+    fill(data, sizeof(data));
+    hash = xxh64(data, sizeof(data), 0);
+    for (bit = 0; bit < TILE_BYTES * 8; bit += 97)
+    {
+        data[bit / 8] ^= 1 << (bit % 8);
+        ck_assert(xxh64(data, sizeof(data), 0) != hash);
+        data[bit / 8] ^= 1 << (bit % 8);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xxhash(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("XXHash");
+
+    tc = tcase_create("xxh64");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_xxh64__reference_values);
+    tcase_add_test(tc, test_xxh64__alignment_and_seed);
+    tcase_add_test(tc, test_xxh64__single_bit_changes);
+
+    return s;
+}
@@ -0,0 +1,358 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Benchmarks for the libxrdp encoders
+ *
+ * Not run by make check, timing depends on the machine, valgrind and the
+ * optimisation level. Run it by hand on a quiet machine, with the names
+ * of the benchmarks to run, or none to run them all.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdlib.h>
+
+#include "libxrdp.h"
+#include "log.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "string_calls.h"
+
+#include "mppc_corpus.h"
+
+/* times round each corpus */
+#define BENCH_ROUNDS 8
+
+/* far below what any build manages, this only catches a search that
+   has stopped being bounded */
+#define MIN_KBYTES_PER_SEC 2048
+
+/* 64x64 tiles, as GFX sends them */
+#define TILE_SIZE 64
+#define BENCH_TILES 4096
+
+/* as in xrdp_bitmap32_compress.c */
+#define FLAGS_RLE 0x10
+#define FLAGS_NOALPHA 0x20
+
+#if defined(__AVX2__)
+#define PLANAR_BUILD "AVX2"
+#elif defined(__SSE2__)
+#define PLANAR_BUILD "SSE2"
+#else
+#define PLANAR_BUILD "scalar"
+#endif
+
+struct bench_result
+{
+    int percent; /* output size in percent of the input */
+    int kbps; /* input KB/s */
+};
+
+struct bench
+{
+    const char *name;
+    int (*run)(void);
+};
+
+/******************************************************************************/
+/* compress the corpus over and over with a fresh encoder */
+static void
+bench_corpus(struct packet *corpus, int protocol, struct bench_result *result)
+{
+    struct xrdp_mppc_enc *enc;
+    long long in_bytes;
+    long long out_bytes;
+    tui64 start;
+    tui64 us;
+    int round;
+    int index;
+
+    enc = mppc_enc_new(protocol);
+    in_bytes = 0;
+    out_bytes = 0;
+    start = g_time4();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (index = 0; index < CORPUS_PACKETS; index++)
+        {
+            if (compress_rdp(enc, corpus[index].data, corpus[index].len))
+            {
+                out_bytes += enc->bytes_in_opb;
+            }
+            else
+            {
+                out_bytes += corpus[index].len;
+            }
+            in_bytes += corpus[index].len;
+        }
+    }
+    us = MAX(g_time4() - start, 1);
+    mppc_enc_free(enc);
+    result->percent = (int) ((out_bytes * 100 + in_bytes - 1) / in_bytes);
+    result->kbps = (int) (in_bytes * 1000000 / 1024 / (long long) us);
+}
+
+/******************************************************************************/
+/* MPPC-64K against what the single probe CRC-16 encoder got,
+   returns non zero if it does worse or is far too slow */
+static int
+bench_mppc_one(const char *name, int (*make)(tui8 *data), tui32 seed,
+               int max_percent)
+{
+    struct packet *corpus;
+    struct bench_result result;
+    int rv;
+
+    corpus_seed(seed);
+    corpus = make_corpus(make);
+    if (corpus == NULL)
+    {
+        g_printf("mppc %s: out of memory\n", name);
+        return 1;
+    }
+    bench_corpus(corpus, PROTO_RDP_50, &result);
+    free_corpus(corpus);
+    rv = result.percent > max_percent || result.kbps < MIN_KBYTES_PER_SEC;
+    g_printf("mppc %-8s %3d%% of input (was %d%%) at %7d KB/s%s\n", name,
+             result.percent, max_percent, result.kbps, rv ? "  FAILED" : "");
+    return rv;
+}
+
+/******************************************************************************/
+static int
+bench_mppc(void)
+{
+    int rv;
+
+    /* the same seeds as the unit tests */
+    rv = bench_mppc_one("orders", make_orders, 1, ORDERS_MAX_PERCENT);
+    rv |= bench_mppc_one("pointers", make_pointer, 2, POINTERS_MAX_PERCENT);
+    rv |= bench_mppc_one("channel", make_channel, 3, CHANNEL_MAX_PERCENT);
+    return rv;
+}
+
+/******************************************************************************/
+/* XCRUSH against MPPC-64K on the same corpus, returns non zero if it
+   does worse than XCRUSH_EXTRA_PERCENT allows */
+static int
+bench_xcrush_one(const char *name, struct packet *corpus)
+{
+    struct bench_result mppc;
+    struct bench_result xcrush;
+    int rv;
+
+    if (corpus == NULL)
+    {
+        g_printf("xcrush %s: out of memory\n", name);
+        return 1;
+    }
+    bench_corpus(corpus, PROTO_RDP_50, &mppc);
+    bench_corpus(corpus, PROTO_RDP_61, &xcrush);
+    free_corpus(corpus);
+    rv = xcrush.percent > mppc.percent + XCRUSH_EXTRA_PERCENT ||
+         xcrush.kbps < MIN_KBYTES_PER_SEC;
+    g_printf("%-8s mppc %3d%% at %7d KB/s, xcrush %3d%% at %7d KB/s%s\n",
+             name, mppc.percent, mppc.kbps, xcrush.percent, xcrush.kbps,
+             rv ? "  FAILED" : "");
+    return rv;
+}
+
+/******************************************************************************/
+static int
+bench_xcrush(void)
+{
+    int rv;
+
+    corpus_seed(1);
+    rv = bench_xcrush_one("orders", make_corpus(make_orders));
+    corpus_seed(2);
+    rv |= bench_xcrush_one("pointers", make_corpus(make_pointer));
+    corpus_seed(3);
+    rv |= bench_xcrush_one("channel", make_corpus(make_channel));
+    corpus_seed(5);
+    rv |= bench_xcrush_one("repeats", make_repeat_corpus());
+    return rv;
+}
+
+/******************************************************************************/
+/* 0 noise, 1 mostly flat with specks, 2 checks, 3 bars with noise */
+static void
+make_tile(tui32 *data, int kind)
+{
+    static const tui32 colors[4] =
+    {
+        0xff000000, 0xffffffff, 0xff00ff00, 0x80345678
+    };
+    int x;
+    int y;
+
+    corpus_seed(kind + 1);
+    for (y = 0; y < TILE_SIZE; y++)
+    {
+        for (x = 0; x < TILE_SIZE; x++)
+        {
+            switch (kind)
+            {
+                case 0:
+                    *data = ((tui32) rnd(0x10000) << 16) | rnd(0x10000);
+                    break;
+                case 1:
+                    *data = (rnd(50) == 0) ? colors[rnd(4)] : colors[0];
+                    break;
+                case 2:
+                    *data = colors[2 + ((x / 7 + y / 5) & 1)];
+                    break;
+                default:
+                    *data = (rnd(100) < 3) ? colors[rnd(4)] :
+                            colors[(y / 9) % 4];
+                    break;
+            }
+            data++;
+        }
+    }
+}
+
+/******************************************************************************/
+/* compress one kind of tile over and over, with room for the whole tile,
+   or with only room for half of what it compresses to */
+static int
+bench_planar_one(const char *name, tui32 *data, struct stream *s,
+                 struct stream *temp_s, int flags, int tight)
+{
+    tui64 start;
+    tui64 us;
+    int byte_limit;
+    int lines;
+    int index;
+
+    byte_limit = 16384 - 100;
+    if (tight)
+    {
+        init_stream(s, 65536);
+        xrdp_bitmap32_compress((char *) data, TILE_SIZE, TILE_SIZE, s, 32,
+                               byte_limit, TILE_SIZE - 1, temp_s, 0, flags);
+        byte_limit = MAX((int) (s->p - s->data) / 2, 64);
+    }
+    lines = 0;
+    start = g_time4();
+    for (index = 0; index < BENCH_TILES; index++)
+    {
+        init_stream(s, 65536);
+        lines = xrdp_bitmap32_compress((char *) data, TILE_SIZE, TILE_SIZE,
+                                       s, 32, byte_limit, TILE_SIZE - 1,
+                                       temp_s, 0, flags);
+    }
+    us = MAX(g_time4() - start, 1);
+    g_printf("planar %-6s %-4s%-8s%-5s %2d lines in %5d bytes, %7llu us "
+             "(%llu MB/s)\n", name, (flags & FLAGS_RLE) ? "rle" : "raw",
+             (flags & FLAGS_NOALPHA) ? "noalpha" : "",
+             tight ? "half" : "", lines,
+             (int) (s->p - s->data), (unsigned long long) us,
+             (unsigned long long) BENCH_TILES * TILE_SIZE * TILE_SIZE * 4 /
+             us);
+    return lines < 1;
+}
+
+/******************************************************************************/
+/* the planar compressor, built as this program is, normally the same
+   flags as libxrdp */
+static int
+bench_planar(void)
+{
+    static const char *names[4] = { "noise", "flat", "checks", "bars" };
+    static const int flags[3] =
+    {
+        FLAGS_RLE, FLAGS_RLE | FLAGS_NOALPHA, FLAGS_NOALPHA
+    };
+    struct stream *s;
+    struct stream *temp_s;
+    tui32 *data;
+    int kind;
+    int index;
+    int rv;
+
+    data = g_new(tui32, TILE_SIZE * TILE_SIZE);
+    if (data == NULL)
+    {
+        g_printf("planar: out of memory\n");
+        return 1;
+    }
+    make_stream(s);
+    make_stream(temp_s);
+    init_stream(temp_s, 65536);
+    g_printf("planar, %d %dx%d tiles each, %s build\n", BENCH_TILES,
+             TILE_SIZE, TILE_SIZE, PLANAR_BUILD);
+    rv = 0;
+    for (kind = 0; kind < 4; kind++)
+    {
+        make_tile(data, kind);
+        for (index = 0; index < 3; index++)
+        {
+            rv |= bench_planar_one(names[kind], data, s, temp_s,
+                                   flags[index], 0);
+        }
+        /* lines dropped to fit */
+        rv |= bench_planar_one(names[kind], data, s, temp_s, FLAGS_RLE, 1);
+    }
+    free_stream(temp_s);
+    free_stream(s);
+    g_free(data);
+    return rv;
+}
+
+/******************************************************************************/
+int
+main(int argc, char **argv)
+{
+    static const struct bench benches[] =
+    {
+        { "mppc", bench_mppc },
+        { "xcrush", bench_xcrush },
+        { "planar", bench_planar }
+    };
+    struct log_config *lc;
+    unsigned int index;
+    int arg;
+    int found;
+    int rv;
+
+    g_init("bench_libxrdp");
+    lc = log_config_init_for_console(LOG_LEVEL_WARNING, NULL);
+    log_start_from_param(lc);
+    log_config_free(lc);
+
+    rv = 0;
+    for (index = 0; index < sizeof(benches) / sizeof(benches[0]); index++)
+    {
+        found = argc < 2;
+        for (arg = 1; arg < argc; arg++)
+        {
+            found |= g_strcmp(argv[arg], benches[index].name) == 0;
+        }
+        if (found)
+        {
+            rv |= benches[index].run();
+        }
+    }
+
+    log_end();
+    g_deinit();
+    return (rv == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
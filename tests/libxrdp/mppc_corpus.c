@@ -0,0 +1,289 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Synthetic RDP traffic for the bulk compressor tests and benchmark
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "string_calls.h"
+
+#include "mppc_corpus.h"
+
+static tui32 g_seed;
+
+/******************************************************************************/
+void
+corpus_seed(tui32 seed)
+{
+    g_seed = seed;
+}
+
+/******************************************************************************/
+int
+rnd(int range)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return (int) ((g_seed >> 8) % (tui32) range);
+}
+
+/******************************************************************************/
+static const char *
+rnd_word(void)
+{
+    static const char *words[] =
+    {
+        "the", "session", "server", "client", "display", "channel",
+        "keyboard", "remote", "desktop", "a", "of", "and", "to", "is",
+        "connection", "window", "file", "user"
+    };
+
+    return words[rnd(sizeof(words) / sizeof(words[0]))];
+}
+
+/******************************************************************************/
+/* little endian field helpers for building packets */
+static tui8 *
+put16(tui8 *p, int value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+/******************************************************************************/
+/* runs of primary drawing orders, mostly delta coded rects, lines and
+   glyph indexes, as a window manager and a terminal produce them */
+int
+make_orders(tui8 *data)
+{
+    static const int widths[] = { 8, 16, 24, 32, 100 };
+    tui8 *p = data;
+    tui8 *end = data + MAX_PACKET - 64;
+    const char *word;
+    int x = rnd(1024);
+    int y = rnd(768);
+
+    while (p < end)
+    {
+        switch (rnd(4))
+        {
+            case 0: /* opaque rect */
+                *p++ = 0x09;
+                *p++ = 0x0a;
+                p = put16(p, x);
+                p = put16(p, y);
+                p = put16(p, widths[rnd(5)]);
+                p = put16(p, 16);
+                *p++ = rnd(3) ? 0xff : rnd(4);
+                break;
+            case 1: /* line to */
+                *p++ = 0x0d;
+                *p++ = 0x09;
+                *p++ = rnd(16);
+                *p++ = rnd(16);
+                *p++ = 0x0d;
+                *p++ = 0x01;
+                break;
+            case 2: /* glyph index, a word of text */
+                *p++ = 0x19;
+                *p++ = 0x1b;
+                p = put16(p, x);
+                p = put16(p, y);
+                word = rnd_word();
+                *p++ = g_strlen(word);
+                for (; *word != 0; word++)
+                {
+                    *p++ = *word;
+                    *p++ = 0x07;
+                }
+                break;
+            default: /* scr blt */
+                *p++ = 0x19;
+                *p++ = 0x02;
+                p = put16(p, 0);
+                p = put16(p, 16);
+                p = put16(p, 1024);
+                p = put16(p, 752);
+                *p++ = 0xcc;
+                break;
+        }
+        x = (x + 8 + rnd(32)) & 1023;
+        if (x < 40)
+        {
+            y = (y + 16) % 768;
+        }
+    }
+    return (int) (p - data);
+}
+
+/******************************************************************************/
+/* 32x32 32 bpp pointer updates, a few shapes over and over */
+int
+make_pointer(tui8 *data)
+{
+    tui8 *p = data;
+    int shape = rnd(6);
+    int x;
+    int y;
+
+    p = put16(p, 0x0009); /* TS_PTRMSGTYPE_POINTER */
+    p = put16(p, 32); /* bpp */
+    p = put16(p, rnd(16)); /* cache index */
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put16(p, 32);
+    p = put16(p, 32);
+    p = put16(p, 128);
+    p = put16(p, 32 * 32 * 4);
+    for (y = 0; y < 32; y++)
+    {
+        for (x = 0; x < 32; x++)
+        {
+            if (x + y * shape / 2 < 24 && x < y + shape)
+            {
+                *p++ = (x == 0 || x == y + shape - 1) ? 0x00 : 0xff;
+                *p++ = (x == 0 || x == y + shape - 1) ? 0x00 : 0xff;
+                *p++ = (x == 0 || x == y + shape - 1) ? 0x00 : 0xff;
+                *p++ = 0xff;
+            }
+            else
+            {
+                *p++ = 0;
+                *p++ = 0;
+                *p++ = 0;
+                *p++ = 0;
+            }
+        }
+    }
+    for (y = 0; y < 32; y++)
+    {
+        for (x = 0; x < 4; x++)
+        {
+            *p++ = (x * 8 < y + shape) ? 0x00 : 0xff;
+        }
+    }
+    return (int) (p - data);
+}
+
+/******************************************************************************/
+/* virtual channel data, clipboard text and redirected file contents */
+int
+make_channel(tui8 *data)
+{
+    tui8 *p = data;
+    tui8 *end;
+    const char *word;
+    int len;
+
+    len = 1024 + rnd(MAX_PACKET - 1024 - 64);
+    end = data + len;
+    p = put16(p, rnd(2) ? 0x0005 : 0x4472); /* CB_FORMAT_DATA_RESPONSE or rdpdr */
+    p = put16(p, 0x0001);
+    p = put16(p, len);
+    p = put16(p, 0);
+    if (rnd(3) == 0)
+    {
+        /* compressed file contents, nothing to find */
+        while (p < end)
+        {
+            *p++ = rnd(256);
+        }
+    }
+    else
+    {
+        /* UTF-16 text */
+        while (p < end - 32)
+        {
+            for (word = rnd_word(); *word != 0; word++)
+            {
+                p = put16(p, *word);
+            }
+            p = put16(p, rnd(10) ? ' ' : '\n');
+        }
+    }
+    return (int) (p - data);
+}
+
+/******************************************************************************/
+void
+free_corpus(struct packet *corpus)
+{
+    int index;
+
+    for (index = 0; index < CORPUS_PACKETS; index++)
+    {
+        g_free(corpus[index].data);
+    }
+    g_free(corpus);
+}
+
+/******************************************************************************/
+struct packet *
+make_corpus(int (*make)(tui8 *data))
+{
+    struct packet *corpus;
+    int index;
+
+    corpus = g_new0(struct packet, CORPUS_PACKETS);
+    if (corpus == NULL)
+    {
+        return NULL;
+    }
+    for (index = 0; index < CORPUS_PACKETS; index++)
+    {
+        corpus[index].data = g_new(tui8, MAX_PACKET);
+        if (corpus[index].data == NULL)
+        {
+            free_corpus(corpus);
+            return NULL;
+        }
+        corpus[index].len = make(corpus[index].data);
+    }
+    return corpus;
+}
+
+/******************************************************************************/
+/* channel data that comes round again further back than MPPC-64K can see,
+   as when the same file or bitmap is sent twice */
+struct packet *
+make_repeat_corpus(void)
+{
+    struct packet *corpus;
+    int index;
+    int edit;
+
+    corpus = make_corpus(make_channel);
+    if (corpus == NULL)
+    {
+        return NULL;
+    }
+    for (index = REPEAT_DISTANCE; index < CORPUS_PACKETS; index++)
+    {
+        corpus[index].len = corpus[index - REPEAT_DISTANCE].len;
+        g_memcpy(corpus[index].data, corpus[index - REPEAT_DISTANCE].data,
+                 corpus[index].len);
+        for (edit = 0; edit < 4; edit++)
+        {
+            corpus[index].data[rnd(corpus[index].len)] = rnd(256);
+        }
+    }
+    return corpus;
+}
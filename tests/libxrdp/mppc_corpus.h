@@ -0,0 +1,72 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Synthetic RDP traffic for the bulk compressor tests and benchmark
+ */
+
+#ifndef MPPC_CORPUS_H
+#define MPPC_CORPUS_H
+
+#include "arch.h"
+
+/* biggest packet the RDP layer hands the compressor */
+#define MAX_PACKET 16384
+
+/* packets of each kind in a corpus */
+#define CORPUS_PACKETS 64
+
+/* output size in percent of the input that the single probe CRC-16
+   encoder got on each corpus, nothing should do worse */
+#define ORDERS_MAX_PERCENT 41
+#define POINTERS_MAX_PERCENT 4
+#define CHANNEL_MAX_PERCENT 59
+
+/* and for XCRUSH, which should do no worse, and much better on data
+   repeated from beyond the 64K window */
+#define XCRUSH_EXTRA_PERCENT 2
+#define REPEAT_DISTANCE 16
+
+struct packet
+{
+    tui8 *data;
+    int len;
+};
+
+/* the corpora are the same for the same seed */
+void
+corpus_seed(tui32 seed);
+int
+rnd(int range);
+
+/* each of these fills data with one packet, returns its length */
+int
+make_orders(tui8 *data);
+int
+make_pointer(tui8 *data);
+int
+make_channel(tui8 *data);
+
+/* CORPUS_PACKETS packets from 'make', NULL if out of memory */
+struct packet *
+make_corpus(int (*make)(tui8 *data));
+void
+free_corpus(struct packet *corpus);
+/* channel data that comes round again further back than MPPC-64K can see */
+struct packet *
+make_repeat_corpus(void);
+
+#endif /* MPPC_CORPUS_H */
@@ -5,5 +5,10 @@
 
 Suite *make_suite_test_xrdp_sec_process_mcs_data_monitors(void);
 Suite *make_suite_test_monitor_processing(void);
+Suite *make_suite_test_xrdp_mppc_enc(void);
+Suite *make_suite_test_xrdp_bitmap_compress(void);
+Suite *make_suite_test_xrdp_jpeg_compress(void);
+Suite *make_suite_test_xrdp_orders(void);
+Suite *make_suite_test_xrdp_rdp_persistent_list(void);
 
 #endif /* TEST_LIBXRDP_H */
@@ -14,6 +14,11 @@ int main (void)
 
     sr = srunner_create(make_suite_test_xrdp_sec_process_mcs_data_monitors());
     srunner_add_suite(sr, make_suite_test_monitor_processing());
+    srunner_add_suite(sr, make_suite_test_xrdp_mppc_enc());
+    srunner_add_suite(sr, make_suite_test_xrdp_bitmap_compress());
+    srunner_add_suite(sr, make_suite_test_xrdp_jpeg_compress());
+    srunner_add_suite(sr, make_suite_test_xrdp_orders());
+    srunner_add_suite(sr, make_suite_test_xrdp_rdp_persistent_list());
 
     srunner_set_tap(sr, "-");
 
@@ -0,0 +1,268 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+#include "xxhash.h"
+
+#include "test_libxrdp.h"
+
+/* odd, so the lines are padded */
+#define IMAGE_WIDTH 61
+#define IMAGE_HEIGHT 40
+
+#define IMAGE_KINDS 4
+
+static tui32 g_seed;
+
+/******************************************************************************/
+static tui32
+rnd(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+/******************************************************************************/
+/* 0 noise, 1 mostly flat with specks, 2 checks, 3 bars with noise, which
+   between them take every kind of order the compressor has */
+static void
+make_image(char *data, int width, int height, int Bpp, int kind)
+{
+    static const tui32 colors[4] = { 0, 0xffffffff, 0x00ff00ff, 0x12345678 };
+    tui32 pixel;
+    int x;
+    int y;
+    int index;
+
+    g_seed = kind + 1;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            switch (kind)
+            {
+                case 0:
+                    pixel = rnd();
+                    break;
+                case 1:
+                    pixel = (rnd() % 50 == 0) ? colors[rnd() % 4] : 0;
+                    break;
+                case 2:
+                    pixel = colors[2 + ((x / 7 + y / 5) & 1)];
+                    break;
+                default:
+                    pixel = (rnd() % 100 < 3) ? colors[rnd() % 4] :
+                            colors[(y / 9) % 4];
+                    break;
+            }
+            for (index = 0; index < Bpp; index++)
+            {
+                data[(y * width + x) * Bpp + index] = pixel >> (index * 8);
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+static int
+bpp_to_Bpp(int bpp)
+{
+    return (bpp == 8) ? 1 : (bpp == 24) ? 4 : 2;
+}
+
+/******************************************************************************/
+/* the output as it was before the runs were looked for a block at a
+   time, it must not change */
+START_TEST(test_bitmap_compress__unchanged_output)
+{
+    static const int bpps[4] = { 8, 15, 16, 24 };
+    static const tui64 expected[4][IMAGE_KINDS] =
+    {
+        {
+            0x102E372497F11F3AULL, 0x394C9CBD13ECF3B2ULL,
+            0x693EABDF1CC94782ULL, 0xECEEA541D7DDCA0CULL
+        },
+        {
+            0x8310A961D02DCF98ULL, 0x28E168C3B3ED6AD9ULL,
+            0xA784094E46A5F45DULL, 0xDED6FA381CFBF0FFULL
+        },
+        {
+            0x8310A961D02DCF98ULL, 0xC59D134A2CB5E434ULL,
+            0xA784094E46A5F45DULL, 0x2903A2C14A5092D8ULL
+        },
+        {
+            0x7C2CFA4A3C0B27A3ULL, 0x3AB90DB09A38AFDEULL,
+            0x67D480792BEC5605ULL, 0x56BEC3C0CBAABE5AULL
+        }
+    };
+    struct stream *s;
+    struct stream *temp_s;
+    char *data;
+    tui64 hash;
+    int lines;
+    int bpp_index;
+    int kind;
+    int e;
+
+    data = g_new(char, IMAGE_WIDTH * IMAGE_HEIGHT * 4);
+    ck_assert_ptr_nonnull(data);
+    make_stream(s);
+    make_stream(temp_s);
+    init_stream(temp_s, 65536);
+    for (bpp_index = 0; bpp_index < 4; bpp_index++)
+    {
+        for (kind = 0; kind < IMAGE_KINDS; kind++)
+        {
+            make_image(data, IMAGE_WIDTH, IMAGE_HEIGHT,
+                       bpp_to_Bpp(bpps[bpp_index]), kind);
+            e = (4 - IMAGE_WIDTH) & 3;
+            init_stream(s, 65536);
+            lines = xrdp_bitmap_compress(data, IMAGE_WIDTH, IMAGE_HEIGHT, s,
+                                         bpps[bpp_index], 8192,
+                                         IMAGE_HEIGHT - 1, temp_s, e);
+            hash = xxh64(s->data, s->p - s->data, lines);
+            ck_assert_int_eq(lines, IMAGE_HEIGHT);
+            ck_assert_msg(hash == expected[bpp_index][kind],
+                          "%d bpp, image %d", bpps[bpp_index], kind);
+        }
+    }
+    free_stream(temp_s);
+    free_stream(s);
+    g_free(data);
+}
+END_TEST
+
+/******************************************************************************/
+/* and for the RDP 6.0 planar compressor, with and without alpha */
+START_TEST(test_bitmap32_compress__unchanged_output)
+{
+    static const int flags[2] = { 0x10, 0x30 };
+    static const tui64 expected[2][IMAGE_KINDS] =
+    {
+        {
+            0x1452B0526D1D4BADULL, 0x4059C586B62F34D7ULL,
+            0x545E04B8C8169BF0ULL, 0xF3EF700DC1871224ULL
+        },
+        {
+            0xFA4989145F87A91BULL, 0xA5C86A835D53C324ULL,
+            0x467FD5FD2F0F7E6CULL, 0x4D633D411AB42B0CULL
+        }
+    };
+    struct stream *s;
+    struct stream *temp_s;
+    char *data;
+    tui64 hash;
+    int lines;
+    int flags_index;
+    int kind;
+
+    data = g_new(char, IMAGE_WIDTH * IMAGE_HEIGHT * 4);
+    ck_assert_ptr_nonnull(data);
+    make_stream(s);
+    make_stream(temp_s);
+    init_stream(temp_s, 65536);
+    for (flags_index = 0; flags_index < 2; flags_index++)
+    {
+        for (kind = 0; kind < IMAGE_KINDS; kind++)
+        {
+            make_image(data, IMAGE_WIDTH, IMAGE_HEIGHT, 4, kind);
+            init_stream(s, 65536);
+            /* too small for the noise, so lines are dropped */
+            lines = xrdp_bitmap32_compress(data, IMAGE_WIDTH, IMAGE_HEIGHT,
+                                           s, 32, 6000, IMAGE_HEIGHT - 1,
+                                           temp_s, 3, flags[flags_index]);
+            hash = xxh64(s->data, s->p - s->data, lines);
+            ck_assert_int_gt(lines, 0);
+            ck_assert_msg(hash == expected[flags_index][kind],
+                          "flags 0x%x, image %d", flags[flags_index], kind);
+        }
+    }
+    free_stream(temp_s);
+    free_stream(s);
+    g_free(data);
+}
+END_TEST
+
+/******************************************************************************/
+/* when not even one line fits nothing is written */
+START_TEST(test_bitmap32_compress__no_lines_fit)
+{
+    static const int flags[4] = { 0x10, 0x30, 0x00, 0x20 };
+    struct stream *s;
+    struct stream *temp_s;
+    char *data;
+    int flags_index;
+
+    data = g_new(char, IMAGE_WIDTH * IMAGE_HEIGHT * 4);
+    ck_assert_ptr_nonnull(data);
+    make_image(data, IMAGE_WIDTH, IMAGE_HEIGHT, 4, 0);
+    make_stream(s);
+    make_stream(temp_s);
+    init_stream(temp_s, 65536);
+    init_stream(s, 65536);
+    for (flags_index = 0; flags_index < 4; flags_index++)
+    {
+        ck_assert_int_eq(xrdp_bitmap32_compress(data, IMAGE_WIDTH,
+                                                IMAGE_HEIGHT, s, 32, 64,
+                                                IMAGE_HEIGHT - 1, temp_s,
+                                                3, flags[flags_index]), 0);
+        ck_assert_msg(s->p == s->data, "flags 0x%x", flags[flags_index]);
+    }
+    free_stream(temp_s);
+    free_stream(s);
+    g_free(data);
+}
+END_TEST
+
+/******************************************************************************/
+static void
+count_job(void *arg, int index)
+{
+    ((int *) arg)[index]++;
+}
+
+/******************************************************************************/
+START_TEST(test_workers__every_job_once)
+{
+    struct xrdp_workers *workers;
+    int counts[100];
+    int round;
+    int index;
+
+    workers = xrdp_workers_create(3);
+    ck_assert_ptr_nonnull(workers);
+    ck_assert_int_eq(workers->num_threads, 3);
+    g_memset(counts, 0, sizeof(counts));
+    for (round = 1; round <= 20; round++)
+    {
+        xrdp_workers_run(workers, 100, count_job, counts);
+        for (index = 0; index < 100; index++)
+        {
+            ck_assert_int_eq(counts[index], round);
+        }
+    }
+    xrdp_workers_run(workers, 0, count_job, counts);
+    xrdp_workers_delete(workers);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_bitmap_compress(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("BitmapCompress");
+
+    tc = tcase_create("xrdp_bitmap_compress");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_bitmap_compress__unchanged_output);
+    tcase_add_test(tc, test_bitmap32_compress__unchanged_output);
+    tcase_add_test(tc, test_bitmap32_compress__no_lines_fit);
+    tcase_add_test(tc, test_workers__every_job_once);
+
+    return s;
+}
@@ -0,0 +1,212 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+#if defined(XRDP_JPEG)
+#include <stdio.h>
+#include <jpeglib.h>
+#endif
+
+#if defined(XRDP_JPEG) && defined(JCS_EXTENSIONS)
+
+#define QUALITY 75
+/* big enough that a whole frame does not fit the first output buffer */
+#define IMAGE_WIDTH 1024
+#define IMAGE_HEIGHT 768
+
+static tui32 g_seed;
+
+/******************************************************************************/
+static tui32
+rnd(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+/******************************************************************************/
+/* XBGR gradients with some noise, so no two MCUs are alike */
+static char *
+make_image(int width, int height)
+{
+    tui32 *data;
+    int x;
+    int y;
+
+    data = g_new(tui32, width * height);
+    ck_assert_ptr_nonnull(data);
+    g_seed = width * height;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            data[y * width + x] = ((x * 3) << 24) | ((y * 5) << 16) |
+                                  (((x + y) & 0xff) << 8) | (rnd() & 0x0f0f0f00);
+        }
+    }
+    return (char *) data;
+}
+
+/******************************************************************************/
+/* the whole rectangle with one compressor, as xrdp_codec_jpeg_compress()
+   sets it up */
+static unsigned char *
+reference_jpeg(const char *src, int stride, int cx, int cy,
+               int restart_interval, unsigned long *bytes)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char *out;
+    JSAMPROW row_pointer[1];
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    out = NULL;
+    *bytes = 0;
+    jpeg_mem_dest(&cinfo, &out, bytes);
+    cinfo.image_width = cx;
+    cinfo.image_height = cy;
+    cinfo.input_components = 4;
+    cinfo.in_color_space = JCS_EXT_XBGR;
+    jpeg_set_defaults(&cinfo);
+    cinfo.num_components = 3;
+    cinfo.dct_method = JDCT_FLOAT;
+    jpeg_set_quality(&cinfo, QUALITY, 1);
+    cinfo.restart_interval = restart_interval;
+    jpeg_start_compress(&cinfo, 1);
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        row_pointer[0] = (JSAMPROW) (src + cinfo.next_scanline * stride);
+        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return out;
+}
+
+/******************************************************************************/
+/* the restart interval the stripes come out at */
+static int
+stripe_interval(int threads, int cx, int cy)
+{
+    int mcu_rows;
+    int mcu_cols;
+    int stripes;
+    int rows;
+
+    mcu_rows = (cy + 15) / 16;
+    mcu_cols = (cx + 15) / 16;
+    stripes = MIN(threads, mcu_rows);
+    rows = (mcu_rows + stripes - 1) / stripes;
+    if (stripes < 2 || mcu_cols * rows > 0xFFFF)
+    {
+        return 0;
+    }
+    return mcu_cols * rows;
+}
+
+/******************************************************************************/
+START_TEST(test_codec_jpeg_compress__same_as_one_compressor)
+{
+    static const int threads[4] = { 1, 2, 3, 4 };
+    static const int sizes[7][2] =
+    {
+        { 64, 64 }, { 61, 40 }, { 200, 100 }, { 256, 17 }, { 16, 16 },
+        { 333, 250 }, { IMAGE_WIDTH - 9, IMAGE_HEIGHT - 7 }
+    };
+    unsigned char *expected;
+    unsigned long expected_bytes;
+    char *data;
+    char *out;
+    void *handle;
+    int threads_index;
+    int size_index;
+    int cx;
+    int cy;
+    int bytes;
+    int round;
+
+    /* the rectangles are taken out of the middle of a bigger image */
+    data = make_image(IMAGE_WIDTH, IMAGE_HEIGHT);
+    out = g_new(char, IMAGE_WIDTH * IMAGE_HEIGHT * 4);
+    ck_assert_ptr_nonnull(out);
+    for (threads_index = 0; threads_index < 4; threads_index++)
+    {
+        handle = xrdp_jpeg_init(threads[threads_index]);
+        ck_assert_ptr_nonnull(handle);
+        for (size_index = 0; size_index < 7; size_index++)
+        {
+            cx = sizes[size_index][0];
+            cy = sizes[size_index][1];
+            expected = reference_jpeg(data + (7 * IMAGE_WIDTH + 9) * 4,
+                                      IMAGE_WIDTH * 4,
+                                      cx, cy,
+                                      stripe_interval(threads[threads_index],
+                                                      cx, cy),
+                                      &expected_bytes);
+            /* the contexts are reused, the second go must be no different */
+            for (round = 0; round < 2; round++)
+            {
+                bytes = IMAGE_WIDTH * IMAGE_HEIGHT * 4;
+                ck_assert_int_eq(xrdp_codec_jpeg_compress(handle, 0, data,
+                                 IMAGE_WIDTH, IMAGE_HEIGHT, IMAGE_WIDTH * 4,
+                                 9, 7, cx, cy, QUALITY, out, &bytes),
+                                 IMAGE_HEIGHT);
+                ck_assert_msg(bytes == (int) expected_bytes &&
+                              g_memcmp(out, expected, bytes) == 0,
+                              "%d threads, %dx%d", threads[threads_index],
+                              cx, cy);
+            }
+            free(expected);
+        }
+        xrdp_jpeg_deinit(handle);
+    }
+    g_free(out);
+    g_free(data);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_codec_jpeg_compress__no_room)
+{
+    char *data;
+    char out[256];
+    void *handle;
+    int bytes;
+
+    data = make_image(64, 64);
+    handle = xrdp_jpeg_init(2);
+    ck_assert_ptr_nonnull(handle);
+    bytes = sizeof(out);
+    ck_assert_int_lt(xrdp_codec_jpeg_compress(handle, 0, data, 64, 64,
+                     64 * 4, 0, 0, 64, 64, QUALITY, out, &bytes), 0);
+    xrdp_jpeg_deinit(handle);
+    g_free(data);
+}
+END_TEST
+
+#endif
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_jpeg_compress(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("JpegCompress");
+
+    tc = tcase_create("xrdp_codec_jpeg_compress");
+    suite_add_tcase(s, tc);
+#if defined(XRDP_JPEG) && defined(JCS_EXTENSIONS)
+    tcase_add_test(tc, test_codec_jpeg_compress__same_as_one_compressor);
+    tcase_add_test(tc, test_codec_jpeg_compress__no_room);
+#endif
+
+    return s;
+}
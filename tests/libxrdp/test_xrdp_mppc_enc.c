@@ -0,0 +1,557 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+#include "ms-rdpegdi.h"
+#include "os_calls.h"
+
+#include "mppc_corpus.h"
+#include "test_libxrdp.h"
+
+#define HIST_LEN (64 * 1024)
+#define XCRUSH_HIST_LEN 2000000
+
+struct mppc_dec
+{
+    tui8 history[HIST_LEN];
+    int offset;
+};
+
+struct xcrush_dec
+{
+    struct mppc_dec level2;
+    tui8 history[XCRUSH_HIST_LEN];
+    int offset;
+    tui8 l1[HIST_LEN];
+};
+
+/******************************************************************************/
+/* MSB first bit reader */
+static int
+get_bits(const tui8 *data, int *bit_pos, int count)
+{
+    int rv = 0;
+
+    while (count-- > 0)
+    {
+        rv = (rv << 1) | ((data[*bit_pos >> 3] >> (7 - (*bit_pos & 7))) & 1);
+        (*bit_pos)++;
+    }
+    return rv;
+}
+
+/******************************************************************************/
+/* a straight MPPC-64K decoder from [MS-RDPBCGR] 3.1.8.4.2, returns the
+   decompressed length or -1 */
+static int
+decompress(struct mppc_dec *dec, const tui8 *data, int len, int flags,
+           tui8 *out)
+{
+    int bit_pos;
+    int bit_end;
+    int start;
+    int copy_offset;
+    int lom;
+    int k;
+
+    if (flags & PACKET_FLUSHED)
+    {
+        g_memset(dec->history, 0, HIST_LEN);
+        dec->offset = 0;
+    }
+    if (flags & PACKET_AT_FRONT)
+    {
+        dec->offset = 0;
+    }
+    if (!(flags & PACKET_COMPRESSED))
+    {
+        g_memcpy(out, data, len);
+        return len;
+    }
+    start = dec->offset;
+    bit_pos = 0;
+    bit_end = len * 8;
+    while (bit_end - bit_pos >= 8)
+    {
+        if (get_bits(data, &bit_pos, 1) == 0)
+        {
+            dec->history[dec->offset++] = get_bits(data, &bit_pos, 7);
+            continue;
+        }
+        if (get_bits(data, &bit_pos, 1) == 0)
+        {
+            dec->history[dec->offset++] = 0x80 | get_bits(data, &bit_pos, 7);
+            continue;
+        }
+        if (get_bits(data, &bit_pos, 1) == 0)
+        {
+            copy_offset = get_bits(data, &bit_pos, 16) + 2368;
+        }
+        else if (get_bits(data, &bit_pos, 1) == 0)
+        {
+            copy_offset = get_bits(data, &bit_pos, 11) + 320;
+        }
+        else if (get_bits(data, &bit_pos, 1) == 0)
+        {
+            copy_offset = get_bits(data, &bit_pos, 8) + 64;
+        }
+        else
+        {
+            copy_offset = get_bits(data, &bit_pos, 6);
+        }
+        k = 1;
+        while (get_bits(data, &bit_pos, 1) == 1)
+        {
+            k++;
+        }
+        lom = (k == 1) ? 3 : (1 << k) + get_bits(data, &bit_pos, k);
+        if (copy_offset < 1 || copy_offset > dec->offset ||
+                dec->offset + lom > HIST_LEN || bit_pos > bit_end)
+        {
+            return -1;
+        }
+        /* byte by byte, the source may overlap what is being written */
+        for (; lom > 0; lom--, dec->offset++)
+        {
+            dec->history[dec->offset] = dec->history[dec->offset - copy_offset];
+        }
+    }
+    g_memcpy(out, dec->history + start, dec->offset - start);
+    return dec->offset - start;
+}
+
+/******************************************************************************/
+static int
+get16(const tui8 *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/******************************************************************************/
+/* an RDP 6.1 decoder from [MS-RDPEGDI] 3.1.8.2, data starts with the
+   Level1ComprFlags and Level2ComprFlags, returns the decompressed length
+   or -1 */
+static int
+decompress_rdp61(struct xcrush_dec *dec, const tui8 *data, int len,
+                 tui8 *out)
+{
+    const tui8 *l1;
+    const tui8 *match;
+    const tui8 *literals;
+    int l1_flags;
+    int l1_len;
+    int count;
+    int start;
+    int lit_pos;
+    int lit_end;
+    int lit_len;
+    int index;
+    int length;
+    int output_offset;
+    int history_offset;
+
+    if (len < 2)
+    {
+        return -1;
+    }
+    l1_flags = data[0];
+    l1_len = decompress(&dec->level2, data + 2, len - 2, data[1], dec->l1);
+    if (l1_len < 0 || !(l1_flags & L1_INNER_COMPRESSION))
+    {
+        return -1;
+    }
+    l1 = dec->l1;
+    if (l1_flags & L1_PACKET_AT_FRONT)
+    {
+        dec->offset = 0;
+    }
+    start = dec->offset;
+    if (l1_flags & L1_NO_COMPRESSION)
+    {
+        if (start + l1_len > XCRUSH_HIST_LEN)
+        {
+            return -1;
+        }
+        g_memcpy(dec->history + start, l1, l1_len);
+        dec->offset += l1_len;
+    }
+    else if (l1_flags & L1_COMPRESSED)
+    {
+        count = get16(l1);
+        if (2 + count * 8 > l1_len)
+        {
+            return -1;
+        }
+        literals = l1 + 2 + count * 8;
+        lit_end = l1_len - 2 - count * 8;
+        lit_pos = 0;
+        for (index = 0; index < count; index++)
+        {
+            match = l1 + 2 + index * 8;
+            length = get16(match);
+            output_offset = get16(match + 2);
+            history_offset = get16(match + 4) | (get16(match + 6) << 16);
+            /* literals up to the match, then the match */
+            lit_len = output_offset - (dec->offset - start);
+            if (lit_len < 0 || lit_pos + lit_len > lit_end ||
+                    dec->offset + lit_len + length > XCRUSH_HIST_LEN ||
+                    history_offset + length > dec->offset + lit_len)
+            {
+                return -1;
+            }
+            g_memcpy(dec->history + dec->offset, literals + lit_pos, lit_len);
+            dec->offset += lit_len;
+            lit_pos += lit_len;
+            g_memcpy(dec->history + dec->offset,
+                     dec->history + history_offset, length);
+            dec->offset += length;
+        }
+        length = lit_end - lit_pos;
+        if (dec->offset + length > XCRUSH_HIST_LEN)
+        {
+            return -1;
+        }
+        g_memcpy(dec->history + dec->offset, literals + lit_pos, length);
+        dec->offset += length;
+    }
+    else
+    {
+        return -1;
+    }
+    g_memcpy(out, dec->history + start, dec->offset - start);
+    return dec->offset - start;
+}
+
+/******************************************************************************/
+/* compress the corpus, checking every packet decompresses to what went
+   in, returns the output size in percent of the input */
+static int
+check_corpus(struct packet *corpus, int protocol)
+{
+    struct xrdp_mppc_enc *enc;
+    struct xcrush_dec *dec;
+    tui8 *out;
+    int in_bytes;
+    int out_bytes;
+    int index;
+
+    enc = mppc_enc_new(protocol);
+    ck_assert_ptr_nonnull(enc);
+    dec = g_new0(struct xcrush_dec, 1);
+    ck_assert_ptr_nonnull(dec);
+    out = g_new(tui8, HIST_LEN);
+    ck_assert_ptr_nonnull(out);
+    in_bytes = 0;
+    out_bytes = 0;
+    for (index = 0; index < CORPUS_PACKETS; index++)
+    {
+        in_bytes += corpus[index].len;
+        if (!compress_rdp(enc, corpus[index].data, corpus[index].len))
+        {
+            /* sent as it is, the next packet resets the history */
+            ck_assert_int_ne(protocol, PROTO_RDP_61);
+            ck_assert_int_eq(decompress(&dec->level2, corpus[index].data,
+                                        corpus[index].len, 0, out),
+                             corpus[index].len);
+            out_bytes += corpus[index].len;
+        }
+        else if (protocol == PROTO_RDP_61)
+        {
+            ck_assert_int_eq(enc->flags, PACKET_COMPRESSED |
+                             PACKET_COMPR_TYPE_RDP61);
+            ck_assert_int_eq(decompress_rdp61(dec,
+                                              (tui8 *) enc->outputBuffer,
+                                              enc->bytes_in_opb, out),
+                             corpus[index].len);
+            out_bytes += enc->bytes_in_opb;
+        }
+        else
+        {
+            ck_assert_int_eq(decompress(&dec->level2,
+                                        (tui8 *) enc->outputBuffer,
+                                        enc->bytes_in_opb, enc->flags, out),
+                             corpus[index].len);
+            out_bytes += enc->bytes_in_opb;
+        }
+        ck_assert_mem_eq(out, corpus[index].data, corpus[index].len);
+    }
+    g_free(out);
+    g_free(dec);
+    mppc_enc_free(enc);
+    return (int) ((out_bytes * 100LL + in_bytes - 1) / in_bytes);
+}
+
+/******************************************************************************/
+START_TEST(test_mppc_enc__orders)
+{
+    struct packet *corpus;
+    int percent;
+
+    corpus_seed(1);
+    corpus = make_corpus(make_orders);
+    ck_assert_ptr_nonnull(corpus);
+    percent = check_corpus(corpus, PROTO_RDP_50);
+    LOG(LOG_LEVEL_INFO, "mppc orders: %d%% of input", percent);
+    ck_assert_int_le(percent, ORDERS_MAX_PERCENT);
+    free_corpus(corpus);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_mppc_enc__pointers)
+{
+    struct packet *corpus;
+    int percent;
+
+    corpus_seed(2);
+    corpus = make_corpus(make_pointer);
+    ck_assert_ptr_nonnull(corpus);
+    percent = check_corpus(corpus, PROTO_RDP_50);
+    LOG(LOG_LEVEL_INFO, "mppc pointers: %d%% of input", percent);
+    ck_assert_int_le(percent, POINTERS_MAX_PERCENT);
+    free_corpus(corpus);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_mppc_enc__channel)
+{
+    struct packet *corpus;
+    int percent;
+
+    corpus_seed(3);
+    corpus = make_corpus(make_channel);
+    ck_assert_ptr_nonnull(corpus);
+    percent = check_corpus(corpus, PROTO_RDP_50);
+    LOG(LOG_LEVEL_INFO, "mppc channel: %d%% of input", percent);
+    ck_assert_int_le(percent, CHANNEL_MAX_PERCENT);
+    free_corpus(corpus);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_mppc_enc__incompressible)
+{
+    struct xrdp_mppc_enc *enc;
+    struct mppc_dec *dec;
+    tui8 *data;
+    tui8 *out;
+    int index;
+
+    corpus_seed(4);
+    enc = mppc_enc_new(PROTO_RDP_50);
+    ck_assert_ptr_nonnull(enc);
+    dec = g_new0(struct mppc_dec, 1);
+    data = g_new(tui8, HIST_LEN);
+    out = g_new(tui8, HIST_LEN);
+    /* a full history's worth of noise must be refused, not overrun */
+    for (index = 0; index < HIST_LEN; index++)
+    {
+        data[index] = rnd(256);
+    }
+    ck_assert_int_eq(compress_rdp(enc, data, HIST_LEN), 0);
+    /* and the next packet starts again from a clean history */
+    g_memset(data, 'x', 100);
+    ck_assert_int_eq(compress_rdp(enc, data, 100), 1);
+    ck_assert_int_ne(enc->flags & PACKET_FLUSHED, 0);
+    ck_assert_int_eq(decompress(dec, (tui8 *) enc->outputBuffer,
+                                enc->bytes_in_opb, enc->flags, out), 100);
+    ck_assert_mem_eq(out, data, 100);
+    g_free(out);
+    g_free(data);
+    g_free(dec);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+/* both encoders on the same corpus */
+static void
+compare_corpus(const char *name, struct packet *corpus, int max_percent)
+{
+    int mppc_percent;
+    int xcrush_percent;
+
+    mppc_percent = check_corpus(corpus, PROTO_RDP_50);
+    xcrush_percent = check_corpus(corpus, PROTO_RDP_61);
+    LOG(LOG_LEVEL_INFO, "%s: mppc %d%% of input, xcrush %d%% of input",
+        name, mppc_percent, xcrush_percent);
+    ck_assert_int_le(xcrush_percent, mppc_percent + XCRUSH_EXTRA_PERCENT);
+    ck_assert_int_le(xcrush_percent, max_percent);
+}
+
+/******************************************************************************/
+START_TEST(test_mppc_enc__worth_trying)
+{
+    struct xrdp_mppc_enc *enc;
+    struct xrdp_mppc_enc *xcrush;
+    struct packet *corpus;
+    int skipped;
+    int index;
+
+    corpus_seed(7);
+    enc = mppc_enc_new(PROTO_RDP_50);
+    ck_assert_ptr_nonnull(enc);
+    xcrush = mppc_enc_new(PROTO_RDP_61);
+    ck_assert_ptr_nonnull(xcrush);
+
+    /* the channel corpus has compressed file contents in with the text,
+       anything skipped must be something MPPC couldn't shrink */
+    corpus = make_corpus(make_channel);
+    ck_assert_ptr_nonnull(corpus);
+    skipped = 0;
+    for (index = 0; index < CORPUS_PACKETS; index++)
+    {
+        ck_assert(mppc_enc_worth_trying(xcrush, corpus[index].data,
+                                        corpus[index].len));
+        if (!mppc_enc_worth_trying(enc, corpus[index].data,
+                                   corpus[index].len))
+        {
+            skipped++;
+            ck_assert_int_eq(compress_rdp(enc, corpus[index].data,
+                                          corpus[index].len), 0);
+        }
+    }
+    ck_assert_int_gt(skipped, CORPUS_PACKETS / 8);
+    free_corpus(corpus);
+
+    /* and nothing from the others */
+    corpus = make_corpus(make_orders);
+    ck_assert_ptr_nonnull(corpus);
+    for (index = 0; index < CORPUS_PACKETS; index++)
+    {
+        ck_assert(mppc_enc_worth_trying(enc, corpus[index].data,
+                                        corpus[index].len));
+    }
+    free_corpus(corpus);
+    corpus = make_corpus(make_pointer);
+    ck_assert_ptr_nonnull(corpus);
+    for (index = 0; index < CORPUS_PACKETS; index++)
+    {
+        ck_assert(mppc_enc_worth_trying(enc, corpus[index].data,
+                                        corpus[index].len));
+    }
+    free_corpus(corpus);
+
+    mppc_enc_free(xcrush);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xcrush_enc__vs_mppc)
+{
+    struct packet *corpus;
+
+    corpus_seed(1);
+    corpus = make_corpus(make_orders);
+    ck_assert_ptr_nonnull(corpus);
+    compare_corpus("orders", corpus,
+                   ORDERS_MAX_PERCENT + XCRUSH_EXTRA_PERCENT);
+    free_corpus(corpus);
+
+    corpus_seed(2);
+    corpus = make_corpus(make_pointer);
+    ck_assert_ptr_nonnull(corpus);
+    compare_corpus("pointers", corpus,
+                   POINTERS_MAX_PERCENT + XCRUSH_EXTRA_PERCENT);
+    free_corpus(corpus);
+
+    corpus_seed(3);
+    corpus = make_corpus(make_channel);
+    ck_assert_ptr_nonnull(corpus);
+    compare_corpus("channel", corpus,
+                   CHANNEL_MAX_PERCENT + XCRUSH_EXTRA_PERCENT);
+    free_corpus(corpus);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xcrush_enc__repeats)
+{
+    struct packet *corpus;
+    int mppc_percent;
+
+    corpus_seed(5);
+    corpus = make_repeat_corpus();
+    ck_assert_ptr_nonnull(corpus);
+    mppc_percent = check_corpus(corpus, PROTO_RDP_50);
+    /* most of the second and later copies should go as matches */
+    compare_corpus("repeats", corpus, mppc_percent / 2);
+    free_corpus(corpus);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xcrush_enc__history_wraps)
+{
+    struct xrdp_mppc_enc *enc;
+    struct xcrush_dec *dec;
+    tui8 *data;
+    tui8 *out;
+    int at_front;
+    int index;
+    int pos;
+
+    corpus_seed(6);
+    enc = mppc_enc_new(PROTO_RDP_61);
+    ck_assert_ptr_nonnull(enc);
+    dec = g_new0(struct xcrush_dec, 1);
+    data = g_new(tui8, HIST_LEN);
+    out = g_new(tui8, HIST_LEN);
+    for (pos = 0; pos < HIST_LEN; pos++)
+    {
+        data[pos] = rnd(256);
+    }
+    /* more than the history holds, each packet partly noise and partly
+       what went before */
+    at_front = 0;
+    for (index = 0; index < 3 * XCRUSH_HIST_LEN / HIST_LEN; index++)
+    {
+        for (pos = rnd(HIST_LEN / 2); pos < HIST_LEN; pos += 1 + rnd(64))
+        {
+            data[pos] = rnd(256);
+        }
+        ck_assert_int_eq(compress_rdp(enc, data, HIST_LEN), 1);
+        ck_assert_int_le(enc->bytes_in_opb, HIST_LEN + 2);
+        if (index > 0 && (enc->outputBuffer[0] & L1_PACKET_AT_FRONT))
+        {
+            at_front++;
+        }
+        ck_assert_int_eq(decompress_rdp61(dec, (tui8 *) enc->outputBuffer,
+                                          enc->bytes_in_opb, out), HIST_LEN);
+        ck_assert_mem_eq(out, data, HIST_LEN);
+    }
+    ck_assert_int_ge(at_front, 2);
+    g_free(out);
+    g_free(data);
+    g_free(dec);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_mppc_enc(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("MppcEnc");
+
+    tc = tcase_create("mppc_enc");
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_mppc_enc__orders);
+    tcase_add_test(tc, test_mppc_enc__pointers);
+    tcase_add_test(tc, test_mppc_enc__channel);
+    tcase_add_test(tc, test_mppc_enc__incompressible);
+    tcase_add_test(tc, test_mppc_enc__worth_trying);
+    tcase_add_test(tc, test_xcrush_enc__vs_mppc);
+    tcase_add_test(tc, test_xcrush_enc__repeats);
+    tcase_add_test(tc, test_xcrush_enc__history_wraps);
+
+    return s;
+}
@@ -0,0 +1,419 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpegdi.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+#define RED 0xff0000
+#define GREEN 0x00ff00
+#define BLUE 0x0000ff
+
+/* for the random batches */
+#define SCREEN_SIZE 128
+#define RANDOM_BATCHES 3000
+#define RANDOM_ORDERS 200
+
+static struct xrdp_rdp *rdp_layer;
+static struct xrdp_orders *orders;
+static tui32 g_seed;
+static int expected[SCREEN_SIZE][SCREEN_SIZE];
+static int painted[SCREEN_SIZE][SCREEN_SIZE];
+
+/******************************************************************************/
+/* a batch already started, which is never sent */
+static void setup(void)
+{
+    rdp_layer = g_new0(struct xrdp_rdp, 1);
+    orders = g_new0(struct xrdp_orders, 1);
+    orders->rdp_layer = rdp_layer;
+    make_stream(orders->out_s);
+    init_stream(orders->out_s, 32 * 1024);
+    orders->order_count_ptr = orders->out_s->p;
+    orders->order_level = 1;
+    orders->orders_state.clip_right = 1;
+    orders->orders_state.clip_bottom = 1;
+}
+
+/******************************************************************************/
+static void teardown(void)
+{
+    free_stream(orders->out_s);
+    g_free(orders->orders_state.text_data);
+    g_free(orders);
+    g_free(rdp_layer);
+}
+
+/******************************************************************************/
+/* any order but a fill sends the fills, returns how many there were */
+static int
+fills_sent(void)
+{
+    int count;
+
+    count = orders->order_count;
+    ck_assert_int_eq(xrdp_orders_dest_blt(orders, 2000, 2000, 1, 1,
+                                          0x55, NULL), 0);
+    return orders->order_count - count - 1;
+}
+
+/******************************************************************************/
+START_TEST(test_orders_rect__held_back)
+{
+    ck_assert_int_eq(xrdp_orders_rect(orders, 10, 10, 20, 20, RED, NULL), 0);
+    ck_assert_int_eq(orders->order_count, 0);
+    ck_assert_int_eq(fills_sent(), 1);
+    ck_assert_int_eq(orders->orders_state.rect_x, 10);
+    ck_assert_int_eq(orders->orders_state.rect_color, RED);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_rect__painted_over)
+{
+    xrdp_orders_rect(orders, 10, 10, 20, 20, RED, NULL);
+    xrdp_orders_rect(orders, 50, 50, 20, 20, GREEN, NULL);
+    xrdp_orders_rect(orders, 0, 0, 100, 100, BLUE, NULL);
+    ck_assert_int_eq(fills_sent(), 1);
+    ck_assert_int_eq(orders->orders_state.rect_cx, 100);
+    ck_assert_int_eq(orders->orders_state.rect_color, BLUE);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_rect__merged)
+{
+    int y;
+
+    /* a box drawn a line at a time */
+    for (y = 0; y < 10; y++)
+    {
+        xrdp_orders_rect(orders, 0, y, 50, 1, GREEN, NULL);
+    }
+    ck_assert_int_eq(fills_sent(), 1);
+    ck_assert_int_eq(orders->orders_state.rect_cx, 50);
+    ck_assert_int_eq(orders->orders_state.rect_cy, 10);
+
+    /* not past a fill of another colour in the way */
+    xrdp_orders_rect(orders, 0, 0, 10, 10, GREEN, NULL);
+    xrdp_orders_rect(orders, 5, 5, 10, 10, RED, NULL);
+    xrdp_orders_rect(orders, 10, 0, 10, 10, GREEN, NULL);
+    ck_assert_int_eq(fills_sent(), 3);
+    ck_assert_int_eq(orders->orders_state.rect_x, 10);
+    ck_assert_int_eq(orders->orders_state.rect_color, GREEN);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_rect__overlaps_kept_in_order)
+{
+    /* blue at 0, 0 would take fewer bytes first, but it is over red */
+    xrdp_orders_rect(orders, 25, 25, 50, 50, RED, NULL);
+    xrdp_orders_rect(orders, 0, 0, 50, 50, BLUE, NULL);
+    ck_assert_int_eq(fills_sent(), 2);
+    ck_assert_int_eq(orders->orders_state.rect_x, 0);
+    ck_assert_int_eq(orders->orders_state.rect_color, BLUE);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_rect__clipped)
+{
+    struct xrdp_rect clip = { 10, 10, 20, 20 };
+
+    xrdp_orders_rect(orders, 0, 0, 100, 100, RED, &clip);
+    xrdp_orders_rect(orders, 30, 30, 10, 10, RED, &clip);
+    ck_assert_int_eq(fills_sent(), 1);
+    ck_assert_int_eq(orders->orders_state.rect_x, 10);
+    ck_assert_int_eq(orders->orders_state.rect_cx, 10);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_rect__opaque_orders)
+{
+    xrdp_orders_rect(orders, 10, 10, 20, 20, RED, NULL);
+    ck_assert_int_eq(xrdp_orders_mem_blt(orders, 0, 0, 0, 0, 100, 100, 0xcc,
+                                         0, 0, 0, NULL), 0);
+    ck_assert_int_eq(orders->order_count, 1);
+
+    /* a screen blt of all of it reads it first */
+    xrdp_orders_rect(orders, 10, 10, 20, 20, RED, NULL);
+    ck_assert_int_eq(xrdp_orders_screen_blt(orders, 0, 0, 100, 100, 5, 5,
+                                            0xcc, NULL), 0);
+    ck_assert_int_eq(orders->order_count, 3);
+
+    /* from an off screen surface, which may have been drawn to */
+    xrdp_orders_rect(orders, 10, 10, 20, 20, RED, NULL);
+    ck_assert_int_eq(xrdp_orders_mem_blt(orders, 255, 0, 0, 0, 100, 100,
+                                         0xcc, 0, 0, 0, NULL), 0);
+    ck_assert_int_eq(orders->order_count, 5);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_rect__nearest_first)
+{
+    int y;
+
+    /* two columns of different fills drawn a row at a time */
+    for (y = 0; y < 8; y++)
+    {
+        xrdp_orders_rect(orders, 0, y * 20, 10, 10, RED + y, NULL);
+        xrdp_orders_rect(orders, 1000, y * 20, 10, 10, BLUE + y, NULL);
+    }
+    ck_assert_int_eq(fills_sent(), 16);
+    /* down the first column with 1 byte deltas, across once and back up
+       the second, rather than 2 byte coordinates for every fill */
+    ck_assert_int_eq(orders->orders_state.rect_x, 1000);
+    ck_assert_int_eq(orders->orders_state.rect_y, 0);
+    ck_assert_int_lt(orders->out_s->p - orders->order_count_ptr, 16 * 6);
+}
+END_TEST
+
+/******************************************************************************/
+static int
+rnd(int range)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return (int) ((g_seed >> 8) % range);
+}
+
+/******************************************************************************/
+/* rop 0xf0 is a fill with color, others are the dest blt rops */
+static void
+paint(int (*screen)[SCREEN_SIZE], int x, int y, int cx, int cy, int rop,
+      int color, const struct xrdp_rect *clip)
+{
+    int i;
+    int j;
+
+    for (j = MAX(y, 0); j < MIN(y + cy, SCREEN_SIZE); j++)
+    {
+        for (i = MAX(x, 0); i < MIN(x + cx, SCREEN_SIZE); i++)
+        {
+            if (clip != NULL &&
+                    (i < clip->left || i >= clip->right ||
+                     j < clip->top || j >= clip->bottom))
+            {
+                continue;
+            }
+            switch (rop)
+            {
+                case 0xf0:
+                    screen[j][i] = color;
+                    break;
+                case 0x00:
+                    screen[j][i] = 0;
+                    break;
+                case 0xff:
+                    screen[j][i] = 0xffffff;
+                    break;
+                default: /* 0x55 */
+                    screen[j][i] ^= 0xffffff;
+                    break;
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+static void
+read_coord(struct stream *s, int delta, int *value)
+{
+    tsi8 d8;
+    tsi16 v16;
+
+    if (delta)
+    {
+        in_sint8(s, d8);
+        *value += d8;
+    }
+    else
+    {
+        in_sint16_le(s, v16);
+        *value = v16;
+    }
+}
+
+/******************************************************************************/
+/* paint what the client would from the orders in the batch, only
+   rects and dest blts without bounds are expected */
+static void
+paint_batch(void)
+{
+    struct stream ls;
+    struct stream *s;
+    int type;
+    int flags;
+    int present;
+    int delta;
+    int count;
+    int value;
+    int rect[4] = { 0, 0, 0, 0 };
+    int dest[4] = { 0, 0, 0, 0 };
+    int color;
+    int rop;
+    int index;
+
+    g_memset(&ls, 0, sizeof(ls));
+    s = &ls;
+    s->data = orders->order_count_ptr;
+    s->p = s->data;
+    s->end = orders->out_s->p;
+    type = 0;
+    color = 0;
+    rop = 0;
+    count = 0;
+    g_memset(painted, 0, sizeof(painted));
+    while (s_check_rem(s, 1))
+    {
+        in_uint8(s, flags);
+        ck_assert_int_eq(flags & (TS_STANDARD | TS_SECONDARY | TS_BOUNDS),
+                         TS_STANDARD);
+        if (flags & TS_TYPE_CHANGE)
+        {
+            in_uint8(s, type);
+        }
+        present = 0;
+        if (!(flags & TS_ZERO_FIELD_BYTE_BIT0))
+        {
+            in_uint8(s, present);
+        }
+        delta = flags & TS_DELTA_COORDINATES;
+        if (type == RDP_ORDER_RECT)
+        {
+            for (index = 0; index < 4; index++)
+            {
+                if (present & (1 << index))
+                {
+                    read_coord(s, delta, rect + index);
+                }
+            }
+            for (index = 0; index < 3; index++)
+            {
+                if (present & (0x10 << index))
+                {
+                    in_uint8(s, value);
+                    color = (color & ~(0xff << (index * 8))) |
+                            (value << (index * 8));
+                }
+            }
+            paint(painted, rect[0], rect[1], rect[2], rect[3], 0xf0, color,
+                  NULL);
+        }
+        else
+        {
+            ck_assert_int_eq(type, RDP_ORDER_DESTBLT);
+            for (index = 0; index < 4; index++)
+            {
+                if (present & (1 << index))
+                {
+                    read_coord(s, delta, dest + index);
+                }
+            }
+            if (present & 0x10)
+            {
+                in_uint8(s, rop);
+            }
+            paint(painted, dest[0], dest[1], dest[2], dest[3], rop, 0, NULL);
+        }
+        count++;
+    }
+    ck_assert_int_eq(count, orders->order_count);
+}
+
+/******************************************************************************/
+/* however the fills are dropped, merged and reordered, the client must
+   end up with the same pixels */
+START_TEST(test_orders_rect__random_batches)
+{
+    static const int rops[3] = { 0x00, 0xff, 0x55 };
+    struct xrdp_rect clip;
+    struct xrdp_rect *pclip;
+    int batch;
+    int num_orders;
+    int index;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int color;
+    int rop;
+
+    g_seed = 1;
+    for (batch = 0; batch < RANDOM_BATCHES; batch++)
+    {
+        if (batch > 0)
+        {
+            teardown();
+            setup();
+        }
+        g_memset(expected, 0, sizeof(expected));
+        num_orders = rnd(RANDOM_ORDERS);
+        for (index = 0; index < num_orders; index++)
+        {
+            x = rnd(SCREEN_SIZE) - 10;
+            y = rnd(SCREEN_SIZE) - 10;
+            cx = rnd(40) + 1;
+            /* plenty of lines, which can be merged */
+            cy = (rnd(3) == 0) ? rnd(3) + 1 : rnd(40) + 1;
+            if (rnd(10) < 7)
+            {
+                color = rnd(4) * 0x404040 + 1;
+                pclip = NULL;
+                if (rnd(4) == 0)
+                {
+                    clip.left = rnd(SCREEN_SIZE);
+                    clip.top = rnd(SCREEN_SIZE);
+                    clip.right = clip.left + rnd(60);
+                    clip.bottom = clip.top + rnd(60);
+                    pclip = &clip;
+                }
+                paint(expected, x, y, cx, cy, 0xf0, color, pclip);
+                ck_assert_int_eq(xrdp_orders_rect(orders, x, y, cx, cy,
+                                                  color, pclip), 0);
+            }
+            else
+            {
+                rop = rops[rnd(3)];
+                paint(expected, x, y, cx, cy, rop, 0, NULL);
+                ck_assert_int_eq(xrdp_orders_dest_blt(orders, x, y, cx, cy,
+                                                      rop, NULL), 0);
+            }
+        }
+        /* off screen, only sends the fills */
+        fills_sent();
+        paint_batch();
+        ck_assert_msg(g_memcmp(expected, painted, sizeof(painted)) == 0,
+                      "batch %d", batch);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_orders(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("Orders");
+
+    tc = tcase_create("xrdp_orders_rect");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_orders_rect__held_back);
+    tcase_add_test(tc, test_orders_rect__painted_over);
+    tcase_add_test(tc, test_orders_rect__merged);
+    tcase_add_test(tc, test_orders_rect__overlaps_kept_in_order);
+    tcase_add_test(tc, test_orders_rect__clipped);
+    tcase_add_test(tc, test_orders_rect__opaque_orders);
+    tcase_add_test(tc, test_orders_rect__nearest_first);
+    tcase_add_test(tc, test_orders_rect__random_batches);
+
+    return s;
+}
@@ -0,0 +1,184 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+#include "ms-rdpbcgr.h"
+
+#include "test_libxrdp.h"
+
+static struct xrdp_rdp *rdp_layer;
+static struct xrdp_session *session;
+
+static void setup(void)
+{
+    rdp_layer = (struct xrdp_rdp *)g_malloc(sizeof(struct xrdp_rdp), 1);
+    session = (struct xrdp_session *)g_malloc(sizeof(struct xrdp_session), 1);
+    session->rdp = rdp_layer;
+    session->client_info = &(rdp_layer->client_info);
+    session->client_info->cache1_entries = 600;
+    session->client_info->cache2_entries = 600;
+    session->client_info->cache3_entries = 4;
+    session->client_info->bitmap_cache_persist_mask = 7;
+}
+
+static void teardown(void)
+{
+    int index;
+
+    for (index = 0; index < XRDP_MAX_BITMAP_CACHE_ID; index++)
+    {
+        g_free(rdp_layer->persist_keys[index]);
+    }
+    g_free(session);
+    g_free(rdp_layer);
+}
+
+/* TS_BITMAPCACHE_PERSISTENT_LIST_PDU, keys for cache n are n:index */
+static struct stream *
+make_list(const int *num, const int *total, int first_index, int bit_mask)
+{
+    struct stream *s;
+    int cache_id;
+    int index;
+
+    make_stream(s);
+    init_stream(s, 8192);
+    for (cache_id = 0; cache_id < 5; cache_id++)
+    {
+        out_uint16_le(s, num[cache_id]);
+    }
+    for (cache_id = 0; cache_id < 5; cache_id++)
+    {
+        out_uint16_le(s, total[cache_id]);
+    }
+    out_uint8(s, bit_mask);
+    out_uint8s(s, 3);
+    for (cache_id = 0; cache_id < 5; cache_id++)
+    {
+        for (index = 0; index < num[cache_id]; index++)
+        {
+            out_uint32_le(s, first_index + index); /* key1 */
+            out_uint32_le(s, cache_id); /* key2 */
+        }
+    }
+    s_mark_end(s);
+    s->p = s->data;
+    return s;
+}
+
+START_TEST(test_persistent_list__single_pdu)
+{
+    const int num[5] = { 2, 0, 1, 0, 0 };
+    struct stream *s;
+    const tui64 *keys;
+    int count;
+
+    s = make_list(num, num, 0, PERSIST_FIRST_PDU | PERSIST_LAST_PDU);
+    ck_assert_int_eq(xrdp_rdp_process_persistent_list(rdp_layer, s), 0);
+    free_stream(s);
+
+    keys = libxrdp_get_persistent_keys(session, 0, &count);
+    ck_assert_int_eq(count, 2);
+    ck_assert(keys[0] == 0);
+    ck_assert(keys[1] == 1);
+    keys = libxrdp_get_persistent_keys(session, 1, &count);
+    ck_assert_int_eq(count, 0);
+    keys = libxrdp_get_persistent_keys(session, 2, &count);
+    ck_assert_int_eq(count, 1);
+    ck_assert(keys[0] == ((tui64) 2 << 32));
+    keys = libxrdp_get_persistent_keys(session, 3, &count);
+    ck_assert_ptr_null(keys);
+    ck_assert_int_eq(count, 0);
+}
+END_TEST
+
+START_TEST(test_persistent_list__split_over_pdus)
+{
+    const int total[5] = { 0, 300, 0, 0, 0 };
+    const int num[5] = { 0, 150, 0, 0, 0 };
+    struct stream *s;
+    const tui64 *keys;
+    int count;
+    int index;
+
+    s = make_list(num, total, 0, PERSIST_FIRST_PDU);
+    ck_assert_int_eq(xrdp_rdp_process_persistent_list(rdp_layer, s), 0);
+    free_stream(s);
+    s = make_list(num, total, 150, PERSIST_LAST_PDU);
+    ck_assert_int_eq(xrdp_rdp_process_persistent_list(rdp_layer, s), 0);
+    free_stream(s);
+
+    keys = libxrdp_get_persistent_keys(session, 1, &count);
+    ck_assert_int_eq(count, 300);
+    for (index = 0; index < count; index++)
+    {
+        ck_assert(keys[index] == (((tui64) 1 << 32) | index));
+    }
+}
+END_TEST
+
+START_TEST(test_persistent_list__limits)
+{
+    const int num[5] = { 3, 0, 8, 2, 2 };
+    struct stream *s;
+    int count;
+
+    /* cache 0 isn't persistent, cache 2 only has 4 entries */
+    session->client_info->bitmap_cache_persist_mask = 6;
+    s = make_list(num, num, 0, PERSIST_FIRST_PDU | PERSIST_LAST_PDU);
+    ck_assert_int_eq(xrdp_rdp_process_persistent_list(rdp_layer, s), 0);
+    free_stream(s);
+
+    ck_assert_ptr_null(libxrdp_get_persistent_keys(session, 0, &count));
+    ck_assert_int_eq(count, 0);
+    libxrdp_get_persistent_keys(session, 2, &count);
+    ck_assert_int_eq(count, 4);
+
+    /* nothing past the totals given in the first PDU is taken */
+    s = make_list(num, num, 0, PERSIST_FIRST_PDU);
+    ck_assert_int_eq(xrdp_rdp_process_persistent_list(rdp_layer, s), 0);
+    free_stream(s);
+    s = make_list(num, num, 0, 0);
+    ck_assert_int_eq(xrdp_rdp_process_persistent_list(rdp_layer, s), 0);
+    free_stream(s);
+    libxrdp_get_persistent_keys(session, 2, &count);
+    ck_assert_int_eq(count, 4);
+}
+END_TEST
+
+START_TEST(test_persistent_list__truncated)
+{
+    const int num[5] = { 2, 0, 0, 0, 0 };
+    struct stream *s;
+
+    s = make_list(num, num, 0, PERSIST_FIRST_PDU | PERSIST_LAST_PDU);
+    s->end -= 4;
+    ck_assert_int_ne(xrdp_rdp_process_persistent_list(rdp_layer, s), 0);
+    s->end = s->data + 20;
+    s->p = s->data;
+    ck_assert_int_ne(xrdp_rdp_process_persistent_list(rdp_layer, s), 0);
+    free_stream(s);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_rdp_persistent_list(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("PersistentList");
+
+    tc = tcase_create("xrdp_rdp_process_persistent_list");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_persistent_list__single_pdu);
+    tcase_add_test(tc, test_persistent_list__split_over_pdus);
+    tcase_add_test(tc, test_persistent_list__limits);
+    tcase_add_test(tc, test_persistent_list__truncated);
+
+    return s;
+}
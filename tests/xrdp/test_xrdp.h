@@ -6,7 +6,10 @@
 Suite *make_suite_test_bitmap_load(void);
 Suite *make_suite_test_keymap_load(void);
 Suite *make_suite_egfx_base_functions(void);
+Suite *make_suite_fb_diff(void);
 Suite *make_suite_region(void);
 Suite *make_suite_tconfig_load_gfx(void);
+Suite *make_suite_text_fragment(void);
+Suite *make_suite_tile_map(void);
 
 #endif /* TEST_XRDP_H */
@@ -0,0 +1,180 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for XRDP routines
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "xrdp_fb_diff.h"
+#include "test_xrdp.h"
+
+#define FB_WIDTH 200
+#define FB_HEIGHT 150
+#define FB_STRIDE (((FB_WIDTH + 63) & ~63) * 4)
+
+static char *g_fb;
+static struct xrdp_fb_diff *g_diff;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_fb = g_new0(char, FB_STRIDE * FB_HEIGHT);
+    g_diff = xrdp_fb_diff_create(FB_WIDTH, FB_HEIGHT);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    xrdp_fb_diff_delete(g_diff);
+    g_free(g_fb);
+}
+
+/******************************************************************************/
+static void
+set_pixel(int x, int y, tui32 pixel)
+{
+    ((tui32 *) (g_fb + y * FB_STRIDE))[x] = pixel;
+}
+
+/******************************************************************************/
+static void
+send_all(void)
+{
+    short rect[4] = { 0, 0, FB_WIDTH, FB_HEIGHT };
+
+    ck_assert_int_eq(xrdp_fb_diff_rect(g_diff, g_fb, FB_STRIDE, rect, 0), 1);
+}
+
+/******************************************************************************/
+START_TEST(test_fb_diff__first_frame_changed)
+{
+    short rect[4] = { 10, 10, 20, 20 };
+
+    /* nothing is known about the client yet */
+    ck_assert_int_eq(xrdp_fb_diff_rect(g_diff, g_fb, FB_STRIDE, rect,
+                                       XRDP_FB_DIFF_SHRINK), 1);
+    ck_assert_int_eq(rect[2], 20);
+    ck_assert_int_eq(rect[3], 20);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fb_diff__unchanged_dropped)
+{
+    short rects[8] = { 0, 0, 50, 50, 100, 100, 50, 50 };
+
+    send_all();
+    ck_assert_int_eq(xrdp_fb_diff_rects(g_diff, g_fb, FB_STRIDE, rects, 2,
+                                        XRDP_FB_DIFF_SHRINK), 0);
+    ck_assert_int_eq(g_diff->actual_pixels, FB_WIDTH * FB_HEIGHT);
+    ck_assert_int_eq(g_diff->reported_pixels,
+                     FB_WIDTH * FB_HEIGHT + 2 * 50 * 50);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fb_diff__shrink)
+{
+    short rects[8] = { 0, 0, 100, 100, 100, 100, 50, 50 };
+
+    send_all();
+    /* caret like change in the first rect only */
+    set_pixel(41, 20, 0xffffff);
+    set_pixel(42, 25, 0xffffff);
+    set_pixel(40, 30, 0xffffff);
+    ck_assert_int_eq(xrdp_fb_diff_rects(g_diff, g_fb, FB_STRIDE, rects, 2,
+                                        XRDP_FB_DIFF_SHRINK), 1);
+    ck_assert_int_eq(rects[0], 40);
+    ck_assert_int_eq(rects[1], 20);
+    ck_assert_int_eq(rects[2], 3);
+    ck_assert_int_eq(rects[3], 11);
+
+    /* stored frame was updated */
+    rects[0] = 0;
+    rects[1] = 0;
+    rects[2] = 100;
+    rects[3] = 100;
+    ck_assert_int_eq(xrdp_fb_diff_rects(g_diff, g_fb, FB_STRIDE, rects, 1,
+                                        XRDP_FB_DIFF_SHRINK), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fb_diff__no_copy)
+{
+    short rect[4] = { 0, 0, 64, 64 };
+
+    send_all();
+    set_pixel(63, 63, 1);
+    ck_assert_int_eq(xrdp_fb_diff_rect(g_diff, g_fb, FB_STRIDE, rect,
+                                       XRDP_FB_DIFF_NO_COPY), 1);
+    /* not shrunk and still different */
+    ck_assert_int_eq(rect[2], 64);
+    ck_assert_int_eq(xrdp_fb_diff_rect(g_diff, g_fb, FB_STRIDE, rect, 0), 1);
+    ck_assert_int_eq(xrdp_fb_diff_rect(g_diff, g_fb, FB_STRIDE, rect, 0), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fb_diff__invalidate)
+{
+    short rect[4] = { 70, 70, 10, 10 };
+
+    send_all();
+    xrdp_fb_diff_invalidate_rect(g_diff, 64, 64, 64, 64);
+    ck_assert_int_eq(xrdp_fb_diff_rect(g_diff, g_fb, FB_STRIDE, rect,
+                                       XRDP_FB_DIFF_SHRINK), 1);
+    /* only a part of the tile was sent, so it stays invalid */
+    ck_assert_int_eq(xrdp_fb_diff_rect(g_diff, g_fb, FB_STRIDE, rect, 0), 1);
+    rect[0] = 0;
+    rect[1] = 0;
+    rect[2] = 10;
+    rect[3] = 10;
+    ck_assert_int_eq(xrdp_fb_diff_rect(g_diff, g_fb, FB_STRIDE, rect, 0), 0);
+
+    xrdp_fb_diff_invalidate(g_diff);
+    ck_assert_int_eq(xrdp_fb_diff_rect(g_diff, g_fb, FB_STRIDE, rect, 0), 1);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_fb_diff(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("test_xrdp_fb_diff");
+
+    tc = tcase_create("xrdp_fb_diff");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_fb_diff__first_frame_changed);
+    tcase_add_test(tc, test_fb_diff__unchanged_dropped);
+    tcase_add_test(tc, test_fb_diff__shrink);
+    tcase_add_test(tc, test_fb_diff__no_copy);
+    tcase_add_test(tc, test_fb_diff__invalidate);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
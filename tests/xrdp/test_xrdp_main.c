@@ -57,8 +57,11 @@ int main (void)
     sr = srunner_create (make_suite_test_bitmap_load());
     srunner_add_suite(sr, make_suite_test_keymap_load());
     srunner_add_suite(sr, make_suite_egfx_base_functions());
+    srunner_add_suite(sr, make_suite_fb_diff());
     srunner_add_suite(sr, make_suite_region());
     srunner_add_suite(sr, make_suite_tconfig_load_gfx());
+    srunner_add_suite(sr, make_suite_text_fragment());
+    srunner_add_suite(sr, make_suite_tile_map());
 
     srunner_set_tap(sr, "-");
     srunner_run_all (sr, CK_ENV);
@@ -0,0 +1,219 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for XRDP routines
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "xrdp.h"
+#include "ms-rdpegdi.h"
+#include "test_xrdp.h"
+
+static struct xrdp_cache *cache;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    cache = g_new0(struct xrdp_cache, 1);
+    cache->frag_entries = 2;
+    cache->frag_size = 64;
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    g_free(cache);
+}
+
+/******************************************************************************/
+/* glyph indexes 'a'.. with a delta of 8 after each */
+static int
+make_run(char *data, int glyphs, char first)
+{
+    int index;
+
+    for (index = 0; index < glyphs; index++)
+    {
+        data[index * 2] = first + index;
+        data[index * 2 + 1] = 8;
+    }
+    return glyphs * 2;
+}
+
+/******************************************************************************/
+START_TEST(test_text_fragment__add_then_use)
+{
+    char data[64];
+    char copy[64];
+    int len;
+
+    len = make_run(data, 5, 'a');
+    g_memcpy(copy, data, len);
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     len + 3);
+    ck_assert_mem_eq(data, copy, len);
+    ck_assert_int_eq((tui8) data[len], GLYPH_FRAGMENT_ADD);
+    ck_assert_int_eq(data[len + 1], 0);
+    ck_assert_int_eq(data[len + 2], len);
+
+    /* the same again is a reference, with a zero delta */
+    make_run(data, 5, 'a');
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     3);
+    ck_assert_int_eq((tui8) data[0], GLYPH_FRAGMENT_USE);
+    ck_assert_int_eq(data[1], 0);
+    ck_assert_int_eq(data[2], 0);
+
+    /* not for another font */
+    make_run(data, 5, 'a');
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 2, 0x03, data, len),
+                     len + 3);
+    ck_assert_int_eq(data[len + 1], 1);
+
+    /* no delta after the reference when the glyphs are evenly spaced */
+    len = 5;
+    g_memcpy(data, "vwxyz", len);
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(
+                         cache, 3, 0x03 | SO_CHAR_INC_EQUAL_BM_BASE,
+                         data, len), len + 3);
+    g_memcpy(data, "vwxyz", len);
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(
+                         cache, 3, 0x03 | SO_CHAR_INC_EQUAL_BM_BASE,
+                         data, len), 2);
+    ck_assert_int_eq((tui8) data[0], GLYPH_FRAGMENT_USE);
+}
+END_TEST
+
+/******************************************************************************/
+/* as the painter does for each clip rectangle after the first */
+START_TEST(test_text_fragment__use_after_add_in_place)
+{
+    char data[64];
+    int len;
+
+    len = make_run(data, 4, 'k');
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     len + 3);
+    /* the run is still at the start, ahead of the add */
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     3);
+    ck_assert_int_eq((tui8) data[0], GLYPH_FRAGMENT_USE);
+    ck_assert_int_eq(data[1], 0);
+    ck_assert_int_eq(data[2], 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_text_fragment__least_recently_used_goes)
+{
+    char data[64];
+    int len;
+
+    len = make_run(data, 4, 'a');
+    xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len);
+    len = make_run(data, 4, 'b');
+    xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len);
+
+    /* use 'a', so 'b' is the oldest and makes way for 'c' */
+    len = make_run(data, 4, 'a');
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     3);
+    len = make_run(data, 4, 'c');
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     len + 3);
+    ck_assert_int_eq(data[len + 1], 1);
+
+    len = make_run(data, 4, 'a');
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     3);
+    ck_assert_int_eq(data[1], 0);
+    len = make_run(data, 4, 'b');
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     len + 3);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_text_fragment__left_alone)
+{
+    char data[300];
+    int len;
+
+    /* too short to be worth it */
+    len = make_run(data, 1, 'a');
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     len);
+
+    /* bigger than the client takes */
+    len = make_run(data, 40, 'a');
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     len);
+
+    /* already has a fragment in */
+    len = make_run(data, 4, 'a');
+    data[len++] = (char) GLYPH_FRAGMENT_USE;
+    data[len++] = 0;
+    data[len++] = 0;
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     len);
+
+    /* long deltas are stepped over */
+    len = make_run(data, 4, 'a');
+    data[1] = (char) 0x80;
+    data[2] = (char) 0xfe;
+    data[3] = 0x01;
+    data[4] = 'b';
+    data[5] = 8;
+    len = 6;
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     len + 3);
+
+    /* turned off */
+    cache->frag_entries = 0;
+    len = make_run(data, 4, 'd');
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(cache, 1, 0x03, data, len),
+                     len);
+    ck_assert_int_eq(xrdp_cache_add_text_fragment(NULL, 1, 0x03, data, len),
+                     len);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_text_fragment(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("test_xrdp_text_fragment");
+
+    tc = tcase_create("xrdp_cache_add_text_fragment");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_text_fragment__add_then_use);
+    tcase_add_test(tc, test_text_fragment__use_after_add_in_place);
+    tcase_add_test(tc, test_text_fragment__least_recently_used_goes);
+    tcase_add_test(tc, test_text_fragment__left_alone);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -0,0 +1,214 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Test driver for XRDP routines
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "xrdp_tile_map.h"
+#include "test_xrdp.h"
+
+/******************************************************************************/
+START_TEST(test_tile_map__add_and_test)
+{
+    struct xrdp_tile_map *map = xrdp_tile_map_create(1920, 1080);
+
+    ck_assert_ptr_ne(map, NULL);
+    ck_assert_int_eq(map->tiles_x, 30);
+    ck_assert_int_eq(map->tiles_y, 17);
+    ck_assert_int_eq(xrdp_tile_map_is_empty(map), 1);
+
+    /* touches tiles 1..2 across, 0..1 down */
+    xrdp_tile_map_add_rect(map, 100, 10, 50, 60);
+    ck_assert_int_eq(xrdp_tile_map_count(map), 4);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 64, 0), 1);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 191, 127), 1);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 192, 0), 0);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 0, 0), 0);
+
+    /* clipped to the map */
+    xrdp_tile_map_add_rect(map, 1900, 1070, 500, 500);
+    ck_assert_int_eq(xrdp_tile_map_count(map), 5);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 1919, 1079), 1);
+
+    xrdp_tile_map_clear(map);
+    ck_assert_int_eq(xrdp_tile_map_is_empty(map), 1);
+    xrdp_tile_map_delete(map);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_map__wide_rows)
+{
+    /* more than 64 tiles across uses two words per row */
+    struct xrdp_tile_map *map = xrdp_tile_map_create(8192, 64);
+
+    ck_assert_int_eq(map->words_per_row, 2);
+    xrdp_tile_map_add_rect(map, 60 * 64, 0, 10 * 64, 64);
+    ck_assert_int_eq(xrdp_tile_map_count(map), 10);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 63 * 64, 0), 1);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 64 * 64, 0), 1);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 70 * 64, 0), 0);
+
+    xrdp_tile_map_remove_rect(map, 62 * 64, 0, 4 * 64, 64);
+    ck_assert_int_eq(xrdp_tile_map_count(map), 6);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 64 * 64, 0), 0);
+    xrdp_tile_map_delete(map);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_map__remove_partial)
+{
+    struct xrdp_tile_map *map = xrdp_tile_map_create(100, 100);
+
+    xrdp_tile_map_add_rect(map, 0, 0, 100, 100);
+    ck_assert_int_eq(xrdp_tile_map_count(map), 4);
+
+    /* does not cover a whole tile */
+    xrdp_tile_map_remove_rect(map, 10, 10, 64, 64);
+    ck_assert_int_eq(xrdp_tile_map_count(map), 4);
+
+    /* edge tiles are only 36 pixels */
+    xrdp_tile_map_remove_rect(map, 64, 64, 36, 36);
+    ck_assert_int_eq(xrdp_tile_map_count(map), 3);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 99, 99), 0);
+    xrdp_tile_map_delete(map);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_map__set_operations)
+{
+    struct xrdp_tile_map *a = xrdp_tile_map_create(640, 480);
+    struct xrdp_tile_map *b = xrdp_tile_map_create(640, 480);
+    struct xrdp_tile_map *c = xrdp_tile_map_create(320, 480);
+
+    xrdp_tile_map_add_rect(a, 0, 0, 256, 64);
+    xrdp_tile_map_add_rect(b, 128, 0, 256, 64);
+
+    ck_assert_int_eq(xrdp_tile_map_intersect(a, c), 1);
+
+    ck_assert_int_eq(xrdp_tile_map_copy(c, a), 1);
+    ck_assert_int_eq(xrdp_tile_map_union(a, b), 0);
+    ck_assert_int_eq(xrdp_tile_map_count(a), 6);
+    ck_assert_int_eq(xrdp_tile_map_subtract(a, b), 0);
+    ck_assert_int_eq(xrdp_tile_map_count(a), 2);
+    ck_assert_int_eq(xrdp_tile_map_test(a, 64, 0), 1);
+    ck_assert_int_eq(xrdp_tile_map_test(a, 128, 0), 0);
+
+    xrdp_tile_map_add_rect(a, 0, 0, 640, 480);
+    ck_assert_int_eq(xrdp_tile_map_intersect(a, b), 0);
+    ck_assert_int_eq(xrdp_tile_map_count(a), 4);
+
+    xrdp_tile_map_delete(a);
+    xrdp_tile_map_delete(b);
+    xrdp_tile_map_delete(c);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_map__get_rects)
+{
+    struct xrdp_tile_map *map = xrdp_tile_map_create(1000, 1000);
+    short rects[4 * 8];
+    int count;
+
+    /* many small rects in one block come back as one */
+    xrdp_tile_map_add_rect(map, 0, 0, 10, 10);
+    xrdp_tile_map_add_rect(map, 70, 5, 10, 10);
+    xrdp_tile_map_add_rect(map, 5, 70, 10, 10);
+    xrdp_tile_map_add_rect(map, 100, 100, 10, 10);
+    count = xrdp_tile_map_get_rects(map, rects, 8);
+    ck_assert_int_eq(count, 1);
+    ck_assert_int_eq(rects[0], 0);
+    ck_assert_int_eq(rects[1], 0);
+    ck_assert_int_eq(rects[2], 128);
+    ck_assert_int_eq(rects[3], 128);
+
+    /* an L shape needs two, the bottom right edge is clipped */
+    xrdp_tile_map_clear(map);
+    xrdp_tile_map_add_rect(map, 0, 0, 64, 1000);
+    xrdp_tile_map_add_rect(map, 0, 960, 1000, 40);
+    count = xrdp_tile_map_get_rects(map, rects, 8);
+    ck_assert_int_eq(count, 2);
+    ck_assert_int_eq(rects[0], 0);
+    ck_assert_int_eq(rects[1], 0);
+    ck_assert_int_eq(rects[2], 64);
+    ck_assert_int_eq(rects[3], 960);
+    ck_assert_int_eq(rects[4], 0);
+    ck_assert_int_eq(rects[5], 960);
+    ck_assert_int_eq(rects[6], 1000);
+    ck_assert_int_eq(rects[7], 40);
+
+    /* not enough room */
+    count = xrdp_tile_map_get_rects(map, rects, 1);
+    ck_assert_int_eq(count, -1);
+    xrdp_tile_map_delete(map);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_tile_map__take_rows)
+{
+    struct xrdp_tile_map *map = xrdp_tile_map_create(640, 480);
+    struct xrdp_tile_map *out = xrdp_tile_map_create(640, 480);
+
+    /* 10 tiles per row */
+    xrdp_tile_map_add_rect(map, 0, 0, 640, 480);
+    ck_assert_int_eq(xrdp_tile_map_take_rows(map, out, 25), 20);
+    ck_assert_int_eq(xrdp_tile_map_count(out), 20);
+    ck_assert_int_eq(xrdp_tile_map_count(map), 60);
+    ck_assert_int_eq(xrdp_tile_map_test(out, 0, 127), 1);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 0, 127), 0);
+    ck_assert_int_eq(xrdp_tile_map_test(map, 0, 128), 1);
+
+    /* always at least one row */
+    ck_assert_int_eq(xrdp_tile_map_take_rows(map, out, 1), 10);
+    ck_assert_int_eq(xrdp_tile_map_test(out, 0, 0), 0);
+    ck_assert_int_eq(xrdp_tile_map_test(out, 0, 128), 1);
+
+    xrdp_tile_map_delete(map);
+    xrdp_tile_map_delete(out);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_tile_map(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("test_xrdp_tile_map");
+
+    tc = tcase_create("xrdp_tile_map");
+    tcase_add_test(tc, test_tile_map__add_and_test);
+    tcase_add_test(tc, test_tile_map__wide_rows);
+    tcase_add_test(tc, test_tile_map__remove_partial);
+    tcase_add_test(tc, test_tile_map__set_operations);
+    tcase_add_test(tc, test_tile_map__get_rects);
+    tcase_add_test(tc, test_tile_map__take_rows);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
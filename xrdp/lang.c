@@ -24,6 +24,8 @@
 #endif
 
 #include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
 
 #include "xrdp.h"
 #include "ms-rdpbcgr.h"
@@ -316,15 +318,40 @@ km_read_section(toml_table_t *tfile, const char *section_name,
     return 0;
 }
 
+/*****************************************************************************/
+static const struct xrdp_keymap *
+km_find_preloaded(const struct list *preloaded, int keylayout)
+{
+    const struct xrdp_preloaded_keymap *pk;
+    int index;
+
+    if (preloaded == NULL)
+    {
+        return NULL;
+    }
+    for (index = 0; index < preloaded->count; index++)
+    {
+        pk = (const struct xrdp_preloaded_keymap *)
+             list_get_item(preloaded, index);
+        if (pk->keylayout == keylayout)
+        {
+            return &(pk->keymap);
+        }
+    }
+    return NULL;
+}
+
 /*****************************************************************************/
 int
-get_keymaps(int keylayout, struct xrdp_keymap *keymap)
+get_keymaps(int keylayout, const struct list *preloaded,
+            struct xrdp_keymap *keymap)
 {
     int basic_key_layout = keylayout & 0x0000ffff;
     char filename[256];
     int layout_list[10];
     int layout_count = 0;
     int i;
+    const struct xrdp_keymap *found;
 
     /* Work out a list of layouts to try to load */
     layout_list[layout_count++] = keylayout; // Requested layout
@@ -341,6 +368,13 @@ get_keymaps(int keylayout, struct xrdp_keymap *keymap)
         g_snprintf(filename, sizeof(filename),
                    XRDP_CFG_PATH "/km-%08x.toml", layout_list[i]);
 
+        found = km_find_preloaded(preloaded, layout_list[i]);
+        if (found != NULL)
+        {
+            LOG(LOG_LEVEL_INFO, "Using preloaded keymap file %s", filename);
+            *keymap = *found;
+            return 0;
+        }
         if (km_load_file(filename, keymap) == 0)
         {
             return 0;
@@ -354,8 +388,9 @@ get_keymaps(int keylayout, struct xrdp_keymap *keymap)
 }
 
 /*****************************************************************************/
-int
-km_load_file(const char *filename, struct xrdp_keymap *keymap)
+/* parses a keymap file, logging only errors */
+static int
+km_parse_file(const char *filename, struct xrdp_keymap *keymap)
 {
     FILE *fp;
     toml_table_t *tfile;
@@ -376,7 +411,6 @@ km_load_file(const char *filename, struct xrdp_keymap *keymap)
     }
     else
     {
-        LOG(LOG_LEVEL_INFO, "Loading keymap file %s", filename);
         fclose(fp);
 
         /* Clear the whole keymap */
@@ -415,6 +449,69 @@ km_load_file(const char *filename, struct xrdp_keymap *keymap)
     return rv;
 }
 
+/*****************************************************************************/
+int
+km_load_file(const char *filename, struct xrdp_keymap *keymap)
+{
+    int rv;
+
+    rv = km_parse_file(filename, keymap);
+    if (rv == 0)
+    {
+        LOG(LOG_LEVEL_INFO, "Loading keymap file %s", filename);
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+int
+km_preload(struct list *preloaded)
+{
+    DIR *dir;
+    struct dirent *entry;
+    struct xrdp_preloaded_keymap *pk;
+    char filename[256];
+    char trailer[8];
+    unsigned int keylayout;
+
+    dir = opendir(XRDP_CFG_PATH);
+    if (dir == NULL)
+    {
+        LOG(LOG_LEVEL_WARNING, "km_preload: can't read %s (%s)",
+            XRDP_CFG_PATH, g_get_strerror());
+        return 1;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        /* km-XXXXXXXX.toml, as get_keymaps() names them */
+        if (g_strlen(entry->d_name) != 16 ||
+                sscanf(entry->d_name, "km-%8x%7s", &keylayout,
+                       trailer) != 2 ||
+                g_strcmp(trailer, ".toml") != 0 ||
+                km_find_preloaded(preloaded, (int) keylayout) != NULL)
+        {
+            continue;
+        }
+        pk = g_new(struct xrdp_preloaded_keymap, 1);
+        if (pk == NULL)
+        {
+            break;
+        }
+        g_snprintf(filename, sizeof(filename), XRDP_CFG_PATH "/%s",
+                   entry->d_name);
+        if (km_parse_file(filename, &(pk->keymap)) != 0)
+        {
+            g_free(pk);
+            continue;
+        }
+        pk->keylayout = (int) keylayout;
+        list_add_item(preloaded, (tintptr) pk);
+    }
+    closedir(dir);
+    LOG(LOG_LEVEL_DEBUG, "km_preload: %d keymaps", preloaded->count);
+    return 0;
+}
+
 /*****************************************************************************/
 void
 xrdp_init_xkb_layout(struct xrdp_client_info *client_info)
@@ -310,6 +310,16 @@ read_xrdp_ini_startup_params(struct xrdp_startup_params *startup_params)
                 }
             }
 
+            else if (g_strcasecmp(name, "listen_acceptors") == 0)
+            {
+                startup_params->listen_acceptors = g_atoi(val);
+            }
+
+            else if (g_strcasecmp(name, "prefork_workers") == 0)
+            {
+                startup_params->prefork_workers = g_atoi(val);
+            }
+
             else if (g_strcasecmp(name, "tcp_nodelay") == 0)
             {
                 startup_params->tcp_nodelay = g_text2bool(val);
@@ -730,6 +740,8 @@ main(int argc, char **argv)
         /* end of daemonizing code */
     }
 
+    /* before any connection is forked off, so all of them share the keys */
+    ssl_tls_ticket_keys_init();
     g_listen = xrdp_listen_create(&startup_params);
     if (xrdp_listen_init(g_listen) != 0)
     {
@@ -776,6 +788,7 @@ main(int argc, char **argv)
     }
 
     xrdp_listen_delete(g_listen);
+    ssl_tls_ticket_keys_deinit();
 
     tc_mutex_delete(g_get_sync_mutex());
     g_set_sync_mutex(0);
@@ -113,6 +113,9 @@ int
 xrdp_cache_add_brush(struct xrdp_cache *self,
                      char *brush_item_data);
 int
+xrdp_cache_add_text_fragment(struct xrdp_cache *self, int font, int flags,
+                             char *data, int data_len);
+int
 xrdp_cache_add_os_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
                          int rdpindex);
 int
@@ -205,6 +208,30 @@ void
 xrdp_process_delete(struct xrdp_process *self);
 int
 xrdp_process_main_loop(struct xrdp_process *self);
+/**
+ * Does the work that doesn't need the client ahead of the connection
+ *
+ * Creates the server trans without a socket and the libxrdp session, which
+ * reads xrdp.ini, and parses the keymaps, decodes the login images and
+ * loads the session modules. For a pre-forked worker.
+ *
+ * @param self Process from xrdp_process_create()
+ * @return 0 for success
+ */
+int
+xrdp_process_prepare(struct xrdp_process *self);
+/**
+ * Gives a prepared process its connection
+ *
+ * @param self Process from xrdp_process_prepare()
+ * @param sck Connected socket, the process closes it
+ * @param mode TRANS_MODE_* of the listener it came from
+ * @param in_size, out_size Stream sizes of the listener it came from
+ * @return 0 for success
+ */
+int
+xrdp_process_attach(struct xrdp_process *self, int sck, int mode,
+                    int in_size, int out_size);
 
 /* xrdp_listen.c */
 struct xrdp_listen *
@@ -263,11 +290,11 @@ xrdp_bitmap_get_child_by_id(struct xrdp_bitmap *self, int id);
 int
 xrdp_bitmap_set_focus(struct xrdp_bitmap *self, int focused);
 int
-xrdp_bitmap_hash_crc(struct xrdp_bitmap *self);
+xrdp_bitmap_hash(struct xrdp_bitmap *self);
 int
-xrdp_bitmap_copy_box_with_crc(struct xrdp_bitmap *self,
-                              struct xrdp_bitmap *dest,
-                              int x, int y, int cx, int cy);
+xrdp_bitmap_copy_box_with_hash(struct xrdp_bitmap *self,
+                               struct xrdp_bitmap *dest,
+                               int x, int y, int cx, int cy);
 int
 xrdp_bitmap_compare(struct xrdp_bitmap *self,
                     struct xrdp_bitmap *b);
@@ -319,6 +346,19 @@ xrdp_bitmap_load(struct xrdp_bitmap *self, const char *filename,
                  enum xrdp_bitmap_load_transform transform,
                  int twidth,
                  int theight);
+/**
+ * Decodes an image file ahead of xrdp_bitmap_load()
+ *
+ * @param filename Filename to load
+ * @return 0 for success.
+ *
+ * With imlib2 the decoded image is kept in imlib2's cache, and a later
+ * xrdp_bitmap_load() of the same unchanged file only converts it. The
+ * builtin loader converts for the bitmap's bpp as it reads, so there is
+ * nothing to keep and this does nothing.
+ */
+int
+xrdp_bitmap_preload(const char *filename);
 /* xrdp_painter.c */
 struct xrdp_painter *
 xrdp_painter_create(struct xrdp_wm *wm, struct xrdp_session *session);
@@ -449,12 +489,31 @@ char32_t
 get_char_from_kbd_event(int keyboard_flags, int key_code, int *keys,
                         int caps_lock, int num_lock, int scroll_lock,
                         struct xrdp_keymap *keymap);
+/**
+ * Load the keymap for a keyboard layout
+ *
+ * @param keylayout Layout the client asked for
+ * @param preloaded List of struct xrdp_preloaded_keymap* from km_preload()
+ *                  looked in before any file is read, or NULL
+ * @param keymap Keymap to fill in
+ */
 int
-get_keymaps(int keylayout, struct xrdp_keymap *keymap);
+get_keymaps(int keylayout, const struct list *preloaded,
+            struct xrdp_keymap *keymap);
 
 int
 km_load_file(const char *filename, struct xrdp_keymap *keymap);
 
+/**
+ * Parse every keymap file ahead of a connection
+ *
+ * @param preloaded List to add struct xrdp_preloaded_keymap* to, the list
+ *                  should free its items
+ * @return 0 for success
+ */
+int
+km_preload(struct list *preloaded);
+
 /**
  * initialise the XKB layout
  *
@@ -479,6 +538,14 @@ unsigned int
 xrdp_login_wnd_get_monitor_dpi(struct xrdp_wm *self);
 int
 xrdp_login_wnd_create(struct xrdp_wm *self);
+/**
+ * Decodes the login screen's background and logo ahead of a connection
+ *
+ * @param xrdp_ini Path to xrdp.ini
+ * @return 0 for success
+ */
+int
+xrdp_login_wnd_preload_images(const char *xrdp_ini);
 int
 load_xrdp_config(struct xrdp_config *config, const char *xrdp_ini, int bpp);
 void
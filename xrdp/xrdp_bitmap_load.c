@@ -707,6 +707,13 @@ xrdp_bitmap_load(struct xrdp_bitmap *self, const char *filename,
 
     return result;
 }
+
+/*****************************************************************************/
+int
+xrdp_bitmap_preload(const char *filename)
+{
+    return 0;
+}
 #endif /* USE_BUILTIN_LOADER */
 
 #ifdef USE_IMLIB2
@@ -1096,4 +1103,27 @@ xrdp_bitmap_load(struct xrdp_bitmap *self, const char *filename,
 
     return result;
 }
+
+/*****************************************************************************/
+int
+xrdp_bitmap_preload(const char *filename)
+{
+    Imlib_Load_Error lerr;
+    Imlib_Image img = imlib_load_image_with_error_return(filename, &lerr);
+
+    if (img == NULL)
+    {
+        log_imlib2_error(LOG_LEVEL_WARNING, filename, lerr);
+        return 1;
+    }
+    imlib_context_set_image(img);
+    /* imlib2 only reads the pixels when they're first asked for */
+    imlib_image_get_data_for_reading_only();
+    /* make room for it, a freed image stays cached while it fits */
+    imlib_set_cache_size(imlib_get_cache_size() +
+                         imlib_image_get_width() *
+                         imlib_image_get_height() * 4);
+    imlib_free_image();
+    return 0;
+}
 #endif /* USE_IMLIB2 */
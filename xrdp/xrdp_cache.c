@@ -24,8 +24,10 @@
 
 #include "xrdp.h"
 #include "log.h"
+#include "ms-rdpegdi.h"
 
-
+static void
+xrdp_cache_add_persist_keys(struct xrdp_cache *self);
 
 /*****************************************************************************/
 static int
@@ -63,23 +65,41 @@ xrdp_cache_reset_lru(struct xrdp_cache *self)
 
 /*****************************************************************************/
 static int
-xrdp_cache_reset_crc(struct xrdp_cache *self)
+xrdp_cache_reset_hash(struct xrdp_cache *self)
 {
     int index;
     int jndex;
 
     for (index = 0; index < XRDP_MAX_BITMAP_CACHE_ID; index++)
     {
-        for (jndex = 0; jndex < 64 * 1024; jndex++)
+        for (jndex = 0; jndex < XRDP_BITMAP_HASH_SIZE; jndex++)
         {
-            /* it's ok to deinit a zeroed out struct list16 */
-            list16_deinit(&(self->crc16[index][jndex]));
-            list16_init(&(self->crc16[index][jndex]));
+            self->bitmap_hash[index][jndex].cache_idx = -1;
         }
     }
     return 0;
 }
 
+/*****************************************************************************/
+static void
+xrdp_cache_set_frag_limits(struct xrdp_cache *self,
+                           struct xrdp_client_info *client_info)
+{
+    self->frag_entries = 0;
+    self->frag_size = 0;
+    if (client_info->use_glyph_frag_cache)
+    {
+        self->frag_entries = MIN(XRDP_MAX_FRAG_ENTRIES,
+                                 client_info->glyph_frag_entries);
+        self->frag_size = MIN(XRDP_MAX_FRAG_SIZE,
+                              client_info->glyph_frag_size);
+    }
+    if (self->frag_size < 4)
+    {
+        self->frag_entries = 0;
+    }
+}
+
 /*****************************************************************************/
 struct xrdp_cache *
 xrdp_cache_create(struct xrdp_wm *owner,
@@ -109,11 +129,14 @@ xrdp_cache_create(struct xrdp_wm *owner,
     self->cache3_size = client_info->cache3_size;
 
     self->bitmap_cache_persist_enable = client_info->bitmap_cache_persist_enable;
+    self->bitmap_cache_persist_mask = client_info->bitmap_cache_persist_mask;
     self->bitmap_cache_version = client_info->bitmap_cache_version;
     self->pointer_cache_entries = client_info->pointer_cache_entries;
+    xrdp_cache_set_frag_limits(self, client_info);
     self->xrdp_os_del_list = list_create();
     xrdp_cache_reset_lru(self);
-    xrdp_cache_reset_crc(self);
+    xrdp_cache_reset_hash(self);
+    xrdp_cache_add_persist_keys(self);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_create: 0 %d 1 %d 2 %d",
               self->cache1_entries, self->cache2_entries, self->cache3_entries);
     return self;
@@ -156,15 +179,6 @@ clear_all_cached_items(struct xrdp_cache *self)
     }
 
     list_delete(self->xrdp_os_del_list);
-
-    /* free all crc lists */
-    for (i = 0; i < XRDP_MAX_BITMAP_CACHE_ID; i++)
-    {
-        for (j = 0; j < 64 * 1024; j++)
-        {
-            list16_deinit(&(self->crc16[i][j]));
-        }
-    }
 }
 
 /*****************************************************************************/
@@ -201,18 +215,122 @@ xrdp_cache_reset(struct xrdp_cache *self,
     self->cache3_entries = client_info->cache3_entries;
     self->cache3_size = client_info->cache3_size;
     self->bitmap_cache_persist_enable = client_info->bitmap_cache_persist_enable;
+    self->bitmap_cache_persist_mask = client_info->bitmap_cache_persist_mask;
     self->bitmap_cache_version = client_info->bitmap_cache_version;
     self->pointer_cache_entries = client_info->pointer_cache_entries;
+    xrdp_cache_set_frag_limits(self, client_info);
     xrdp_cache_reset_lru(self);
-    xrdp_cache_reset_crc(self);
+    xrdp_cache_reset_hash(self);
     return 0;
 }
 
-#define COMPARE_WITH_CRC32(_b1, _b2) \
-    ((_b1->crc32 == _b2->crc32) && \
+#define COMPARE_WITH_HASH(_b1, _b2) \
+    ((_b1->hash == _b2->hash) && \
      (_b1->bpp == _b2->bpp) && \
      (_b1->width == _b2->width) && (_b1->height == _b2->height))
 
+#define HASH_SLOT(_hash) ((int) ((_hash) & (XRDP_BITMAP_HASH_SIZE - 1)))
+
+/*****************************************************************************/
+/* returns the cache_idx of a cached bitmap the same as bitmap, or -1 */
+static int
+xrdp_cache_hash_find(struct xrdp_cache *self, int cache_id,
+                     struct xrdp_bitmap *bitmap)
+{
+    struct xrdp_bitmap_hash_item *table;
+    struct xrdp_bitmap_item *item;
+    struct xrdp_bitmap *lbm;
+    int slot;
+
+    table = self->bitmap_hash[cache_id];
+    for (slot = HASH_SLOT(bitmap->hash); table[slot].cache_idx != -1;
+            slot = HASH_SLOT(slot + 1))
+    {
+        if (table[slot].hash == bitmap->hash)
+        {
+            item = &(self->bitmap_items[cache_id][table[slot].cache_idx]);
+            lbm = item->bitmap;
+            if (lbm == NULL)
+            {
+                /* a persistent key has no bitmap to compare, but the
+                   size and bpp went into the hash seed */
+                if (item->has_persist_key)
+                {
+                    return table[slot].cache_idx;
+                }
+            }
+            else if (COMPARE_WITH_HASH(lbm, bitmap))
+            {
+                return table[slot].cache_idx;
+            }
+        }
+    }
+    return -1;
+}
+
+/*****************************************************************************/
+static void
+xrdp_cache_hash_add(struct xrdp_cache *self, int cache_id, tui64 hash,
+                    int cache_idx)
+{
+    struct xrdp_bitmap_hash_item *table;
+    int slot;
+
+    /* there are always empty slots, the table is more than twice the
+       size of the cache */
+    table = self->bitmap_hash[cache_id];
+    for (slot = HASH_SLOT(hash); table[slot].cache_idx != -1;
+            slot = HASH_SLOT(slot + 1))
+    {
+    }
+    table[slot].hash = hash;
+    table[slot].cache_idx = cache_idx;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+xrdp_cache_hash_remove(struct xrdp_cache *self, int cache_id, tui64 hash,
+                       int cache_idx)
+{
+    struct xrdp_bitmap_hash_item *table;
+    int slot;
+    int next;
+    int home;
+
+    table = self->bitmap_hash[cache_id];
+    for (slot = HASH_SLOT(hash); table[slot].cache_idx != cache_idx;
+            slot = HASH_SLOT(slot + 1))
+    {
+        if (table[slot].cache_idx == -1)
+        {
+            return 1;
+        }
+    }
+    /* move back any later entry that can no longer be reached past the
+       hole, so lookups can stop at the first empty slot */
+    next = slot;
+    for (;;)
+    {
+        next = HASH_SLOT(next + 1);
+        if (table[next].cache_idx == -1)
+        {
+            break;
+        }
+        home = HASH_SLOT(table[next].hash);
+        /* is home cyclically in (slot, next]? then it stays */
+        if (slot <= next ? (slot < home && home <= next) :
+                (slot < home || home <= next))
+        {
+            continue;
+        }
+        table[slot] = table[next];
+        slot = next;
+    }
+    table[slot].cache_idx = -1;
+    return 0;
+}
+
 /*****************************************************************************/
 static int
 xrdp_cache_update_lru(struct xrdp_cache *self, int cache_id, int lru_index)
@@ -283,34 +401,89 @@ xrdp_cache_update_lru(struct xrdp_cache *self, int cache_id, int lru_index)
     return 0;
 }
 
+/*****************************************************************************/
+/* the lru list starts out covering XRDP_MAX_BITMAP_CACHE_IDX entries, cut
+   it down to the size of the client's cache */
+static void
+xrdp_cache_trim_lru(struct xrdp_cache *self, int cache_id, int cache_entries)
+{
+    int index;
+    struct xrdp_lru_item *llru;
+
+    if (self->lru_reset[cache_id])
+    {
+        self->lru_reset[cache_id] = 0;
+        LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_cache_trim_lru: reset detected cache_id %d",
+                  cache_id);
+        self->lru_tail[cache_id] = cache_entries - 1;
+        index = self->lru_tail[cache_id];
+        llru = &(self->bitmap_lrus[cache_id][index]);
+        llru->next = -1;
+    }
+}
+
+/*****************************************************************************/
+/* fill the cache index with the keys the client loaded from its
+   persistent bitmap cache, a bitmap hashing to one of these is not sent */
+static void
+xrdp_cache_add_persist_keys(struct xrdp_cache *self)
+{
+    const tui64 *keys;
+    struct xrdp_bitmap_item *item;
+    int cache_entries[XRDP_MAX_BITMAP_CACHE_ID];
+    int cache_id;
+    int cache_idx;
+    int count;
+
+    cache_entries[0] = self->cache1_entries;
+    cache_entries[1] = self->cache2_entries;
+    cache_entries[2] = self->cache3_entries;
+    for (cache_id = 0; cache_id < XRDP_MAX_BITMAP_CACHE_ID; cache_id++)
+    {
+        keys = libxrdp_get_persistent_keys(self->session, cache_id, &count);
+        count = MIN(count, cache_entries[cache_id]);
+        if ((keys == NULL) || (count < 1))
+        {
+            continue;
+        }
+        xrdp_cache_trim_lru(self, cache_id, cache_entries[cache_id]);
+        for (cache_idx = 0; cache_idx < count; cache_idx++)
+        {
+            item = &(self->bitmap_items[cache_id][cache_idx]);
+            item->has_persist_key = 1;
+            item->persist_key = keys[cache_idx];
+            item->lru_index = cache_idx;
+            xrdp_cache_hash_add(self, cache_id, keys[cache_idx], cache_idx);
+            /* so empty entries are used up first */
+            xrdp_cache_update_lru(self, cache_id, cache_idx);
+        }
+        LOG(LOG_LEVEL_INFO, "xrdp_cache_add_persist_keys: %d keys for "
+            "cache_id %d", count, cache_id);
+    }
+}
+
 /*****************************************************************************/
 /* returns cache id */
 int
 xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
                       int hints)
 {
-    int index;
-    int jndex;
     int cache_id;
     int cache_idx;
     int bmp_size;
     int e;
     int Bpp;
-    int crc16;
-    int iig;
-    int found;
     int cache_entries;
     int lru_index;
-    struct list16 *ll;
+    tui64 key;
     struct xrdp_bitmap *lbm;
-    struct xrdp_lru_item *llru;
+    struct xrdp_bitmap_item *item;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap:");
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap: crc16 0x%4.4x",
-              bitmap->crc16);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap: hash 0x%16.16llx",
+              (unsigned long long) bitmap->hash);
 
     e = (4 - (bitmap->width % 4)) & 3;
-    found = 0;
     cache_id = 0;
     cache_entries = 0;
 
@@ -341,24 +514,25 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
         return 0;
     }
 
-    crc16 = bitmap->crc16;
-    ll = &(self->crc16[cache_id][crc16]);
-    for (jndex = 0; jndex < ll->count; jndex++)
+    cache_idx = xrdp_cache_hash_find(self, cache_id, bitmap);
+    if (cache_idx != -1)
     {
-        cache_idx = list16_get_item(ll, jndex);
-        lbm = self->bitmap_items[cache_id][cache_idx].bitmap;
-        if ((lbm != NULL) && COMPARE_WITH_CRC32(lbm, bitmap))
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "found bitmap at %d %d", cache_id, cache_idx);
+        item = &(self->bitmap_items[cache_id][cache_idx]);
+        lru_index = item->lru_index;
+        item->stamp = self->bitmap_stamp;
+        if (item->bitmap == NULL)
         {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "found bitmap at %d %d", cache_idx, jndex);
-            found = 1;
-            break;
+            /* the client has this one from disk, keep it for comparing */
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "persistent key hit at %d %d",
+                      cache_id, cache_idx);
+            item->bitmap = bitmap;
+            item->has_persist_key = 0;
+        }
+        else
+        {
+            xrdp_bitmap_delete(bitmap);
         }
-    }
-    if (found)
-    {
-        lru_index = self->bitmap_items[cache_id][cache_idx].lru_index;
-        self->bitmap_items[cache_id][cache_idx].stamp = self->bitmap_stamp;
-        xrdp_bitmap_delete(bitmap);
 
         /* update lru to end */
         xrdp_cache_update_lru(self, cache_id, lru_index);
@@ -369,16 +543,7 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
     /* find lru */
 
     /* check for reset */
-    if (self->lru_reset[cache_id])
-    {
-        self->lru_reset[cache_id] = 0;
-        LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_cache_add_bitmap: reset detected cache_id %d",
-                  cache_id);
-        self->lru_tail[cache_id] = cache_entries - 1;
-        index = self->lru_tail[cache_id];
-        llru = &(self->bitmap_lrus[cache_id][index]);
-        llru->next = -1;
-    }
+    xrdp_cache_trim_lru(self, cache_id, cache_entries);
 
     /* lru is item at head */
     lru_index = self->lru_head[cache_id];
@@ -394,20 +559,22 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
               self->bitmap_items[cache_id][cache_idx].bitmap,
               bitmap);
 
-    /* remove old, about to be deleted, from crc16 list */
-    lbm = self->bitmap_items[cache_id][cache_idx].bitmap;
+    /* remove old, about to be deleted, from hash table */
+    item = &(self->bitmap_items[cache_id][cache_idx]);
+    lbm = item->bitmap;
+    if ((lbm == 0) && item->has_persist_key)
+    {
+        xrdp_cache_hash_remove(self, cache_id, item->persist_key, cache_idx);
+        item->has_persist_key = 0;
+    }
     if (lbm != 0)
     {
-        crc16 = lbm->crc16;
-        ll = &(self->crc16[cache_id][crc16]);
-        iig = list16_index_of(ll, cache_idx);
-        if (iig == -1)
+        if (xrdp_cache_hash_remove(self, cache_id, lbm->hash, cache_idx) != 0)
         {
             LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_cache_add_bitmap: error removing cache_idx");
         }
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap: removing index %d from crc16 %d",
-                  iig, crc16);
-        list16_remove_item(ll, iig);
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap: removing index %d "
+                  "hash 0x%16.16llx", cache_idx, (unsigned long long) lbm->hash);
         xrdp_bitmap_delete(lbm);
     }
 
@@ -417,13 +584,14 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
     self->bitmap_items[cache_id][cache_idx].stamp = self->bitmap_stamp;
     self->bitmap_items[cache_id][cache_idx].lru_index = lru_index;
 
-    /* add to crc16 list */
-    crc16 = bitmap->crc16;
-    ll = &(self->crc16[cache_id][crc16]);
-    list16_add_item(ll, cache_idx);
-    if (ll->count > 1)
+    /* add to hash table */
+    xrdp_cache_hash_add(self, cache_id, bitmap->hash, cache_idx);
+
+    /* have the client keep it on disk under its hash */
+    key = 0;
+    if (self->bitmap_cache_persist_mask & (1 << cache_id))
     {
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap: count %d", ll->count);
+        key = bitmap->hash;
     }
 
     if (self->use_bitmap_comp)
@@ -444,7 +612,7 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
             libxrdp_orders_send_bitmap2(self->session, bitmap->width,
                                         bitmap->height, bitmap->bpp,
                                         bitmap->data, cache_id, cache_idx,
-                                        hints);
+                                        hints, key);
         }
         else if (self->bitmap_cache_version & 1)
         {
@@ -459,7 +627,8 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
         {
             libxrdp_orders_send_raw_bitmap2(self->session, bitmap->width,
                                             bitmap->height, bitmap->bpp,
-                                            bitmap->data, cache_id, cache_idx);
+                                            bitmap->data, cache_id, cache_idx,
+                                            key);
         }
         else if (self->bitmap_cache_version & 1)
         {
@@ -593,6 +762,100 @@ xrdp_cache_add_char(struct xrdp_cache *self,
     return MAKELONG(c, f);
 }
 
+/*****************************************************************************/
+/* data is the glyph data of a text order, an index for each glyph, each
+   followed by a delta unless flags has SO_CHAR_INC_EQUAL_BM_BASE. If the
+   same run was sent before with the same font it is changed to a
+   reference to the client's copy, otherwise the run is added to the
+   client's fragment cache as it is sent. data must have room for 3 more
+   bytes. Only call this when the order will be sent.
+   returns the new length of data */
+int
+xrdp_cache_add_text_fragment(struct xrdp_cache *self, int font, int flags,
+                             char *data, int data_len)
+{
+    struct xrdp_frag_item *item;
+    int has_delta;
+    int index;
+    int oldest;
+    int i;
+
+    /* a reference is 3 bytes, and the add has to fit in the order's
+       one byte length too */
+    if ((self == 0) || (self->frag_entries < 1) || (data_len < 4) ||
+            (data_len > self->frag_size) || (data_len > 255 - 3))
+    {
+        return data_len;
+    }
+
+    /* leave it if it already has fragments in */
+    has_delta = !(flags & SO_CHAR_INC_EQUAL_BM_BASE);
+    i = 0;
+    while (i < data_len)
+    {
+        if ((tui8) data[i] >= GLYPH_FRAGMENT_USE)
+        {
+            return data_len;
+        }
+        i++;
+        if (has_delta)
+        {
+            i += ((i < data_len) && ((tui8) data[i] == 0x80)) ? 3 : 1;
+        }
+    }
+    if (i != data_len)
+    {
+        return data_len;
+    }
+
+    self->frag_stamp++;
+
+    /* look for match */
+    for (i = 0; i < self->frag_entries; i++)
+    {
+        item = &(self->frag_items[i]);
+        if ((item->stamp != 0) && (item->font == font) &&
+                (item->size == data_len) &&
+                (g_memcmp(item->data, data, data_len) == 0))
+        {
+            item->stamp = self->frag_stamp;
+            LOG_DEVEL(LOG_LEVEL_TRACE, "found fragment at %d", i);
+            data[0] = (char) GLYPH_FRAGMENT_USE;
+            data[1] = i;
+            if (has_delta)
+            {
+                data[2] = 0;
+                return 3;
+            }
+            return 2;
+        }
+    }
+
+    /* look for oldest */
+    index = 0;
+    oldest = 0x7fffffff;
+
+    for (i = 0; i < self->frag_entries; i++)
+    {
+        if (self->frag_items[i].stamp < oldest)
+        {
+            oldest = self->frag_items[i].stamp;
+            index = i;
+        }
+    }
+
+    item = &(self->frag_items[index]);
+    item->stamp = self->frag_stamp;
+    item->font = font;
+    item->size = data_len;
+    g_memcpy(item->data, data, data_len);
+    LOG_DEVEL(LOG_LEVEL_TRACE, "adding fragment at %d", index);
+    data[data_len] = (char) GLYPH_FRAGMENT_ADD;
+    data[data_len + 1] = index;
+    data[data_len + 2] = data_len;
+    return data_len + 3;
+}
+
 /*****************************************************************************/
 /* added the pointer to the cache and send it to client, it also sets the
    client if it finds it
@@ -56,6 +56,17 @@
 #define MIN_XRDP_GFX_MAX_COMPRESSED_BYTES (64 * 1024)
 #define MAX_XRDP_GFX_MAX_COMPRESSED_BYTES (256 * 1024 * 1024)
 
+/* bandwidth estimator, enabled with env var XRDP_GFX_ADAPTIVE_BITRATE */
+#define XRDP_BW_WINDOW_MS 1000
+#define XRDP_BW_MIN_KBPS 256
+#define XRDP_BW_MAX_KBPS (100 * 1000)
+
+/* frame compare, enabled with env var XRDP_FB_DIFF */
+#define XRDP_FB_DIFF_STRIDE(_width) ((((_width) + 63) & ~63) * 4)
+
+/* first paint, enabled with env var XRDP_GFX_FIRST_PAINT */
+#define XRDP_FIRST_PAINT_CRF 38
+
 #define XRDP_SURCMD_PREFIX_BYTES 256
 #define OUT_DATA_BYTES_DEFAULT_SIZE (16 * 1024 * 1024)
 
@@ -138,8 +149,12 @@ xrdp_encoder_create(struct xrdp_mm *mm)
 
     struct xrdp_encoder *self;
     struct xrdp_client_info *client_info;
+    struct monitor_info *mi;
+    const char *env_var;
     char buf[1024];
     int pid;
+    int index;
+    int count;
 
     client_info = mm->wm->client_info;
 
@@ -316,7 +331,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     self->xrdp_encoder_term_done = g_create_wait_obj(buf);
     if (client_info->gfx)
     {
-        const char *env_var = g_getenv("XRDP_GFX_FRAMES_IN_FLIGHT");
+        env_var = g_getenv("XRDP_GFX_FRAMES_IN_FLIGHT");
         self->frames_in_flight = DEFAULT_XRDP_GFX_FRAMES_IN_FLIGHT;
         if (env_var != NULL)
         {
@@ -365,12 +380,81 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     /* make sure frames_in_flight is at least 1 */
     self->frames_in_flight = MAX(self->frames_in_flight, 1);
 
+    if (self->gfx)
+    {
+        /* geometry is copied here as the encoder thread must not look
+           at client_info */
+        count = client_info->display_sizes.monitorCount;
+        if (count < 1)
+        {
+            self->prewarm[0].cx = mm->wm->screen->width;
+            self->prewarm[0].cy = mm->wm->screen->height;
+            self->num_prewarm = 1;
+        }
+        for (index = 0; index < count && index < 16; index++)
+        {
+            mi = client_info->display_sizes.minfo_wm + index;
+            self->prewarm[index].x = mi->left;
+            self->prewarm[index].y = mi->top;
+            self->prewarm[index].cx = mi->right - mi->left + 1;
+            self->prewarm[index].cy = mi->bottom - mi->top + 1;
+            self->num_prewarm = index + 1;
+        }
+    }
+    self->start_time = g_time3();
+
+    env_var = g_getenv("XRDP_FB_DIFF");
+    self->fb_diff_enabled = (env_var != NULL) && g_text2bool(env_var);
+
+    env_var = g_getenv("XRDP_GFX_FIRST_PAINT");
+    self->first_paint_enabled = self->gfx && (env_var != NULL) &&
+                                g_text2bool(env_var);
+
+    env_var = g_getenv("XRDP_GFX_ADAPTIVE_BITRATE");
+    self->bw_adaptive = (env_var != NULL) && g_text2bool(env_var);
+    if (self->bw_adaptive)
+    {
+        LOG(LOG_LEVEL_INFO, "xrdp_encoder_create: "
+            "XRDP_GFX_ADAPTIVE_BITRATE set, adapting H.264 bitrate");
+    }
+    self->bw_window_start = g_time3();
+
     /* create thread to process messages */
     tc_thread_create(proc_enc_msg, self);
 
     return self;
 }
 
+/*****************************************************************************/
+/* logs how much of the damage the module reported really changed */
+static void
+xrdp_encoder_fb_diff_report(struct xrdp_encoder *self)
+{
+    struct xrdp_fb_diff *diff;
+    tui64 reported;
+    tui64 actual;
+    int index;
+
+    reported = 0;
+    actual = 0;
+    for (index = -1; index < 16; index++)
+    {
+        diff = (index < 0) ? self->fb_diff_sc : self->fb_diff_gfx[index];
+        if (diff != NULL)
+        {
+            reported += diff->reported_pixels;
+            actual += diff->actual_pixels;
+        }
+    }
+    if (reported > 0)
+    {
+        LOG(LOG_LEVEL_INFO, "xrdp_encoder_delete: frame compare, damage "
+            "reported %llu pixels, changed %llu pixels (%d%%)",
+            (unsigned long long) reported, (unsigned long long) actual,
+            (int) (actual * 100 / reported));
+    }
+}
+
 /*****************************************************************************/
 void
 xrdp_encoder_delete(struct xrdp_encoder *self)
@@ -441,6 +525,21 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
     fifo_delete(self->fifo_to_proc, NULL);
     fifo_delete(self->fifo_processed, NULL);
     tc_mutex_delete(self->mutex);
+    for (index = 0; index < 16; index++)
+    {
+        xrdp_tile_map_delete(self->lq_tiles[index]);
+    }
+    xrdp_tile_map_delete(self->refine_tiles);
+    xrdp_tile_map_delete(self->region_tiles);
+    if (self->fb_diff_enabled)
+    {
+        xrdp_encoder_fb_diff_report(self);
+    }
+    xrdp_fb_diff_delete(self->fb_diff_sc);
+    for (index = 0; index < 16; index++)
+    {
+        xrdp_fb_diff_delete(self->fb_diff_gfx[index]);
+    }
     g_free(self);
 }
 
@@ -541,6 +640,62 @@ process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
 }
 
 #ifdef XRDP_RFXCODEC
+/*****************************************************************************/
+/* called from encoder thread, returns the frame store for a surface,
+   creating it if needed */
+static struct xrdp_fb_diff *
+fb_diff_get(struct xrdp_fb_diff **diff, int width, int height)
+{
+    if ((*diff != NULL) &&
+            (((*diff)->width != width) || ((*diff)->height != height)))
+    {
+        xrdp_fb_diff_delete(*diff);
+        *diff = NULL;
+    }
+    if (*diff == NULL)
+    {
+        *diff = xrdp_fb_diff_create(width, height);
+    }
+    return *diff;
+}
+
+/*****************************************************************************/
+/* called from encoder thread, drops the tiles that did not change since
+   the last frame and cuts the damage rects down to what changed */
+static void
+process_enc_rfx_fb_diff(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    struct xrdp_fb_diff *diff;
+    int stride;
+
+    diff = fb_diff_get(&self->fb_diff_sc, enc->u.sc.width, enc->u.sc.height);
+    if (diff == NULL)
+    {
+        return;
+    }
+    if ((int)enc->flags & KEY_FRAME_REQUESTED)
+    {
+        xrdp_fb_diff_invalidate(diff);
+    }
+    stride = XRDP_FB_DIFF_STRIDE(enc->u.sc.width);
+    /* tiles first, the damage rects pass updates the stored frame */
+    enc->u.sc.num_crects =
+        xrdp_fb_diff_rects(diff, enc->u.sc.data, stride,
+                           enc->u.sc.crects, enc->u.sc.num_crects,
+                           XRDP_FB_DIFF_NO_COPY | XRDP_FB_DIFF_NO_COUNT);
+    enc->u.sc.num_drects =
+        xrdp_fb_diff_rects(diff, enc->u.sc.data, stride,
+                           enc->u.sc.drects, enc->u.sc.num_drects,
+                           XRDP_FB_DIFF_SHRINK);
+    if (enc->u.sc.num_drects < 1)
+    {
+        /* any change left in the tiles was not reported yet */
+        enc->u.sc.num_crects = 0;
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_rfx_fb_diff: num_crects %d "
+              "num_drects %d", enc->u.sc.num_crects, enc->u.sc.num_drects);
+}
+
 /*****************************************************************************/
 /* called from encoder thread */
 static int
@@ -575,6 +730,11 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     mutex = self->mutex;
     event_processed = self->xrdp_encoder_event_processed;
 
+    if (self->fb_diff_enabled)
+    {
+        process_enc_rfx_fb_diff(self, enc);
+    }
+
     all_tiles_written = 0;
     encode_passes = 0;
     do
@@ -758,6 +918,46 @@ out_RFX_AVC420_METABLOCK(struct xrdp_egfx_rect *dst_rect,
 
 #define AVC444 1
 
+/*****************************************************************************/
+/* called from encoder thread, picks the region rects for the metablock,
+   more than 15 damage rects are merged on the tile grid and the copy
+   rects are only used if that is still too many */
+static int
+build_region_rects(struct xrdp_encoder *self, XRDP_ENC_DATA *enc,
+                   int width, int height, short **rrects)
+{
+    int rcount;
+
+    rcount = enc->u.sc.num_drects;
+    *rrects = enc->u.sc.drects;
+    if (rcount <= 15)
+    {
+        return rcount;
+    }
+    if ((self->region_tiles == NULL) ||
+            (self->region_tiles->width != width) ||
+            (self->region_tiles->height != height))
+    {
+        xrdp_tile_map_delete(self->region_tiles);
+        self->region_tiles = xrdp_tile_map_create(width, height);
+    }
+    if (self->region_tiles != NULL)
+    {
+        xrdp_tile_map_clear(self->region_tiles);
+        xrdp_tile_map_add_rects(self->region_tiles, enc->u.sc.drects,
+                                enc->u.sc.num_drects);
+        rcount = xrdp_tile_map_get_rects(self->region_tiles,
+                                         self->region_rects, 15);
+        if (rcount > 0)
+        {
+            *rrects = self->region_rects;
+            return rcount;
+        }
+    }
+    *rrects = enc->u.sc.crects;
+    return enc->u.sc.num_crects;
+}
+
 static int
 build_rfx_avc420_metablock(struct stream *s, short *rrects, int rcount, int width, int height)
 {
@@ -825,13 +1025,7 @@ build_enc_h264_avc444_yuv420_and_chroma420_stream(struct xrdp_encoder *self, XRD
     scr_width = self->mm->wm->screen->width;
     scr_height = self->mm->wm->screen->height;
 
-    rcount = enc->u.sc.num_drects;
-    rrects = enc->u.sc.drects;
-    if (rcount > 15)
-    {
-        rcount = enc->u.sc.num_crects;
-        rrects = enc->u.sc.crects;
-    }
+    rcount = build_region_rects(self, enc, scr_width, scr_height, &rrects);
 
     out_data_bytes = 128 * 1024 * 1024;
     index = XRDP_SURCMD_PREFIX_BYTES + 16 + 2 + enc->u.sc.num_drects * 8;
@@ -1062,13 +1256,7 @@ build_enc_h264_avc444_yuv420_stream(struct xrdp_encoder *self, XRDP_ENC_DATA *en
     scr_width = self->mm->wm->screen->width;
     scr_height = self->mm->wm->screen->height;
 
-    rcount = enc->u.sc.num_drects;
-    rrects = enc->u.sc.drects;
-    if (rcount > 15)
-    {
-        rcount = enc->u.sc.num_crects;
-        rrects = enc->u.sc.crects;
-    }
+    rcount = build_region_rects(self, enc, scr_width, scr_height, &rrects);
 
     out_data_bytes = 128 * 1024 * 1024;
     index = XRDP_SURCMD_PREFIX_BYTES + 16 + 2 + rcount * 8;
@@ -1208,13 +1396,7 @@ build_enc_h264_avc444_chroma420_stream(struct xrdp_encoder *self, XRDP_ENC_DATA
     scr_width = self->mm->wm->screen->width;
     scr_height = self->mm->wm->screen->height;
 
-    rcount = enc->u.sc.num_drects;
-    rrects = enc->u.sc.drects;
-    if (rcount > 15)
-    {
-        rcount = enc->u.sc.num_crects;
-        rrects = enc->u.sc.crects;
-    }
+    rcount = build_region_rects(self, enc, scr_width, scr_height, &rrects);
 
     out_data_bytes = 128 * 1024 * 1024;
     index = XRDP_SURCMD_PREFIX_BYTES + 16 + 2 + rcount * 8;
@@ -1416,6 +1598,195 @@ gfx_send_done(struct xrdp_encoder *self, XRDP_ENC_DATA *enc,
     return 0;
 }
 
+/*****************************************************************************/
+/* called from encoder thread when the client surface contents are lost */
+static void
+gfx_fb_diff_invalidate(struct xrdp_encoder *self)
+{
+    int index;
+
+    for (index = 0; index < 16; index++)
+    {
+        if (self->fb_diff_gfx[index] != NULL)
+        {
+            xrdp_fb_diff_invalidate(self->fb_diff_gfx[index]);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* called from encoder thread at the start of a frame, the frame is sent
+   at the lowest quality if a first paint was requested */
+static void
+gfx_first_paint_begin(struct xrdp_encoder *self)
+{
+    tc_mutex_lock(self->mutex);
+    self->first_paint_active = self->first_paint_pending;
+    self->first_paint_pending = 0;
+    tc_mutex_unlock(self->mutex);
+    if (self->first_paint_active)
+    {
+        /* the whole screen is sent again */
+        gfx_fb_diff_invalidate(self);
+    }
+#ifdef XRDP_X264
+    if (self->first_paint_active && (self->codec_handle_x264 != NULL))
+    {
+        xrdp_encoder_x264_reconfig(self->codec_handle_x264,
+                                   self->bw_applied_kbps,
+                                   self->bw_applied_kbps / 10,
+                                   XRDP_FIRST_PAINT_CRF);
+    }
+#endif
+}
+
+/*****************************************************************************/
+/* called from encoder thread at the end of a frame */
+static void
+gfx_first_paint_end(struct xrdp_encoder *self)
+{
+    if (!self->first_paint_active)
+    {
+        return;
+    }
+    self->first_paint_active = 0;
+#ifdef XRDP_X264
+    if (self->codec_handle_x264 != NULL)
+    {
+        xrdp_encoder_x264_reconfig(self->codec_handle_x264,
+                                   self->bw_applied_kbps,
+                                   self->bw_applied_kbps / 10, 0);
+    }
+#endif
+}
+
+#if defined(XRDP_RFXCODEC) || defined(XRDP_X264)
+/*****************************************************************************/
+/* called from encoder thread, returns the first paint quality map for a
+   surface, creating it if needed */
+static struct xrdp_tile_map *
+gfx_lq_tiles_get(struct xrdp_encoder *self, int mon_index,
+                 int width, int height)
+{
+    struct xrdp_tile_map *tiles;
+
+    if (!self->first_paint_enabled)
+    {
+        return NULL;
+    }
+    tiles = self->lq_tiles[mon_index];
+    if ((tiles != NULL) &&
+            ((tiles->width != width) || (tiles->height != height)))
+    {
+        xrdp_tile_map_delete(tiles);
+        tiles = NULL;
+    }
+    if (tiles == NULL)
+    {
+        tiles = xrdp_tile_map_create(width, height);
+        self->lq_tiles[mon_index] = tiles;
+    }
+    return tiles;
+}
+#endif
+
+/*****************************************************************************/
+/* called from encoder thread at the end of a frame, picks the next tiles
+   still at first paint quality for the main thread to repaint, see
+   xrdp_encoder_first_paint_upgrade() */
+static void
+gfx_refine_schedule(struct xrdp_encoder *self)
+{
+    struct xrdp_tile_map *lq;
+    short rects[4 * XRDP_REFINE_TILES_PER_FRAME];
+    int mon_index;
+    int count;
+    int index;
+    int busy;
+
+    if (!self->first_paint_enabled)
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    busy = self->num_refine_rects > 0;
+    tc_mutex_unlock(self->mutex);
+    if (busy)
+    {
+        /* main thread has not taken the last ones yet */
+        return;
+    }
+    for (mon_index = 0; mon_index < 16; mon_index++)
+    {
+        lq = self->lq_tiles[mon_index];
+        if ((lq == NULL) || xrdp_tile_map_is_empty(lq))
+        {
+            continue;
+        }
+        if ((self->refine_tiles == NULL) ||
+                (self->refine_tiles->width != lq->width) ||
+                (self->refine_tiles->height != lq->height))
+        {
+            xrdp_tile_map_delete(self->refine_tiles);
+            self->refine_tiles = xrdp_tile_map_create(lq->width, lq->height);
+            if (self->refine_tiles == NULL)
+            {
+                return;
+            }
+        }
+        xrdp_tile_map_take_rows(lq, self->refine_tiles,
+                                XRDP_REFINE_TILES_PER_FRAME);
+        count = xrdp_tile_map_get_rects(self->refine_tiles, rects,
+                                        XRDP_REFINE_TILES_PER_FRAME);
+        if (count < 0)
+        {
+            /* one very wide row, put back what does not fit */
+            count = XRDP_REFINE_TILES_PER_FRAME;
+            for (index = 0; index < count; index++)
+            {
+                xrdp_tile_map_remove_rect(self->refine_tiles,
+                                          rects[index * 4 + 0],
+                                          rects[index * 4 + 1],
+                                          rects[index * 4 + 2],
+                                          rects[index * 4 + 3]);
+            }
+            xrdp_tile_map_union(lq, self->refine_tiles);
+        }
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "gfx_refine_schedule: mon_index %d "
+                  "rects %d tiles left %d", mon_index, count,
+                  xrdp_tile_map_count(lq));
+        for (index = 0; index < count; index++)
+        {
+            /* these are repainted unchanged, do not let the frame compare
+               drop them */
+            if (self->fb_diff_gfx[mon_index] != NULL)
+            {
+                xrdp_fb_diff_invalidate_rect(self->fb_diff_gfx[mon_index],
+                                             rects[index * 4 + 0],
+                                             rects[index * 4 + 1],
+                                             rects[index * 4 + 2],
+                                             rects[index * 4 + 3]);
+            }
+        }
+        tc_mutex_lock(self->mutex);
+        for (index = 0; index < count; index++)
+        {
+            self->refine_rects[index].x = rects[index * 4 + 0];
+            self->refine_rects[index].y = rects[index * 4 + 1];
+            self->refine_rects[index].cx = rects[index * 4 + 2];
+            self->refine_rects[index].cy = rects[index * 4 + 3];
+            if (mon_index < self->num_prewarm)
+            {
+                self->refine_rects[index].x += self->prewarm[mon_index].x;
+                self->refine_rects[index].y += self->prewarm[mon_index].y;
+            }
+        }
+        self->num_refine_rects = count;
+        tc_mutex_unlock(self->mutex);
+        return;
+    }
+}
+
 /*****************************************************************************/
 static struct stream *
 gfx_wiretosurface1(struct xrdp_encoder *self,
@@ -1445,6 +1816,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
     struct stream ls;
     struct stream *s;
     short *crects;
+    struct xrdp_tile_map *lq;
     struct xrdp_enc_gfx_cmd *enc_gfx_cmd = &(enc->u.gfx);
 
     s = &ls;
@@ -1566,6 +1938,26 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
     g_free(c_rects);
     g_free(d_rects);
 
+    /* gfx_wiretosurface1() always uses encoder 0 */
+    lq = gfx_lq_tiles_get(self, 0, twidth, theight);
+    for (index = 0; (lq != NULL) && (index < num_rects_c); index++)
+    {
+        if (self->first_paint_active)
+        {
+            xrdp_tile_map_add_rect(lq, crects[index * 4 + 0],
+                                   crects[index * 4 + 1],
+                                   crects[index * 4 + 2],
+                                   crects[index * 4 + 3]);
+        }
+        else
+        {
+            xrdp_tile_map_remove_rect(lq, crects[index * 4 + 0],
+                                      crects[index * 4 + 1],
+                                      crects[index * 4 + 2],
+                                      crects[index * 4 + 3]);
+        }
+    }
+
     if (ENC_IS_BIT_SET(flags, 0))
     {
         /* already compressed */
@@ -1627,6 +2019,67 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
 #endif
 }
 
+#ifdef XRDP_RFXCODEC
+/*****************************************************************************/
+/* called from encoder thread, drops the tiles that did not change since
+   the last frame and cuts the damage rects down to what changed, returns
+   false if nothing is left to send */
+static int
+gfx_fb_diff(struct xrdp_encoder *self, int mon_index,
+            int width, int height, const char *data,
+            struct rfx_tile *tiles, int *num_tiles,
+            struct rfx_rect *rfxrects, int *num_rects)
+{
+    struct xrdp_fb_diff *diff;
+    short rect[4];
+    int stride;
+    int index;
+    int count;
+
+    diff = fb_diff_get(&self->fb_diff_gfx[mon_index], width, height);
+    if (diff == NULL)
+    {
+        return 1;
+    }
+    stride = XRDP_FB_DIFF_STRIDE(width);
+    /* tiles first, the damage rects pass updates the stored frame */
+    count = 0;
+    for (index = 0; index < *num_tiles; index++)
+    {
+        rect[0] = tiles[index].x;
+        rect[1] = tiles[index].y;
+        rect[2] = tiles[index].cx;
+        rect[3] = tiles[index].cy;
+        if (xrdp_fb_diff_rect(diff, data, stride, rect,
+                              XRDP_FB_DIFF_NO_COPY | XRDP_FB_DIFF_NO_COUNT))
+        {
+            tiles[count++] = tiles[index];
+        }
+    }
+    *num_tiles = count;
+    count = 0;
+    for (index = 0; index < *num_rects; index++)
+    {
+        rect[0] = rfxrects[index].x;
+        rect[1] = rfxrects[index].y;
+        rect[2] = rfxrects[index].cx;
+        rect[3] = rfxrects[index].cy;
+        if (xrdp_fb_diff_rect(diff, data, stride, rect, XRDP_FB_DIFF_SHRINK))
+        {
+            rfxrects[count].x = rect[0];
+            rfxrects[count].y = rect[1];
+            rfxrects[count].cx = rect[2];
+            rfxrects[count].cy = rect[3];
+            count++;
+        }
+    }
+    *num_rects = count;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "gfx_fb_diff: mon_index %d tiles %d rects %d",
+              mon_index, *num_tiles, *num_rects);
+    return (*num_tiles > 0) && (*num_rects > 0);
+}
+#endif
+
 /*****************************************************************************/
 static struct stream *
 gfx_wiretosurface2(struct xrdp_encoder *self,
@@ -1656,6 +2109,8 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
     int total_tiles;
     int tiles_written;
     int mon_index;
+    const char *quants;
+    struct xrdp_tile_map *lq;
 
     if (!s_check_rem(in_s, 15))
     {
@@ -1734,6 +2189,15 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
     LOG_DEVEL(LOG_LEVEL_INFO, "gfx_wiretosurface2: left %d top "
               "%d width %d height %d mon_index %d",
               left, top, width, height, mon_index);
+    if (self->fb_diff_enabled &&
+            !gfx_fb_diff(self, mon_index, width, height, enc->u.gfx.data,
+                         tiles, &num_rects_c, rfxrects, &num_rects_d))
+    {
+        /* nothing changed */
+        g_free(tiles);
+        g_free(rfxrects);
+        return NULL;
+    }
     if (self->codec_handle_prfx_gfx[mon_index] == NULL)
     {
         self->codec_handle_prfx_gfx[mon_index] = rfxcodec_encode_create(
@@ -1756,6 +2220,25 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
         g_free(rfxrects);
         return NULL;
     }
+    quants = self->quants;
+    if (self->first_paint_active)
+    {
+        quants = (const char *) g_rfx_quantization_values_ulq;
+    }
+    lq = gfx_lq_tiles_get(self, mon_index, width, height);
+    for (index = 0; (lq != NULL) && (index < num_rects_c); index++)
+    {
+        if (self->first_paint_active)
+        {
+            xrdp_tile_map_add_rect(lq, tiles[index].x, tiles[index].y,
+                                   tiles[index].cx, tiles[index].cy);
+        }
+        else
+        {
+            xrdp_tile_map_remove_rect(lq, tiles[index].x, tiles[index].y,
+                                      tiles[index].cx, tiles[index].cy);
+        }
+    }
     rv = NULL;
     tiles_written = 0;
     total_tiles = num_rects_c;
@@ -1770,7 +2253,7 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
                             ((width + 63) & ~63) * 4,
                             rfxrects, num_rects_d,
                             tiles + tiles_written, total_tiles - tiles_written,
-                            self->quants, self->num_quants);
+                            quants, self->num_quants);
         if (tiles_compressed < 1)
         {
             break;
@@ -1896,6 +2379,8 @@ gfx_createsurface(struct xrdp_encoder *self,
     in_uint16_le(in_s, width);
     in_uint16_le(in_s, height);
     in_uint8(in_s, pixel_format);
+    /* new surfaces start empty on the client */
+    gfx_fb_diff_invalidate(self);
     return xrdp_egfx_create_surface(bulk, surface_id,
                                     width, height, pixel_format);
 }
@@ -2021,11 +2506,18 @@ process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     int cmd_bytes;
     int frame_id;
     int got_frame_id;
+    int is_last;
+    int sent_last;
+    int end_frame_id;
+    int got_end_frame_id;
     int error;
     char *holdp;
     char *holdend;
 
     bulk = self->mm->egfx->bulk;
+    sent_last = 0;
+    end_frame_id = 0;
+    got_end_frame_id = 0;
     g_memset(&in_s, 0, sizeof(in_s));
     in_s.data = enc->u.gfx.cmd;
     in_s.size = enc->u.gfx.cmd_bytes;
@@ -2068,11 +2560,16 @@ process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
                 s = gfx_deletesurface(self, bulk, &in_s);
                 break;
             case XR_RDPGFX_CMDID_STARTFRAME:            /* 0x000B */
+                gfx_first_paint_begin(self);
                 s = gfx_startframe(self, bulk, &in_s);
                 break;
             case XR_RDPGFX_CMDID_ENDFRAME:              /* 0x000C */
                 s = gfx_endframe(self, bulk, &in_s, &frame_id);
                 got_frame_id = 1;
+                end_frame_id = frame_id;
+                got_end_frame_id = 1;
+                gfx_first_paint_end(self);
+                gfx_refine_schedule(self);
                 break;
             case XR_RDPGFX_CMDID_RESETGRAPHICS:         /* 0x000E */
                 s = gfx_resetgraphics(self, bulk, &in_s);
@@ -2089,9 +2586,10 @@ process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
         if (s != NULL)
         {
             /* send message to main thread */
+            is_last = !s_check_rem(&in_s, 8);
             error = gfx_send_done(self, enc, (int) (s->end - s->data),
                                   0, s->data, got_frame_id, frame_id,
-                                  !s_check_rem(&in_s, 8));
+                                  is_last);
             if (error != 0)
             {
                 LOG(LOG_LEVEL_ERROR, "process_enc_egfx: gfx_send_done failed "
@@ -2100,12 +2598,307 @@ process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
                 return 1;
             }
             g_free(s); /* don't call free_stream() here so s->data is valid */
+            sent_last = is_last;
         }
         else
         {
             LOG_DEVEL(LOG_LEVEL_INFO, "process_enc_egfx: nil");
         }
     }
+    if (!sent_last)
+    {
+        /* the last command had nothing to send, e.g. a wire to surface
+           where nothing changed, the main thread still has to see the
+           end of the buffer to free enc and end the frame */
+        error = gfx_send_done(self, enc, 0, 0, NULL, got_end_frame_id,
+                              end_frame_id, 1);
+        if (error != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "process_enc_egfx: gfx_send_done failed "
+                "error %d", error);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* called from main thread, closes an estimation window and picks a new
+   target, lowering it when the client can not keep up with the frames
+   we send and probing upwards again when it can */
+static void
+xrdp_encoder_bw_update(struct xrdp_encoder *self)
+{
+    int now;
+    int elapsed;
+    int kbps;
+    int target;
+
+    now = g_time3();
+    elapsed = now - self->bw_window_start;
+    if (elapsed < XRDP_BW_WINDOW_MS)
+    {
+        return;
+    }
+    kbps = (int) (((long long) self->bw_window_bytes * 8) / elapsed);
+    tc_mutex_lock(self->mutex);
+    target = self->bw_target_kbps;
+    if (self->bw_window_congested > 0)
+    {
+        target = MAX(kbps * 85 / 100, XRDP_BW_MIN_KBPS);
+        if (self->bw_target_kbps != 0)
+        {
+            target = MIN(target, self->bw_target_kbps);
+        }
+    }
+    else if (target != 0)
+    {
+        target = target * 110 / 100;
+        if (target >= XRDP_BW_MAX_KBPS)
+        {
+            target = 0;
+        }
+    }
+    if (target != self->bw_target_kbps)
+    {
+        LOG(LOG_LEVEL_DEBUG, "xrdp_encoder_bw_update: measured %d kbit/s "
+            "congested %d, target %d kbit/s", kbps,
+            self->bw_window_congested, target);
+        self->bw_target_kbps = target;
+        g_set_wait_obj(self->xrdp_encoder_event_to_proc);
+    }
+    tc_mutex_unlock(self->mutex);
+    self->bw_window_start = now;
+    self->bw_window_bytes = 0;
+    self->bw_window_congested = 0;
+}
+
+/*****************************************************************************/
+/* called from main thread when encoded data goes out to the client */
+void
+xrdp_encoder_bw_sent(struct xrdp_encoder *self, int bytes)
+{
+    if (self == NULL || !self->bw_adaptive)
+    {
+        return;
+    }
+    self->bw_window_bytes += bytes;
+    xrdp_encoder_bw_update(self);
+}
+
+/*****************************************************************************/
+/* called from main thread after frame_id_client has been updated */
+void
+xrdp_encoder_bw_frame_ack(struct xrdp_encoder *self)
+{
+    if (self == NULL || !self->bw_adaptive)
+    {
+        return;
+    }
+    /* all frames were still in flight when this ack arrived */
+    if (self->frame_id_server - self->frame_id_client >=
+            self->frames_in_flight)
+    {
+        self->bw_window_congested++;
+    }
+    xrdp_encoder_bw_update(self);
+}
+
+/*****************************************************************************/
+/* called from encoder thread, pushes a new bandwidth target into the
+   H.264 encoder without reopening it */
+static void
+xrdp_encoder_bw_apply(struct xrdp_encoder *self)
+{
+    int target;
+
+    tc_mutex_lock(self->mutex);
+    target = self->bw_target_kbps;
+    tc_mutex_unlock(self->mutex);
+    if (target == self->bw_applied_kbps)
+    {
+        return;
+    }
+#if defined(XRDP_X264)
+    if (self->codec_handle_x264 != NULL)
+    {
+        /* a VBV buffer of 100 ms at the target rate */
+        xrdp_encoder_x264_reconfig(self->codec_handle_x264,
+                                   target, target / 10, 0);
+    }
+#elif defined(XRDP_OPENH264)
+    if (self->codec_handle_openh264 != NULL)
+    {
+        xrdp_encoder_openh264_reconfig(self->codec_handle_openh264,
+                                       (uint32_t) target * 1000);
+    }
+#endif
+    self->bw_applied_kbps = target;
+}
+
+/*****************************************************************************/
+/* called from main thread when the whole screen is about to be sent, the
+   next frame goes out at the lowest quality and is then upgraded by
+   xrdp_encoder_first_paint_upgrade() */
+void
+xrdp_encoder_first_paint(struct xrdp_encoder *self)
+{
+    if (self == NULL || !self->first_paint_enabled)
+    {
+        return;
+    }
+    LOG(LOG_LEVEL_DEBUG, "xrdp_encoder_first_paint:");
+    tc_mutex_lock(self->mutex);
+    self->first_paint_pending = 1;
+    self->num_refine_rects = 0;
+    tc_mutex_unlock(self->mutex);
+}
+
+/*****************************************************************************/
+/* called from main thread on each frame sent, asks the module to repaint
+   the tiles gfx_refine_schedule() picked so they are encoded again at
+   the normal quality */
+void
+xrdp_encoder_first_paint_upgrade(struct xrdp_encoder *self)
+{
+    struct xrdp_enc_rect rects[XRDP_REFINE_TILES_PER_FRAME];
+    struct xrdp_rect rect;
+    int count;
+    int index;
+
+    if (self == NULL || !self->first_paint_enabled)
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    count = self->num_refine_rects;
+    g_memcpy(rects, self->refine_rects, sizeof(rects[0]) * count);
+    self->num_refine_rects = 0;
+    tc_mutex_unlock(self->mutex);
+    for (index = 0; index < count; index++)
+    {
+        rect.left = rects[index].x;
+        rect.top = rects[index].y;
+        rect.right = rects[index].x + rects[index].cx;
+        rect.bottom = rects[index].y + rects[index].cy;
+        xrdp_bitmap_invalidate(self->mm->wm->screen, &rect);
+    }
+}
+
+/*****************************************************************************/
+/* called from encoder thread before the first message, creates the codec
+   contexts the first frame would otherwise create lazily so that work
+   overlaps with the module connection */
+static void
+xrdp_encoder_prewarm(struct xrdp_encoder *self)
+{
+    int index;
+    int width;
+    int height;
+    int start_time;
+
+    start_time = g_time3();
+    for (index = 0; index < self->num_prewarm; index++)
+    {
+        width = self->prewarm[index].cx;
+        height = self->prewarm[index].cy;
+        if ((width < 1) || (height < 1))
+        {
+            continue;
+        }
+#ifdef XRDP_RFXCODEC
+        if ((self->mm->egfx_flags & XRDP_EGFX_RFX_PRO) &&
+                (self->codec_handle_prfx_gfx[index] == NULL))
+        {
+            self->codec_handle_prfx_gfx[index] = rfxcodec_encode_create(
+                    width,
+                    height,
+                    RFX_FORMAT_YUV,
+                    RFX_FLAGS_RLGR1 | RFX_FLAGS_PRO1);
+        }
+#endif
+#ifdef XRDP_X264
+        /* gfx_wiretosurface1() always uses encoder 0 */
+        if ((self->mm->egfx_flags & XRDP_EGFX_H264) && (index == 0))
+        {
+            if (self->codec_handle_x264 == NULL)
+            {
+                self->codec_handle_x264 = xrdp_encoder_x264_create();
+            }
+            if (self->codec_handle_x264 != NULL)
+            {
+                /* no data, this only opens the encoder */
+                xrdp_encoder_x264_encode(self->codec_handle_x264, 0, 0, 0,
+                                         width, height, width, height,
+                                         0, NULL, NULL, 0, NULL, NULL);
+            }
+        }
+#endif
+    }
+    LOG(LOG_LEVEL_DEBUG, "xrdp_encoder_prewarm: %d surface(s) took %d ms",
+        self->num_prewarm, g_time3() - start_time);
+}
+
+/*****************************************************************************/
+/* called from main thread when the first frame has gone to the client */
+void
+xrdp_encoder_first_frame_sent(struct xrdp_encoder *self)
+{
+    if (self == NULL || self->time_to_first_frame != 0)
+    {
+        return;
+    }
+    self->time_to_first_frame = MAX(g_time3() - self->start_time, 1);
+    LOG(LOG_LEVEL_INFO, "xrdp_encoder_first_frame_sent: "
+        "time to first frame %d ms", self->time_to_first_frame);
+}
+
+/*****************************************************************************/
+static int
+proc_enc_term_in(void *arg, tintptr obj, int events)
+{
+    /* global term */
+    LOG(LOG_LEVEL_DEBUG,
+        "Received termination signal, stopping the encoder thread");
+    return 1;
+}
+
+/*****************************************************************************/
+static int
+proc_enc_lterm_in(void *arg, tintptr obj, int events)
+{
+    /* xrdp_mm term */
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "proc_enc_msg: xrdp_mm term");
+    return 1;
+}
+
+/*****************************************************************************/
+static int
+proc_enc_event_in(void *arg, tintptr obj, int events)
+{
+    XRDP_ENC_DATA *enc;
+    struct xrdp_encoder *self;
+
+    self = (struct xrdp_encoder *) arg;
+    /* clear it right away */
+    g_reset_wait_obj(obj);
+    if (self->bw_adaptive)
+    {
+        xrdp_encoder_bw_apply(self);
+    }
+    /* get first msg */
+    tc_mutex_lock(self->mutex);
+    enc = (XRDP_ENC_DATA *) fifo_remove_item(self->fifo_to_proc);
+    tc_mutex_unlock(self->mutex);
+    while (enc != 0)
+    {
+        /* do work */
+        self->process_enc(self, enc);
+        /* get next msg */
+        tc_mutex_lock(self->mutex);
+        enc = (XRDP_ENC_DATA *) fifo_remove_item(self->fifo_to_proc);
+        tc_mutex_unlock(self->mutex);
+    }
     return 0;
 }
 
@@ -2115,19 +2908,9 @@ process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
 THREAD_RV THREAD_CC
 proc_enc_msg(void *arg)
 {
-    XRDP_ENC_DATA *enc;
-    struct fifo *fifo_to_proc;
-    tbus mutex;
-    tbus event_to_proc;
-    tbus term_obj;
-    tbus lterm_obj;
-    int robjs_count;
-    int wobjs_count;
-    int cont;
-    int timeout;
-    tbus robjs[32];
-    tbus wobjs[32];
     struct xrdp_encoder *self;
+    struct g_reactor *reactor;
+    int rv;
 
     LOG_DEVEL(LOG_LEVEL_INFO, "proc_enc_msg: thread is running");
 
@@ -2138,62 +2921,35 @@ proc_enc_msg(void *arg)
         return 0;
     }
 
-    fifo_to_proc = self->fifo_to_proc;
-    mutex = self->mutex;
-    event_to_proc = self->xrdp_encoder_event_to_proc;
-
-    term_obj = g_get_term();
-    lterm_obj = self->xrdp_encoder_term_request;
+    xrdp_encoder_prewarm(self);
 
-    cont = 1;
-    while (cont)
+    reactor = g_reactor_create();
+    if (reactor == NULL ||
+            g_reactor_add(reactor, g_get_term(), G_REACTOR_READ,
+                          proc_enc_term_in, self) != 0 ||
+            g_reactor_add(reactor, self->xrdp_encoder_term_request,
+                          G_REACTOR_READ, proc_enc_lterm_in, self) != 0 ||
+            g_reactor_add(reactor, self->xrdp_encoder_event_to_proc,
+                          G_REACTOR_READ, proc_enc_event_in, self) != 0)
     {
-        timeout = -1;
-        robjs_count = 0;
-        wobjs_count = 0;
-        robjs[robjs_count++] = term_obj;
-        robjs[robjs_count++] = lterm_obj;
-        robjs[robjs_count++] = event_to_proc;
-
-        if (g_obj_wait(robjs, robjs_count, wobjs, wobjs_count, timeout) != 0)
+        LOG(LOG_LEVEL_ERROR, "proc_enc_msg: can't set up the event loop");
+        rv = 1;
+    }
+    else
+    {
+        rv = 0;
+    }
+    while (rv == 0)
+    {
+        rv = g_reactor_wait(reactor, NULL, 0, NULL, 0, -1);
+        if (rv < 0)
         {
             /* error, should not get here */
             g_sleep(100);
+            rv = 0;
         }
-
-        if (g_is_wait_obj_set(term_obj)) /* global term */
-        {
-            LOG(LOG_LEVEL_DEBUG,
-                "Received termination signal, stopping the encoder thread");
-            break;
-        }
-
-        if (g_is_wait_obj_set(lterm_obj)) /* xrdp_mm term */
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "proc_enc_msg: xrdp_mm term");
-            break;
-        }
-
-        if (g_is_wait_obj_set(event_to_proc))
-        {
-            /* clear it right away */
-            g_reset_wait_obj(event_to_proc);
-            /* get first msg */
-            tc_mutex_lock(mutex);
-            enc = (XRDP_ENC_DATA *) fifo_remove_item(fifo_to_proc);
-            tc_mutex_unlock(mutex);
-            while (enc != 0)
-            {
-                /* do work */
-                self->process_enc(self, enc);
-                /* get next msg */
-                tc_mutex_lock(mutex);
-                enc = (XRDP_ENC_DATA *) fifo_remove_item(fifo_to_proc);
-                tc_mutex_unlock(mutex);
-            }
-        }
-
-    } /* end while (cont) */
+    }
+    g_reactor_delete(reactor);
     g_set_wait_obj(self->xrdp_encoder_term_done);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "proc_enc_msg: thread exit");
     return 0;
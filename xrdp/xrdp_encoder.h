@@ -5,6 +5,8 @@
 #include "arch.h"
 #include "fifo.h"
 #include "xrdp_client_info.h"
+#include "xrdp_tile_map.h"
+#include "xrdp_fb_diff.h"
 
 #define ENC_IS_BIT_SET(_flags, _bit) (((_flags) & (1 << (_bit))) != 0)
 #define ENC_SET_BIT(_flags, _bit) do { _flags |= (1 << (_bit)); } while (0)
@@ -14,6 +16,18 @@
 
 struct xrdp_enc_data;
 
+/* most tiles asked to be repainted after a first paint per frame, each
+   one needs at most one rect */
+#define XRDP_REFINE_TILES_PER_FRAME 128
+
+struct xrdp_enc_rect
+{
+    short x;
+    short y;
+    short cx;
+    short cy;
+};
+
 /* for codec mode operations */
 struct xrdp_encoder
 {
@@ -48,6 +62,35 @@ struct xrdp_encoder
     int quant_idx_y;
     int quant_idx_u;
     int quant_idx_v;
+    /* bandwidth estimator, see xrdp_encoder_bw_sent() */
+    int bw_adaptive;
+    int bw_window_start; /* g_time3() */
+    int bw_window_bytes;
+    int bw_window_congested;
+    int bw_target_kbps; /* 0 = no limit, protected by mutex */
+    int bw_applied_kbps; /* encoder thread only */
+    /* surfaces to create codec contexts for before the first frame */
+    int num_prewarm;
+    struct xrdp_enc_rect prewarm[16];
+    int start_time; /* g_time3() when created */
+    int time_to_first_frame; /* ms, 0 until the first frame is sent */
+    /* first paint, see xrdp_encoder_first_paint() */
+    int first_paint_enabled;
+    int first_paint_pending; /* protected by mutex */
+    int first_paint_active; /* encoder thread only */
+    /* tiles per surface still at first paint quality, encoder thread only */
+    struct xrdp_tile_map *lq_tiles[16];
+    struct xrdp_tile_map *refine_tiles; /* encoder thread only */
+    /* next tiles to repaint, screen coordinates, protected by mutex */
+    int num_refine_rects;
+    struct xrdp_enc_rect refine_rects[XRDP_REFINE_TILES_PER_FRAME];
+    /* H.264 region rects merged from the damage, encoder thread only */
+    struct xrdp_tile_map *region_tiles;
+    short region_rects[4 * 15];
+    /* frame compare, encoder thread only, see xrdp_fb_diff.h */
+    int fb_diff_enabled;
+    struct xrdp_fb_diff *fb_diff_sc;
+    struct xrdp_fb_diff *fb_diff_gfx[16];
 };
 
 /* cmd_id = 0 */
@@ -77,14 +120,6 @@ struct xrdp_enc_gfx_cmd
     int data_bytes;
 };
 
-struct xrdp_enc_rect
-{
-    short x;
-    short y;
-    short cx;
-    short cy;
-};
-
 struct xrdp_enc_rect calculate_bounding_box(short* boxes, int numBoxes);
 
 typedef struct xrdp_enc_data XRDP_ENC_DATA;
@@ -133,5 +168,15 @@ void
 xrdp_encoder_delete(struct xrdp_encoder *self);
 THREAD_RV THREAD_CC
 proc_enc_msg(void *arg);
+void
+xrdp_encoder_bw_sent(struct xrdp_encoder *self, int bytes);
+void
+xrdp_encoder_bw_frame_ack(struct xrdp_encoder *self);
+void
+xrdp_encoder_first_frame_sent(struct xrdp_encoder *self);
+void
+xrdp_encoder_first_paint(struct xrdp_encoder *self);
+void
+xrdp_encoder_first_paint_upgrade(struct xrdp_encoder *self);
 
 #endif
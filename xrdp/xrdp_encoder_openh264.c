@@ -179,6 +179,41 @@ xrdp_encoder_openh264_delete(void *handle)
 	return 0;
 }
 
+/*****************************************************************************/
+int
+xrdp_encoder_openh264_reconfig(void *handle, uint32_t bitRate)
+{
+	struct openh264_context *h264 = (struct openh264_context *)handle;
+	SBitrateInfo bitrate;
+
+	if (!h264) {
+		return 1;
+	}
+
+	h264->bitRate = (bitRate > 0) ? bitRate : OPENH264_DEFAULT_BITRATE;
+	LOG(LOG_LEVEL_DEBUG, "xrdp_encoder_openh264_reconfig: bitrate %"PRIu32"",
+		h264->bitRate);
+	if (!h264->pEncoder) {
+		/* applied by xrdp_encoder_openh264_open() */
+		return 0;
+	}
+
+	bitrate.iLayer = SPATIAL_LAYER_ALL;
+	bitrate.iBitrate = h264->bitRate;
+	if ((*h264->pEncoder)->SetOption(h264->pEncoder, ENCODER_OPTION_BITRATE, &bitrate)) {
+		LOG(LOG_LEVEL_ERROR, "Failed to set encoder bitrate to %d", bitrate.iBitrate);
+		return 1;
+	}
+	bitrate.iLayer = SPATIAL_LAYER_ALL;
+	bitrate.iBitrate = (bitRate > 0) ? bitRate : UNSPECIFIED_BIT_RATE;
+	if ((*h264->pEncoder)->SetOption(h264->pEncoder, ENCODER_OPTION_MAX_BITRATE, &bitrate)) {
+		LOG(LOG_LEVEL_ERROR, "Failed to set encoder max bitrate to %d", bitrate.iBitrate);
+		return 1;
+	}
+	h264->maxBitRate = bitrate.iBitrate;
+	return 0;
+}
+
 /*****************************************************************************/
 void *xrdp_encoder_openh264_create()
 {
@@ -238,7 +273,10 @@ void *xrdp_encoder_openh264_open(struct openh264_context *h264, uint32_t scrWidt
 	h264->pic1.iStride[2] = h264->pic2.iStride[2] = h264Width / 2;
 
 	h264->frameRate = 20;
-	h264->bitRate = 1000000 * 2; /* 2 Mbit/s */
+	if (h264->bitRate == 0) {
+		/* not set by xrdp_encoder_openh264_reconfig() */
+		h264->bitRate = OPENH264_DEFAULT_BITRATE;
+	}
 
 	ysize = h264Width * h264Height;
 	usize = vsize = ysize >> 2;
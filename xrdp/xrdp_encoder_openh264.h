@@ -26,6 +26,8 @@
 
 //#ifdef WITH_OPENH264
 
+#define OPENH264_DEFAULT_BITRATE (1000000 * 2) /* 2 Mbit/s */
+
 typedef struct openh264_context {
 	ISVCEncoder *pEncoder;
 	SSourcePicture pic1;
@@ -53,6 +55,8 @@ xrdp_encoder_openh264_encode(void *handle, int session,
                         	 int width, int height, int format, const char *data,
                          	 char *cdata, int *cdata_bytes);
 int
+xrdp_encoder_openh264_reconfig(void *handle, uint32_t bitRate);
+int
 xrdp_encoder_openh264_delete(void *handle);
 // struct openh264_context *
 // ogon_openh264_context_new(uint32_t scrWidth, uint32_t scrHeight, uint32_t scrStride);
@@ -43,14 +43,39 @@ struct x264_encoder
     x264_param_t x264_params;
     int width;
     int height;
+    float base_crf; /* crf picked by the preset when opened */
+    int reopen; /* rate change could not be applied with reconfig */
+    int force_idr; /* reused for a new surface, the client has no ref */
 };
 
 struct x264_global
 {
     struct x264_encoder encoders[X264_MAX_ENCODERS];
     struct xrdp_tconfig_gfx_x264_param x264_param[NUM_CONNECTION_TYPES];
+    /* runtime rate control overrides, 0 means use x264_param */
+    int vbv_max_bitrate;
+    int vbv_buffer_size;
+    float crf;
 };
 
+/*****************************************************************************/
+static void
+xrdp_encoder_x264_set_rc(struct x264_global *xg, struct x264_encoder *xe,
+                         x264_param_t *params, int ct)
+{
+    if (xg->vbv_max_bitrate > 0)
+    {
+        params->rc.i_vbv_max_bitrate = xg->vbv_max_bitrate;
+        params->rc.i_vbv_buffer_size = xg->vbv_buffer_size;
+    }
+    else
+    {
+        params->rc.i_vbv_max_bitrate = xg->x264_param[ct].vbv_max_bitrate;
+        params->rc.i_vbv_buffer_size = xg->x264_param[ct].vbv_buffer_size;
+    }
+    params->rc.f_rf_constant = (xg->crf > 0) ? xg->crf : xe->base_crf;
+}
+
 /*****************************************************************************/
 void *
 xrdp_encoder_x264_create(void)
@@ -82,7 +107,7 @@ xrdp_encoder_x264_delete(void *handle)
         return 0;
     }
     xg = (struct x264_global *) handle;
-    for (index = 0; index < 16; index++)
+    for (index = 0; index < X264_MAX_ENCODERS; index++)
     {
         xe = &(xg->encoders[index]);
         if (xe->x264_enc_han != NULL)
@@ -95,6 +120,62 @@ xrdp_encoder_x264_delete(void *handle)
     return 0;
 }
 
+/*****************************************************************************/
+int
+xrdp_encoder_x264_reconfig(void *handle, int vbv_max_bitrate,
+                           int vbv_buffer_size, float crf)
+{
+    struct x264_global *xg;
+    struct x264_encoder *xe;
+    x264_param_t params;
+    int index;
+    int ct; /* connection_type */
+
+    /* the same as xrdp_encoder_x264_encode() opens with */
+    ct = CONNECTION_TYPE_LAN;
+
+    if (handle == NULL)
+    {
+        return 1;
+    }
+    xg = (struct x264_global *) handle;
+    xg->vbv_max_bitrate = MAX(vbv_max_bitrate, 0);
+    xg->vbv_buffer_size = MAX(vbv_buffer_size, 0);
+    xg->crf = crf;
+    LOG(LOG_LEVEL_DEBUG, "xrdp_encoder_x264_reconfig: vbv_max_bitrate %d "
+        "vbv_buffer_size %d crf %f", vbv_max_bitrate, vbv_buffer_size,
+        (double) crf);
+    for (index = 0; index < X264_MAX_ENCODERS; index++)
+    {
+        xe = &(xg->encoders[index]);
+        if (xe->x264_enc_han == NULL)
+        {
+            continue;
+        }
+        x264_encoder_parameters(xe->x264_enc_han, &params);
+        xrdp_encoder_x264_set_rc(xg, xe, &params, ct);
+        /* VBV can not be switched on with x264_encoder_reconfig when
+           the encoder was opened without it */
+        if ((xe->x264_params.rc.i_vbv_max_bitrate == 0) &&
+                (params.rc.i_vbv_max_bitrate > 0))
+        {
+            xe->reopen = 1;
+            continue;
+        }
+        if (x264_encoder_reconfig(xe->x264_enc_han, &params) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "xrdp_encoder_x264_reconfig: "
+                "x264_encoder_reconfig failed, reopening encoder");
+            xe->reopen = 1;
+            continue;
+        }
+        xe->x264_params.rc.i_vbv_max_bitrate = params.rc.i_vbv_max_bitrate;
+        xe->x264_params.rc.i_vbv_buffer_size = params.rc.i_vbv_buffer_size;
+        xe->x264_params.rc.f_rf_constant = params.rc.f_rf_constant;
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 int
 xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
@@ -117,6 +198,8 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
     int y;
     int cx;
     int cy;
+    int padded_width;
+    int padded_height;
     int ct; /* connection_type */
 
     /* TODO: connection_type argument */
@@ -130,7 +213,25 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
     xg = (struct x264_global *) handle;
     xe = &(xg->encoders[session % X264_MAX_ENCODERS]);
 
-    if ((xe->x264_enc_han == NULL) ||
+    padded_width = (width + 15) & ~15;
+    padded_height = (height + 15) & ~15;
+    if ((xe->x264_enc_han != NULL) && (xe->reopen == 0) &&
+            ((xe->width != width) || (xe->height != height)) &&
+            (xe->x264_params.i_width == padded_width) &&
+            (xe->x264_params.i_height == padded_height))
+    {
+        /* the bitstream size does not change, keep the encoder and
+           save reopening it, the client has a new surface and decoder
+           though, so the next frame must still be an IDR */
+        LOG(LOG_LEVEL_DEBUG, "xrdp_encoder_x264_encode: "
+            "reusing encoder %p for width %d height %d",
+            xe->x264_enc_han, width, height);
+        xe->width = width;
+        xe->height = height;
+        xe->force_idr = 1;
+    }
+
+    if ((xe->x264_enc_han == NULL) || (xe->reopen != 0) ||
             (xe->width != width) || (xe->height != height))
     {
         if (xe->x264_enc_han != NULL)
@@ -149,13 +250,13 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
                                       xg->x264_param[ct].preset,
                                       xg->x264_param[ct].tune);
             xe->x264_params.i_threads = 1;
-            xe->x264_params.i_width = (width + 15) & ~15;
-            xe->x264_params.i_height = (height + 15) & ~15;
+            xe->x264_params.i_width = padded_width;
+            xe->x264_params.i_height = padded_height;
             xe->x264_params.i_fps_num = xg->x264_param[ct].fps_num;
             xe->x264_params.i_fps_den = xg->x264_param[ct].fps_den;
             xe->x264_params.rc.i_rc_method = X264_RC_CRF;
-            xe->x264_params.rc.i_vbv_max_bitrate = xg->x264_param[ct].vbv_max_bitrate;
-            xe->x264_params.rc.i_vbv_buffer_size = xg->x264_param[ct].vbv_buffer_size;
+            xe->base_crf = xe->x264_params.rc.f_rf_constant;
+            xrdp_encoder_x264_set_rc(xg, xe, &(xe->x264_params), ct);
             x264_param_apply_profile(&(xe->x264_params),
                                      xg->x264_param[ct].profile);
             xe->x264_enc_han = x264_encoder_open(&(xe->x264_params));
@@ -166,7 +267,7 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
             {
                 return 1;
             }
-            xe->yuvdata = g_new(char, width * height * 2);
+            xe->yuvdata = g_new(char, padded_width * padded_height * 3 / 2);
             if (xe->yuvdata == NULL)
             {
                 x264_encoder_close(xe->x264_enc_han);
@@ -175,6 +276,8 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
             }
             flags |= 1;
         }
+        xe->reopen = 0;
+        xe->force_idr = 0;
         xe->width = width;
         xe->height = height;
     }
@@ -228,6 +331,11 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
                               (xe->yuvdata + x264_width_height);
         pic_in.img.i_stride[0] = xe->x264_params.i_width;
         pic_in.img.i_stride[1] = xe->x264_params.i_width;
+        if (xe->force_idr)
+        {
+            pic_in.i_type = X264_TYPE_IDR;
+            xe->force_idr = 0;
+        }
         num_nals = 0;
         frame_size = x264_encoder_encode(xe->x264_enc_han, &nals, &num_nals,
                                          &pic_in, &pic_out);
@@ -27,6 +27,21 @@ void *
 xrdp_encoder_x264_create(void);
 int
 xrdp_encoder_x264_delete(void *handle);
+/**
+ * Change rate control of the open and future encoders mid-stream
+ *
+ * @param handle Handle from xrdp_encoder_x264_create()
+ * @param vbv_max_bitrate VBV max bitrate in kbit/s, 0 to use gfx.toml
+ * @param vbv_buffer_size VBV buffer size in kbit
+ * @param crf Constant rate factor, 0 to use the preset value
+ * @return 0 for success
+ *
+ * Encoders that can not take the change with x264_encoder_reconfig()
+ * are reopened on their next frame.
+ */
+int
+xrdp_encoder_x264_reconfig(void *handle, int vbv_max_bitrate,
+                           int vbv_buffer_size, float crf);
 int
 xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
                          int width, int height, int twidth, int theight,
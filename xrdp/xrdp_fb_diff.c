@@ -0,0 +1,309 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * frame buffer compare
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "arch.h"
+#include "defines.h"
+#include "os_calls.h"
+#include "xrdp_fb_diff.h"
+#include "xrdp_tile_map.h"
+
+/*****************************************************************************/
+/* index of the first pixel that differs, or count if none */
+static int
+row_first_diff(const tui32 *p, const tui32 *q, int count)
+{
+    int index;
+
+    index = 0;
+#if defined(__SSE2__)
+    for (; index + 4 <= count; index += 4)
+    {
+        __m128i a;
+        __m128i b;
+        int mask;
+
+        a = _mm_loadu_si128((const __m128i *) (p + index));
+        b = _mm_loadu_si128((const __m128i *) (q + index));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi32(a, b));
+        if (mask != 0xFFFF)
+        {
+            break;
+        }
+    }
+#endif
+    for (; index < count; index++)
+    {
+        if (p[index] != q[index])
+        {
+            break;
+        }
+    }
+    return index;
+}
+
+/*****************************************************************************/
+/* index of the last pixel that differs, or -1 if none */
+static int
+row_last_diff(const tui32 *p, const tui32 *q, int count)
+{
+    int index;
+
+    index = count;
+#if defined(__SSE2__)
+    for (; index >= 4; index -= 4)
+    {
+        __m128i a;
+        __m128i b;
+        int mask;
+
+        a = _mm_loadu_si128((const __m128i *) (p + index - 4));
+        b = _mm_loadu_si128((const __m128i *) (q + index - 4));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi32(a, b));
+        if (mask != 0xFFFF)
+        {
+            break;
+        }
+    }
+#endif
+    for (index--; index >= 0; index--)
+    {
+        if (p[index] != q[index])
+        {
+            break;
+        }
+    }
+    return index;
+}
+
+/*****************************************************************************/
+struct xrdp_fb_diff *
+xrdp_fb_diff_create(int width, int height)
+{
+    struct xrdp_fb_diff *self;
+
+    if (width < 1 || height < 1)
+    {
+        return NULL;
+    }
+    self = g_new0(struct xrdp_fb_diff, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->width = width;
+    self->height = height;
+    self->stride = width * 4;
+    self->prev = g_new(char, self->stride * height);
+    self->invalid = xrdp_tile_map_create(width, height);
+    if (self->prev == NULL || self->invalid == NULL)
+    {
+        xrdp_fb_diff_delete(self);
+        return NULL;
+    }
+    xrdp_fb_diff_invalidate(self);
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_fb_diff_delete(struct xrdp_fb_diff *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    xrdp_tile_map_delete(self->invalid);
+    g_free(self->prev);
+    g_free(self);
+}
+
+/*****************************************************************************/
+void
+xrdp_fb_diff_invalidate(struct xrdp_fb_diff *self)
+{
+    xrdp_tile_map_add_rect(self->invalid, 0, 0, self->width, self->height);
+}
+
+/*****************************************************************************/
+void
+xrdp_fb_diff_invalidate_rect(struct xrdp_fb_diff *self,
+                             int x, int y, int cx, int cy)
+{
+    xrdp_tile_map_add_rect(self->invalid, x, y, cx, cy);
+}
+
+/*****************************************************************************/
+/* true if any tile under the rect is invalid */
+static int
+fb_diff_touches_invalid(struct xrdp_fb_diff *self,
+                        int x, int y, int cx, int cy)
+{
+    int tx;
+    int ty;
+
+    for (ty = y & ~(XRDP_TILE_SIZE - 1); ty < y + cy; ty += XRDP_TILE_SIZE)
+    {
+        for (tx = x & ~(XRDP_TILE_SIZE - 1); tx < x + cx;
+                tx += XRDP_TILE_SIZE)
+        {
+            if (xrdp_tile_map_test(self->invalid, tx, ty))
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_fb_diff_rect(struct xrdp_fb_diff *self, const char *data, int stride,
+                  short *rect, int flags)
+{
+    const tui32 *p;
+    tui32 *q;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int row;
+    int first_row;
+    int last_row;
+    int left;
+    int right;
+    int index;
+    int copy;
+
+    x = MAX(rect[0], 0);
+    y = MAX(rect[1], 0);
+    cx = MIN(rect[0] + rect[2], self->width) - x;
+    cy = MIN(rect[1] + rect[3], self->height) - y;
+    if (cx < 1 || cy < 1)
+    {
+        return 0;
+    }
+    copy = !(flags & XRDP_FB_DIFF_NO_COPY);
+    if (fb_diff_touches_invalid(self, x, y, cx, cy))
+    {
+        /* do not know what the client has here, all of it changed */
+        if (copy)
+        {
+            for (row = y; row < y + cy; row++)
+            {
+                g_memcpy(self->prev + row * self->stride + x * 4,
+                         data + row * stride + x * 4, cx * 4);
+            }
+            xrdp_tile_map_remove_rect(self->invalid, x, y, cx, cy);
+        }
+        if (!(flags & XRDP_FB_DIFF_NO_COUNT))
+        {
+            self->reported_pixels += cx * cy;
+            self->actual_pixels += cx * cy;
+        }
+        return 1;
+    }
+    first_row = -1;
+    last_row = -1;
+    left = cx;
+    right = -1;
+    for (row = y; row < y + cy; row++)
+    {
+        p = (const tui32 *) (data + row * stride) + x;
+        q = (tui32 *) (self->prev + row * self->stride) + x;
+        index = row_first_diff(p, q, cx);
+        if (index == cx)
+        {
+            continue;
+        }
+        if (first_row < 0)
+        {
+            first_row = row;
+        }
+        last_row = row;
+        /* only the part outside what is known to differ needs a look */
+        left = MIN(left, index);
+        if (right < cx - 1)
+        {
+            index = row_last_diff(p + right + 1, q + right + 1,
+                                  cx - right - 1);
+            if (index >= 0)
+            {
+                right += index + 1;
+            }
+        }
+        if (copy)
+        {
+            g_memcpy(q, p, cx * 4);
+        }
+    }
+    if (!(flags & XRDP_FB_DIFF_NO_COUNT))
+    {
+        self->reported_pixels += cx * cy;
+        if (first_row >= 0)
+        {
+            self->actual_pixels += (right - left + 1) *
+                                   (last_row - first_row + 1);
+        }
+    }
+    if (first_row < 0)
+    {
+        return 0;
+    }
+    if (flags & XRDP_FB_DIFF_SHRINK)
+    {
+        rect[0] = x + left;
+        rect[1] = first_row;
+        rect[2] = right - left + 1;
+        rect[3] = last_row - first_row + 1;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+int
+xrdp_fb_diff_rects(struct xrdp_fb_diff *self, const char *data, int stride,
+                   short *rects, int count, int flags)
+{
+    int index;
+    int rv;
+
+    rv = 0;
+    for (index = 0; index < count; index++)
+    {
+        if (xrdp_fb_diff_rect(self, data, stride, rects + index * 4, flags))
+        {
+            if (rv != index)
+            {
+                g_memcpy(rects + rv * 4, rects + index * 4,
+                         4 * sizeof(short));
+            }
+            rv++;
+        }
+    }
+    return rv;
+}
@@ -0,0 +1,101 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file xrdp_fb_diff.h
+ * @brief Compare new frames against the last one sent to trim damage
+ *
+ * Keeps a copy of the last 32 bpp frame sent for a surface. Damage
+ * rectangles from the module are compared against it so unchanged
+ * rectangles can be dropped and changed ones cut down to the pixels that
+ * really differ.
+ */
+
+#ifndef _XRDP_FB_DIFF_H
+#define _XRDP_FB_DIFF_H
+
+#include "arch.h"
+
+struct xrdp_tile_map;
+
+/* flags for xrdp_fb_diff_rect() */
+#define XRDP_FB_DIFF_SHRINK   (1 << 0) /* cut rect to the changed pixels */
+#define XRDP_FB_DIFF_NO_COPY  (1 << 1) /* leave the stored frame alone */
+#define XRDP_FB_DIFF_NO_COUNT (1 << 2) /* leave the counters alone */
+
+struct xrdp_fb_diff
+{
+    int width;
+    int height;
+    int stride; /* bytes per line in prev */
+    char *prev; /* last frame sent */
+    /* tiles where prev is not known to match the client */
+    struct xrdp_tile_map *invalid;
+    /* pixels in the rects passed in and in the rects passed back */
+    tui64 reported_pixels;
+    tui64 actual_pixels;
+};
+
+/**
+ * Create a frame store for a surface, everything starts invalid
+ *
+ * @return New object, or NULL on error
+ */
+struct xrdp_fb_diff *
+xrdp_fb_diff_create(int width, int height);
+void
+xrdp_fb_diff_delete(struct xrdp_fb_diff *self);
+/**
+ * Forget the stored frame, the next compare of any rect reports it
+ * changed. Used when the client surface contents are lost.
+ */
+void
+xrdp_fb_diff_invalidate(struct xrdp_fb_diff *self);
+/**
+ * Forget the stored frame under a rectangle, for areas the client will
+ * be sent again even if they have not changed
+ */
+void
+xrdp_fb_diff_invalidate_rect(struct xrdp_fb_diff *self,
+                             int x, int y, int cx, int cy);
+/**
+ * Compare one rectangle of a new frame against the stored frame
+ *
+ * The rectangle is clipped to the surface.
+ *
+ * @param data New frame, 32 bpp
+ * @param stride Bytes per line in data
+ * @param rect x, y, cx, cy, cut down in place if XRDP_FB_DIFF_SHRINK is
+ *        set and the rect changed
+ * @param flags XRDP_FB_DIFF_*
+ * @return 1 if anything in the rectangle changed, 0 if not
+ */
+int
+xrdp_fb_diff_rect(struct xrdp_fb_diff *self, const char *data, int stride,
+                  short *rect, int flags);
+/**
+ * Compare 'count' rectangles and remove the unchanged ones
+ *
+ * @return Number of rectangles left at the start of rects
+ */
+int
+xrdp_fb_diff_rects(struct xrdp_fb_diff *self, const char *data, int stride,
+                   short *rects, int count, int flags);
+
+#endif
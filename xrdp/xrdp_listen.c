@@ -26,10 +26,8 @@
 #include "log.h"
 #include "string_calls.h"
 
-/* 'g_process' is protected by the semaphore 'g_process_sem'.  One thread sets
-   g_process and waits for the other to process it */
-static tbus g_process_sem = 0;
-static struct xrdp_process *g_process = 0;
+/* serialises xrdp_process_create() between the accept threads */
+static tbus g_process_mutex = 0;
 
 int
 xrdp_listen_conn_in(struct trans *self, struct trans *new_self);
@@ -64,26 +62,54 @@ xrdp_listen_create(struct xrdp_startup_params *startup_params)
     self->trans_list = list_create();
     self->process_list = list_create();
     self->fork_list = list_create();
+    self->worker_list = list_create();
+    self->worker_list->auto_free = 1;
+    self->acceptor_list = list_create();
     self->startup_params = startup_params;
 
-    if (g_process_sem == 0)
+    if (g_process_mutex == 0)
     {
-        g_process_sem = tc_sem_create(0);
+        g_process_mutex = tc_mutex_create();
     }
     return self;
 }
 
+/*****************************************************************************/
+/* drops the idle workers, which exit when their socket closes */
+static void
+xrdp_listen_close_workers(struct xrdp_listen *self)
+{
+    int index;
+    struct xrdp_listen_worker *worker;
+
+    for (index = 0; index < self->worker_list->count; index++)
+    {
+        worker = (struct xrdp_listen_worker *)
+                 list_get_item(self->worker_list, index);
+        g_sck_close(worker->sck);
+    }
+    list_clear(self->worker_list);
+}
+
 /*****************************************************************************/
 void
 xrdp_listen_delete(struct xrdp_listen *self)
 {
     int index;
     struct trans *ltrans;
+    struct xrdp_listen *acceptor;
 
     if (self == NULL)
     {
         return;
     }
+    for (index = 0; index < self->acceptor_list->count; index++)
+    {
+        acceptor = (struct xrdp_listen *)
+                   list_get_item(self->acceptor_list, index);
+        xrdp_listen_delete(acceptor);
+    }
+    list_delete(self->acceptor_list);
     if (self->trans_list != NULL)
     {
         for (index = 0; index < self->trans_list->count; index++)
@@ -94,15 +120,24 @@ xrdp_listen_delete(struct xrdp_listen *self)
         list_delete(self->trans_list);
     }
 
-    if (g_process_sem != 0)
+    if (self->owner == NULL && g_process_mutex != 0)
     {
-        tc_sem_delete(g_process_sem);
-        g_process_sem = 0;
+        tc_mutex_delete(g_process_mutex);
+        g_process_mutex = 0;
+    }
+
+    if (self->owner == NULL)
+    {
+        tc_mutex_delete(self->lock);
+        g_delete_wait_obj(self->fork_event);
+        g_delete_wait_obj(self->refill_event);
     }
 
     g_delete_wait_obj(self->pro_done_event);
     list_delete(self->process_list);
     list_delete(self->fork_list);
+    xrdp_listen_close_workers(self);
+    list_delete(self->worker_list);
     g_free(self);
 }
 
@@ -140,16 +175,13 @@ xrdp_listen_delete_done_pro(struct xrdp_listen *self)
 }
 
 /*****************************************************************************/
-/* i can't get stupid in_val to work, hum using global var for now */
 static THREAD_RV THREAD_CC
 xrdp_process_run(void *in_val)
 {
     struct xrdp_process *process;
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "process started");
-    process = g_process;
-    g_process = 0;
-    tc_sem_inc(g_process_sem);
+    process = (struct xrdp_process *) in_val;
     xrdp_process_main_loop(process);
     LOG_DEVEL(LOG_LEVEL_TRACE, "process done");
     return 0;
@@ -565,8 +597,8 @@ xrdp_listen_pp(struct xrdp_listen *self, int *index,
 /*****************************************************************************/
 /* returns 0 if xrdp is listening correctly
    returns 1 if xrdp is not listening correctly */
-int
-xrdp_listen_init(struct xrdp_listen *self)
+static int
+xrdp_listen_init_trans(struct xrdp_listen *self)
 {
     int mode; /* TRANS_MODE_TCP*, TRANS_MODE_UNIX, TRANS_MODE_VSOCK */
     int error;
@@ -589,6 +621,14 @@ xrdp_listen_init(struct xrdp_listen *self)
             cont = 0;
             break;
         }
+        if (self->owner != NULL &&
+                mode != TRANS_MODE_TCP &&
+                mode != TRANS_MODE_TCP4 &&
+                mode != TRANS_MODE_TCP6)
+        {
+            /* only TCP ports can be shared between acceptors */
+            continue;
+        }
         LOG(LOG_LEVEL_INFO, "address [%s] port [%s] mode %d",
             address, port, mode);
         ltrans = trans_create(mode, 16, 16);
@@ -600,6 +640,7 @@ xrdp_listen_init(struct xrdp_listen *self)
         }
         LOG(LOG_LEVEL_INFO, "listening to port %s on %s",
             port, address);
+        ltrans->listen_reuseport = startup_params->listen_acceptors > 1;
         error = trans_listen_address(ltrans, port, address);
         if (error != 0)
         {
@@ -680,26 +721,68 @@ xrdp_listen_init(struct xrdp_listen *self)
 }
 
 /*****************************************************************************/
-static int
-xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
+/* returns 0 if xrdp is listening correctly
+   returns 1 if xrdp is not listening correctly */
+int
+xrdp_listen_init(struct xrdp_listen *self)
 {
-    int pid;
     int index;
-    struct xrdp_process *process;
-    struct trans *ltrans;
+    struct xrdp_listen *acceptor;
+    char text[256];
 
-    pid = g_fork();
+    if (xrdp_listen_init_trans(self) != 0)
+    {
+        return 1;
+    }
+    self->lock = tc_mutex_create();
+    g_snprintf(text, 255, "xrdp_%8.8x_listen_fork_event", g_getpid());
+    self->fork_event = g_create_wait_obj(text);
+    g_snprintf(text, 255, "xrdp_%8.8x_listen_refill_event", g_getpid());
+    self->refill_event = g_create_wait_obj(text);
+    if (self->lock == 0 || self->fork_event == 0 || self->refill_event == 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_listen_init: can't create the fork "
+            "queue");
+        return 1;
+    }
+    /* the sockets for the other accept loops are all opened here, before
+       any privileges are dropped */
+    for (index = 1; index < self->startup_params->listen_acceptors; index++)
+    {
+        acceptor = xrdp_listen_create(self->startup_params);
+        acceptor->owner = self;
+        if (xrdp_listen_init_trans(acceptor) != 0)
+        {
+            xrdp_listen_delete(acceptor);
+            return 1;
+        }
+        if (acceptor->trans_list->count == 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "listen_acceptors ignored, no TCP ports "
+                "to share");
+            xrdp_listen_delete(acceptor);
+            break;
+        }
+        list_add_item(self->acceptor_list, (tintptr) acceptor);
+    }
+    if (self->acceptor_list->count > 0)
+    {
+        LOG(LOG_LEVEL_INFO, "accepting connections on %d threads",
+            self->acceptor_list->count + 1);
+    }
+    return 0;
+}
 
-    if (pid == 0)
+/*****************************************************************************/
+/* in a child, close the sockets of a listener or an acceptor */
+static void
+xrdp_listen_drop_listeners(struct xrdp_listen *self)
+{
+    int index;
+    struct trans *ltrans;
+
+    if (self->trans_list != NULL)
     {
-        /* child */
-        /* recreate some main globals */
-        xrdp_child_fork();
-        /* recreate the process done wait object, not used in fork mode */
-        /* close, don't delete this */
-        g_close_wait_obj(self->pro_done_event);
-        xrdp_listen_create_pro_done(self);
-        /* delete listener, child need not listen */
         for (index = 0; index < self->trans_list->count; index++)
         {
             ltrans = (struct trans *) list_get_item(self->trans_list, index);
@@ -707,15 +790,95 @@ xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
         }
         list_delete(self->trans_list);
         self->trans_list = NULL;
+    }
+    /* an idle worker must see its socket close when the listener goes */
+    xrdp_listen_close_workers(self);
+}
+
+/*****************************************************************************/
+/* fork from the main thread with the lock held, so no accept thread is
+   part way through xrdp_listen_trans_in() and the child sees fork_list
+   and the acceptors' status whole, call xrdp_listen_child_init() in the
+   child */
+static int
+xrdp_listen_fork_locked(struct xrdp_listen *self)
+{
+    int pid;
+
+    tc_mutex_lock(self->lock);
+    pid = g_fork();
+    if (pid != 0)
+    {
+        tc_mutex_unlock(self->lock);
+    }
+    return pid;
+}
+
+/*****************************************************************************/
+/* called in a child just after xrdp_listen_fork_locked(), drops everything
+   that belongs to the listener */
+static void
+xrdp_listen_child_init(struct xrdp_listen *self)
+{
+    int index;
+    struct trans *ltrans;
+    struct xrdp_listen *acceptor;
+
+    /* recreate some main globals */
+    xrdp_child_fork();
+    /* recreate the process done wait object, not used in fork mode */
+    /* close, don't delete this */
+    g_close_wait_obj(self->pro_done_event);
+    xrdp_listen_create_pro_done(self);
+    /* delete listeners, child need not listen */
+    xrdp_listen_drop_listeners(self);
+    for (index = 0; index < self->acceptor_list->count; index++)
+    {
+        acceptor = (struct xrdp_listen *)
+                   list_get_item(self->acceptor_list, index);
+        xrdp_listen_drop_listeners(acceptor);
+        /* the threads running these did not come with us */
+        acceptor->status = -1;
+    }
+    /* connections still queued belong to other children */
+    for (index = 0; index < self->fork_list->count; index++)
+    {
+        ltrans = (struct trans *) list_get_item(self->fork_list, index);
+        trans_delete_from_child(ltrans);
+    }
+    list_clear(self->fork_list);
+    tc_mutex_unlock(self->lock);
+}
+
+/*****************************************************************************/
+/* runs a connection in a child, returns when it is done */
+static void
+xrdp_listen_child_run(struct xrdp_process *process,
+                      struct trans *server_trans)
+{
+    process->server_trans = server_trans;
+    xrdp_process_run(process);
+    xrdp_process_delete(process);
+    /* mark this process to exit */
+    g_set_term(1);
+}
+
+/*****************************************************************************/
+static int
+xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
+{
+    int pid;
+    struct xrdp_process *process;
+
+    pid = xrdp_listen_fork_locked(self);
+
+    if (pid == 0)
+    {
+        /* child */
+        xrdp_listen_child_init(self);
         /* new connect instance */
         process = xrdp_process_create(self, 0);
-        process->server_trans = server_trans;
-        g_process = process;
-        xrdp_process_run(0);
-        tc_sem_dec(g_process_sem);
-        xrdp_process_delete(process);
-        /* mark this process to exit */
-        g_set_term(1);
+        xrdp_listen_child_run(process, server_trans);
         return 1;
     }
 
@@ -724,6 +887,152 @@ xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
     return 0;
 }
 
+/*****************************************************************************/
+/* in a pre-forked worker, wait for the listener to pass a connection on
+   and run it */
+static void
+xrdp_listen_worker_run(struct xrdp_listen *self, int sck)
+{
+    struct xrdp_process *process;
+    tbus robjs[2];
+    unsigned int fdcount;
+    int info[3]; /* mode, in_s size, out_s size */
+    int fd;
+
+    /* everything that does not need the connection is done up front */
+    process = xrdp_process_create(self, 0);
+    if (xrdp_process_prepare(process) != 0)
+    {
+        /* the listener forks for the connection instead */
+        LOG(LOG_LEVEL_WARNING, "xrdp_listen_worker_run: can't prepare "
+            "for a connection");
+        g_sck_close(sck);
+        xrdp_process_delete(process);
+        g_set_term(1);
+        return;
+    }
+    robjs[0] = g_get_term();
+    robjs[1] = sck;
+    while (!g_is_wait_obj_set(robjs[0]) && !g_sck_can_recv(sck, 0))
+    {
+        g_obj_wait(robjs, 2, 0, 0, -1);
+    }
+    fdcount = 0;
+    if (!g_is_wait_obj_set(robjs[0]) &&
+            g_sck_recv_fd_set(sck, info, sizeof(info),
+                              &fd, 1, &fdcount) == sizeof(info) &&
+            fdcount == 1)
+    {
+        g_sck_close(sck);
+        g_file_set_cloexec(fd, 1);
+        xrdp_process_attach(process, fd, info[0], info[1], info[2]);
+        xrdp_listen_child_run(process, process->server_trans);
+        return;
+    }
+    /* terminated, or the listener has gone away */
+    if (fdcount == 1)
+    {
+        g_sck_close(fd);
+    }
+    g_sck_close(sck);
+    xrdp_process_delete(process);
+    g_set_term(1);
+}
+
+/*****************************************************************************/
+/* fork one idle worker if there are fewer than prefork_workers, refill_event
+   stays set until there are enough, or until a fork fails, when the next
+   handoff or worker exit sets it again
+   returns 1 in a worker once it is done, like xrdp_listen_fork() */
+static int
+xrdp_listen_refill(struct xrdp_listen *self)
+{
+    struct xrdp_listen_worker *worker;
+    int sck[2];
+    int pid;
+
+    if (self->worker_list->count >= self->startup_params->prefork_workers)
+    {
+        g_reset_wait_obj(self->refill_event);
+        return 0;
+    }
+    if (g_sck_local_socketpair(sck) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_listen_refill: can't create "
+            "socketpair [%s]", g_get_strerror());
+        g_reset_wait_obj(self->refill_event);
+        return 0;
+    }
+    g_file_set_cloexec(sck[0], 1);
+    g_file_set_cloexec(sck[1], 1);
+    pid = xrdp_listen_fork_locked(self);
+    if (pid == 0)
+    {
+        /* worker */
+        g_sck_close(sck[0]);
+        xrdp_listen_child_init(self);
+        xrdp_listen_worker_run(self, sck[1]);
+        return 1;
+    }
+    g_sck_close(sck[1]);
+    worker = g_new0(struct xrdp_listen_worker, 1);
+    if (pid < 0 || worker == NULL)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_listen_refill: can't start a worker");
+        /* a worker that did start exits when this closes */
+        g_sck_close(sck[0]);
+        g_free(worker);
+        g_reset_wait_obj(self->refill_event);
+        return 0;
+    }
+    worker->pid = pid;
+    worker->sck = sck[0];
+    list_add_item(self->worker_list, (tintptr) worker);
+    if (self->worker_list->count >= self->startup_params->prefork_workers)
+    {
+        g_reset_wait_obj(self->refill_event);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* pass a new connection on to an idle worker
+   returns 0 if a worker has it, 1 if it still needs a fork */
+static int
+xrdp_listen_handoff(struct xrdp_listen *self, struct trans *server_trans)
+{
+    struct xrdp_listen_worker *worker;
+    int info[3];
+    int fd;
+    int rv;
+
+    fd = server_trans->sck;
+    info[0] = server_trans->mode;
+    info[1] = server_trans->in_s->size;
+    info[2] = server_trans->out_s->size;
+    rv = 1;
+    /* oldest first, a worker that has gone away fails and the next is
+       tried */
+    while (rv != 0 && self->worker_list->count > 0)
+    {
+        worker = (struct xrdp_listen_worker *)
+                 list_get_item(self->worker_list, 0);
+        if (g_sck_send_fd_set(worker->sck, info, sizeof(info),
+                              &fd, 1) == sizeof(info))
+        {
+            rv = 0;
+        }
+        g_sck_close(worker->sck);
+        list_remove_item(self->worker_list, 0);
+        g_set_wait_obj(self->refill_event);
+    }
+    if (rv == 0)
+    {
+        trans_delete(server_trans);
+    }
+    return rv;
+}
+
 /*****************************************************************************/
 /* a new connection is coming in */
 int
@@ -731,24 +1040,29 @@ xrdp_listen_conn_in(struct trans *self, struct trans *new_self)
 {
     struct xrdp_process *process;
     struct xrdp_listen *lis;
+    struct xrdp_listen *root;
 
     lis = (struct xrdp_listen *)(self->callback_data);
 
     if (lis->startup_params->fork)
     {
-        list_add_item(lis->fork_list, (intptr_t) new_self);
+        /* only the main thread forks, the lock is held by
+           xrdp_listen_trans_in() */
+        root = (lis->owner != NULL) ? lis->owner : lis;
+        list_add_item(root->fork_list, (intptr_t) new_self);
+        g_set_wait_obj(root->fork_event);
         return 0;
     }
 
+    tc_mutex_lock(g_process_mutex);
     process = xrdp_process_create(lis, lis->pro_done_event);
+    tc_mutex_unlock(g_process_mutex);
 
     if (xrdp_listen_add_pro(lis, process) == 0)
     {
         /* start thread */
         process->server_trans = new_self;
-        g_process = process;
-        tc_thread_create(xrdp_process_run, 0);
-        tc_sem_dec(g_process_sem); /* this will wait */
+        tc_thread_create(xrdp_process_run, process);
     }
     else
     {
@@ -766,13 +1080,28 @@ xrdp_listen_conn_in(struct trans *self, struct trans *new_self)
  * on a signal. This should be investigated.
  */
 static void
-process_pending_sigchld_events(void)
+process_pending_sigchld_events(struct xrdp_listen *self)
 {
     struct proc_exit_status e;
+    struct xrdp_listen_worker *worker;
+    int index;
     int pid;
 
     while ((pid = g_waitchild(&e)) > 0)
     {
+        /* an idle worker can't take connections any more */
+        for (index = 0; index < self->worker_list->count; index++)
+        {
+            worker = (struct xrdp_listen_worker *)
+                     list_get_item(self->worker_list, index);
+            if (worker->pid == pid)
+            {
+                g_sck_close(worker->sck);
+                list_remove_item(self->worker_list, index);
+                g_set_wait_obj(self->refill_event);
+                break;
+            }
+        }
         if (e.reason == E_PXR_SIGNAL)
         {
             char sigstr[MAXSTRSIGLEN];
@@ -783,160 +1112,318 @@ process_pending_sigchld_events(void)
     }
 }
 /*****************************************************************************/
-/* wait for incoming connections
-   passes through trans_listen_address return value */
+static int
+xrdp_listen_term_in(void *arg, tintptr obj, int events)
+{
+    /* not from the accept threads, the main thread may be forking and
+       the child would inherit a held log lock */
+    if (((struct xrdp_listen *) arg)->owner == NULL)
+    {
+        LOG(LOG_LEVEL_INFO,
+            "Received termination signal, stopping the server accept new "
+            "connections thread");
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+static int
+xrdp_listen_sigchld_in(void *arg, tintptr obj, int events)
+{
+    /* SIGCHLD caught */
+    g_set_sigchld(0);
+    process_pending_sigchld_events((struct xrdp_listen *) arg);
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+xrdp_listen_sync_in(void *arg, tintptr obj, int events)
+{
+    /* some function must be processed by this thread */
+    g_reset_wait_obj(obj);
+    g_process_waiting_function(); /* run the function */
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+xrdp_listen_done_in(void *arg, tintptr obj, int events)
+{
+    /* pro_done_event, a process has died remove it from lists */
+    g_reset_wait_obj(obj);
+    xrdp_listen_delete_done_pro((struct xrdp_listen *) arg);
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+xrdp_listen_fork_in(void *arg, tintptr obj, int events)
+{
+    /* connections queued, they are taken off fork_list in the main loop */
+    g_reset_wait_obj(obj);
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+xrdp_listen_refill_in(void *arg, tintptr obj, int events)
+{
+    /* a worker is forked at the end of the pass, after the connections
+       that came in with it have been handed on */
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+xrdp_listen_trans_in(void *arg, tintptr obj, int events)
+{
+    struct trans *ltrans;
+    struct xrdp_listen *lis;
+    struct xrdp_listen *root;
+    int rv;
+
+    ltrans = (struct trans *) arg;
+    lis = (struct xrdp_listen *) (ltrans->callback_data);
+    if (!lis->startup_params->fork)
+    {
+        /* Run the callback when accept() returns a new socket */
+        return trans_check_wait_objs(ltrans) != 0;
+    }
+    /* the main thread can't fork while an accept thread is part way
+       through this, holding the log lock say, xrdp_listen_conn_in()
+       queues the connection under the same lock */
+    root = (lis->owner != NULL) ? lis->owner : lis;
+    tc_mutex_lock(root->lock);
+    rv = trans_check_wait_objs(ltrans) != 0;
+    tc_mutex_unlock(root->lock);
+    return rv;
+}
+
+/*****************************************************************************/
+/* takes the oldest connection off the main listener's fork_list */
+static struct trans *
+xrdp_listen_next_fork(struct xrdp_listen *self)
+{
+    struct trans *rv;
+
+    rv = NULL;
+    tc_mutex_lock(self->lock);
+    if (self->fork_list->count > 0)
+    {
+        rv = (struct trans *) list_get_item(self->fork_list, 0);
+        list_remove_item(self->fork_list, 0);
+    }
+    tc_mutex_unlock(self->lock);
+    return rv;
+}
+
+/*****************************************************************************/
+/* an acceptor's status is read by the main thread */
+static void
+xrdp_listen_set_status(struct xrdp_listen *self, int status)
+{
+    if (self->owner == NULL)
+    {
+        self->status = status;
+        return;
+    }
+    tc_mutex_lock(self->owner->lock);
+    self->status = status;
+    tc_mutex_unlock(self->owner->lock);
+}
+
+/*****************************************************************************/
+static THREAD_RV THREAD_CC
+xrdp_listen_acceptor_run(void *in_val)
+{
+    struct xrdp_listen *self;
+
+    self = (struct xrdp_listen *) in_val;
+    xrdp_listen_main_loop(self);
+    /* let the main listener know */
+    g_set_wait_obj(self->owner->pro_done_event);
+    return 0;
+}
+
+/*****************************************************************************/
+/* true while any accept thread is still running */
+static int
+xrdp_listen_acceptors_running(struct xrdp_listen *self)
+{
+    int index;
+    int rv;
+    struct xrdp_listen *acceptor;
+
+    rv = 0;
+    tc_mutex_lock(self->lock);
+    for (index = 0; index < self->acceptor_list->count; index++)
+    {
+        acceptor = (struct xrdp_listen *)
+                   list_get_item(self->acceptor_list, index);
+        if (acceptor->status > 0)
+        {
+            rv = 1;
+            break;
+        }
+    }
+    tc_mutex_unlock(self->lock);
+    return rv;
+}
+
+/*****************************************************************************/
 int
 xrdp_listen_main_loop(struct xrdp_listen *self)
 {
-    int robjs_count;
     int cont;
     int index;
+    int rv;
     int timeout;
-    intptr_t robjs[32];
     intptr_t term_obj;
     intptr_t sigchld_obj;
     intptr_t sync_obj;
     intptr_t done_obj;
     struct trans *ltrans;
+    struct xrdp_listen *acceptor;
+    struct g_reactor *reactor;
 
-    self->status = 1;
+    xrdp_listen_set_status(self, 1);
 
     term_obj = g_get_term(); /*Global termination event */
     sigchld_obj = g_get_sigchld();
     sync_obj = g_get_sync_event();
     done_obj = self->pro_done_event;
-    cont = 1;
-    while (cont)
+    reactor = g_reactor_create();
+    if (reactor == NULL)
     {
-        /* build the wait obj list */
-        robjs_count = 0;
-        robjs[robjs_count++] = term_obj;
-        robjs[robjs_count++] = sigchld_obj;
-        robjs[robjs_count++] = sync_obj;
-        robjs[robjs_count++] = done_obj;
-        timeout = -1;
-
-        for (index = 0; index < self->trans_list->count; index++)
+        LOG(LOG_LEVEL_ERROR, "xrdp_listen_main_loop: g_reactor_create failed");
+        xrdp_listen_set_status(self, -1);
+        return 1;
+    }
+    /* everything waited on here lives as long as the loop */
+    cont = g_reactor_add(reactor, term_obj, G_REACTOR_READ,
+                         xrdp_listen_term_in, self) == 0 &&
+           g_reactor_add(reactor, done_obj, G_REACTOR_READ,
+                         xrdp_listen_done_in, self) == 0;
+    if (self->owner == NULL)
+    {
+        /* signals, sync calls and forks are only handled on the main
+           thread */
+        cont = cont &&
+               g_reactor_add(reactor, sigchld_obj, G_REACTOR_READ,
+                             xrdp_listen_sigchld_in, self) == 0 &&
+               g_reactor_add(reactor, sync_obj, G_REACTOR_READ,
+                             xrdp_listen_sync_in, self) == 0 &&
+               g_reactor_add(reactor, self->fork_event, G_REACTOR_READ,
+                             xrdp_listen_fork_in, self) == 0 &&
+               g_reactor_add(reactor, self->refill_event, G_REACTOR_READ,
+                             xrdp_listen_refill_in, self) == 0;
+    }
+    for (index = 0; cont && index < self->trans_list->count; index++)
+    {
+        ltrans = (struct trans *) list_get_item(self->trans_list, index);
+        if (ltrans->status != TRANS_STATUS_UP ||
+                g_reactor_add(reactor, ltrans->sck, G_REACTOR_READ,
+                              xrdp_listen_trans_in, ltrans) != 0)
         {
-            ltrans = (struct trans *)
-                     list_get_item(self->trans_list, index);
-            if (trans_get_wait_objs(ltrans, robjs, &robjs_count) != 0)
-            {
-                cont = 0;
-                break;
-            }
+            cont = 0;
         }
-        if (cont == 0)
+    }
+    if (self->owner == NULL && self->startup_params->fork &&
+            self->startup_params->prefork_workers > 0)
+    {
+        LOG(LOG_LEVEL_INFO, "keeping %d pre-forked workers",
+            self->startup_params->prefork_workers);
+        g_set_wait_obj(self->refill_event);
+    }
+    for (index = 0; cont && index < self->acceptor_list->count; index++)
+    {
+        acceptor = (struct xrdp_listen *)
+                   list_get_item(self->acceptor_list, index);
+        xrdp_listen_set_status(acceptor, 1);
+        if (tc_thread_create(xrdp_listen_acceptor_run, acceptor) != 0)
         {
-            break;
+            LOG(LOG_LEVEL_ERROR, "xrdp_listen_main_loop: can't start an "
+                "accept thread");
+            xrdp_listen_set_status(acceptor, -1);
         }
-
-        /* wait - timeout -1 means wait indefinitely*/
-        if (g_obj_wait(robjs, robjs_count, 0, 0, timeout) != 0)
+    }
+    while (cont)
+    {
+        /* wait - timeout -1 means wait indefinitely, the main listener
+           wakes up to rotate the TLS ticket keys */
+        timeout = (self->owner == NULL) ? ssl_tls_ticket_keys_check() : -1;
+        rv = g_reactor_wait(reactor, NULL, 0, NULL, 0, timeout);
+        if (rv < 0)
         {
             /* error, should not get here */
             g_sleep(100);
         }
-
-        if (g_is_wait_obj_set(term_obj)) /* termination called */
+        else if (rv > 0)
         {
-            LOG(LOG_LEVEL_INFO,
-                "Received termination signal, stopping the server accept new "
-                "connections thread");
+            /* termination called, or a listener failed */
             break;
         }
-
-        if (g_is_wait_obj_set(sigchld_obj)) /* SIGCHLD caught */
+        while (self->owner == NULL &&
+                (ltrans = xrdp_listen_next_fork(self)) != NULL)
         {
-            g_set_sigchld(0);
-            process_pending_sigchld_events();
-        }
-
-        /* some function must be processed by this thread */
-        if (g_is_wait_obj_set(sync_obj))
-        {
-            g_reset_wait_obj(sync_obj);
-            g_process_waiting_function(); /* run the function */
-        }
-
-        if (g_is_wait_obj_set(done_obj)) /* pro_done_event */
-        {
-            g_reset_wait_obj(done_obj);
-            /* a process has died remove it from lists*/
-            xrdp_listen_delete_done_pro(self);
-        }
-
-        /* Run the callback when accept() returns a new socket*/
-        for (index = 0; index < self->trans_list->count; index++)
-        {
-            ltrans = (struct trans *)
-                     list_get_item(self->trans_list, index);
-            if (trans_check_wait_objs(ltrans) != 0)
+            if (xrdp_listen_handoff(self, ltrans) == 0)
             {
-                cont = 0;
-                break;
+                continue;
             }
-        }
-        if (cont == 0)
-        {
-            break;
-        }
-        while (self->fork_list->count > 0)
-        {
-            ltrans = (struct trans *) list_get_item(self->fork_list, 0);
-            list_remove_item(self->fork_list, 0);
             if (xrdp_listen_fork(self, ltrans) != 0)
             {
                 cont = 0;
                 break;
             }
         }
-        if (cont == 0)
+        /* one fork a pass, while the workers are short, so a connection
+           is never kept waiting behind a run of them */
+        if (cont && self->owner == NULL &&
+                g_is_wait_obj_set(self->refill_event) &&
+                xrdp_listen_refill(self) != 0)
         {
+            /* this is a worker whose connection has finished */
             break;
         }
     }
 
     /* stop listening */
-    xrdp_listen_stop_all_listen(self);
-
-    /* second loop to wait for all process threads to close */
-    cont = 1;
-
-    while (cont)
+    g_reactor_remove(reactor, term_obj);
+    if (self->owner == NULL)
     {
-        if (self->process_list->count == 0)
+        g_reactor_remove(reactor, sigchld_obj);
+    }
+    if (self->trans_list != NULL)
+    {
+        for (index = 0; index < self->trans_list->count; index++)
         {
-            break;
+            ltrans = (struct trans *) list_get_item(self->trans_list, index);
+            g_reactor_remove(reactor, ltrans->sck);
         }
+    }
+    xrdp_listen_stop_all_listen(self);
+    xrdp_listen_close_workers(self);
+    if (xrdp_listen_acceptors_running(self))
+    {
+        /* the accept threads stop on term too */
+        g_set_term(1);
+    }
 
-        timeout = -1;
-        /* build the wait obj list */
-        robjs_count = 0;
-        robjs[robjs_count++] = sync_obj;
-        robjs[robjs_count++] = done_obj;
-
+    /* second loop to wait for all process and accept threads to close, on
+       the sync and done events still registered */
+    while (self->process_list->count > 0 ||
+            xrdp_listen_acceptors_running(self))
+    {
         /* wait - timeout -1 means wait indefinitely*/
-        if (g_obj_wait(robjs, robjs_count, 0, 0, timeout) != 0)
+        if (g_reactor_wait(reactor, NULL, 0, NULL, 0, -1) < 0)
         {
             /* error, should not get here */
             g_sleep(100);
         }
-
-        /* some function must be processed by this thread */
-        if (g_is_wait_obj_set(sync_obj))
-        {
-            g_reset_wait_obj(sync_obj);
-            g_process_waiting_function(); /* run the function that is waiting*/
-        }
-
-        if (g_is_wait_obj_set(done_obj)) /* pro_done_event */
-        {
-            g_reset_wait_obj(done_obj);
-            xrdp_listen_delete_done_pro(self);
-        }
     }
 
-    self->status = -1;
+    g_reactor_delete(reactor);
+    xrdp_listen_set_status(self, -1);
     return 0;
 }
@@ -743,6 +743,72 @@ xrdp_login_wnd_get_monitor_dpi(struct xrdp_wm *self)
 }
 
 
+/******************************************************************************/
+/* the background image, relative to XRDP_SHARE_PATH unless absolute */
+static void
+xrdp_login_wnd_background_path(const struct xrdp_cfg_globals *globals,
+                               char *fileName, int fileNameSize)
+{
+    if (globals->ls_background_image[0] == '/')
+    {
+        g_snprintf(fileName, fileNameSize, "%s",
+                   globals->ls_background_image);
+    }
+    else
+    {
+        g_snprintf(fileName, fileNameSize, "%s/%s",
+                   XRDP_SHARE_PATH, globals->ls_background_image);
+    }
+}
+
+/******************************************************************************/
+/* if logo image not specified, use default */
+static void
+xrdp_login_wnd_default_logo(struct xrdp_cfg_globals *globals)
+{
+    if (globals->ls_logo_filename[0] == 0)
+    {
+#ifdef USE_IMLIB2
+        g_snprintf(globals->ls_logo_filename, 255, "%s/xrdp_logo.png",
+                   XRDP_SHARE_PATH);
+#else
+        g_snprintf(globals->ls_logo_filename, 255, "%s/xrdp_logo.bmp",
+                   XRDP_SHARE_PATH);
+#endif
+    }
+}
+
+/******************************************************************************/
+int
+xrdp_login_wnd_preload_images(const char *xrdp_ini)
+{
+    struct xrdp_config *config;
+    struct xrdp_cfg_globals *globals;
+    char fileName[256];
+
+    config = g_new0(struct xrdp_config, 1);
+    if (config == NULL)
+    {
+        return 1;
+    }
+    /* the colors read depend on the bpp, the file names don't */
+    if (load_xrdp_config(config, xrdp_ini, 24) != 0)
+    {
+        g_free(config);
+        return 1;
+    }
+    globals = &config->cfg_globals;
+    if (globals->ls_background_image[0] != 0)
+    {
+        xrdp_login_wnd_background_path(globals, fileName, sizeof(fileName));
+        xrdp_bitmap_preload(fileName);
+    }
+    xrdp_login_wnd_default_logo(globals);
+    xrdp_bitmap_preload(globals->ls_logo_filename);
+    g_free(config);
+    return 0;
+}
+
 /******************************************************************************/
 int
 xrdp_login_wnd_create(struct xrdp_wm *self)
@@ -869,16 +935,8 @@ xrdp_login_wnd_create(struct xrdp_wm *self)
                 char fileName[256] ;
                 but = xrdp_bitmap_create(4, 4, self->screen->bpp,
                                          WND_TYPE_IMAGE, self);
-                if (globals->ls_background_image[0] == '/')
-                {
-                    g_snprintf(fileName, 255, "%s",
-                               globals->ls_background_image);
-                }
-                else
-                {
-                    g_snprintf(fileName, 255, "%s/%s",
-                               XRDP_SHARE_PATH, globals->ls_background_image);
-                }
+                xrdp_login_wnd_background_path(globals, fileName,
+                                               sizeof(fileName));
                 LOG(LOG_LEVEL_DEBUG, "We try to load the following background file: %s", fileName);
                 if (globals->ls_background_transform == XBLT_NONE)
                 {
@@ -907,17 +965,7 @@ xrdp_login_wnd_create(struct xrdp_wm *self)
             }
         }
 
-        /* if logo image not specified, use default */
-        if (globals->ls_logo_filename[0] == 0)
-        {
-#ifdef USE_IMLIB2
-            g_snprintf(globals->ls_logo_filename, 255, "%s/xrdp_logo.png",
-                       XRDP_SHARE_PATH);
-#else
-            g_snprintf(globals->ls_logo_filename, 255, "%s/xrdp_logo.bmp",
-                       XRDP_SHARE_PATH);
-#endif
-        }
+        xrdp_login_wnd_default_logo(globals);
 
         /* logo image */
         but = xrdp_bitmap_create(4, 4, self->screen->bpp, WND_TYPE_IMAGE, self);
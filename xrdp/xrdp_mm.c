@@ -1215,6 +1215,7 @@ xrdp_mm_egfx_invalidate_wm_screen(struct xrdp_mm *self)
         }
         error = xrdp_region_add_rect(self->wm->screen_dirty_region, &xr_rect);
     }
+    xrdp_encoder_first_paint(self->encoder);
     return error;
 }
 
@@ -1520,6 +1521,24 @@ xrdp_mm_egfx_caps_advertise(void *user, int caps_count,
     return 0;
 }
 
+/*****************************************************************************/
+/* returns non-zero if the module is not to be told to send another frame
+   yet, because what it sent would only queue up behind the client's
+   pacer. It is dropped in the module instead, which keeps collecting
+   damage. xrdp_mm_pace_release() sends the ack later */
+static int
+xrdp_mm_pace_hold(struct xrdp_mm *self, int frame_id)
+{
+    if (!trans_pace_backlog(self->wm->session->trans))
+    {
+        return 0;
+    }
+    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_mm_pace_hold: frame_id %d", frame_id);
+    self->pace_held = 1;
+    self->pace_held_frame_id = frame_id;
+    return 1;
+}
+
 /*****************************************************************************/
 static int
 xrdp_mm_update_module_frame_ack(struct xrdp_mm *self)
@@ -1533,6 +1552,10 @@ xrdp_mm_update_module_frame_ack(struct xrdp_mm *self)
     {
         if (encoder->frame_id_server > encoder->frame_id_server_sent)
         {
+            if (xrdp_mm_pace_hold(self, -1))
+            {
+                return 0;
+            }
             LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_update_module_ack: "
                       "frame_id_server %d", encoder->frame_id_server);
             encoder->frame_id_server_sent = encoder->frame_id_server;
@@ -1542,6 +1565,31 @@ xrdp_mm_update_module_frame_ack(struct xrdp_mm *self)
     return 0;
 }
 
+/*****************************************************************************/
+/* sends the frame ack xrdp_mm_pace_hold() held back, once the pacer has
+   caught up */
+static void
+xrdp_mm_pace_release(struct xrdp_mm *self)
+{
+    if (!self->pace_held || trans_pace_backlog(self->wm->session->trans))
+    {
+        return;
+    }
+    self->pace_held = 0;
+    if (self->mod == NULL || self->encoder == NULL)
+    {
+        return;
+    }
+    if (self->pace_held_frame_id < 0)
+    {
+        xrdp_mm_update_module_frame_ack(self);
+    }
+    else
+    {
+        self->mod->mod_frame_ack(self->mod, 0, self->pace_held_frame_id);
+    }
+}
+
 static int
 xrdp_mm_egfx_frame_ack(void *user, uint32_t queue_depth, int frame_id,
                        int frames_decoded)
@@ -1595,6 +1643,7 @@ xrdp_mm_egfx_frame_ack(void *user, uint32_t queue_depth, int frame_id,
         /* frame acks can come out of order so ignore older one */
         encoder->frame_id_client = MAX(frame_id, encoder->frame_id_client);
     }
+    xrdp_encoder_bw_frame_ack(encoder);
     xrdp_mm_update_module_frame_ack(self);
     return 0;
 }
@@ -3231,6 +3280,64 @@ xrdp_mm_connect(struct xrdp_mm *self)
     xrdp_mm_connect_sm(self);
 }
 
+/*****************************************************************************/
+/* cap what is sent to the client now the user is known
+
+   session_max_mbps from [Globals] is already in force. The connection's
+   own section can change it, and a session_max_mbps.<group> entry in
+   [Globals] for a group the user is in overrides both */
+static void
+xrdp_mm_set_session_pacing(struct xrdp_mm *self)
+{
+    struct list *names;
+    struct list *values;
+    const char *username;
+    const char *name;
+    int mbps;
+    int index;
+    int gid;
+    int ok;
+
+    mbps = xrdp_mm_get_value_int(self, "session_max_mbps",
+                                 self->wm->client_info->session_max_mbps);
+    username = xrdp_mm_get_value(self, "username");
+    names = list_create();
+    names->auto_free = 1;
+    values = list_create();
+    values->auto_free = 1;
+    if (username != NULL && username[0] != '\0' &&
+            file_by_name_read_section(self->wm->session->xrdp_ini,
+                                      "Globals", names, values) == 0)
+    {
+        for (index = 0; index < names->count; index++)
+        {
+            name = (const char *)list_get_item(names, index);
+            if (g_strncasecmp(name, "session_max_mbps.", 17) != 0)
+            {
+                continue;
+            }
+            ok = 0;
+            if (g_getgroup_info(name + 17, &gid) == 0 &&
+                    g_check_user_in_group(username, gid, &ok) == 0 && ok)
+            {
+                mbps = g_atoi((const char *)list_get_item(values, index));
+                break;
+            }
+        }
+    }
+    list_delete(names);
+    list_delete(values);
+
+    if (mbps > 0)
+    {
+        /* 10 Gbit/s is as high as trans_set_pacing() goes, and keeps the
+           kbit/s value inside an int */
+        mbps = MIN(mbps, 10 * 1000);
+        LOG(LOG_LEVEL_INFO, "Limiting the session to %d Mbit/s", mbps);
+    }
+    trans_set_pacing(self->wm->session->trans, mbps * 1000);
+}
+
 /*****************************************************************************/
 static void
 xrdp_mm_connect_sm(struct xrdp_mm *self)
@@ -3376,6 +3483,7 @@ xrdp_mm_connect_sm(struct xrdp_mm *self)
             {
                 xrdp_wm_log_msg(self->wm, LOG_LEVEL_INFO,
                                 "Connecting to session");
+                xrdp_mm_set_session_pacing(self);
                 /* This is synchronous - no reply message expected */
                 status = xrdp_mm_user_session_connect(self);
             }
@@ -3484,6 +3592,21 @@ xrdp_mm_get_wait_objs(struct xrdp_mm *self,
         read_objs[(*rcount)++] = self->encoder->xrdp_encoder_event_processed;
     }
 
+    if (self->pace_held)
+    {
+        /* wake up to send the held frame ack when the pacer has caught
+           up, while output is queued the client transport wakes us */
+        struct trans *trans = self->wm->session->trans;
+        int delay = trans_pace_delay(trans);
+        if (delay > 0 || !trans_pace_backlog(trans))
+        {
+            if ((*timeout < 0) || (*timeout > delay))
+            {
+                *timeout = delay;
+            }
+        }
+    }
+
     if (self->resize_queue != 0)
     {
         read_objs[(*rcount)++] = self->resize_ready;
@@ -3601,6 +3724,8 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
 
     LOG(LOG_LEVEL_TRACE, "xrdp_mm_process_enc_done:");
 
+    /* surface commands and frame markers go out in full TLS records */
+    trans_set_cork(self->wm->session->trans, 1);
     while (1)
     {
         tc_mutex_lock(self->encoder->mutex);
@@ -3627,6 +3752,7 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
                   "bytes %d", enc_done->comp_bytes);
         if (enc_done->comp_bytes > 0)
         {
+            xrdp_encoder_bw_sent(self->encoder, enc_done->comp_bytes);
             if (is_gfx)
             {
                 xrdp_egfx_send_data(self->egfx,
@@ -3662,16 +3788,20 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
         /* free enc_done */
         if (enc_done->last)
         {
+            /* end of frame */
+            trans_flush(self->wm->session->trans);
             enc = enc_done->enc;
             LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_process_enc_done: last set");
             if (got_frame_id)
             {
+                xrdp_encoder_first_frame_sent(self->encoder);
+                xrdp_encoder_first_paint_upgrade(self->encoder);
                 if (client_ack)
                 {
                     self->encoder->frame_id_server = enc_done->frame_id;
                     xrdp_mm_update_module_frame_ack(self);
                 }
-                else
+                else if (!xrdp_mm_pace_hold(self, enc_done->frame_id))
                 {
                     self->mod->mod_frame_ack(self->mod, 0,
                                              enc_done->frame_id);
@@ -3695,6 +3825,7 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
         g_free(enc_done->comp_pad_data);
         g_free(enc_done);
     }
+    trans_set_cork(self->wm->session->trans, 0);
     return 0;
 }
 
@@ -3881,6 +4012,8 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
         }
     }
 
+    xrdp_mm_pace_release(self);
+
     if (self->wm->screen_dirty_region != NULL)
     {
         if (xrdp_region_not_empty(self->wm->screen_dirty_region))
@@ -3937,6 +4070,7 @@ xrdp_mm_frame_ack(struct xrdp_mm *self, int frame_id)
         /* frame acks can come out of order so ignore older one */
         encoder->frame_id_client = MAX(frame_id, encoder->frame_id_client);
     }
+    xrdp_encoder_bw_frame_ack(encoder);
     xrdp_mm_update_module_frame_ack(self);
     return 0;
 }
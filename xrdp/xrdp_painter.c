@@ -810,6 +810,7 @@ xrdp_painter_draw_utf32(struct xrdp_painter *self,
     int total_height;
     int dx;
     int dy;
+    int data_len;
     char *data;
     struct xrdp_region *region;
     struct xrdp_rect rect;
@@ -936,7 +937,9 @@ xrdp_painter_draw_utf32(struct xrdp_painter *self,
     total_width = 0;
     total_height = 0;
     index = 0;
-    data = (char *)g_malloc(utf32len * 2, 1);
+    /* room for a fragment to be added */
+    data = (char *)g_malloc(utf32len * 2 + 3, 1);
+    data_len = 0;
 
     for (index = 0 ; index < utf32len; ++index)
     {
@@ -979,11 +982,25 @@ xrdp_painter_draw_utf32(struct xrdp_painter *self,
             x1 = x;
             y1 = y + font->body_height;
             flags = 0x03; /* 0x03 0x73; TEXT2_IMPLICIT_X and something else */
+            if (data_len == 0)
+            {
+                data_len = xrdp_cache_add_text_fragment(self->wm->cache, f,
+                                                        flags, data,
+                                                        utf32len * 2);
+            }
             libxrdp_orders_text(self->session, f, flags, 0,
                                 self->fg_color, 0,
                                 x - 1, y - 1, x + total_width, y + total_height,
                                 0, 0, 0, 0,
-                                x1, y1, data, utf32len * 2, &draw_rect);
+                                x1, y1, data, data_len, &draw_rect);
+            if (data_len > utf32len * 2)
+            {
+                /* the run went out with its add, the other rectangles
+                   only need to use it, the run is still at the start */
+                data_len = xrdp_cache_add_text_fragment(self->wm->cache, f,
+                                                        flags, data,
+                                                        utf32len * 2);
+            }
         }
 
         k++;
@@ -1044,6 +1061,8 @@ xrdp_painter_draw_text2(struct xrdp_painter *self,
     struct xrdp_rect draw_rect;
     struct xrdp_rect rect;
     struct xrdp_region *region;
+    char *frag_data;
+    int run_len;
     int k;
     int dx;
     int dy;
@@ -1101,21 +1120,40 @@ xrdp_painter_draw_text2(struct xrdp_painter *self,
     x += dx;
     y += dy;
     k = 0;
+    frag_data = NULL;
+    run_len = data_len;
 
     while (xrdp_region_get_rect(region, k, &rect) == 0)
     {
         if (rect_intersect(&rect, &clip_rect, &draw_rect))
         {
+            if (frag_data == NULL)
+            {
+                /* the module's data is not ours to add a fragment to */
+                frag_data = (char *)g_malloc(data_len + 3, 0);
+                g_memcpy(frag_data, data, data_len);
+                data = frag_data;
+                data_len = xrdp_cache_add_text_fragment(self->wm->cache, font,
+                                                        flags, data, data_len);
+            }
             libxrdp_orders_text(self->session, font, flags, mixmode,
                                 self->fg_color, self->bg_color,
                                 clip_left, clip_top, clip_right, clip_bottom,
                                 box_left, box_top, box_right, box_bottom,
                                 x, y, data, data_len, &draw_rect);
+            if (data_len > run_len)
+            {
+                /* the run went out with its add, the other rectangles
+                   only need to use it */
+                data_len = xrdp_cache_add_text_fragment(self->wm->cache, font,
+                                                        flags, data, run_len);
+            }
         }
 
         k++;
     }
 
+    g_free(frag_data);
     xrdp_region_delete(region);
     return 0;
 }
@@ -1388,12 +1426,7 @@ xrdp_painter_copy(struct xrdp_painter *self,
                 w = MIN(64, ((srcx + cx) - i));
                 h = MIN(64, ((srcy + cy) - j));
                 b = xrdp_bitmap_create(w, h, src->bpp, 0, self->wm);
-#if 1
-                xrdp_bitmap_copy_box_with_crc(src, b, i, j, w, h);
-#else
-                xrdp_bitmap_copy_box(src, b, i, j, w, h);
-                xrdp_bitmap_hash_crc(b);
-#endif
+                xrdp_bitmap_copy_box_with_hash(src, b, i, j, w, h);
                 bitmap_id = xrdp_cache_add_bitmap(self->wm->cache, b, self->wm->hints);
                 cache_id = HIWORD(bitmap_id);
                 cache_idx = LOWORD(bitmap_id);
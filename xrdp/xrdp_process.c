@@ -23,6 +23,10 @@
 #endif
 
 #include "xrdp.h"
+#include "string_calls.h"
+
+/* the client socket, and the TLS wait object */
+#define MAX_CLIENT_OBJS 4
 
 static int g_session_id = 0;
 
@@ -51,6 +55,8 @@ xrdp_process_create(struct xrdp_listen *owner, tbus done_event)
 void
 xrdp_process_delete(struct xrdp_process *self)
 {
+    int index;
+
     if (self == 0)
     {
         return;
@@ -60,6 +66,15 @@ xrdp_process_delete(struct xrdp_process *self)
     libxrdp_exit(self->session);
     xrdp_wm_delete(self->wm);
     trans_delete(self->server_trans);
+    list_delete(self->keymaps);
+    if (self->mod_handles != NULL)
+    {
+        for (index = 0; index < self->mod_handles->count; index++)
+        {
+            g_free_library(list_get_item(self->mod_handles, index));
+        }
+        list_delete(self->mod_handles);
+    }
     g_free(self);
 }
 
@@ -79,6 +94,9 @@ xrdp_process_loop(struct xrdp_process *self, struct stream *s)
         {
             LOG_DEVEL(LOG_LEVEL_TRACE, "calling xrdp_wm_init and creating wm");
             self->wm = xrdp_wm_create(self, self->session->client_info);
+            /* the wm has its keymap now */
+            list_delete(self->keymaps);
+            self->keymaps = NULL;
             /* at this point the wm(window manager) is created and
                wm::login_state is WMLS_RESET and wm::login_state_event is set
                so xrdp_wm_init should be called by xrdp_wm_check_wait_objs
@@ -217,19 +235,121 @@ xrdp_process_data_in(struct trans *self)
 }
 
 /*****************************************************************************/
-int
-xrdp_process_main_loop(struct xrdp_process *self)
+static int
+xrdp_process_term_in(void *arg, tintptr obj, int events)
 {
-    int robjs_count;
-    int wobjs_count;
-    int cont;
-    int timeout = 0;
-    tbus robjs[32];
-    tbus wobjs[32];
-    tbus term_obj;
+    LOG(LOG_LEVEL_DEBUG,
+        "Received termination signal, stopping the client message "
+        "processor thread");
+    return 1;
+}
 
-    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_process_main_loop");
-    self->status = 1;
+/*****************************************************************************/
+static int
+xrdp_process_self_term_in(void *arg, tintptr obj, int events)
+{
+    return 1;
+}
+
+/*****************************************************************************/
+static int
+xrdp_process_client_in(void *arg, tintptr obj, int events)
+{
+    /* the client transport is checked after every wait */
+    return 0;
+}
+
+/*****************************************************************************/
+/* G_REACTOR_* for what the client transport wants obj waited for */
+static int
+xrdp_process_client_events(tbus obj, const tbus *robjs, int rcount,
+                           const tbus *wobjs, int wcount)
+{
+    int events;
+    int index;
+
+    events = 0;
+    for (index = 0; index < rcount; index++)
+    {
+        if (robjs[index] == obj)
+        {
+            events |= G_REACTOR_READ;
+        }
+    }
+    for (index = 0; index < wcount; index++)
+    {
+        if (wobjs[index] == obj)
+        {
+            events |= G_REACTOR_WRITE;
+        }
+    }
+    return events;
+}
+
+/*****************************************************************************/
+/* the client transport's objects last as long as the loop, so they stay
+   registered and only what each is waited for changes, objs holds the
+   ones registered so far, returns error */
+static int
+xrdp_process_client_objs(struct xrdp_process *self,
+                         struct g_reactor *reactor,
+                         tbus *objs, int *count, int *timeout)
+{
+    tbus robjs[MAX_CLIENT_OBJS];
+    tbus wobjs[MAX_CLIENT_OBJS];
+    tbus obj;
+    int rcount;
+    int wcount;
+    int index;
+    int jndex;
+    int events;
+
+    rcount = 0;
+    wcount = 0;
+    trans_get_wait_objs_rw(self->server_trans, robjs, &rcount,
+                           wobjs, &wcount, timeout);
+    /* no syscall unless what an object is waited for changes */
+    for (index = 0; index < *count; index++)
+    {
+        events = xrdp_process_client_events(objs[index], robjs, rcount,
+                                            wobjs, wcount);
+        if (g_reactor_modify(reactor, objs[index], events) != 0)
+        {
+            return 1;
+        }
+    }
+    /* the TLS wait object turns up once the handshake starts */
+    for (index = 0; index < rcount + wcount; index++)
+    {
+        obj = (index < rcount) ? robjs[index] : wobjs[index - rcount];
+        for (jndex = 0; jndex < *count && objs[jndex] != obj; jndex++)
+        {
+        }
+        if (jndex < *count)
+        {
+            continue;
+        }
+        if (*count >= MAX_CLIENT_OBJS)
+        {
+            return 1;
+        }
+        events = xrdp_process_client_events(obj, robjs, rcount,
+                                            wobjs, wcount);
+        if (g_reactor_add(reactor, obj, events,
+                          xrdp_process_client_in, self) != 0)
+        {
+            return 1;
+        }
+        objs[(*count)++] = obj;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* the libxrdp session, which reads xrdp.ini, doesn't need the client */
+static void
+xrdp_process_init_session(struct xrdp_process *self)
+{
     self->server_trans->extra_flags = 0;
     self->server_trans->header_size = 0;
     self->server_trans->no_stream_init_on_data_in = 1;
@@ -244,13 +364,168 @@ xrdp_process_main_loop(struct xrdp_process *self)
     self->session->callback = callback;
     /* this function is just above */
     self->session->is_term = xrdp_is_term;
+}
+
+/*****************************************************************************/
+/* loads the lib of every xrdp.ini section, a second load when the user
+   picks one only takes a reference */
+static void
+xrdp_process_preload_modules(struct xrdp_process *self, const char *xrdp_ini)
+{
+    struct list *sections;
+    struct list *names;
+    struct list *values;
+    char text[256];
+    const char *section;
+    long handle;
+    int fd;
+    int index;
+    int jndex;
+
+    fd = g_file_open_ro(xrdp_ini);
+    if (fd < 0)
+    {
+        return;
+    }
+    sections = list_create();
+    sections->auto_free = 1;
+    names = list_create();
+    names->auto_free = 1;
+    values = list_create();
+    values->auto_free = 1;
+    if (file_read_sections(fd, sections) == 0)
+    {
+        for (index = 0; index < sections->count; index++)
+        {
+            section = (const char *) list_get_item(sections, index);
+            list_clear(names);
+            list_clear(values);
+            if (file_read_section(fd, section, names, values) != 0)
+            {
+                continue;
+            }
+            for (jndex = 0; jndex < names->count; jndex++)
+            {
+                if (g_strcasecmp((char *) list_get_item(names, jndex),
+                                 "lib") != 0)
+                {
+                    continue;
+                }
+                g_snprintf(text, sizeof(text), "%s/%s", XRDP_MODULE_PATH,
+                           (char *) list_get_item(values, jndex));
+                handle = g_load_library(text);
+                if (handle == 0)
+                {
+                    continue;
+                }
+                if (list_index_of(self->mod_handles, handle) >= 0)
+                {
+                    /* in more than one section */
+                    g_free_library(handle);
+                }
+                else
+                {
+                    list_add_item(self->mod_handles, handle);
+                }
+            }
+        }
+    }
+    list_delete(values);
+    list_delete(names);
+    list_delete(sections);
+    g_file_close(fd);
+    LOG(LOG_LEVEL_DEBUG, "xrdp_process_preload_modules: %d modules",
+        self->mod_handles->count);
+}
+
+/*****************************************************************************/
+int
+xrdp_process_prepare(struct xrdp_process *self)
+{
+    const char *xrdp_ini;
+
+    xrdp_ini = self->lis_layer->startup_params->xrdp_ini;
+    self->server_trans = trans_create(TRANS_MODE_TCP, 16, 16);
+    self->keymaps = list_create();
+    self->mod_handles = list_create();
+    if (self->server_trans == NULL || self->keymaps == NULL ||
+            self->mod_handles == NULL)
+    {
+        return 1;
+    }
+    self->keymaps->auto_free = 1;
+    xrdp_process_init_session(self);
+    km_preload(self->keymaps);
+    xrdp_login_wnd_preload_images(xrdp_ini);
+    xrdp_process_preload_modules(self, xrdp_ini);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_process_attach(struct xrdp_process *self, int sck, int mode,
+                    int in_size, int out_size)
+{
+    struct trans *server_trans;
+
+    server_trans = self->server_trans;
+    server_trans->sck = sck;
+    server_trans->mode = mode;
+    server_trans->type1 = TRANS_TYPE_SERVER;
+    server_trans->status = TRANS_STATUS_UP;
+    init_stream(server_trans->in_s, in_size);
+    init_stream(server_trans->out_s, out_size);
+    return libxrdp_load_client_address(self->session);
+}
+
+/*****************************************************************************/
+int
+xrdp_process_main_loop(struct xrdp_process *self)
+{
+    int robjs_count;
+    int wobjs_count;
+    int cont;
+    int rv;
+    int handshake;
+    int timeout = 0;
+    int client_count;
+    tbus robjs[32];
+    tbus wobjs[32];
+    tbus client_objs[MAX_CLIENT_OBJS];
+    tbus term_obj;
+    struct g_reactor *reactor;
+
+    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_process_main_loop");
+    self->status = 1;
+    if (self->session == NULL)
+    {
+        xrdp_process_init_session(self);
+    }
+    trans_set_pacing(self->server_trans,
+                     self->session->client_info->session_max_mbps * 1000);
 
     if (libxrdp_process_incoming(self->session) == 0)
     {
         init_stream(self->server_trans->in_s, 32 * 1024);
 
         term_obj = g_get_term();
-        cont = 1;
+        reactor = g_reactor_create();
+        /* the term events are there for the whole session, the rest come
+           and go with the module and the client's flow control */
+        cont = reactor != NULL &&
+               g_reactor_add(reactor, term_obj, G_REACTOR_READ,
+                             xrdp_process_term_in, self) == 0 &&
+               g_reactor_add(reactor, self->self_term_event, G_REACTOR_READ,
+                             xrdp_process_self_term_in, self) == 0;
+        if (!cont)
+        {
+            LOG(LOG_LEVEL_ERROR, "xrdp_process_main_loop: can't set up the "
+                "event loop");
+        }
+        /* a TLS handshake is taken on by the loop, the connection sequence
+           carries on once it is over */
+        handshake = trans_tls_accept_pending(self->server_trans);
+        client_count = 0;
 
         while (cont)
         {
@@ -258,42 +533,60 @@ xrdp_process_main_loop(struct xrdp_process *self)
             timeout = -1;
             robjs_count = 0;
             wobjs_count = 0;
-            robjs[robjs_count++] = term_obj;
-            robjs[robjs_count++] = self->self_term_event;
+            /* the wm and module objects can be closed, and their fds
+               reused, inside any of their callbacks, which a registration
+               would not see, so they are only waited on for one wait */
             xrdp_wm_get_wait_objs(self->wm, robjs, &robjs_count,
                                   wobjs, &wobjs_count, &timeout);
-            trans_get_wait_objs_rw(self->server_trans, robjs, &robjs_count,
-                                   wobjs, &wobjs_count, &timeout);
+            if (xrdp_process_client_objs(self, reactor, client_objs,
+                                         &client_count, &timeout) != 0)
+            {
+                LOG(LOG_LEVEL_ERROR, "xrdp_process_main_loop: can't wait "
+                    "on the client");
+                break;
+            }
             /* wait */
-            if (g_obj_wait(robjs, robjs_count, wobjs, wobjs_count, timeout) != 0)
+            rv = g_reactor_wait(reactor, robjs, robjs_count,
+                                wobjs, wobjs_count, timeout);
+            if (rv < 0)
             {
                 /* error, should not get here */
                 g_sleep(100);
             }
-
-            if (g_is_wait_obj_set(term_obj)) /* term */
+            else if (rv > 0)
             {
-                LOG(LOG_LEVEL_DEBUG,
-                    "Received termination signal, stopping the client message "
-                    "processor thread");
+                /* term */
                 break;
             }
 
-            if (g_is_wait_obj_set(self->self_term_event))
+            if (xrdp_wm_check_wait_objs(self->wm) != 0)
             {
                 break;
             }
 
-            if (xrdp_wm_check_wait_objs(self->wm) != 0)
+            if (trans_check_wait_objs(self->server_trans) != 0)
             {
+                if (handshake)
+                {
+                    LOG(LOG_LEVEL_ERROR, "xrdp_process_main_loop: TLS "
+                        "handshake failed");
+                }
                 break;
             }
 
-            if (trans_check_wait_objs(self->server_trans) != 0)
+            if (handshake && !trans_tls_accept_pending(self->server_trans))
             {
-                break;
+                handshake = 0;
+                if (libxrdp_process_incoming(self->session) != 0)
+                {
+                    LOG(LOG_LEVEL_ERROR, "xrdp_process_main_loop: "
+                        "libxrdp_process_incoming failed");
+                    break;
+                }
+                init_stream(self->server_trans->in_s, 32 * 1024);
             }
         }
+        g_reactor_delete(reactor);
         /* send disconnect message if possible */
         libxrdp_disconnect(self->session);
     }
@@ -0,0 +1,532 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * 64x64 tile dirty bitmap
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "arch.h"
+#include "defines.h"
+#include "os_calls.h"
+#include "xrdp_tile_map.h"
+
+#define ROW(_self, _ty) ((_self)->words + (_ty) * (_self)->words_per_row)
+
+/*****************************************************************************/
+/* index of lowest set bit, bits must not be zero */
+static int
+tile_ctz64(uint64_t bits)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int rv;
+
+    rv = 0;
+    while ((bits & 1) == 0)
+    {
+        bits >>= 1;
+        rv++;
+    }
+    return rv;
+#endif
+}
+
+/*****************************************************************************/
+static int
+tile_popcount64(uint64_t bits)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(bits);
+#else
+    int rv;
+
+    rv = 0;
+    while (bits != 0)
+    {
+        bits &= bits - 1;
+        rv++;
+    }
+    return rv;
+#endif
+}
+
+/*****************************************************************************/
+struct xrdp_tile_map *
+xrdp_tile_map_create(int width, int height)
+{
+    struct xrdp_tile_map *self;
+
+    if (width < 1 || height < 1)
+    {
+        return NULL;
+    }
+    self = g_new0(struct xrdp_tile_map, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->width = width;
+    self->height = height;
+    self->tiles_x = (width + XRDP_TILE_SIZE - 1) >> XRDP_TILE_SHIFT;
+    self->tiles_y = (height + XRDP_TILE_SIZE - 1) >> XRDP_TILE_SHIFT;
+    self->words_per_row = (self->tiles_x + 63) / 64;
+    self->words = g_new0(uint64_t, self->words_per_row * self->tiles_y);
+    if (self->words == NULL)
+    {
+        g_free(self);
+        return NULL;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_tile_map_delete(struct xrdp_tile_map *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    g_free(self->words);
+    g_free(self);
+}
+
+/*****************************************************************************/
+void
+xrdp_tile_map_clear(struct xrdp_tile_map *self)
+{
+    g_memset(self->words, 0,
+             sizeof(uint64_t) * self->words_per_row * self->tiles_y);
+}
+
+/*****************************************************************************/
+int
+xrdp_tile_map_is_empty(const struct xrdp_tile_map *self)
+{
+    int index;
+    int count;
+
+    count = self->words_per_row * self->tiles_y;
+    for (index = 0; index < count; index++)
+    {
+        if (self->words[index] != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+int
+xrdp_tile_map_count(const struct xrdp_tile_map *self)
+{
+    int index;
+    int count;
+    int rv;
+
+    rv = 0;
+    count = self->words_per_row * self->tiles_y;
+    for (index = 0; index < count; index++)
+    {
+        rv += tile_popcount64(self->words[index]);
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+int
+xrdp_tile_map_test(const struct xrdp_tile_map *self, int x, int y)
+{
+    int tx;
+    int ty;
+
+    if (x < 0 || y < 0 || x >= self->width || y >= self->height)
+    {
+        return 0;
+    }
+    tx = x >> XRDP_TILE_SHIFT;
+    ty = y >> XRDP_TILE_SHIFT;
+    return (ROW(self, ty)[tx / 64] >> (tx % 64)) & 1;
+}
+
+/*****************************************************************************/
+/* set or clear tiles tx0 up to but not including tx1 in rows ty0 to ty1 */
+static void
+tile_map_set_range(struct xrdp_tile_map *self, int tx0, int tx1,
+                   int ty0, int ty1, int set)
+{
+    uint64_t *row;
+    uint64_t mask;
+    int w0;
+    int w1;
+    int w;
+    int ty;
+
+    w0 = tx0 / 64;
+    w1 = (tx1 - 1) / 64;
+    for (ty = ty0; ty < ty1; ty++)
+    {
+        row = ROW(self, ty);
+        for (w = w0; w <= w1; w++)
+        {
+            mask = ~((uint64_t)0);
+            if (w == w0)
+            {
+                mask &= mask << (tx0 % 64);
+            }
+            if (w == w1 && (tx1 % 64) != 0)
+            {
+                mask &= (((uint64_t)1) << (tx1 % 64)) - 1;
+            }
+            if (set)
+            {
+                row[w] |= mask;
+            }
+            else
+            {
+                row[w] &= ~mask;
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+void
+xrdp_tile_map_add_rect(struct xrdp_tile_map *self,
+                       int x, int y, int cx, int cy)
+{
+    int x1;
+    int y1;
+
+    x1 = MIN(x + cx, self->width);
+    y1 = MIN(y + cy, self->height);
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+    if (x1 <= x || y1 <= y)
+    {
+        return;
+    }
+    tile_map_set_range(self,
+                       x >> XRDP_TILE_SHIFT,
+                       ((x1 - 1) >> XRDP_TILE_SHIFT) + 1,
+                       y >> XRDP_TILE_SHIFT,
+                       ((y1 - 1) >> XRDP_TILE_SHIFT) + 1, 1);
+}
+
+/*****************************************************************************/
+void
+xrdp_tile_map_remove_rect(struct xrdp_tile_map *self,
+                          int x, int y, int cx, int cy)
+{
+    int x1;
+    int y1;
+    int tx0;
+    int tx1;
+    int ty0;
+    int ty1;
+
+    x1 = MIN(x + cx, self->width);
+    y1 = MIN(y + cy, self->height);
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+    if (x1 <= x || y1 <= y)
+    {
+        return;
+    }
+    /* only tiles completely inside the rectangle, the partial tiles at
+       the right and bottom of the map are complete at the edge */
+    tx0 = (x + XRDP_TILE_SIZE - 1) >> XRDP_TILE_SHIFT;
+    ty0 = (y + XRDP_TILE_SIZE - 1) >> XRDP_TILE_SHIFT;
+    tx1 = (x1 == self->width) ? self->tiles_x : x1 >> XRDP_TILE_SHIFT;
+    ty1 = (y1 == self->height) ? self->tiles_y : y1 >> XRDP_TILE_SHIFT;
+    if (tx1 <= tx0 || ty1 <= ty0)
+    {
+        return;
+    }
+    tile_map_set_range(self, tx0, tx1, ty0, ty1, 0);
+}
+
+/*****************************************************************************/
+void
+xrdp_tile_map_add_rects(struct xrdp_tile_map *self,
+                        const short *rects, int count)
+{
+    int index;
+
+    for (index = 0; index < count; index++)
+    {
+        xrdp_tile_map_add_rect(self,
+                               rects[index * 4 + 0], rects[index * 4 + 1],
+                               rects[index * 4 + 2], rects[index * 4 + 3]);
+    }
+}
+
+/*****************************************************************************/
+static int
+tile_map_same_size(const struct xrdp_tile_map *self,
+                   const struct xrdp_tile_map *other)
+{
+    return (self->tiles_x == other->tiles_x) &&
+           (self->tiles_y == other->tiles_y);
+}
+
+/*****************************************************************************/
+int
+xrdp_tile_map_copy(struct xrdp_tile_map *self,
+                   const struct xrdp_tile_map *other)
+{
+    if (!tile_map_same_size(self, other))
+    {
+        return 1;
+    }
+    g_memcpy(self->words, other->words,
+             sizeof(uint64_t) * self->words_per_row * self->tiles_y);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_tile_map_union(struct xrdp_tile_map *self,
+                    const struct xrdp_tile_map *other)
+{
+    int index;
+    int count;
+
+    if (!tile_map_same_size(self, other))
+    {
+        return 1;
+    }
+    count = self->words_per_row * self->tiles_y;
+    for (index = 0; index < count; index++)
+    {
+        self->words[index] |= other->words[index];
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_tile_map_intersect(struct xrdp_tile_map *self,
+                        const struct xrdp_tile_map *other)
+{
+    int index;
+    int count;
+
+    if (!tile_map_same_size(self, other))
+    {
+        return 1;
+    }
+    count = self->words_per_row * self->tiles_y;
+    for (index = 0; index < count; index++)
+    {
+        self->words[index] &= other->words[index];
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_tile_map_subtract(struct xrdp_tile_map *self,
+                       const struct xrdp_tile_map *other)
+{
+    int index;
+    int count;
+
+    if (!tile_map_same_size(self, other))
+    {
+        return 1;
+    }
+    count = self->words_per_row * self->tiles_y;
+    for (index = 0; index < count; index++)
+    {
+        self->words[index] &= ~(other->words[index]);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_tile_map_take_rows(struct xrdp_tile_map *self,
+                        struct xrdp_tile_map *out, int max_tiles)
+{
+    uint64_t *row;
+    int ty;
+    int w;
+    int row_tiles;
+    int rv;
+
+    if (!tile_map_same_size(self, out))
+    {
+        return -1;
+    }
+    xrdp_tile_map_clear(out);
+    rv = 0;
+    for (ty = 0; ty < self->tiles_y; ty++)
+    {
+        row = ROW(self, ty);
+        row_tiles = 0;
+        for (w = 0; w < self->words_per_row; w++)
+        {
+            row_tiles += tile_popcount64(row[w]);
+        }
+        if (row_tiles == 0)
+        {
+            continue;
+        }
+        if (rv > 0 && rv + row_tiles > max_tiles)
+        {
+            break;
+        }
+        g_memcpy(ROW(out, ty), row, sizeof(uint64_t) * self->words_per_row);
+        g_memset(row, 0, sizeof(uint64_t) * self->words_per_row);
+        rv += row_tiles;
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+/* first tile at or after tx in row that is set, or tiles_x if none */
+static int
+tile_map_next_set(const struct xrdp_tile_map *self, const uint64_t *row,
+                  int tx)
+{
+    uint64_t bits;
+    int w;
+
+    w = tx / 64;
+    if (w >= self->words_per_row)
+    {
+        return self->tiles_x;
+    }
+    bits = row[w] & (~((uint64_t)0) << (tx % 64));
+    for (;;)
+    {
+        if (bits != 0)
+        {
+            return MIN(w * 64 + tile_ctz64(bits), self->tiles_x);
+        }
+        w++;
+        if (w >= self->words_per_row)
+        {
+            return self->tiles_x;
+        }
+        bits = row[w];
+    }
+}
+
+/*****************************************************************************/
+/* first tile at or after tx in row that is clear, or tiles_x if none */
+static int
+tile_map_next_clear(const struct xrdp_tile_map *self, const uint64_t *row,
+                    int tx)
+{
+    uint64_t bits;
+    int w;
+
+    w = tx / 64;
+    if (w >= self->words_per_row)
+    {
+        return self->tiles_x;
+    }
+    bits = ~(row[w]) & (~((uint64_t)0) << (tx % 64));
+    for (;;)
+    {
+        if (bits != 0)
+        {
+            return MIN(w * 64 + tile_ctz64(bits), self->tiles_x);
+        }
+        w++;
+        if (w >= self->words_per_row)
+        {
+            return self->tiles_x;
+        }
+        bits = ~(row[w]);
+    }
+}
+
+/*****************************************************************************/
+/* true if row ty holds exactly the run tx0 up to tx1 at that position */
+static int
+tile_map_row_has_run(const struct xrdp_tile_map *self, int ty,
+                     int tx0, int tx1)
+{
+    const uint64_t *row;
+
+    row = ROW(self, ty);
+    if (tx0 > 0 && ((row[(tx0 - 1) / 64] >> ((tx0 - 1) % 64)) & 1))
+    {
+        return 0;
+    }
+    return (tile_map_next_set(self, row, tx0) == tx0) &&
+           (tile_map_next_clear(self, row, tx0) == tx1);
+}
+
+/*****************************************************************************/
+int
+xrdp_tile_map_get_rects(const struct xrdp_tile_map *self,
+                        short *rects, int max_rects)
+{
+    const uint64_t *row;
+    int count;
+    int tx0;
+    int tx1;
+    int ty;
+    int ty1;
+    int x;
+    int y;
+
+    count = 0;
+    for (ty = 0; ty < self->tiles_y; ty++)
+    {
+        row = ROW(self, ty);
+        tx0 = tile_map_next_set(self, row, 0);
+        while (tx0 < self->tiles_x)
+        {
+            tx1 = tile_map_next_clear(self, row, tx0);
+            /* skip runs already merged into a rectangle from above */
+            if (ty == 0 || !tile_map_row_has_run(self, ty - 1, tx0, tx1))
+            {
+                ty1 = ty + 1;
+                while (ty1 < self->tiles_y &&
+                        tile_map_row_has_run(self, ty1, tx0, tx1))
+                {
+                    ty1++;
+                }
+                if (count >= max_rects)
+                {
+                    return -1;
+                }
+                x = tx0 << XRDP_TILE_SHIFT;
+                y = ty << XRDP_TILE_SHIFT;
+                rects[count * 4 + 0] = x;
+                rects[count * 4 + 1] = y;
+                rects[count * 4 + 2] =
+                    MIN(tx1 << XRDP_TILE_SHIFT, self->width) - x;
+                rects[count * 4 + 3] =
+                    MIN(ty1 << XRDP_TILE_SHIFT, self->height) - y;
+                count++;
+            }
+            tx0 = tile_map_next_set(self, row, tx1);
+        }
+    }
+    return count;
+}
@@ -0,0 +1,138 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) 2026, all xrdp contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file xrdp_tile_map.h
+ * @brief Fixed size 64x64 tile dirty bitmap used by the encoder
+ *
+ * One bit per tile, stored in 64 bit words per tile row, so set
+ * operations between maps of the same size are a single pass over the
+ * words and never allocate.
+ */
+
+#ifndef _XRDP_TILE_MAP_H
+#define _XRDP_TILE_MAP_H
+
+#include "arch.h"
+
+#define XRDP_TILE_SIZE 64
+#define XRDP_TILE_SHIFT 6
+
+struct xrdp_tile_map
+{
+    int width; /* in pixels */
+    int height;
+    int tiles_x;
+    int tiles_y;
+    int words_per_row;
+    uint64_t *words; /* words_per_row * tiles_y */
+};
+
+/**
+ * Create an empty tile map covering a surface
+ *
+ * @param width Surface width in pixels
+ * @param height Surface height in pixels
+ * @return New map, or NULL on error
+ */
+struct xrdp_tile_map *
+xrdp_tile_map_create(int width, int height);
+void
+xrdp_tile_map_delete(struct xrdp_tile_map *self);
+void
+xrdp_tile_map_clear(struct xrdp_tile_map *self);
+int
+xrdp_tile_map_is_empty(const struct xrdp_tile_map *self);
+/**
+ * @return Number of dirty tiles
+ */
+int
+xrdp_tile_map_count(const struct xrdp_tile_map *self);
+/**
+ * @return True if the tile containing pixel x, y is dirty
+ */
+int
+xrdp_tile_map_test(const struct xrdp_tile_map *self, int x, int y);
+/**
+ * Mark every tile touched by a rectangle dirty
+ *
+ * The rectangle is clipped to the map.
+ */
+void
+xrdp_tile_map_add_rect(struct xrdp_tile_map *self,
+                       int x, int y, int cx, int cy);
+/**
+ * Mark every tile fully covered by a rectangle clean
+ *
+ * Tiles on the right and bottom edge of the map count as fully
+ * covered when the rectangle reaches the edge.
+ */
+void
+xrdp_tile_map_remove_rect(struct xrdp_tile_map *self,
+                          int x, int y, int cx, int cy);
+/**
+ * Add 'count' rectangles in x, y, cx, cy short format
+ */
+void
+xrdp_tile_map_add_rects(struct xrdp_tile_map *self,
+                        const short *rects, int count);
+
+/* Set operations, maps must have the same size, result goes in self */
+int
+xrdp_tile_map_copy(struct xrdp_tile_map *self,
+                   const struct xrdp_tile_map *other);
+int
+xrdp_tile_map_union(struct xrdp_tile_map *self,
+                    const struct xrdp_tile_map *other);
+int
+xrdp_tile_map_intersect(struct xrdp_tile_map *self,
+                        const struct xrdp_tile_map *other);
+int
+xrdp_tile_map_subtract(struct xrdp_tile_map *self,
+                       const struct xrdp_tile_map *other);
+
+/**
+ * Move whole tile rows from the top of a map into another
+ *
+ * Rows are moved until the next one would take the total above
+ * max_tiles, but at least one row with dirty tiles is moved.
+ *
+ * @param out Receives the moved tiles, must be the same size as self
+ * @return Number of tiles moved, or -1 if the maps differ in size
+ */
+int
+xrdp_tile_map_take_rows(struct xrdp_tile_map *self,
+                        struct xrdp_tile_map *out, int max_tiles);
+
+/**
+ * Coalesce the dirty tiles into rectangles
+ *
+ * Horizontal runs of dirty tiles are merged with identical runs in the
+ * rows below. Rectangles are clipped to the map size.
+ *
+ * @param rects Output, x, y, cx, cy for each rectangle
+ * @param max_rects Size of rects in rectangles
+ * @return Number of rectangles, or -1 if max_rects was too small. In
+ *         that case the first max_rects rectangles are valid.
+ */
+int
+xrdp_tile_map_get_rects(const struct xrdp_tile_map *self,
+                        short *rects, int max_rects);
+
+#endif
@@ -240,6 +240,10 @@ struct xrdp_bitmap_item
     int stamp;
     int lru_index;
     struct xrdp_bitmap *bitmap;
+    /* the client loaded a bitmap with this key from disk into this entry,
+       only used while bitmap is NULL */
+    int has_persist_key;
+    tui64 persist_key;
 };
 
 struct xrdp_lru_item
@@ -248,6 +252,16 @@ struct xrdp_lru_item
     int prev;
 };
 
+/* open addressed, linear probing, a power of two at least twice
+   XRDP_MAX_BITMAP_CACHE_IDX so probes stay short */
+#define XRDP_BITMAP_HASH_SIZE 4096
+
+struct xrdp_bitmap_hash_item
+{
+    tui64 hash; /* of the cached bitmap */
+    int cache_idx; /* -1 for an empty slot */
+};
+
 struct xrdp_os_bitmap_item
 {
     int id;
@@ -274,6 +288,19 @@ struct xrdp_pointer_item
     int pad1;
 };
 
+/* the fragment cache holds 256 runs of glyph data, each given a one
+   byte size when added */
+#define XRDP_MAX_FRAG_ENTRIES 256
+#define XRDP_MAX_FRAG_SIZE 255
+
+struct xrdp_frag_item
+{
+    int stamp; /* 0 for an empty slot */
+    int font; /* glyph cache the run's indexes are in */
+    int size;
+    char data[XRDP_MAX_FRAG_SIZE];
+};
+
 struct xrdp_brush_item
 {
     int stamp;
@@ -305,8 +332,9 @@ struct xrdp_cache
     int lru_tail[XRDP_MAX_BITMAP_CACHE_ID];
     int lru_reset[XRDP_MAX_BITMAP_CACHE_ID];
 
-    /* crc optimize */
-    struct list16 crc16[XRDP_MAX_BITMAP_CACHE_ID][64 * 1024];
+    /* find a bitmap by its hash */
+    struct xrdp_bitmap_hash_item bitmap_hash[XRDP_MAX_BITMAP_CACHE_ID]
+        [XRDP_BITMAP_HASH_SIZE];
 
     int use_bitmap_comp;
     int cache1_entries;
@@ -316,6 +344,7 @@ struct xrdp_cache
     int cache3_entries;
     int cache3_size;
     int bitmap_cache_persist_enable;
+    int bitmap_cache_persist_mask;
     int bitmap_cache_version;
     /* font */
     int char_stamp;
@@ -326,6 +355,11 @@ struct xrdp_cache
     int pointer_cache_entries;
     int brush_stamp;
     struct xrdp_brush_item brush_items[64];
+    /* glyph fragments */
+    int frag_stamp;
+    int frag_entries; /* 0 if not used */
+    int frag_size;
+    struct xrdp_frag_item frag_items[XRDP_MAX_FRAG_ENTRIES];
     struct xrdp_os_bitmap_item os_bitmap_items[2000];
     struct list *xrdp_os_del_list;
 };
@@ -440,6 +474,8 @@ struct xrdp_mm
     struct guid guid; /* GUID for the session, or all zeros  */
     int code; /* 0=Xvnc session, 20=xorg driver mode */
     struct xrdp_encoder *encoder;
+    int pace_held; /* module frame ack held back by the client's pacer */
+    int pace_held_frame_id; /* frame to ack, -1 to recheck frames in flight */
     int cs2xr_cid_map[256];
     int xr2cr_cid_map[256];
     int dynamic_monitor_chanid;
@@ -480,6 +516,13 @@ struct xrdp_keymap
                                           SCANCODE_MIN_NUMLOCK + 1];
 };
 
+/* a keymap file parsed before the client asked for it */
+struct xrdp_preloaded_keymap
+{
+    int keylayout;
+    struct xrdp_keymap keymap;
+};
+
 /* the window manager */
 
 /***
@@ -607,17 +650,37 @@ struct xrdp_process
     //int app_sck;
     tbus done_event;
     int session_id;
+    /* set up by xrdp_process_prepare() before there is a client */
+    struct list *keymaps; /* struct xrdp_preloaded_keymap*, until the wm */
+    struct list *mod_handles; /* from g_load_library() */
 };
 
 /* rdp listener */
+/* an idle pre-forked process waiting for a connection */
+struct xrdp_listen_worker
+{
+    int pid;
+    int sck; /* our end of the socketpair the connection is passed on */
+};
+
 struct xrdp_listen
 {
     int status;
     struct list *trans_list; /* list of struct trans* */
     struct list *process_list;
     struct list *fork_list;
+    struct list *worker_list; /* list of struct xrdp_listen_worker* */
     tbus pro_done_event;
     struct xrdp_startup_params *startup_params;
+    /* extra accept loops, each in its own thread with its own sockets on
+       the same ports, list of struct xrdp_listen* */
+    struct list *acceptor_list;
+    struct xrdp_listen *owner; /* the main listener, for an acceptor */
+    /* main listener only, only the main thread forks so the acceptors
+       queue their connections on its fork_list and set fork_event */
+    tbus lock; /* fork_list and the acceptors' status */
+    tbus fork_event;
+    tbus refill_event; /* set while worker_list is short of workers */
 };
 
 /* region */
@@ -696,9 +759,8 @@ struct xrdp_bitmap
     /* for popup */
     struct xrdp_bitmap *popped_from;
     int item_height;
-    /* crc */
-    int crc32;
-    int crc16;
+    /* see xrdp_bitmap_hash() */
+    tui64 hash;
 };
 
 #define MAX_FONT_CHARS 0x4e00
@@ -751,6 +813,8 @@ struct xrdp_startup_params
     int help;
     int version;
     int fork;
+    int prefork_workers;
+    int listen_acceptors;
     int dump_config;
     int license;
     int tcp_send_buffer_bytes;
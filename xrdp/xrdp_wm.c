@@ -110,7 +110,8 @@ xrdp_wm_create(struct xrdp_process *owner,
     self->log->auto_free = 1;
     self->mm = xrdp_mm_create(self);
     /* this will use built in keymap or load from file */
-    get_keymaps(self->session->client_info->keylayout, &(self->keymap));
+    get_keymaps(self->session->client_info->keylayout, owner->keymaps,
+                &(self->keymap));
     xrdp_wm_set_login_state(self, WMLS_RESET);
     self->target_surface = self->screen;
     self->current_surface_index = 0xffff; /* screen */